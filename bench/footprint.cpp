@@ -0,0 +1,427 @@
+// Memory per idle relayed session. For every count a server process is
+// forked & its RSS (/proc/<pid>/statm) read as the sessions are built up:
+//
+//   session_objects  Session::Create, the object, its buffers & unopened
+//                    sockets & timers
+//   accepted_idle    a client accepted into each & Start()ed: the socket's
+//                    reactor state & the pending greeting read
+//   relayed_idle     handshake done, connected upstream: the upstream
+//                    socket & both pending relay reads
+//
+// in bytes per session, plus the kernel's slab memory from /proc/meminfo
+// (system wide: both ends of both connections; idle sockets hold no
+// buffers). Sessions are what s5server runs without options: every feature
+// off, with a policy reader & the loop's session list as their only
+// services. Clients bind to 127.0.0.2 & up & the upstreams listen on a port
+// per 20000 sessions, so ephemeral ports don't run out; each process needs
+// two descriptors per session, counts the limit doesn't allow are skipped.
+//
+// The result is a JSON object, one count per line. The exit status is 1 if
+// a count's RSS per session is above --max-bytes (small counts carry the
+// allocator's fixed costs, ~10 KiB at 10000 sessions & up):
+//
+//   footprint [--counts 10000 100000 500000] [--max-bytes 12800]
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <array>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/asio.hpp>
+#include <boost/log/core.hpp>
+#include <boost/log/expressions.hpp>
+#include <boost/log/trivial.hpp>
+#include <boost/program_options.hpp>
+
+#include "s5session_impl.h"
+#include "support.h"
+
+namespace ba = boost::asio;
+namespace bs = boost::system;
+namespace po = boost::program_options;
+using tcp = ba::ip::tcp;
+
+namespace {
+
+using IdleSession =
+    socks5::Session<socks5::NoAuth, socks5::NoAccess, socks5::NoAccounting>;
+
+const std::size_t sessions_per_address = 20000;
+
+uint64_t Resident(pid_t pid) {
+    std::ifstream in{"/proc/" + std::to_string(pid) + "/statm"};
+    uint64_t size = 0;
+    uint64_t resident = 0;
+    in >> size >> resident;
+    return resident * static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+}
+
+// kernel slab memory, sockets & their epoll & file entries among it
+uint64_t KernelSlab() {
+    std::ifstream in{"/proc/meminfo"};
+    std::string name;
+    uint64_t kilobytes = 0;
+    while (in >> name >> kilobytes) {
+        if (name == "Slab:") {
+            return kilobytes * 1024;
+        }
+        in.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+    }
+
+    return 0;
+}
+
+void Check(bool ok, const char* what) {
+    if (!ok) {
+        throw std::runtime_error(std::string(what) + ": " +
+                                 std::strerror(errno));
+    }
+}
+
+void SendAll(int fd, const char* data, std::size_t size) {
+    while (size) {
+        const ssize_t sent = send(fd, data, size, MSG_NOSIGNAL);
+        Check(sent > 0, "send");
+        data += sent;
+        size -= static_cast<std::size_t>(sent);
+    }
+}
+
+void ReceiveAll(int fd, char* data, std::size_t size) {
+    while (size) {
+        const ssize_t received = recv(fd, data, size, 0);
+        Check(received > 0, "recv");
+        data += received;
+        size -= static_cast<std::size_t>(received);
+    }
+}
+
+// The server process, driven over a pipe one command byte at a time:
+// 'c' creates the sessions, 'a' accepts a client into each & starts it, 'q'
+// quits. Each is acknowledged. The io service runs on its own thread from
+// the start, so its stack & allocator arena aren't counted to the sessions.
+void Server(int commands, int replies, std::size_t count) {
+    boost::log::core::get()->set_filter(boost::log::trivial::severity >=
+                                        boost::log::trivial::warning);
+
+    // outlive the io service, whose handlers may still hold sessions
+    socks5::PolicyStore policies{std::make_unique<socks5::Policy>(), 1};
+    socks5::SessionList list;
+    socks5::Services services;
+    services.policy = &policies.GetReader(0);
+    services.sessions = &list;
+
+    ba::io_service io;
+    tcp::acceptor acceptor{io};
+    const tcp::endpoint endpoint{ba::ip::address_v4::loopback(), 0};
+    acceptor.open(endpoint.protocol());
+    acceptor.bind(endpoint);
+    acceptor.listen(ba::socket_base::max_connections);
+
+    std::vector<std::shared_ptr<IdleSession>> sessions;
+    sessions.reserve(count);
+    auto work = std::make_unique<ba::io_service::work>(io);
+    std::thread thread{[&io]() { io.run(); }};
+
+    const uint16_t port = acceptor.local_endpoint().port();
+    Check(write(replies, &port, sizeof(port)) == sizeof(port), "write");
+
+    char command = 0;
+    while (read(commands, &command, 1) == 1 && command != 'q') {
+        switch (command) {
+            case 'c':
+                for (std::size_t i = 0; i < count; ++i) {
+                    sessions.emplace_back(IdleSession::Create(io, services));
+                }
+                break;
+            case 'a':
+                for (auto& session : sessions) {
+                    acceptor.accept(session->AcceptorSocket());
+                    session->Start();
+                }
+                break;
+        }
+
+        Check(write(replies, &command, 1) == 1, "write");
+    }
+
+    io.stop();
+    thread.join();
+}
+
+class ServerProcess {
+   public:
+    explicit ServerProcess(std::size_t count) {
+        int commands[2];
+        int replies[2];
+        Check(pipe(commands) == 0 && pipe(replies) == 0, "pipe");
+
+        pid_ = fork();
+        Check(pid_ >= 0, "fork");
+        if (pid_ == 0) {
+            close(commands[1]);
+            close(replies[0]);
+            int status = 0;
+            try {
+                Server(commands[0], replies[1], count);
+            } catch (const std::exception& e) {
+                std::cerr << "footprint server: " << e.what() << '\n';
+                status = 1;
+            }
+            _exit(status);
+        }
+
+        close(commands[0]);
+        close(replies[1]);
+        commands_ = commands[1];
+        replies_ = replies[0];
+        Check(read(replies_, &port_, sizeof(port_)) == sizeof(port_),
+              "server start");
+    }
+
+    ServerProcess(const ServerProcess&) = delete;
+    ServerProcess& operator=(const ServerProcess&) = delete;
+
+    ~ServerProcess() {
+        Send('q');
+        close(commands_);
+        close(replies_);
+        int status = 0;
+        waitpid(pid_, &status, 0);
+    }
+
+    pid_t Pid() const { return pid_; }
+
+    uint16_t Port() const { return port_; }
+
+    void Send(char command) {
+        Check(write(commands_, &command, 1) == 1, "write");
+    }
+
+    void Wait() {
+        char reply = 0;
+        Check(read(replies_, &reply, 1) == 1, "server exited");
+    }
+
+   private:
+    pid_t pid_ = -1;
+    int commands_ = -1;
+    int replies_ = -1;
+    uint16_t port_ = 0;
+};
+
+int Listen(sockaddr_in& address) {
+    const int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    Check(fd >= 0, "socket");
+    address = sockaddr_in{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(address);
+    Check(bind(fd, reinterpret_cast<sockaddr*>(&address), length) == 0 &&
+              listen(fd, SOMAXCONN) == 0 &&
+              getsockname(fd, reinterpret_cast<sockaddr*>(&address),
+                          &length) == 0,
+          "listen");
+    return fd;
+}
+
+// client i from 127.0.0.(2 + i / sessions_per_address)
+int Connect(std::size_t i, uint16_t port) {
+    const int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    Check(fd >= 0, "socket");
+
+    sockaddr_in source{};
+    source.sin_family = AF_INET;
+    source.sin_addr.s_addr =
+        htonl(INADDR_LOOPBACK + 1 +
+              static_cast<uint32_t>(i / sessions_per_address));
+    sockaddr_in proxy{};
+    proxy.sin_family = AF_INET;
+    proxy.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    proxy.sin_port = htons(port);
+    Check(bind(fd, reinterpret_cast<sockaddr*>(&source), sizeof(source)) ==
+                  0 &&
+              connect(fd, reinterpret_cast<sockaddr*>(&proxy),
+                      sizeof(proxy)) == 0,
+          "connect");
+    return fd;
+}
+
+struct Sample {
+    uint64_t resident;
+    uint64_t kernel;
+};
+
+// the sample as a JSON object without its closing brace & the RSS per
+// session
+std::string Measure(std::size_t count, double& rss_per_session) {
+    ServerProcess server{count};
+    const auto sample = [&server]() {
+        return Sample{Resident(server.Pid()), KernelSlab()};
+    };
+
+    std::vector<int> listeners;
+    std::vector<sockaddr_in> upstreams;
+    for (std::size_t i = 0; i < count; i += sessions_per_address) {
+        upstreams.emplace_back();
+        listeners.push_back(Listen(upstreams.back()));
+    }
+    std::vector<int> clients;
+    std::vector<int> accepted;
+    clients.reserve(count);
+    accepted.reserve(count);
+
+    const Sample empty = sample();
+
+    server.Send('c');
+    server.Wait();
+    const Sample created = sample();
+
+    server.Send('a');
+    for (std::size_t i = 0; i < count; ++i) {
+        clients.push_back(Connect(i, server.Port()));
+    }
+    server.Wait();
+    const Sample started = sample();
+
+    const std::array<char, 3> greeting{{socks5::version, 1, 0}};
+    std::array<char, 10> message;
+    for (std::size_t i = 0; i < count; ++i) {
+        const int client = clients[i];
+        SendAll(client, greeting.data(), greeting.size());
+        ReceiveAll(client, message.data(), 2);
+
+        const sockaddr_in& upstream = upstreams[i / sessions_per_address];
+        message[0] = socks5::version;
+        message[1] = static_cast<char>(socks5::Command::connect);
+        message[2] = socks5::reserved;
+        message[3] = static_cast<char>(socks5::AddressType::ipv4);
+        std::memcpy(&message[4], &upstream.sin_addr.s_addr, 4);
+        std::memcpy(&message[8], &upstream.sin_port, 2);
+        SendAll(client, message.data(), message.size());
+        ReceiveAll(client, message.data(), message.size());
+        if (message[1] != static_cast<char>(socks5::Reply::succeeded)) {
+            throw std::runtime_error("connect failed, reply " +
+                                     std::to_string(message[1]));
+        }
+
+        const int fd = accept4(listeners[i / sessions_per_address], nullptr,
+                               nullptr, SOCK_CLOEXEC);
+        Check(fd >= 0, "accept");
+        accepted.push_back(fd);
+    }
+    // the relay reads are posted right after the reply
+    std::this_thread::sleep_for(std::chrono::milliseconds{200});
+    const Sample relayed = sample();
+
+    const auto per_session = [count](uint64_t after, uint64_t before) {
+        return (static_cast<double>(after) - static_cast<double>(before)) /
+               static_cast<double>(count);
+    };
+
+    rss_per_session = per_session(relayed.resident, empty.resident);
+
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(1) << "{\"sessions\": " << count
+        << ", \"rss_bytes_per_session\": " << rss_per_session
+        << ", \"session_objects\": "
+        << per_session(created.resident, empty.resident)
+        << ", \"accepted_idle\": "
+        << per_session(started.resident, created.resident)
+        << ", \"relayed_idle\": "
+        << per_session(relayed.resident, started.resident)
+        << ", \"kernel_slab_bytes_per_session\": "
+        << per_session(relayed.kernel, empty.kernel);
+
+    for (const auto fds : {&clients, &accepted, &listeners}) {
+        for (const int fd : *fds) {
+            close(fd);
+        }
+    }
+
+    return out.str();
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    std::vector<std::size_t> counts{10000, 100000, 500000};
+    double max_bytes = 12800;
+
+    po::options_description desc("Options");
+    // clang-format off
+    desc.add_options()
+        ("help,h", "print this message")
+        ("counts", po::value(&counts)->multitoken(),
+         "idle sessions to open, a run each (10000 100000 500000)")
+        ("max-bytes", po::value(&max_bytes)->default_value(max_bytes),
+         "fail above this RSS per session");
+    // clang-format on
+
+    try {
+        po::variables_map vm;
+        po::store(po::parse_command_line(argc, argv, desc), vm);
+        if (vm.count("help")) {
+            std::cout << "Usage: " << argv[0] << " [options]\n" << desc;
+            return 1;
+        }
+        po::notify(vm);
+    } catch (po::error& e) {
+        std::cout << e.what() << "\n\n"
+                  << "Usage: " << argv[0] << " [options]\n"
+                  << desc;
+        return 1;
+    }
+
+    const std::size_t descriptors = bench::RaiseDescriptorLimit();
+
+    int status = 0;
+    std::cout << "{\n  \"session_object_bytes\": " << sizeof(IdleSession)
+              << ",\n  \"max_bytes\": " << max_bytes;
+    for (const std::size_t count : counts) {
+        std::cout << ",\n  \"sessions_" << count << "\": ";
+        const std::size_t needed = 2 * count + 64;
+        if (needed > descriptors) {
+            std::cout << "{\"sessions\": " << count << ", \"skipped\": \"needs "
+                      << needed << " descriptors, the limit is "
+                      << descriptors << "\"}";
+            continue;
+        }
+
+        try {
+            double bytes = 0;
+            const std::string result = Measure(count, bytes);
+            const bool pass = bytes <= max_bytes;
+            std::cout << result << ", \"pass\": " << (pass ? "true" : "false")
+                      << '}';
+            if (!pass) {
+                status = 1;
+            }
+        } catch (const std::exception& e) {
+            std::cout << "{\"sessions\": " << count << ", \"error\": \""
+                      << e.what() << "\"}";
+            status = 1;
+        }
+        std::cout.flush();
+    }
+    std::cout << "\n}\n";
+
+    if (status) {
+        std::cerr << "footprint: a count failed or is above " << max_bytes
+                  << " bytes per session\n";
+    }
+    return status;
+}
@@ -0,0 +1,351 @@
+// Handshake & relay primitives, one case per hot path function:
+//
+//   greeting_parse        GreetingSize & SelectAuthMethod, 2 methods offered
+//   request_size_*        RequestSize of an ipv4 / domain name request
+//   request_port_*        RequestPort of the same
+//   request_address_*     RequestAddress of an ipv4 / ipv6 request
+//   reply_*               WriteReply with an ipv4 / ipv6 bound address
+//   socks4_request        socks4::Request built & its buffers taken
+//   socks4_response       socks4::Response the same
+//   session_create_*      Session::Create & destruction, policies compiled
+//                         out / all enabled
+//   relay_step            4 KiB (a session buffer) through a relaying session
+//                         over loopback: a read & a write, on one thread
+//
+// Every case is timed in runs of at least 20ms, the median of 5 runs is
+// reported as a JSON object of {"case": {"ns_per_op", "iterations"}}, one
+// case per line, to compare across commits (of Release builds):
+//
+//   microbench [substring of the cases to run]
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <boost/asio.hpp>
+#include <boost/log/core.hpp>
+#include <boost/log/expressions.hpp>
+#include <boost/log/trivial.hpp>
+
+#include <socks/socks4.h>
+#include <socks/socks5.h>
+
+#include "s5session_impl.h"
+
+namespace ba = boost::asio;
+namespace bs = boost::system;
+using tcp = ba::ip::tcp;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+using NoneSession =
+    socks5::Session<socks5::NoAuth, socks5::NoAccess, socks5::NoAccounting>;
+using ChecksSession = socks5::Session<socks5::PasswordAuth, socks5::RuleAccess,
+                                      socks5::TableAccounting>;
+
+// keeps the compiler from dropping value's computation & makes it assume
+// memory changed, so inputs are read again every iteration
+template <typename T>
+void Keep(T& value) {
+#if defined(__GNUC__)
+    asm volatile("" : : "r,m"(value) : "memory");
+#else
+    static volatile char sink;
+    sink = *reinterpret_cast<volatile char*>(&value);
+#endif
+}
+
+struct Result {
+    double ns_per_op;
+    std::size_t iterations;
+};
+
+Result Measure(const std::function<void()>& op) {
+    const auto run = [&op](std::size_t iterations) {
+        const auto start = Clock::now();
+        for (std::size_t i = 0; i < iterations; ++i) {
+            op();
+        }
+        return std::chrono::duration<double, std::nano>(Clock::now() - start)
+            .count();
+    };
+
+    const double min_run = 20e6;
+    std::size_t iterations = 1;
+    for (double elapsed = run(iterations); elapsed < min_run;
+         elapsed = run(iterations)) {
+        iterations = elapsed > min_run / 100
+                         ? static_cast<std::size_t>(iterations * min_run /
+                                                    elapsed * 1.2) +
+                               1
+                         : iterations * 100;
+    }
+
+    std::vector<double> runs;
+    for (int i = 0; i < 5; ++i) {
+        runs.push_back(run(iterations) / iterations);
+    }
+    std::sort(runs.begin(), runs.end());
+    return {runs[runs.size() / 2], iterations};
+}
+
+// a request as the session holds it, DST.PORT 443
+std::array<char, 64> Request(socks5::AddressType atype) {
+    std::array<char, 64> request{};
+    request[0] = socks5::version;
+    request[1] = static_cast<char>(socks5::Command::connect);
+    request[3] = static_cast<char>(atype);
+
+    std::size_t port = 0;
+    switch (atype) {
+        case socks5::AddressType::ipv4:
+            std::memcpy(&request[4], "\x0a\x00\x00\x01", 4);
+            port = 8;
+            break;
+        case socks5::AddressType::domain_name:
+            request[4] = 11;
+            std::memcpy(&request[5], "example.com", 11);
+            port = 16;
+            break;
+        case socks5::AddressType::ipv6:
+            request[4] = 0x20;
+            request[5] = 0x01;
+            request[19] = 0x01;
+            port = 20;
+            break;
+    }
+
+    request[port] = 0x01;
+    request[port + 1] = static_cast<char>(0xbb);
+    return request;
+}
+
+// Session relaying between a client & an upstream socket, driven by polling
+// the io service from the benchmark's thread
+class Relay {
+   public:
+    Relay()
+        : proxy_acceptor_{io_, Loopback()},
+          upstream_acceptor_{io_, Loopback()},
+          client_{io_},
+          upstream_{io_},
+          session_{NoneSession::Create(io_)} {
+        client_.connect(proxy_acceptor_.local_endpoint());
+        proxy_acceptor_.accept(session_->AcceptorSocket());
+        session_->Start();
+
+        bool accepted = false;
+        upstream_acceptor_.async_accept(
+            upstream_, [&accepted](const bs::error_code& ec) {
+                if (ec) {
+                    throw bs::system_error(ec);
+                }
+                accepted = true;
+            });
+
+        const std::array<char, 3> greeting{{socks5::version, 1, 0}};
+        ba::write(client_, ba::buffer(greeting));
+        Receive(client_, 2);
+
+        auto request = Request(socks5::AddressType::ipv4);
+        const auto address =
+            upstream_acceptor_.local_endpoint().address().to_v4().to_bytes();
+        std::copy(address.begin(), address.end(), request.begin() + 4);
+        const uint16_t port = upstream_acceptor_.local_endpoint().port();
+        request[8] = static_cast<char>(port >> 8);
+        request[9] = static_cast<char>(port & 0xff);
+        ba::write(client_, ba::buffer(request.data(), 10));
+        Receive(client_, 10);
+        while (!accepted) {
+            io_.poll();
+        }
+
+        for (auto* socket : {&client_, &upstream_}) {
+            socket->set_option(tcp::no_delay{true});
+        }
+    }
+
+    ~Relay() {
+        bs::error_code ignored;
+        client_.close(ignored);
+        upstream_.close(ignored);
+        io_.poll();
+    }
+
+    // client -> session -> upstream
+    void Step() {
+        ba::write(client_, ba::buffer(chunk_));
+        Receive(upstream_, chunk_.size());
+    }
+
+   private:
+    static tcp::endpoint Loopback() {
+        return tcp::endpoint{ba::ip::address_v4::loopback(), 0};
+    }
+
+    void Receive(tcp::socket& socket, std::size_t size) {
+        std::size_t received = 0;
+        while (received < size) {
+            io_.poll();
+            if (socket.available()) {
+                received += socket.read_some(ba::buffer(
+                    buf_.data(), std::min(buf_.size(), size - received)));
+            }
+        }
+    }
+
+   private:
+    ba::io_service io_;
+    tcp::acceptor proxy_acceptor_;
+    tcp::acceptor upstream_acceptor_;
+    tcp::socket client_;
+    tcp::socket upstream_;
+    std::shared_ptr<NoneSession> session_;
+    std::array<char, 4096> chunk_{};
+    std::array<char, 4096> buf_;
+};
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    const std::string filter = argc > 1 ? argv[1] : "";
+
+    boost::log::core::get()->set_filter(boost::log::trivial::severity >=
+                                        boost::log::trivial::warning);
+
+    std::array<char, 8> greeting{{socks5::version, 2, 0, 2}};
+    auto ipv4 = Request(socks5::AddressType::ipv4);
+    auto domain = Request(socks5::AddressType::domain_name);
+    auto ipv6 = Request(socks5::AddressType::ipv6);
+    std::array<char, 32> reply;
+    tcp::endpoint bound4{ba::ip::address::from_string("10.0.0.1"), 40000};
+    tcp::endpoint bound6{ba::ip::address::from_string("2001::1"), 40000};
+    ba::io_service io;
+    std::unique_ptr<Relay> relay;
+
+    const std::vector<std::pair<const char*, std::function<void()>>> cases{
+        {"greeting_parse",
+         [&greeting]() {
+             Keep(greeting);
+             std::size_t size = socks5::GreetingSize(greeting.data());
+             auto method = socks5::SelectAuthMethod(
+                 greeting.data(), socks5::AuthMethod::username_password);
+             Keep(size);
+             Keep(method);
+         }},
+        {"request_size_ipv4",
+         [&ipv4]() {
+             Keep(ipv4);
+             std::size_t size = socks5::RequestSize(ipv4.data());
+             Keep(size);
+         }},
+        {"request_size_domain",
+         [&domain]() {
+             Keep(domain);
+             std::size_t size = socks5::RequestSize(domain.data());
+             Keep(size);
+         }},
+        {"request_port_ipv4",
+         [&ipv4]() {
+             Keep(ipv4);
+             uint16_t port = socks5::RequestPort(ipv4.data());
+             Keep(port);
+         }},
+        {"request_port_domain",
+         [&domain]() {
+             Keep(domain);
+             uint16_t port = socks5::RequestPort(domain.data());
+             Keep(port);
+         }},
+        {"request_address_ipv4",
+         [&ipv4]() {
+             Keep(ipv4);
+             auto address = socks5::RequestAddress(ipv4.data());
+             Keep(address);
+         }},
+        {"request_address_ipv6",
+         [&ipv6]() {
+             Keep(ipv6);
+             auto address = socks5::RequestAddress(ipv6.data());
+             Keep(address);
+         }},
+        {"reply_ipv4",
+         [&reply, &bound4]() {
+             Keep(bound4);
+             std::size_t size = socks5::WriteReply(
+                 reply.data(), socks5::Reply::succeeded, bound4);
+             Keep(size);
+             Keep(reply);
+         }},
+        {"reply_ipv6",
+         [&reply, &bound6]() {
+             Keep(bound6);
+             std::size_t size = socks5::WriteReply(
+                 reply.data(), socks5::Reply::succeeded, bound6);
+             Keep(size);
+             Keep(reply);
+         }},
+        {"socks4_request",
+         [&bound4]() {
+             Keep(bound4);
+             socks4::Request request{socks4::Request::Command::connect, bound4,
+                                     "user"};
+             std::size_t size = ba::buffer_size(request.buffers());
+             Keep(size);
+         }},
+        {"socks4_response",
+         [&bound4]() {
+             Keep(bound4);
+             socks4::Response response{socks4::Response::Status::granted,
+                                       bound4};
+             const auto& built = response;
+             std::size_t size = ba::buffer_size(built.buffers());
+             Keep(size);
+         }},
+        {"session_create_none",
+         [&io]() {
+             auto session = NoneSession::Create(io);
+             Keep(session);
+         }},
+        {"session_create_checks",
+         [&io]() {
+             auto session = ChecksSession::Create(io);
+             Keep(session);
+         }},
+        {"relay_step", [&relay]() { relay->Step(); }},
+    };
+
+    bool first = true;
+    std::cout << "{\n" << std::fixed << std::setprecision(3);
+    for (const auto& test : cases) {
+        const std::string name = test.first;
+        if (name.find(filter) == std::string::npos) {
+            continue;
+        }
+
+        if (name == "relay_step") {
+            relay = std::make_unique<Relay>();
+        }
+
+        const Result result = Measure(test.second);
+        relay.reset();
+
+        std::cout << (first ? "" : ",\n") << "  \"" << name
+                  << "\": {\"ns_per_op\": " << result.ns_per_op
+                  << ", \"iterations\": " << result.iterations << '}';
+        std::cout.flush();
+        first = false;
+    }
+    std::cout << "\n}\n";
+
+    return 0;
+}
@@ -0,0 +1,280 @@
+// Performance regression check against a checked-in baseline: runs
+// microbench, starts s5server & runs every s5bench scenario of the baseline
+// through it, then puts each baseline metric against this run's:
+//
+//   microbench/<case>/ns_per_op
+//   s5bench/<scenario>/<key>[/<percentile>]
+//
+// A metric has its baseline value, a tolerance (a fraction of the value)
+// & which way is better. Changes for the worse beyond the tolerance are
+// regressions, for the better improvements. The table goes to stdout; the
+// exit status is 1 on a regression or a metric the run didn't produce.
+// --update rewrites the baseline's values with this run's, keeping its
+// scenarios & tolerances. Compare Release builds, on the machine that wrote
+// the baseline:
+//
+//   regress [--baseline bench/baseline.json] [--update]
+
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <boost/asio.hpp>
+#include <boost/program_options.hpp>
+#include <boost/property_tree/json_parser.hpp>
+#include <boost/property_tree/ptree.hpp>
+
+#include "support.h"
+
+namespace ba = boost::asio;
+namespace po = boost::program_options;
+namespace pt = boost::property_tree;
+using tcp = ba::ip::tcp;
+
+namespace {
+
+using bench::Capture;
+using bench::FreePort;
+using bench::ServerProcess;
+using bench::WaitListening;
+
+struct Metric {
+    std::string name;
+    double baseline;
+    double tolerance;
+    bool lower_is_better;
+};
+
+struct Baseline {
+    std::string note;
+    std::vector<std::pair<std::string, std::string>> scenarios;
+    std::vector<Metric> metrics;
+};
+
+Baseline Load(const std::string& path) {
+    pt::ptree tree;
+    pt::read_json(path, tree);
+
+    Baseline baseline;
+    baseline.note = tree.get("note", "");
+    for (const auto& scenario : tree.get_child("scenarios")) {
+        baseline.scenarios.emplace_back(scenario.first,
+                                        scenario.second.data());
+    }
+
+    for (const auto& metric : tree.get_child("metrics")) {
+        const std::string better = metric.second.get<std::string>("better");
+        if (better != "lower" && better != "higher") {
+            throw std::runtime_error(metric.first + ": better is " + better +
+                                     ", not lower or higher");
+        }
+
+        baseline.metrics.push_back({metric.first,
+                                    metric.second.get<double>("baseline"),
+                                    metric.second.get<double>("tolerance"),
+                                    better == "lower"});
+    }
+
+    return baseline;
+}
+
+// one metric per line, as Load reads it
+void Save(const std::string& path, const Baseline& baseline) {
+    std::ofstream out{path};
+    out << "{\n  \"note\": \"" << baseline.note << "\",\n  \"scenarios\": {";
+    for (std::size_t i = 0; i < baseline.scenarios.size(); ++i) {
+        out << (i ? ",\n" : "\n") << "    \"" << baseline.scenarios[i].first
+            << "\": \"" << baseline.scenarios[i].second << '"';
+    }
+    out << "\n  },\n  \"metrics\": {";
+    for (std::size_t i = 0; i < baseline.metrics.size(); ++i) {
+        const Metric& metric = baseline.metrics[i];
+        out << (i ? ",\n" : "\n") << "    \"" << metric.name
+            << "\": {\"baseline\": " << std::setprecision(6)
+            << metric.baseline << ", \"tolerance\": " << metric.tolerance
+            << ", \"better\": \""
+            << (metric.lower_is_better ? "lower" : "higher") << "\"}";
+    }
+    out << "\n  }\n}\n";
+
+    if (!out) {
+        throw std::runtime_error("can't write " + path);
+    }
+}
+
+// numbers of a JSON result as prefix/key/... paths, strings & nulls skipped
+void Flatten(const pt::ptree& tree, const std::string& prefix,
+             std::map<std::string, double>& values) {
+    for (const auto& child : tree) {
+        const std::string name = prefix + '/' + child.first;
+        if (!child.second.empty()) {
+            Flatten(child.second, name, values);
+            continue;
+        }
+
+        const auto value = child.second.get_value_optional<double>();
+        if (value) {
+            values[name] = *value;
+        }
+    }
+}
+
+void ParseInto(const std::string& json, const std::string& prefix,
+               std::map<std::string, double>& values) {
+    std::istringstream in{json};
+    pt::ptree tree;
+    pt::read_json(in, tree);
+    Flatten(tree, prefix, values);
+}
+
+std::string Quote(const std::string& path) { return "'" + path + "'"; }
+
+struct Paths {
+    std::string server;
+    std::string microbench;
+    std::string s5bench;
+    std::string baseline;
+};
+
+std::map<std::string, double> Run(const Paths& paths,
+                                  const Baseline& baseline) {
+    std::map<std::string, double> values;
+
+    std::cerr << "regress: microbench\n";
+    ParseInto(Capture(Quote(paths.microbench)), "microbench", values);
+
+    ba::io_service io;
+    const uint16_t port = FreePort(io);
+    ServerProcess server{paths.server,
+                         {std::to_string(port), "--log-level", "warning",
+                          "--stats-interval", "0"}};
+    WaitListening(io, tcp::endpoint{ba::ip::address_v4::loopback(), port});
+
+    for (const auto& scenario : baseline.scenarios) {
+        std::cerr << "regress: s5bench " << scenario.first << '\n';
+        ParseInto(Capture(Quote(paths.s5bench) + " --proxy 127.0.0.1:" +
+                          std::to_string(port) + ' ' + scenario.second),
+                  "s5bench/" + scenario.first, values);
+    }
+
+    return values;
+}
+
+// the table, the count of regressions & missing metrics
+int Compare(const Baseline& baseline,
+            const std::map<std::string, double>& values) {
+    int regressions = 0;
+    int improvements = 0;
+    int missing = 0;
+
+    std::cout << std::left << std::setw(44) << "metric" << std::right
+              << std::setw(13) << "baseline" << std::setw(13) << "current"
+              << std::setw(11) << "change" << std::setw(7) << "tol"
+              << "  result\n"
+              << std::fixed;
+    for (const Metric& metric : baseline.metrics) {
+        std::cout << std::left << std::setw(44) << metric.name << std::right
+                  << std::setprecision(2) << std::setw(13) << metric.baseline;
+
+        const auto it = values.find(metric.name);
+        if (it == values.end()) {
+            std::cout << std::setw(13) << "-" << std::setw(11) << "-"
+                      << std::setw(7) << "-" << "  MISSING\n";
+            ++missing;
+            continue;
+        }
+
+        const double change =
+            metric.baseline != 0
+                ? (it->second - metric.baseline) / std::fabs(metric.baseline)
+                : 0;
+        const double gain = metric.lower_is_better ? -change : change;
+        const char* result = "ok";
+        if (gain < -metric.tolerance) {
+            result = "REGRESSION";
+            ++regressions;
+        } else if (gain > metric.tolerance) {
+            result = "improved";
+            ++improvements;
+        }
+
+        std::cout << std::setw(13) << it->second << std::setprecision(1)
+                  << std::showpos << std::setw(10) << change * 100 << '%'
+                  << std::noshowpos << std::setprecision(0) << std::setw(6)
+                  << metric.tolerance * 100 << '%' << "  " << result << '\n';
+    }
+
+    std::cout << '\n'
+              << regressions << " regressions, " << improvements
+              << " improvements, "
+              << baseline.metrics.size() - static_cast<std::size_t>(
+                                               regressions + improvements +
+                                               missing)
+              << " within tolerance, " << missing << " missing\n";
+    return regressions + missing;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    Paths paths{S5SERVER_PATH, MICROBENCH_PATH, S5BENCH_PATH, BASELINE_PATH};
+
+    po::options_description desc("Options");
+    // clang-format off
+    desc.add_options()
+        ("help,h", "print this message")
+        ("baseline", po::value(&paths.baseline)->default_value(paths.baseline),
+         "baseline to compare with")
+        ("update", "write this run's values to the baseline")
+        ("server", po::value(&paths.server)->default_value(paths.server),
+         "s5server binary")
+        ("microbench",
+         po::value(&paths.microbench)->default_value(paths.microbench),
+         "microbench binary")
+        ("s5bench", po::value(&paths.s5bench)->default_value(paths.s5bench),
+         "s5bench binary");
+    // clang-format on
+
+    po::variables_map vm;
+    try {
+        po::store(po::parse_command_line(argc, argv, desc), vm);
+        if (vm.count("help")) {
+            std::cout << "Usage: " << argv[0] << " [options]\n" << desc;
+            return 1;
+        }
+        po::notify(vm);
+    } catch (po::error& e) {
+        std::cout << e.what() << "\n\n"
+                  << "Usage: " << argv[0] << " [options]\n"
+                  << desc;
+        return 1;
+    }
+
+    try {
+        Baseline baseline = Load(paths.baseline);
+        const auto values = Run(paths, baseline);
+        const int failures = Compare(baseline, values);
+
+        if (vm.count("update")) {
+            for (Metric& metric : baseline.metrics) {
+                const auto it = values.find(metric.name);
+                if (it != values.end()) {
+                    metric.baseline = it->second;
+                }
+            }
+            Save(paths.baseline, baseline);
+            std::cout << "baseline " << paths.baseline << " updated\n";
+            return 0;
+        }
+
+        return failures ? 1 : 0;
+    } catch (const std::exception& e) {
+        std::cerr << "regress: " << e.what() << '\n';
+        return 1;
+    }
+}
@@ -0,0 +1,649 @@
+// Load generator for s5server & s4server: thousands of concurrent clients
+// handshake through the proxy to upstreams s5bench serves itself on
+// loopback, then
+//
+//   churn  send --size bytes to the echo upstream, read them back & close,
+//          over & over (connections per second)
+//   bulk   stream --chunk sized writes to the sink upstream (--direction up)
+//          or read what the source upstream streams (down) for the whole run
+//   rr     request/response of --size bytes on long lived connections
+//
+// Latency is per churn session (connect to echo) or rr round trip, the
+// handshake from connect to the proxy's reply. Churn closes with a reset, so
+// the client side doesn't run out of ports to TIME_WAIT. Failed clients
+// count an error & reconnect after a pause. The descriptor limit is raised to
+// the hard limit, --clients it can't hold are refused. The result is a JSON
+// object on stdout; run the proxy with --log-level warning not to measure its
+// logging:
+//
+//   s5bench --proxy 127.0.0.1:1080 --mode churn --clients 1000
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/asio.hpp>
+#include <boost/program_options.hpp>
+
+#include <socks/socks4.h>
+#include <socks/socks5.h>
+
+#include "s5histogram.h"
+#include "support.h"
+
+namespace ba = boost::asio;
+namespace bs = boost::system;
+namespace po = boost::program_options;
+using tcp = ba::ip::tcp;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+const std::chrono::milliseconds accept_backoff{100};
+
+enum class Mode { churn, bulk, rr };
+
+struct Config {
+    tcp::endpoint proxy;
+    bool socks4 = false;
+    Mode mode = Mode::churn;
+    bool upload = true;  // bulk direction
+    std::size_t clients = 1000;
+    unsigned duration = 10;  // seconds
+    unsigned threads = 1;
+    std::size_t size = 64;
+    std::size_t chunk = 16384;
+};
+
+// per client thread, read once the threads are joined
+struct Stats {
+    uint64_t connections = 0;   // handshakes completed
+    uint64_t transactions = 0;  // churn sessions or rr round trips
+    uint64_t errors = 0;
+    uint64_t bytes = 0;  // payload, one way
+    std::unique_ptr<socks5::Histogram> handshake =
+        std::make_unique<socks5::Histogram>();
+    std::unique_ptr<socks5::Histogram> latency =
+        std::make_unique<socks5::Histogram>();
+};
+
+// upstream: echoes, discards or streams zeros
+class Upstream {
+   public:
+    enum class Kind { echo, sink, source };
+
+    Upstream(ba::io_service& io, Kind kind, std::size_t chunk)
+        : io_(io),
+          acceptor_{io, tcp::endpoint{ba::ip::address_v4::loopback(), 0}},
+          accept_timer_{io},
+          kind_{kind},
+          chunk_{chunk} {
+        Accept();
+    }
+
+    tcp::endpoint Endpoint() const { return acceptor_.local_endpoint(); }
+
+   private:
+    struct Connection {
+        Connection(ba::io_service& io, std::size_t size)
+            : socket{io}, buf(size) {}
+
+        tcp::socket socket;
+        std::vector<char> buf;
+    };
+
+    void Accept() {
+        auto connection = std::make_shared<Connection>(io_, chunk_);
+        acceptor_.async_accept(
+            connection->socket, [this, connection](const bs::error_code& ec) {
+                if (ec) {
+                    // out of descriptors: wait for clients to close some
+                    // rather than spin on the acceptor
+                    accept_timer_.expires_from_now(accept_backoff);
+                    accept_timer_.async_wait(
+                        [this](const bs::error_code& ec) {
+                            if (!ec) {
+                                Accept();
+                            }
+                        });
+                    return;
+                }
+
+                bs::error_code ignored;
+                connection->socket.set_option(tcp::no_delay{true}, ignored);
+                kind_ == Kind::source ? Write(connection, chunk_)
+                                      : Read(connection);
+                Accept();
+            });
+    }
+
+    void Read(std::shared_ptr<Connection> connection) {
+        connection->socket.async_read_some(
+            ba::buffer(connection->buf),
+            [this, connection](const bs::error_code& ec, std::size_t length) {
+                if (ec) {
+                    return;
+                }
+
+                if (kind_ == Kind::echo) {
+                    Write(connection, length);
+                } else {
+                    Read(connection);
+                }
+            });
+    }
+
+    void Write(std::shared_ptr<Connection> connection, std::size_t length) {
+        ba::async_write(
+            connection->socket, ba::buffer(connection->buf.data(), length),
+            [this, connection, length](const bs::error_code& ec, std::size_t) {
+                if (ec) {
+                    return;
+                }
+
+                if (kind_ == Kind::source) {
+                    Write(connection, length);
+                } else {
+                    Read(connection);
+                }
+            });
+    }
+
+   private:
+    ba::io_service& io_;
+    tcp::acceptor acceptor_;
+    ba::steady_timer accept_timer_;
+    Kind kind_;
+    std::size_t chunk_;
+};
+
+class Client : public std::enable_shared_from_this<Client> {
+   public:
+    Client(ba::io_service& io, const Config& config,
+           const tcp::endpoint& target, Stats& stats)
+        : socket_{io},
+          retry_timer_{io},
+          config_(config),
+          target_{target},
+          stats_(stats),
+          buf_(std::max<std::size_t>({config.size, config.chunk, 32})) {}
+
+    void Start() {
+        auto self(shared_from_this());
+        started_ = Clock::now();
+        socket_.async_connect(config_.proxy,
+                              [this, self](const bs::error_code& ec) {
+                                  if (ec) {
+                                      Fail();
+                                      return;
+                                  }
+
+                                  bs::error_code ignored;
+                                  socket_.set_option(tcp::no_delay{true},
+                                                     ignored);
+                                  if (config_.socks4) {
+                                      Socks4Request();
+                                  } else {
+                                      Socks5Greeting();
+                                  }
+                              });
+    }
+
+   private:
+    void Socks5Greeting() {
+        buf_[0] = socks5::version;
+        buf_[1] = 1;
+        buf_[2] = static_cast<unsigned char>(socks5::AuthMethod::no_auth);
+
+        auto self(shared_from_this());
+        ba::async_write(
+            socket_, ba::buffer(buf_.data(), 3),
+            [this, self](const bs::error_code& ec, std::size_t) {
+                if (ec) {
+                    Fail();
+                    return;
+                }
+
+                ba::async_read(
+                    socket_, ba::buffer(buf_.data(), 2),
+                    [this, self](const bs::error_code& ec, std::size_t) {
+                        if (ec || buf_[1] != static_cast<unsigned char>(
+                                                 socks5::AuthMethod::no_auth)) {
+                            Fail();
+                            return;
+                        }
+
+                        Socks5Request();
+                    });
+            });
+    }
+
+    void Socks5Request() {
+        const auto address = target_.address().to_v4().to_bytes();
+        buf_[0] = socks5::version;
+        buf_[1] = static_cast<unsigned char>(socks5::Command::connect);
+        buf_[2] = socks5::reserved;
+        buf_[3] = static_cast<unsigned char>(socks5::AddressType::ipv4);
+        std::copy(address.begin(), address.end(), buf_.begin() + 4);
+        buf_[8] = static_cast<unsigned char>(target_.port() >> 8);
+        buf_[9] = static_cast<unsigned char>(target_.port() & 0xff);
+
+        auto self(shared_from_this());
+        ba::async_write(socket_, ba::buffer(buf_.data(), 10),
+                        [this, self](const bs::error_code& ec, std::size_t) {
+                            if (ec) {
+                                Fail();
+                                return;
+                            }
+
+                            Socks5Reply();
+                        });
+    }
+
+    // VER REP RSV ATYP, then the bound address & port
+    void Socks5Reply() {
+        auto self(shared_from_this());
+        ba::async_read(
+            socket_, ba::buffer(buf_.data(), 4),
+            [this, self](const bs::error_code& ec, std::size_t) {
+                if (ec || buf_[1] != static_cast<unsigned char>(
+                                         socks5::Reply::succeeded)) {
+                    Fail();
+                    return;
+                }
+
+                const std::size_t rest =
+                    buf_[3] == static_cast<unsigned char>(
+                                   socks5::AddressType::ipv6)
+                        ? 18
+                        : 6;
+                ba::async_read(
+                    socket_, ba::buffer(buf_.data(), rest),
+                    [this, self](const bs::error_code& ec, std::size_t) {
+                        if (ec) {
+                            Fail();
+                            return;
+                        }
+
+                        Connected();
+                    });
+            });
+    }
+
+    void Socks4Request() {
+        request4_ = socks4::Request{socks4::Request::Command::connect, target_,
+                                    ""};
+
+        auto self(shared_from_this());
+        ba::async_write(
+            socket_, request4_.buffers(),
+            [this, self](const bs::error_code& ec, std::size_t) {
+                if (ec) {
+                    Fail();
+                    return;
+                }
+
+                ba::async_read(
+                    socket_, response4_.buffers(),
+                    [this, self](const bs::error_code& ec, std::size_t) {
+                        if (ec || response4_.status() !=
+                                      socks4::Response::Status::granted) {
+                            Fail();
+                            return;
+                        }
+
+                        Connected();
+                    });
+            });
+    }
+
+    void Connected() {
+        stats_.handshake->Record(Nanoseconds(started_));
+        ++stats_.connections;
+
+        switch (config_.mode) {
+            case Mode::churn:
+            case Mode::rr:
+                Exchange();
+                break;
+            case Mode::bulk:
+                config_.upload ? Send() : Receive();
+                break;
+        }
+    }
+
+    void Exchange() {
+        exchange_started_ = Clock::now();
+
+        auto self(shared_from_this());
+        ba::async_write(
+            socket_, ba::buffer(buf_.data(), config_.size),
+            [this, self](const bs::error_code& ec, std::size_t) {
+                if (ec) {
+                    Fail();
+                    return;
+                }
+
+                ba::async_read(
+                    socket_, ba::buffer(buf_.data(), config_.size),
+                    [this, self](const bs::error_code& ec, std::size_t) {
+                        if (ec) {
+                            Fail();
+                            return;
+                        }
+
+                        ++stats_.transactions;
+                        stats_.bytes += config_.size;
+                        if (config_.mode == Mode::rr) {
+                            stats_.latency->Record(
+                                Nanoseconds(exchange_started_));
+                            Exchange();
+                            return;
+                        }
+
+                        stats_.latency->Record(Nanoseconds(started_));
+                        bs::error_code ignored;
+                        socket_.set_option(ba::socket_base::linger{true, 0},
+                                           ignored);
+                        socket_.close(ignored);
+                        Start();
+                    });
+            });
+    }
+
+    void Send() {
+        auto self(shared_from_this());
+        ba::async_write(socket_, ba::buffer(buf_.data(), config_.chunk),
+                        [this, self](const bs::error_code& ec,
+                                     std::size_t length) {
+                            if (ec) {
+                                Fail();
+                                return;
+                            }
+
+                            stats_.bytes += length;
+                            Send();
+                        });
+    }
+
+    void Receive() {
+        auto self(shared_from_this());
+        socket_.async_read_some(ba::buffer(buf_),
+                                [this, self](const bs::error_code& ec,
+                                             std::size_t length) {
+                                    if (ec) {
+                                        Fail();
+                                        return;
+                                    }
+
+                                    stats_.bytes += length;
+                                    Receive();
+                                });
+    }
+
+    void Fail() {
+        ++stats_.errors;
+        bs::error_code ignored;
+        socket_.close(ignored);
+
+        auto self(shared_from_this());
+        retry_timer_.expires_from_now(std::chrono::milliseconds{100});
+        retry_timer_.async_wait([this, self](const bs::error_code& ec) {
+            if (!ec) {
+                Start();
+            }
+        });
+    }
+
+    static uint64_t Nanoseconds(Clock::time_point since) {
+        return static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() -
+                                                                 since)
+                .count());
+    }
+
+   private:
+    tcp::socket socket_;
+    ba::steady_timer retry_timer_;
+    const Config& config_;
+    tcp::endpoint target_;
+    Stats& stats_;
+    std::vector<unsigned char> buf_;
+    socks4::Request request4_;
+    socks4::Response response4_;
+    Clock::time_point started_;
+    Clock::time_point exchange_started_;
+};
+
+struct Loop {
+    Stats stats;  // outlives the clients the io service holds
+    ba::io_service io{1};
+    std::thread thread;
+};
+
+void PrintLatency(std::ostream& out, const char* name,
+                  const socks5::Histogram& histogram) {
+    out << "  \"" << name << "\": {\"count\": " << histogram.Count();
+    const struct {
+        const char* name;
+        double quantile;
+    } quantiles[] = {
+        {"p50", 0.5}, {"p90", 0.9}, {"p99", 0.99}, {"p999", 0.999}};
+    for (const auto& quantile : quantiles) {
+        out << ", \"" << quantile.name
+            << "\": " << histogram.Quantile(quantile.quantile) / 1000.0;
+    }
+    out << '}';
+}
+
+bool ParseOptions(int argc, char* argv[], Config& config) {
+    std::string proxy = "127.0.0.1:1080";
+    std::string protocol = "socks5";
+    std::string mode = "churn";
+    std::string direction = "up";
+
+    po::options_description desc("Options");
+    // clang-format off
+    desc.add_options()
+        ("help,h", "print this message")
+        ("proxy", po::value(&proxy)->default_value(proxy),
+         "proxy to drive, ip:port")
+        ("protocol", po::value(&protocol)->default_value(protocol),
+         "socks5 or socks4")
+        ("mode", po::value(&mode)->default_value(mode),
+         "churn, bulk or rr")
+        ("direction", po::value(&direction)->default_value(direction),
+         "bulk data direction: up (to the sink) or down (from the source)")
+        ("clients",
+         po::value(&config.clients)->default_value(config.clients),
+         "concurrent clients")
+        ("duration",
+         po::value(&config.duration)->default_value(config.duration),
+         "seconds to run")
+        ("threads",
+         po::value(&config.threads)->default_value(config.threads),
+         "client threads, the upstreams run on as many")
+        ("size", po::value(&config.size)->default_value(config.size),
+         "churn & rr message bytes")
+        ("chunk", po::value(&config.chunk)->default_value(config.chunk),
+         "bulk write & read bytes");
+    // clang-format on
+
+    try {
+        po::variables_map vm;
+        po::store(po::parse_command_line(argc, argv, desc), vm);
+
+        if (vm.count("help")) {
+            std::cout << "Usage: " << argv[0] << " [options]\n" << desc;
+            return false;
+        }
+
+        po::notify(vm);
+
+        const auto colon = proxy.rfind(':');
+        if (colon == std::string::npos) {
+            throw po::error("--proxy must be ip:port");
+        }
+        bs::error_code ec;
+        const auto address =
+            ba::ip::address::from_string(proxy.substr(0, colon), ec);
+        if (ec) {
+            throw po::error("--proxy must be ip:port");
+        }
+        const std::string port = proxy.substr(colon + 1);
+        if (port.empty() || port.size() > 5 ||
+            !std::all_of(port.begin(), port.end(), [](unsigned char c) {
+                return std::isdigit(c);
+            }) ||
+            !std::stoul(port) || std::stoul(port) > 65535) {
+            throw po::error("--proxy port must be 1-65535");
+        }
+        config.proxy =
+            tcp::endpoint{address, static_cast<uint16_t>(std::stoul(port))};
+
+        if (protocol != "socks5" && protocol != "socks4") {
+            throw po::error("--protocol must be socks5 or socks4");
+        }
+        config.socks4 = protocol == "socks4";
+
+        if (mode == "churn") {
+            config.mode = Mode::churn;
+        } else if (mode == "bulk") {
+            config.mode = Mode::bulk;
+        } else if (mode == "rr") {
+            config.mode = Mode::rr;
+        } else {
+            throw po::error("--mode must be churn, bulk or rr");
+        }
+
+        if (direction != "up" && direction != "down") {
+            throw po::error("--direction must be up or down");
+        }
+        config.upload = direction == "up";
+
+        if (!config.threads || !config.clients || !config.size ||
+            !config.chunk) {
+            throw po::error(
+                "--threads, --clients, --size & --chunk must be positive");
+        }
+    } catch (std::exception& e) {
+        std::cout << e.what() << "\n\n"
+                  << "Usage: " << argv[0] << " [options]\n"
+                  << desc;
+        return false;
+    }
+
+    return true;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    Config config;
+    if (!ParseOptions(argc, argv, config)) {
+        return 1;
+    }
+
+    // a client & its upstream connection each, on top of the acceptors,
+    // io services & threads
+    const std::size_t descriptors = bench::RaiseDescriptorLimit();
+    const std::size_t needed = 2 * config.clients + 64;
+    if (needed > descriptors) {
+        std::cerr << "--clients " << config.clients << " needs " << needed
+                  << " descriptors, the limit is " << descriptors << '\n';
+        return 1;
+    }
+
+    ba::io_service upstream_io;
+    ba::io_service::work upstream_work{upstream_io};
+    Upstream echo{upstream_io, Upstream::Kind::echo, config.chunk};
+    Upstream sink{upstream_io, Upstream::Kind::sink, config.chunk};
+    Upstream source{upstream_io, Upstream::Kind::source, config.chunk};
+    const tcp::endpoint target =
+        config.mode != Mode::bulk
+            ? echo.Endpoint()
+            : config.upload ? sink.Endpoint() : source.Endpoint();
+
+    std::vector<std::thread> upstream_threads;
+    for (unsigned i = 0; i < config.threads; ++i) {
+        upstream_threads.emplace_back([&upstream_io]() { upstream_io.run(); });
+    }
+
+    std::vector<std::unique_ptr<Loop>> loops;
+    for (unsigned i = 0; i < config.threads; ++i) {
+        loops.push_back(std::make_unique<Loop>());
+    }
+
+    const auto start = Clock::now();
+    for (std::size_t i = 0; i < config.clients; ++i) {
+        Loop& loop = *loops[i % loops.size()];
+        std::make_shared<Client>(loop.io, config, target, loop.stats)->Start();
+    }
+
+    for (auto& loop : loops) {
+        ba::io_service* io = &loop->io;
+        loop->thread = std::thread{[io]() { io->run(); }};
+    }
+
+    std::this_thread::sleep_for(std::chrono::seconds{config.duration});
+
+    for (auto& loop : loops) {
+        loop->io.stop();
+        loop->thread.join();
+    }
+    const std::chrono::duration<double> elapsed = Clock::now() - start;
+
+    upstream_io.stop();
+    for (auto& thread : upstream_threads) {
+        thread.join();
+    }
+
+    Stats total;
+    for (const auto& loop : loops) {
+        total.connections += loop->stats.connections;
+        total.transactions += loop->stats.transactions;
+        total.errors += loop->stats.errors;
+        total.bytes += loop->stats.bytes;
+        total.handshake->Merge(*loop->stats.handshake);
+        total.latency->Merge(*loop->stats.latency);
+    }
+
+    const double seconds = elapsed.count();
+    const char* modes[] = {"churn", "bulk", "rr"};
+    std::ostream& out = std::cout;
+    out << std::fixed << std::setprecision(3) << "{\n"
+        << "  \"protocol\": \"" << (config.socks4 ? "socks4" : "socks5")
+        << "\",\n"
+        << "  \"mode\": \"" << modes[static_cast<int>(config.mode)] << "\",\n"
+        << "  \"direction\": \"" << (config.upload ? "up" : "down") << "\",\n"
+        << "  \"clients\": " << config.clients << ",\n"
+        << "  \"threads\": " << config.threads << ",\n"
+        << "  \"size\": " << config.size << ",\n"
+        << "  \"chunk\": " << config.chunk << ",\n"
+        << "  \"seconds\": " << seconds << ",\n"
+        << "  \"connections\": " << total.connections << ",\n"
+        << "  \"connections_per_second\": " << total.connections / seconds
+        << ",\n"
+        << "  \"transactions\": " << total.transactions << ",\n"
+        << "  \"transactions_per_second\": " << total.transactions / seconds
+        << ",\n"
+        << "  \"errors\": " << total.errors << ",\n"
+        << "  \"bytes\": " << total.bytes << ",\n"
+        << "  \"megabits_per_second\": " << total.bytes * 8 / seconds / 1e6
+        << ",\n";
+    PrintLatency(out, "handshake_us", *total.handshake);
+    out << ",\n";
+    PrintLatency(out, "latency_us", *total.latency);
+    out << "\n}\n";
+
+    return 0;
+}
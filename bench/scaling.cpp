@@ -0,0 +1,238 @@
+// Thread scaling of s5server: for 1..--max-threads event loops a fresh
+// server is started with --threads n & s5bench run through it twice,
+//
+//   churn  connections per second, short sessions (handshake-bound)
+//   bulk   megabits per second, long streams upstream (relay-bound)
+//
+// Every thread count is a CSV row of the rates, their speedup over one
+// thread & scaling efficiency (speedup / threads). A rate that grows by
+// less than --min-gain over the thread count before is flagged flat: the
+// point where adding cores stops helping. The table & the first flat point
+// of each rate go to stdout. s5bench shares the machine, give it enough
+// threads (--bench-threads) not to be what stops scaling:
+//
+//   scaling [--max-threads 8] [--duration 5] [--output scaling.csv]
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/asio.hpp>
+#include <boost/program_options.hpp>
+#include <boost/property_tree/json_parser.hpp>
+#include <boost/property_tree/ptree.hpp>
+
+#include "support.h"
+
+namespace ba = boost::asio;
+namespace po = boost::program_options;
+namespace pt = boost::property_tree;
+using tcp = ba::ip::tcp;
+
+namespace {
+
+using bench::Capture;
+using bench::FreePort;
+using bench::ServerProcess;
+using bench::WaitListening;
+
+struct Config {
+    std::string server;
+    std::string s5bench;
+    unsigned max_threads = 0;
+    unsigned bench_threads = 0;
+    unsigned duration = 5;
+    unsigned churn_clients = 256;
+    unsigned bulk_clients = 64;
+    double min_gain = 0.05;
+    std::string output = "scaling.csv";
+};
+
+struct Point {
+    unsigned threads;
+    double connections_per_second;
+    double megabits_per_second;
+};
+
+double Bench(const Config& config, uint16_t port, const std::string& args,
+             const char* key) {
+    std::istringstream out{Capture(
+        "'" + config.s5bench + "' --proxy 127.0.0.1:" + std::to_string(port) +
+        " --threads " + std::to_string(config.bench_threads) +
+        " --duration " + std::to_string(config.duration) + ' ' + args)};
+    pt::ptree result;
+    pt::read_json(out, result);
+    return result.get<double>(key);
+}
+
+Point Run(const Config& config, unsigned threads) {
+    ba::io_service io;
+    const uint16_t port = FreePort(io);
+    ServerProcess server{config.server,
+                         {std::to_string(port), "--threads",
+                          std::to_string(threads), "--log-level", "warning",
+                          "--stats-interval", "0"}};
+    WaitListening(io, tcp::endpoint{ba::ip::address_v4::loopback(), port});
+
+    Point point{threads, 0, 0};
+    point.connections_per_second = Bench(
+        config, port,
+        "--mode churn --clients " + std::to_string(config.churn_clients),
+        "connections_per_second");
+    point.megabits_per_second =
+        Bench(config, port,
+              "--mode bulk --direction up --clients " +
+                  std::to_string(config.bulk_clients),
+              "megabits_per_second");
+    return point;
+}
+
+// speedup over one thread, efficiency & whether it stopped growing
+struct Scaling {
+    double speedup;
+    double efficiency;
+    bool flat;
+};
+
+Scaling Scale(const std::vector<Point>& points, std::size_t i,
+              double Point::*rate, double min_gain) {
+    const double first = points.front().*rate;
+    const double speedup = first > 0 ? points[i].*rate / first : 0;
+    const bool flat =
+        i > 0 && points[i].*rate < points[i - 1].*rate * (1 + min_gain);
+    return {speedup, speedup / points[i].threads, flat};
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    Config config;
+    config.server = S5SERVER_PATH;
+    config.s5bench = S5BENCH_PATH;
+    config.max_threads = std::max(std::thread::hardware_concurrency(), 1u);
+    config.bench_threads = config.max_threads;
+
+    po::options_description desc("Options");
+    // clang-format off
+    desc.add_options()
+        ("help,h", "print this message")
+        ("max-threads",
+         po::value(&config.max_threads)->default_value(config.max_threads),
+         "server threads to sweep up to, from 1")
+        ("duration",
+         po::value(&config.duration)->default_value(config.duration),
+         "seconds per s5bench run")
+        ("bench-threads",
+         po::value(&config.bench_threads)->default_value(config.bench_threads),
+         "s5bench threads")
+        ("churn-clients",
+         po::value(&config.churn_clients)->default_value(config.churn_clients),
+         "concurrent churn clients")
+        ("bulk-clients",
+         po::value(&config.bulk_clients)->default_value(config.bulk_clients),
+         "concurrent bulk streams")
+        ("min-gain",
+         po::value(&config.min_gain)->default_value(config.min_gain),
+         "growth per added thread below which a rate is flat")
+        ("output", po::value(&config.output)->default_value(config.output),
+         "CSV to write")
+        ("server", po::value(&config.server)->default_value(config.server),
+         "s5server binary")
+        ("s5bench", po::value(&config.s5bench)->default_value(config.s5bench),
+         "s5bench binary");
+    // clang-format on
+
+    try {
+        po::variables_map vm;
+        po::store(po::parse_command_line(argc, argv, desc), vm);
+        if (vm.count("help")) {
+            std::cout << "Usage: " << argv[0] << " [options]\n" << desc;
+            return 1;
+        }
+        po::notify(vm);
+
+        if (config.max_threads == 0 || config.bench_threads == 0) {
+            throw po::error("thread counts must be at least 1");
+        }
+    } catch (po::error& e) {
+        std::cout << e.what() << "\n\n"
+                  << "Usage: " << argv[0] << " [options]\n"
+                  << desc;
+        return 1;
+    }
+
+    std::vector<Point> points;
+    try {
+        for (unsigned threads = 1; threads <= config.max_threads; ++threads) {
+            std::cerr << "scaling: " << threads << " threads\n";
+            points.push_back(Run(config, threads));
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "scaling: " << e.what() << '\n';
+        return 1;
+    }
+
+    std::ofstream csv{config.output};
+    csv << "threads,connections_per_second,connections_speedup,"
+           "connections_efficiency,connections_flat,megabits_per_second,"
+           "megabits_speedup,megabits_efficiency,megabits_flat\n";
+    std::cout << std::setw(7) << "threads" << std::setw(12) << "conn/s"
+              << std::setw(9) << "speedup" << std::setw(6) << "eff"
+              << std::setw(12) << "Mbit/s" << std::setw(9) << "speedup"
+              << std::setw(6) << "eff" << '\n'
+              << std::fixed;
+
+    unsigned connections_flat = 0;
+    unsigned megabits_flat = 0;
+    for (std::size_t i = 0; i < points.size(); ++i) {
+        const Point& point = points[i];
+        const Scaling connections = Scale(
+            points, i, &Point::connections_per_second, config.min_gain);
+        const Scaling megabits =
+            Scale(points, i, &Point::megabits_per_second, config.min_gain);
+        if (connections.flat && !connections_flat) {
+            connections_flat = point.threads;
+        }
+        if (megabits.flat && !megabits_flat) {
+            megabits_flat = point.threads;
+        }
+
+        csv << point.threads << ',' << point.connections_per_second << ','
+            << connections.speedup << ',' << connections.efficiency << ','
+            << connections.flat << ',' << point.megabits_per_second << ','
+            << megabits.speedup << ',' << megabits.efficiency << ','
+            << megabits.flat << '\n';
+
+        std::cout << std::setw(7) << point.threads << std::setprecision(1)
+                  << std::setw(12) << point.connections_per_second
+                  << std::setprecision(2) << std::setw(9)
+                  << connections.speedup << std::setprecision(0)
+                  << std::setw(5) << connections.efficiency * 100 << '%'
+                  << std::setprecision(1) << std::setw(12)
+                  << point.megabits_per_second << std::setprecision(2)
+                  << std::setw(9) << megabits.speedup << std::setprecision(0)
+                  << std::setw(5) << megabits.efficiency * 100 << '%'
+                  << (connections.flat ? "  conn/s flat" : "")
+                  << (megabits.flat ? "  Mbit/s flat" : "") << '\n';
+    }
+
+    const auto report = [](const char* rate, unsigned flat, unsigned max) {
+        std::cout << rate;
+        if (flat) {
+            std::cout << " stops scaling at " << flat << " threads\n";
+        } else {
+            std::cout << " scales up to " << max << " threads\n";
+        }
+    };
+    std::cout << '\n';
+    report("conn/s", connections_flat, config.max_threads);
+    report("Mbit/s", megabits_flat, config.max_threads);
+    std::cout << "wrote " << config.output << '\n';
+
+    return csv ? 0 : 1;
+}
@@ -0,0 +1,459 @@
+// Session policy overhead: the policy work of one session, taken out of the
+// session & timed in isolation, so sockets & the kernel don't drown it. Per
+// session: pin the policy, pick the auth method & check the password, check
+// the destination domain & addresses, open an accounting entry, count 16
+// relayed chunks each way, close the entry & unpin. Two configurations:
+//
+//   off  nothing configured
+//   on   users, address & domain rules & an accounting table, through the
+//        real services: a PolicyStore reader & an Accounting table
+//
+// each run by three implementations:
+//
+//   template  the policy classes the server instantiates for it (off:
+//             NoAuth, NoAccess, NoAccounting; on: PasswordAuth, RuleAccess,
+//             TableAccounting)
+//   legacy    the run time checks of the session before it was a template,
+//             as its handshake & relay code made them (the remote_endpoint()
+//             call its address check made left out)
+//   virtual   the template's policies behind virtual calls
+//
+// Variants take turns round by round, the median round is reported.
+//
+//   session_policy [sessions per round] [rounds]
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <boost/asio.hpp>
+
+#include "s5session.h"
+
+namespace ba = boost::asio;
+
+namespace {
+
+const std::size_t chunks = 16;
+const std::size_t chunk_size = 4096;
+
+// keeps the compiler from dropping value's computation
+template <typename T>
+void Keep(T& value) {
+#if defined(__GNUC__)
+    asm volatile("" : : "r,m"(value) : "memory");
+#else
+    static volatile T sink;
+    sink = value;
+#endif
+}
+
+// what a session knows when it makes its checks
+struct Request {
+    std::string user{"alice"};
+    std::string password{"secret"};
+    std::string host{"www.example.com"};
+    std::string destination{"www.example.com:443"};
+    ba::ip::address source{ba::ip::address_v4::loopback()};
+    ba::ip::address address{ba::ip::address_v4{{{93, 184, 216, 34}}}};
+};
+
+struct Services {
+    socks5::PolicyStore::Reader* policy;
+    socks5::Accounting::Table* accounting;  // nullptr when off
+};
+
+template <typename AuthPolicy, typename AccessPolicy,
+          typename AccountingPolicy>
+class TemplateChecks : private AccountingPolicy {
+   public:
+    uint64_t Run(const Services& services, const Request& request) {
+        uint64_t passed = 0;
+        const socks5::Policy* policy = services.policy->Acquire();
+
+        if (AuthPolicy::Method(policy) ==
+                socks5::AuthMethod::username_password &&
+            AuthPolicy::Authenticate(policy, request.user, request.password)) {
+            ++passed;
+        }
+
+        if (!AccessPolicy::enabled ||
+            (AccessPolicy::DomainAllowed(policy, request.host) &&
+             AccessPolicy::Allowed(policy, request.source, request.address))) {
+            ++passed;
+        }
+
+        if (services.accounting) {
+            this->AccountOpen(services.accounting, request.user,
+                              request.destination);
+        }
+
+        for (std::size_t i = 0; i < chunks; ++i) {
+            this->AccountUp(chunk_size);
+            this->AccountDown(chunk_size);
+        }
+
+        this->AccountClose(services.accounting);
+        services.policy->Release(policy);
+        return passed;
+    }
+};
+
+// as the non-template Session made them: every part of the policy & the
+// accounting table tested for at run time
+class LegacyChecks {
+   public:
+    uint64_t Run(const Services& services, const Request& request) {
+        uint64_t passed = 0;
+        const socks5::Policy* policy = services.policy->Acquire();
+
+        const socks5::AuthMethod wanted =
+            policy && policy->users ? socks5::AuthMethod::username_password
+                                    : socks5::AuthMethod::no_auth;
+        if (wanted == socks5::AuthMethod::username_password &&
+            policy->users->Check(request.user, request.password)) {
+            ++passed;
+        }
+
+        const bool domain_allowed = !policy || !policy->domains ||
+                                    policy->domains->Allowed(request.host);
+        const bool address_allowed =
+            !policy || !policy->acl ||
+            policy->acl->Allowed(request.source, request.address);
+        if (domain_allowed && address_allowed) {
+            ++passed;
+        }
+
+        socks5::Accounting::Table::Account* account = nullptr;
+        if (services.accounting) {
+            account =
+                services.accounting->Open(request.user, request.destination);
+        }
+
+        for (std::size_t i = 0; i < chunks; ++i) {
+            if (account) {
+                account->counters.bytes_up += chunk_size;
+            }
+            if (account) {
+                account->counters.bytes_down += chunk_size;
+            }
+        }
+
+        if (account) {
+            services.accounting->Close(account);
+        }
+
+        if (policy) {
+            services.policy->Release(policy);
+        }
+
+        return passed;
+    }
+};
+
+// policies dispatched at run time, as an interface based design would
+class AuthChecks {
+   public:
+    virtual ~AuthChecks() = default;
+    virtual socks5::AuthMethod Method(const socks5::Policy* policy) const = 0;
+    virtual bool Authenticate(const socks5::Policy* policy,
+                              const std::string& user,
+                              const std::string& password) const = 0;
+};
+
+class AccessChecks {
+   public:
+    virtual ~AccessChecks() = default;
+    virtual bool Allowed(const socks5::Policy* policy,
+                         const ba::ip::address& source,
+                         const ba::ip::address& destination) const = 0;
+    virtual bool DomainAllowed(const socks5::Policy* policy,
+                               const std::string& host) const = 0;
+};
+
+class AccountingChecks {
+   public:
+    using Account = socks5::Accounting::Table::Account;
+
+    virtual ~AccountingChecks() = default;
+    virtual Account* Open(socks5::Accounting::Table* table,
+                          const std::string& user,
+                          const std::string& destination) const = 0;
+    virtual void Up(Account* account, std::size_t length) const = 0;
+    virtual void Down(Account* account, std::size_t length) const = 0;
+    virtual void Close(socks5::Accounting::Table* table,
+                       Account* account) const = 0;
+};
+
+template <typename AuthPolicy>
+class VirtualAuth : public AuthChecks {
+   public:
+    socks5::AuthMethod Method(const socks5::Policy* policy) const override {
+        return AuthPolicy::Method(policy);
+    }
+
+    bool Authenticate(const socks5::Policy* policy, const std::string& user,
+                      const std::string& password) const override {
+        return AuthPolicy::Authenticate(policy, user, password);
+    }
+};
+
+template <typename AccessPolicy>
+class VirtualAccess : public AccessChecks {
+   public:
+    bool Allowed(const socks5::Policy* policy, const ba::ip::address& source,
+                 const ba::ip::address& destination) const override {
+        return !AccessPolicy::enabled ||
+               AccessPolicy::Allowed(policy, source, destination);
+    }
+
+    bool DomainAllowed(const socks5::Policy* policy,
+                       const std::string& host) const override {
+        return !AccessPolicy::enabled ||
+               AccessPolicy::DomainAllowed(policy, host);
+    }
+};
+
+class VirtualNoAccounting : public AccountingChecks {
+   public:
+    Account* Open(socks5::Accounting::Table* /*unused*/,
+                  const std::string& /*unused*/,
+                  const std::string& /*unused*/) const override {
+        return nullptr;
+    }
+
+    void Up(Account* /*unused*/, std::size_t /*unused*/) const override {}
+
+    void Down(Account* /*unused*/, std::size_t /*unused*/) const override {}
+
+    void Close(socks5::Accounting::Table* /*unused*/,
+               Account* /*unused*/) const override {}
+};
+
+class VirtualTableAccounting : public AccountingChecks {
+   public:
+    Account* Open(socks5::Accounting::Table* table, const std::string& user,
+                  const std::string& destination) const override {
+        return table->Open(user, destination);
+    }
+
+    void Up(Account* account, std::size_t length) const override {
+        if (account) {
+            account->counters.bytes_up += length;
+        }
+    }
+
+    void Down(Account* account, std::size_t length) const override {
+        if (account) {
+            account->counters.bytes_down += length;
+        }
+    }
+
+    void Close(socks5::Accounting::Table* table,
+               Account* account) const override {
+        if (account) {
+            table->Close(account);
+        }
+    }
+};
+
+class VirtualChecks {
+   public:
+    // held through pointers set at run time, so calls can't be devirtualized
+    VirtualChecks(const AuthChecks* auth, const AccessChecks* access,
+                  const AccountingChecks* accounting)
+        : auth_(auth), access_(access), accounting_(accounting) {}
+
+    uint64_t Run(const Services& services, const Request& request) {
+        uint64_t passed = 0;
+        const socks5::Policy* policy = services.policy->Acquire();
+
+        if (auth_->Method(policy) == socks5::AuthMethod::username_password &&
+            auth_->Authenticate(policy, request.user, request.password)) {
+            ++passed;
+        }
+
+        if (access_->DomainAllowed(policy, request.host) &&
+            access_->Allowed(policy, request.source, request.address)) {
+            ++passed;
+        }
+
+        AccountingChecks::Account* account = nullptr;
+        if (services.accounting) {
+            account = accounting_->Open(services.accounting, request.user,
+                                        request.destination);
+        }
+
+        for (std::size_t i = 0; i < chunks; ++i) {
+            accounting_->Up(account, chunk_size);
+            accounting_->Down(account, chunk_size);
+        }
+
+        accounting_->Close(services.accounting, account);
+        services.policy->Release(policy);
+        return passed;
+    }
+
+   private:
+    const AuthChecks* auth_;
+    const AccessChecks* access_;
+    const AccountingChecks* accounting_;
+};
+
+std::unique_ptr<socks5::Policy> ConfiguredPolicy() {
+    auto policy = std::make_unique<socks5::Policy>();
+
+    std::istringstream users{"bob hunter2\nalice secret\n"};
+    policy->users = socks5::Credentials::Parse(users, "users");
+
+    std::istringstream rules{
+        "allow src 127.0.0.0/8\n"
+        "deny src 10.0.0.0/8\n"
+        "deny dst 192.168.0.0/16\n"
+        "allow dst 93.184.0.0/16\n"
+        "default deny\n"};
+    policy->acl = acl::RuleSet::Parse(rules, "acl");
+
+    std::istringstream domains{
+        "deny ads.example.com\n"
+        "allow example.com\n"
+        "default deny\n"};
+    policy->domains = acl::DomainRules::Parse(domains, "domains");
+    return policy;
+}
+
+// nanoseconds per session
+template <typename Checks>
+double Time(Checks& checks, const Services& services, const Request& request,
+            std::size_t sessions) {
+    uint64_t passed = 0;
+    const auto start = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < sessions; ++i) {
+        passed += checks.Run(services, request);
+        Keep(passed);
+    }
+
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    return std::chrono::duration<double, std::nano>(elapsed).count() /
+           sessions;
+}
+
+double Median(std::vector<double> values) {
+    std::sort(values.begin(), values.end());
+    return values[values.size() / 2];
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    const std::size_t sessions = argc > 1 ? std::strtoul(argv[1], nullptr, 10)
+                                          : 200000;
+    const std::size_t rounds = argc > 2 ? std::strtoul(argv[2], nullptr, 10)
+                                        : 5;
+    if (!sessions || !rounds) {
+        std::cerr << "usage: session_policy [sessions per round] [rounds]\n";
+        return 1;
+    }
+
+    int status = 0;
+    char path[] = "/tmp/session_policy.XXXXXX";
+    const int fd = ::mkstemp(path);
+    if (fd < 0) {
+        std::cerr << "session_policy: can't create an accounting file\n";
+        return 1;
+    }
+    ::close(fd);
+
+    try {
+        const Request request;
+
+        socks5::PolicyStore off_store{std::make_unique<socks5::Policy>(), 1};
+        const Services off{&off_store.GetReader(0), nullptr};
+
+        // written on destruction only, an interval never passes
+        ba::io_service io;
+        socks5::Accounting::Config accounting_config;
+        accounting_config.path = path;
+        accounting_config.interval = std::chrono::hours{24};
+        socks5::Accounting accounting{accounting_config, {&io}};
+        socks5::PolicyStore on_store{ConfiguredPolicy(), 1};
+        const Services on{&on_store.GetReader(0), &accounting.GetTable(0)};
+
+        TemplateChecks<socks5::NoAuth, socks5::NoAccess, socks5::NoAccounting>
+            template_off;
+        TemplateChecks<socks5::PasswordAuth, socks5::RuleAccess,
+                       socks5::TableAccounting>
+            template_on;
+        LegacyChecks legacy;
+
+        const VirtualAuth<socks5::NoAuth> no_auth;
+        const VirtualAuth<socks5::PasswordAuth> password_auth;
+        const VirtualAccess<socks5::NoAccess> no_access;
+        const VirtualAccess<socks5::RuleAccess> rule_access;
+        const VirtualNoAccounting no_accounting;
+        const VirtualTableAccounting table_accounting;
+        VirtualChecks virtual_off{&no_auth, &no_access, &no_accounting};
+        VirtualChecks virtual_on{&password_auth, &rule_access,
+                                 &table_accounting};
+
+        struct Variant {
+            const char* config;
+            const char* name;
+            std::function<double(std::size_t)> run;
+            std::vector<double> results;
+        };
+
+        std::vector<Variant> variants{
+            {"off", "template",
+             [&](std::size_t n) { return Time(template_off, off, request, n); },
+             {}},
+            {"off", "legacy",
+             [&](std::size_t n) { return Time(legacy, off, request, n); },
+             {}},
+            {"off", "virtual",
+             [&](std::size_t n) { return Time(virtual_off, off, request, n); },
+             {}},
+            {"on", "template",
+             [&](std::size_t n) { return Time(template_on, on, request, n); },
+             {}},
+            {"on", "legacy",
+             [&](std::size_t n) { return Time(legacy, on, request, n); },
+             {}},
+            {"on", "virtual",
+             [&](std::size_t n) { return Time(virtual_on, on, request, n); },
+             {}}};
+
+        // warm up
+        for (auto& variant : variants) {
+            variant.run(std::min<std::size_t>(sessions, 1000));
+        }
+
+        for (std::size_t round = 0; round < rounds; ++round) {
+            for (auto& variant : variants) {
+                variant.results.push_back(variant.run(sessions));
+            }
+        }
+
+        for (const auto& variant : variants) {
+            std::cout << "session_policy config=" << variant.config
+                      << " variant=" << variant.name
+                      << " ns_per_session=" << Median(variant.results)
+                      << '\n';
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "session_policy: " << e.what() << '\n';
+        status = 1;
+    }
+
+    ::unlink(path);
+    return status;
+}
@@ -0,0 +1,140 @@
+#include "support.h"
+
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <thread>
+
+namespace bs = boost::system;
+
+namespace bench {
+
+std::string Capture(const std::string& command) {
+    FILE* pipe = popen(command.c_str(), "r");
+    if (!pipe) {
+        throw std::runtime_error("can't run " + command);
+    }
+
+    std::string output;
+    char buf[4096];
+    std::size_t size;
+    while ((size = fread(buf, 1, sizeof(buf), pipe)) > 0) {
+        output.append(buf, size);
+    }
+
+    const int status = pclose(pipe);
+    if (status != 0) {
+        throw std::runtime_error(command + " exited with " +
+                                 std::to_string(status));
+    }
+
+    return output;
+}
+
+ServerProcess::ServerProcess(const std::string& path,
+                             const std::vector<std::string>& args,
+                             const std::function<void(pid_t)>& starting) {
+    // the child execs once the parent is done with starting
+    int ready[2];
+    if (pipe(ready) != 0) {
+        throw std::runtime_error("pipe failed");
+    }
+
+    pid_ = fork();
+    if (pid_ < 0) {
+        close(ready[0]);
+        close(ready[1]);
+        throw std::runtime_error("fork failed");
+    }
+
+    if (pid_ == 0) {
+        close(ready[1]);
+        char byte;
+        if (read(ready[0], &byte, 1) != 1) {
+            _exit(127);
+        }
+
+        std::vector<char*> argv{const_cast<char*>(path.c_str())};
+        for (const auto& arg : args) {
+            argv.push_back(const_cast<char*>(arg.c_str()));
+        }
+        argv.push_back(nullptr);
+        execv(path.c_str(), argv.data());
+        _exit(127);
+    }
+
+    close(ready[0]);
+    if (starting) {
+        starting(pid_);
+    }
+
+    const char byte = 0;
+    const bool started = write(ready[1], &byte, 1) == 1;
+    close(ready[1]);
+    if (!started) {
+        Stop();
+        throw std::runtime_error("can't start " + path);
+    }
+}
+
+ServerProcess::~ServerProcess() {
+    if (pid_ > 0) {
+        Stop();
+    }
+}
+
+rusage ServerProcess::Stop() {
+    rusage usage;
+    std::memset(&usage, 0, sizeof(usage));
+    if (pid_ <= 0) {
+        return usage;
+    }
+
+    kill(pid_, SIGTERM);
+    int status = 0;
+    wait4(pid_, &status, 0, &usage);
+    pid_ = -1;
+    return usage;
+}
+
+uint16_t FreePort(ba::io_service& io) {
+    tcp::acceptor probe{io,
+                        tcp::endpoint{ba::ip::address_v4::loopback(), 0}};
+    return probe.local_endpoint().port();
+}
+
+void WaitListening(ba::io_service& io, const tcp::endpoint& server) {
+    const auto deadline =
+        std::chrono::steady_clock::now() + std::chrono::seconds{5};
+    for (;;) {
+        tcp::socket socket{io};
+        bs::error_code ec;
+        socket.connect(server, ec);
+        if (!ec) {
+            return;
+        }
+
+        if (std::chrono::steady_clock::now() > deadline) {
+            throw std::runtime_error("server doesn't listen: " + ec.message());
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds{10});
+    }
+}
+
+std::size_t RaiseDescriptorLimit() {
+    rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) != 0) {
+        return 0;
+    }
+
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+    return static_cast<std::size_t>(limit.rlim_cur);
+}
+
+}  // namespace bench
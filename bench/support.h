@@ -0,0 +1,57 @@
+#ifndef BENCH_SUPPORT_H
+#define BENCH_SUPPORT_H
+
+#include <sys/resource.h>
+#include <sys/types.h>
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <boost/asio.hpp>
+
+namespace ba = boost::asio;
+using tcp = ba::ip::tcp;
+
+// Process & socket helpers the benchmarks that drive s5server share.
+namespace bench {
+
+// runs a shell command, its stdout; throws std::runtime_error if it can't
+// be run or exits non-zero
+std::string Capture(const std::string& command);
+
+// A server executable in a child process, terminated with SIGTERM.
+class ServerProcess {
+   public:
+    // starting is called with the child's pid before it execs, e.g. to
+    // attach counters that must see it from the start
+    ServerProcess(const std::string& path, const std::vector<std::string>& args,
+                  const std::function<void(pid_t)>& starting = {});
+
+    ServerProcess(const ServerProcess&) = delete;
+    ServerProcess& operator=(const ServerProcess&) = delete;
+
+    ~ServerProcess();
+
+    pid_t Pid() const { return pid_; }
+
+    // terminates the server, its resource usage over its lifetime
+    rusage Stop();
+
+   private:
+    pid_t pid_ = -1;
+};
+
+// a loopback port nothing listens on right now
+uint16_t FreePort(ba::io_service& io);
+
+// until a connect to server succeeds, throws after 5 seconds
+void WaitListening(ba::io_service& io, const tcp::endpoint& server);
+
+// descriptors a process may open, raised to the hard limit
+std::size_t RaiseDescriptorLimit();
+
+}  // namespace bench
+
+#endif /* BENCH_SUPPORT_H */
@@ -0,0 +1,367 @@
+// Bulk relay efficiency of s5server over loopback. For every combination of
+// write size, stream count & relay mode a fresh server is started, streams
+// push data through it to a sink for --seconds, and the server's CPU use is
+// put against the bytes it relayed:
+//
+//   cycles_per_byte          perf_event cpu cycles of all server threads,
+//                            user space only where kernel profiling isn't
+//                            allowed (cycles_scope says which)
+//   syscalls_per_mb          perf_event raw_syscalls:sys_enter, needs
+//                            tracefs & perf_event_paranoid -1 or CAP_PERFMON
+//   context_switches_per_mb  rusage of the server from wait4(), start to exit
+//   cpu_ns_per_byte          the same, user + system time
+//
+// Throughput & perf counts are taken over the measured window after a
+// warm-up, rusage ratios over all bytes relayed. Counters that can't be
+// opened are null. Modes are server settings:
+//
+//   drr     fair scheduling of relay reads (--drr-quantum 16384)
+//   direct  relay reads as they come (no --drr-quantum, the default)
+//
+// The result is a JSON object, one configuration per line:
+//
+//   throughput [--server path] [--sizes 1024 16384 65536] [--streams 1 4 16]
+//              [--modes drr direct] [--seconds 3]
+
+#include <fcntl.h>
+#include <linux/perf_event.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/asio.hpp>
+#include <boost/program_options.hpp>
+
+#include <socks/socks5.h>
+
+#include "support.h"
+
+namespace ba = boost::asio;
+namespace bs = boost::system;
+namespace po = boost::program_options;
+using tcp = ba::ip::tcp;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+using bench::FreePort;
+using bench::ServerProcess;
+using bench::WaitListening;
+
+// a perf_event counter over a process & the threads it starts later
+class Counter {
+   public:
+    Counter() = default;
+
+    Counter(pid_t pid, uint32_t type, uint64_t config, bool exclude_kernel) {
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = type;
+        attr.config = config;
+        attr.inherit = 1;
+        attr.exclude_kernel = exclude_kernel ? 1 : 0;
+        attr.exclude_hv = 1;
+        fd_ = static_cast<int>(syscall(SYS_perf_event_open, &attr, pid, -1,
+                                       -1, PERF_FLAG_FD_CLOEXEC));
+    }
+
+    Counter(const Counter&) = delete;
+    Counter& operator=(const Counter&) = delete;
+
+    Counter(Counter&& other) noexcept : fd_{other.fd_} { other.fd_ = -1; }
+
+    Counter& operator=(Counter&& other) noexcept {
+        std::swap(fd_, other.fd_);
+        return *this;
+    }
+
+    ~Counter() {
+        if (fd_ >= 0) {
+            close(fd_);
+        }
+    }
+
+    bool Open() const { return fd_ >= 0; }
+
+    uint64_t Read() const {
+        uint64_t value = 0;
+        if (fd_ < 0 || read(fd_, &value, sizeof(value)) != sizeof(value)) {
+            return 0;
+        }
+
+        return value;
+    }
+
+   private:
+    int fd_ = -1;
+};
+
+long SyscallTracepoint() {
+    for (const char* path :
+         {"/sys/kernel/tracing/events/raw_syscalls/sys_enter/id",
+          "/sys/kernel/debug/tracing/events/raw_syscalls/sys_enter/id"}) {
+        std::ifstream in{path};
+        long id = 0;
+        if (in >> id) {
+            return id;
+        }
+    }
+
+    return -1;
+}
+
+// perf counters over s5server, opened before it execs so they see all of
+// its threads
+struct ServerCounters {
+    void Open(pid_t pid) {
+        cycles = Counter{pid, PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES,
+                         false};
+        cycles_scope = "user+kernel";
+        if (!cycles.Open()) {
+            cycles = Counter{pid, PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES,
+                             true};
+            cycles_scope = cycles.Open() ? "user" : nullptr;
+        }
+
+        const long tracepoint = SyscallTracepoint();
+        if (tracepoint >= 0) {
+            syscalls = Counter{pid, PERF_TYPE_TRACEPOINT,
+                               static_cast<uint64_t>(tracepoint), false};
+        }
+    }
+
+    Counter cycles;
+    const char* cycles_scope = nullptr;
+    Counter syscalls;
+};
+
+// no auth, connect to an ipv4 target
+void Handshake(tcp::socket& socket, const tcp::endpoint& target) {
+    const std::array<char, 3> greeting{{socks5::version, 1, 0}};
+    ba::write(socket, ba::buffer(greeting));
+
+    std::array<char, 10> message;
+    ba::read(socket, ba::buffer(message.data(), 2));
+
+    const auto address = target.address().to_v4().to_bytes();
+    message[0] = socks5::version;
+    message[1] = static_cast<char>(socks5::Command::connect);
+    message[2] = socks5::reserved;
+    message[3] = static_cast<char>(socks5::AddressType::ipv4);
+    std::copy(address.begin(), address.end(), message.begin() + 4);
+    message[8] = static_cast<char>(target.port() >> 8);
+    message[9] = static_cast<char>(target.port() & 0xff);
+    ba::write(socket, ba::buffer(message));
+
+    ba::read(socket, ba::buffer(message));
+    if (message[1] != static_cast<char>(socks5::Reply::succeeded)) {
+        throw std::runtime_error("connect failed, reply " +
+                                 std::to_string(message[1]));
+    }
+}
+
+struct Config {
+    std::string server;
+    std::vector<std::size_t> sizes{1024, 16384, 65536};
+    std::vector<std::size_t> streams{1, 4, 16};
+    std::vector<std::string> modes{"drr", "direct"};
+    unsigned seconds = 3;
+};
+
+void Run(const Config& config, std::size_t size, std::size_t streams,
+         const std::string& mode, bool first) {
+    ba::io_service io;
+    const uint16_t port = FreePort(io);
+    std::vector<std::string> args{std::to_string(port), "--log-level",
+                                  "warning", "--stats-interval", "0"};
+    if (mode == "drr") {
+        args.insert(args.end(), {"--drr-quantum", "16384"});
+    } else if (mode != "direct") {
+        throw std::runtime_error("unknown mode " + mode);
+    }
+
+    ServerCounters counters;
+    ServerProcess server{config.server, args,
+                         [&counters](pid_t pid) { counters.Open(pid); }};
+    const tcp::endpoint proxy{ba::ip::address_v4::loopback(), port};
+    WaitListening(io, proxy);
+
+    tcp::acceptor sink{io, tcp::endpoint{ba::ip::address_v4::loopback(), 0}};
+    std::vector<std::unique_ptr<tcp::socket>> clients;
+    std::vector<std::unique_ptr<tcp::socket>> upstreams;
+    for (std::size_t i = 0; i < streams; ++i) {
+        clients.push_back(std::make_unique<tcp::socket>(io));
+        clients.back()->connect(proxy);
+        Handshake(*clients.back(), sink.local_endpoint());
+        upstreams.push_back(std::make_unique<tcp::socket>(io));
+        sink.accept(*upstreams.back());
+    }
+
+    std::atomic<uint64_t> received{0};
+    std::atomic<bool> stop{false};
+    std::vector<std::thread> threads;
+    for (auto& upstream : upstreams) {
+        tcp::socket* socket = upstream.get();
+        threads.emplace_back([socket, &received]() {
+            std::vector<char> buf(256 * 1024);
+            bs::error_code ec;
+            for (;;) {
+                const std::size_t length =
+                    socket->read_some(ba::buffer(buf), ec);
+                if (ec) {
+                    return;
+                }
+                received.fetch_add(length, std::memory_order_relaxed);
+            }
+        });
+    }
+    for (auto& client : clients) {
+        tcp::socket* socket = client.get();
+        threads.emplace_back([socket, size, &stop]() {
+            const std::vector<char> chunk(size);
+            bs::error_code ec;
+            while (!stop.load(std::memory_order_relaxed) && !ec) {
+                ba::write(*socket, ba::buffer(chunk), ec);
+            }
+        });
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds{500});
+    const uint64_t cycles_before = counters.cycles.Read();
+    const uint64_t syscalls_before = counters.syscalls.Read();
+    const uint64_t bytes_before = received.load();
+    const auto start = Clock::now();
+
+    std::this_thread::sleep_for(std::chrono::seconds{config.seconds});
+
+    const uint64_t cycles = counters.cycles.Read() - cycles_before;
+    const uint64_t syscalls = counters.syscalls.Read() - syscalls_before;
+    const double bytes = static_cast<double>(received.load() - bytes_before);
+    const std::chrono::duration<double> elapsed = Clock::now() - start;
+
+    // unblocks the writers, the server relays the end to the readers
+    stop = true;
+    for (auto& client : clients) {
+        shutdown(client->native_handle(), SHUT_RDWR);
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    const rusage usage = server.Stop();
+    const double total_mb = static_cast<double>(received.load()) / 1e6;
+    const double cpu_seconds =
+        static_cast<double>(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) +
+        (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+    const auto switches =
+        static_cast<double>(usage.ru_nvcsw + usage.ru_nivcsw);
+
+    std::cout << (first ? "" : ",\n") << "  \"" << mode << "_s" << size
+              << "_x" << streams << "\": {\"mode\": \"" << mode
+              << "\", \"size\": " << size << ", \"streams\": " << streams
+              << ", \"megabits_per_second\": "
+              << bytes * 8 / elapsed.count() / 1e6 << ", \"cycles_per_byte\": ";
+    if (counters.cycles.Open() && bytes) {
+        std::cout << cycles / bytes << ", \"cycles_scope\": \""
+                  << counters.cycles_scope << '"';
+    } else {
+        std::cout << "null, \"cycles_scope\": null";
+    }
+    std::cout << ", \"syscalls_per_mb\": ";
+    if (counters.syscalls.Open() && bytes) {
+        std::cout << syscalls / (bytes / 1e6);
+    } else {
+        std::cout << "null";
+    }
+    std::cout << ", \"context_switches_per_mb\": "
+              << (total_mb ? switches / total_mb : 0)
+              << ", \"cpu_ns_per_byte\": "
+              << (total_mb ? cpu_seconds * 1e9 / (total_mb * 1e6) : 0) << '}';
+    std::cout.flush();
+}
+
+bool ParseOptions(int argc, char* argv[], Config& config) {
+    config.server = S5SERVER_PATH;
+
+    po::options_description desc("Options");
+    // clang-format off
+    desc.add_options()
+        ("help,h", "print this message")
+        ("server", po::value(&config.server)->default_value(config.server),
+         "s5server binary")
+        ("sizes", po::value(&config.sizes)->multitoken(),
+         "client write sizes in bytes (1024 16384 65536)")
+        ("streams", po::value(&config.streams)->multitoken(),
+         "concurrent streams (1 4 16)")
+        ("modes", po::value(&config.modes)->multitoken(),
+         "relay modes: drr, direct (both)")
+        ("seconds",
+         po::value(&config.seconds)->default_value(config.seconds),
+         "measured seconds per configuration");
+    // clang-format on
+
+    try {
+        po::variables_map vm;
+        po::store(po::parse_command_line(argc, argv, desc), vm);
+
+        if (vm.count("help")) {
+            std::cout << "Usage: " << argv[0] << " [options]\n" << desc;
+            return false;
+        }
+
+        po::notify(vm);
+    } catch (po::error& e) {
+        std::cout << e.what() << "\n\n"
+                  << "Usage: " << argv[0] << " [options]\n"
+                  << desc;
+        return false;
+    }
+
+    return true;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    Config config;
+    if (!ParseOptions(argc, argv, config)) {
+        return 1;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+
+    std::cout << "{\n" << std::fixed << std::setprecision(3);
+    bool first = true;
+    try {
+        for (const auto& mode : config.modes) {
+            for (const std::size_t streams : config.streams) {
+                for (const std::size_t size : config.sizes) {
+                    Run(config, size, streams, mode, first);
+                    first = false;
+                }
+            }
+        }
+    } catch (const std::exception& e) {
+        std::cout << "\n}\n";
+        std::cerr << "throughput: " << e.what() << '\n';
+        return 1;
+    }
+    std::cout << "\n}\n";
+
+    return 0;
+}
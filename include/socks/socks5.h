@@ -1,6 +1,14 @@
 #ifndef SOCKS5_H
 #define SOCKS5_H
 
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include <boost/asio/error.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/system/error_code.hpp>
+
 namespace socks5 {
 
 const unsigned char version = 0x05;
@@ -38,7 +46,146 @@ enum class Reply : unsigned char {
     address_type_not_supported = 0x08,
 };
 
-// todo: add requests, replies fields offset enums
+// reply for a failed resolve/connect to the requested destination
+inline Reply ErrorReply(const boost::system::error_code& ec) {
+    namespace error = boost::asio::error;
+
+    if (ec == error::connection_refused) {
+        return Reply::connection_refused;
+    }
+
+    if (ec == error::network_unreachable || ec == error::network_down) {
+        return Reply::network_unreachable;
+    }
+
+    if (ec == error::host_unreachable || ec == error::host_not_found ||
+        ec == error::host_not_found_try_again || ec == error::no_data) {
+        return Reply::host_unreachable;
+    }
+
+    if (ec == error::timed_out) {
+        return Reply::ttl_expired;
+    }
+
+    if (ec == error::address_family_not_supported) {
+        return Reply::address_type_not_supported;
+    }
+
+    return Reply::general_socks_server_failure;
+}
+
+// Wire format of the messages, over a buffer holding at least the bytes the
+// sizes say: the length fields are read first, the rest as they tell.
+
+// greeting: VER NMETHODS METHODS
+inline std::size_t GreetingSize(const char* greeting) {
+    return 2 + static_cast<unsigned char>(greeting[1]);
+}
+
+// wanted if the greeting offers it, no_acceptable_methods otherwise
+inline AuthMethod SelectAuthMethod(const char* greeting, AuthMethod wanted) {
+    const std::size_t nmethods = static_cast<unsigned char>(greeting[1]);
+    for (std::size_t i = 0; i < nmethods; ++i) {
+        if (static_cast<AuthMethod>(greeting[2 + i]) == wanted) {
+            return wanted;
+        }
+    }
+
+    return AuthMethod::no_acceptable_methods;
+}
+
+// request: VER CMD RSV ATYP DST.ADDR DST.PORT
+inline Command RequestCommand(const char* request) {
+    return static_cast<Command>(request[1]);
+}
+
+inline AddressType RequestAddressType(const char* request) {
+    return static_cast<AddressType>(request[3]);
+}
+
+inline std::size_t RequestDomainNameSize(const char* request) {
+    return static_cast<unsigned char>(request[4]);
+}
+
+// 0 for an unknown address type
+inline std::size_t RequestSize(const char* request) {
+    switch (RequestAddressType(request)) {
+        case AddressType::ipv4:
+            return 10;
+        case AddressType::domain_name:
+            return 7 + RequestDomainNameSize(request);
+        case AddressType::ipv6:
+            return 22;
+    }
+
+    return 0;
+}
+
+inline std::string RequestDomainName(const char* request) {
+    return std::string(request + 5, RequestDomainNameSize(request));
+}
+
+inline uint16_t RequestPort(const char* request) {
+    const std::size_t size = RequestSize(request);
+    if (!size) {
+        return 0;
+    }
+
+    return static_cast<uint16_t>(
+        static_cast<unsigned char>(request[size - 2]) << 8 |
+        static_cast<unsigned char>(request[size - 1]));
+}
+
+// unspecified for a domain name
+inline boost::asio::ip::address RequestAddress(const char* request) {
+    namespace ip = boost::asio::ip;
+
+    const AddressType atype = RequestAddressType(request);
+    if (atype == AddressType::ipv4) {
+        ip::address_v4::bytes_type bytes;
+        for (std::size_t i = 0; i < bytes.size(); ++i) {
+            bytes[i] = static_cast<unsigned char>(request[4 + i]);
+        }
+
+        return ip::address(ip::address_v4(bytes));
+    }
+
+    if (atype == AddressType::ipv6) {
+        ip::address_v6::bytes_type bytes;
+        for (std::size_t i = 0; i < bytes.size(); ++i) {
+            bytes[i] = static_cast<unsigned char>(request[4 + i]);
+        }
+
+        return ip::address(ip::address_v6(bytes));
+    }
+
+    return ip::address();
+}
+
+// reply: VER REP RSV ATYP BND.ADDR BND.PORT, returns its size (22 at most)
+inline std::size_t WriteReply(char* reply, Reply code,
+                              const boost::asio::ip::tcp::endpoint& bound) {
+    reply[0] = version;
+    reply[1] = static_cast<char>(code);
+    reply[2] = reserved;
+
+    std::size_t size = 4;
+    if (bound.address().is_v6()) {
+        reply[3] = static_cast<char>(AddressType::ipv6);
+        for (const auto byte : bound.address().to_v6().to_bytes()) {
+            reply[size++] = static_cast<char>(byte);
+        }
+    } else {
+        reply[3] = static_cast<char>(AddressType::ipv4);
+        for (const auto byte : bound.address().to_v4().to_bytes()) {
+            reply[size++] = static_cast<char>(byte);
+        }
+    }
+
+    reply[size++] = static_cast<char>((bound.port() >> 8) & 0xFF);
+    reply[size++] = static_cast<char>(bound.port() & 0xFF);
+    return size;
+}
 
 }  // namespace socks5
 
@@ -0,0 +1,391 @@
+#include "acl.h"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+namespace acl {
+
+namespace {
+
+const unsigned direct_bits = 16;
+const unsigned stride = 6;
+const uint32_t leaf_flag = 0x80000000;
+
+unsigned Popcount(uint64_t x) {
+#if defined(__GNUC__) || defined(__clang__)
+    return static_cast<unsigned>(__builtin_popcountll(x));
+#else
+    unsigned n = 0;
+    for (; x; x &= x - 1) {
+        ++n;
+    }
+    return n;
+#endif
+}
+
+// bits [offset, offset + bits) of a 128 bit key, msb first, zero padded
+// past the end
+template <typename Key>
+unsigned Chunk(const Key& key, unsigned offset, unsigned bits) {
+    uint64_t v = 0;
+    if (offset + bits <= 64) {
+        v = key.hi >> (64 - offset - bits);
+    } else if (offset >= 64) {
+        const unsigned o = offset - 64;
+        v = o + bits <= 64 ? key.lo >> (64 - o - bits)
+                           : key.lo << (o + bits - 64);
+    } else {
+        v = (key.hi << (offset + bits - 64)) |
+            (key.lo >> (128 - offset - bits));
+    }
+
+    return static_cast<unsigned>(v & ((1u << bits) - 1));
+}
+
+template <typename Key>
+unsigned Bit(const Key& key, unsigned i) {
+    return Chunk(key, i, 1);
+}
+
+ba::ip::address Normalize(const ba::ip::address& address) {
+    if (address.is_v6() && address.to_v6().is_v4_mapped()) {
+        return address.to_v6().to_v4();
+    }
+
+    return address;
+}
+
+}  // namespace
+
+PrefixTable::PrefixTable() {
+    v4_.trie.emplace_back();
+    v6_.trie.emplace_back();
+    Compile();
+}
+
+PrefixTable::Key PrefixTable::MakeKey(const ba::ip::address& address) {
+    Key key{0, 0};
+    if (address.is_v4()) {
+        key.hi = static_cast<uint64_t>(address.to_v4().to_ulong()) << 32;
+        return key;
+    }
+
+    const auto bytes = address.to_v6().to_bytes();
+    for (std::size_t i = 0; i < 8; ++i) {
+        key.hi = (key.hi << 8) | bytes[i];
+        key.lo = (key.lo << 8) | bytes[8 + i];
+    }
+
+    return key;
+}
+
+void PrefixTable::Add(const ba::ip::address& address, unsigned length,
+                      uint32_t value) {
+    const ba::ip::address normalized = Normalize(address);
+    if (normalized.is_v4()) {
+        // a v4-mapped prefix applies to the v4 address
+        if (address.is_v6()) {
+            length = length > 96 ? length - 96 : 0;
+        }
+        Insert(v4_, MakeKey(normalized), std::min(length, 32u), value);
+    } else {
+        Insert(v6_, MakeKey(normalized), std::min(length, 128u), value);
+    }
+}
+
+void PrefixTable::Insert(Family& family, const Key& key, unsigned length,
+                         uint32_t value) {
+    int32_t n = 0;
+    for (unsigned i = 0; i < length; ++i) {
+        const unsigned bit = Bit(key, i);
+        if (family.trie[n].child[bit] < 0) {
+            family.trie[n].child[bit] =
+                static_cast<int32_t>(family.trie.size());
+            family.trie.emplace_back();
+        }
+        n = family.trie[n].child[bit];
+    }
+
+    if (!family.trie[n].value) {
+        family.trie[n].value = value;
+    }
+}
+
+void PrefixTable::Compile() {
+    Compile(v4_);
+    Compile(v6_);
+}
+
+std::size_t PrefixTable::MemoryUsage() const {
+    std::size_t size = 0;
+    for (const Family* family : {&v4_, &v6_}) {
+        size += family->direct.size() * sizeof(uint32_t) +
+                family->nodes.size() * sizeof(Node) +
+                family->leaves.size() * sizeof(uint32_t);
+    }
+
+    return size;
+}
+
+void PrefixTable::Compile(Family& family) {
+    family.direct.assign(std::size_t{1} << direct_bits, 0);
+    family.nodes.clear();
+    family.leaves.clear();
+
+    const auto& trie = family.trie;
+    for (uint32_t prefix = 0; prefix < family.direct.size(); ++prefix) {
+        int32_t n = 0;
+        uint32_t best = trie[0].value;
+        for (unsigned i = 0; i < direct_bits && n >= 0; ++i) {
+            n = trie[n].child[(prefix >> (direct_bits - 1 - i)) & 1];
+            if (n >= 0 && trie[n].value) {
+                best = trie[n].value;
+            }
+        }
+
+        if (n >= 0 && (trie[n].child[0] >= 0 || trie[n].child[1] >= 0)) {
+            const std::size_t index = family.nodes.size();
+            family.nodes.emplace_back();
+            const Node node = Build(family, n, best);
+            family.nodes[index] = node;
+            family.direct[prefix] = static_cast<uint32_t>(index);
+        } else {
+            family.direct[prefix] = leaf_flag | best;
+        }
+    }
+
+    family.nodes.shrink_to_fit();
+    family.leaves.shrink_to_fit();
+}
+
+PrefixTable::Node PrefixTable::Build(Family& family, int32_t trie_node,
+                                     uint32_t inherited) {
+    struct Slot {
+        int32_t next;  // trie node to continue from, -1 for a leaf
+        uint32_t value;
+    };
+
+    const std::size_t fanout = std::size_t{1} << stride;
+    Slot slots[fanout];
+    std::size_t children = 0;
+    for (unsigned v = 0; v < fanout; ++v) {
+        int32_t n = trie_node;
+        uint32_t best = inherited;
+        for (unsigned i = 0; i < stride && n >= 0; ++i) {
+            n = family.trie[n].child[(v >> (stride - 1 - i)) & 1];
+            if (n >= 0 && family.trie[n].value) {
+                best = family.trie[n].value;
+            }
+        }
+
+        const bool deeper = n >= 0 && (family.trie[n].child[0] >= 0 ||
+                                       family.trie[n].child[1] >= 0);
+        slots[v] = Slot{deeper ? n : -1, best};
+        children += deeper ? 1 : 0;
+    }
+
+    Node node{0, 0, static_cast<uint32_t>(family.leaves.size()), 0};
+
+    // runs of equal leaves are stored once
+    bool first = true;
+    uint32_t previous = 0;
+    for (unsigned v = 0; v < fanout; ++v) {
+        if (slots[v].next >= 0) {
+            continue;
+        }
+
+        if (first || slots[v].value != previous) {
+            node.leafvec |= uint64_t{1} << v;
+            family.leaves.push_back(slots[v].value);
+            previous = slots[v].value;
+            first = false;
+        }
+    }
+
+    node.base1 = static_cast<uint32_t>(family.nodes.size());
+    family.nodes.resize(family.nodes.size() + children);
+
+    std::size_t k = 0;
+    for (unsigned v = 0; v < fanout; ++v) {
+        if (slots[v].next < 0) {
+            continue;
+        }
+
+        node.vector |= uint64_t{1} << v;
+        const Node child = Build(family, slots[v].next, slots[v].value);
+        family.nodes[node.base1 + k++] = child;
+    }
+
+    return node;
+}
+
+uint32_t PrefixTable::Lookup(const ba::ip::address& address) const {
+    const ba::ip::address normalized = Normalize(address);
+    return normalized.is_v4() ? Lookup(v4_, MakeKey(normalized))
+                              : Lookup(v6_, MakeKey(normalized));
+}
+
+uint32_t PrefixTable::Lookup(const Family& family, const Key& key) {
+    const uint32_t direct = family.direct[Chunk(key, 0, direct_bits)];
+    if (direct & leaf_flag) {
+        return direct & ~leaf_flag;
+    }
+
+    const Node* node = &family.nodes[direct];
+    unsigned offset = direct_bits;
+    unsigned v = Chunk(key, offset, stride);
+    while (node->vector & (uint64_t{1} << v)) {
+        const uint64_t mask = (uint64_t{2} << v) - 1;
+        node = &family.nodes[node->base1 + Popcount(node->vector & mask) - 1];
+        offset += stride;
+        v = Chunk(key, offset, stride);
+    }
+
+    const uint64_t mask = (uint64_t{2} << v) - 1;
+    return family.leaves[node->base0 + Popcount(node->leafvec & mask) - 1];
+}
+
+bool ParsePrefix(const std::string& text, ba::ip::address& address,
+                 unsigned& length) {
+    const auto slash = text.find('/');
+    boost::system::error_code ec;
+    address = ba::ip::address::from_string(text.substr(0, slash), ec);
+    if (ec) {
+        return false;
+    }
+
+    const unsigned max_length = address.is_v4() ? 32 : 128;
+    length = max_length;
+    if (slash == std::string::npos) {
+        return true;
+    }
+
+    // digits only: stoul() would take "24abc" & " 24"
+    const std::string digits = text.substr(slash + 1);
+    if (digits.empty() || digits.size() > 3 ||
+        digits.find_first_not_of("0123456789") != std::string::npos) {
+        return false;
+    }
+
+    length = static_cast<unsigned>(std::stoul(digits));
+    return length <= max_length;
+}
+
+std::unique_ptr<RuleSet> RuleSet::Load(const std::string& path) {
+    std::ifstream in{path};
+    if (!in) {
+        throw std::runtime_error("can't open rule file " + path);
+    }
+
+    return Parse(in, path);
+}
+
+std::unique_ptr<RuleSet> RuleSet::Parse(std::istream& in,
+                                        const std::string& name) {
+    auto rules = std::make_unique<RuleSet>();
+
+    std::string line;
+    for (std::size_t number = 1; std::getline(in, line); ++number) {
+        const std::string text = line.substr(0, line.find('#'));
+        std::istringstream fields{text};
+
+        auto fail = [&name, number, &line](const std::string& what) {
+            return std::runtime_error(name + ':' + std::to_string(number) +
+                                      ": " + what + ": " + line);
+        };
+
+        std::string action;
+        if (!(fields >> action)) {
+            continue;  // blank
+        }
+
+        Action parsed_action;
+        if (action == "allow") {
+            parsed_action = Action::allow;
+        } else if (action == "deny") {
+            parsed_action = Action::deny;
+        } else if (action == "default") {
+            std::string value;
+            std::string extra;
+            fields >> value;
+            if ((value != "allow" && value != "deny") || fields >> extra) {
+                throw fail("expected allow or deny");
+            }
+            rules->default_action_ =
+                value == "allow" ? Action::allow : Action::deny;
+            continue;
+        } else {
+            throw fail("unknown action");
+        }
+
+        std::string direction;
+        std::string cidr;
+        if (!(fields >> direction >> cidr) ||
+            (direction != "src" && direction != "dst")) {
+            throw fail("expected src|dst <address>[/<length>]");
+        }
+
+        ba::ip::address address;
+        unsigned length = 0;
+        if (!ParsePrefix(cidr, address, length)) {
+            throw fail("bad address or prefix length");
+        }
+
+        std::string extra;
+        if (fields >> extra) {
+            throw fail("unexpected field");
+        }
+
+        auto rule = std::make_unique<Rule>();
+        rule->action = parsed_action;
+        rule->direction =
+            direction == "src" ? Direction::source : Direction::destination;
+        rule->text = action + ' ' + direction + ' ' + cidr;
+
+        const auto id = static_cast<uint32_t>(rules->rules_.size() + 1);
+        (rule->direction == Direction::source ? rules->source_
+                                              : rules->destination_)
+            .Add(address, length, id);
+        rules->rules_.push_back(std::move(rule));
+    }
+
+    rules->source_.Compile();
+    rules->destination_.Compile();
+    return rules;
+}
+
+bool RuleSet::Allowed(const ba::ip::address& source,
+                      const ba::ip::address& destination, bool count) const {
+    return SourceAllowed(source, count) &&
+           DestinationAllowed(destination, count);
+}
+
+bool RuleSet::SourceAllowed(const ba::ip::address& source, bool count) const {
+    return Allowed(source_, source, count);
+}
+
+bool RuleSet::DestinationAllowed(const ba::ip::address& destination,
+                                 bool count) const {
+    return Allowed(destination_, destination, count);
+}
+
+bool RuleSet::Allowed(const PrefixTable& table, const ba::ip::address& address,
+                      bool count) const {
+    const uint32_t id = table.Lookup(address);
+    if (!id) {
+        if (count) {
+            default_hits_.fetch_add(1, std::memory_order_relaxed);
+        }
+        return default_action_ == Action::allow;
+    }
+
+    Rule& rule = *rules_[id - 1];
+    if (count) {
+        rule.hits.fetch_add(1, std::memory_order_relaxed);
+    }
+    return rule.action == Action::allow;
+}
+
+}  // namespace acl
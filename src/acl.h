@@ -0,0 +1,141 @@
+#ifndef ACL_H
+#define ACL_H
+
+#include <atomic>
+#include <cstdint>
+#include <istream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <boost/asio.hpp>
+
+namespace ba = boost::asio;
+
+// Source & destination address rules shared by s4server and s5server.
+namespace acl {
+
+// Longest prefix match over ipv4 & ipv6 prefixes: Add() non-zero values,
+// Compile() once, then Lookup() returns the value of the longest matching
+// prefix or 0.
+//
+// Compiled into a poptrie (Asai & Ohara, SIGCOMM 2015): the first 16 bits
+// index a direct table, the rest is walked in 6 bit strides through nodes
+// whose children & leaves are stored contiguously and located by popcount
+// of a 64 bit map. A lookup touches a handful of cache lines regardless of
+// the number of prefixes.
+class PrefixTable {
+   public:
+    PrefixTable();
+
+    // value must be below 2^31; the first value added for a prefix wins
+    void Add(const ba::ip::address& address, unsigned length, uint32_t value);
+
+    void Compile();
+
+    uint32_t Lookup(const ba::ip::address& address) const;
+
+    // size of the compiled tables
+    std::size_t MemoryUsage() const;
+
+   private:
+    struct Key {
+        uint64_t hi;
+        uint64_t lo;
+    };
+
+    struct TrieNode {
+        int32_t child[2] = {-1, -1};
+        uint32_t value = 0;
+    };
+
+    struct Node {
+        uint64_t vector;   // bit set: child is a node
+        uint64_t leafvec;  // bit set: a run of equal leaves starts
+        uint32_t base0;    // first leaf
+        uint32_t base1;    // first child node
+    };
+
+    // one per address family
+    struct Family {
+        std::vector<TrieNode> trie;  // build time binary trie
+        std::vector<uint32_t> direct;
+        std::vector<Node> nodes;
+        std::vector<uint32_t> leaves;
+    };
+
+    static Key MakeKey(const ba::ip::address& address);
+
+    static void Insert(Family& family, const Key& key, unsigned length,
+                       uint32_t value);
+    static void Compile(Family& family);
+    static Node Build(Family& family, int32_t trie_node, uint32_t inherited);
+    static uint32_t Lookup(const Family& family, const Key& key);
+
+   private:
+    Family v4_;
+    Family v6_;
+};
+
+// "<address>[/<prefix length>]", the length no longer than the address;
+// false on anything else, trailing characters included
+bool ParsePrefix(const std::string& text, ba::ip::address& address,
+                 unsigned& length);
+
+enum class Action : unsigned char { allow, deny };
+
+enum class Direction : unsigned char { source, destination };
+
+struct Rule {
+    Action action;
+    Direction direction;
+    std::string text;  // as written in the rule file
+    std::atomic<uint64_t> hits{0};
+};
+
+// Rule file, one rule per line, '#' starts a comment:
+//
+//   allow|deny src|dst <address>[/<prefix length>]
+//   default allow|deny
+//
+// A connection is allowed if both its source & its destination are: the
+// longest matching prefix of each direction decides, the default action
+// (allow unless set) applies when none matches.
+class RuleSet {
+   public:
+    // throw std::runtime_error naming the offending line
+    static std::unique_ptr<RuleSet> Load(const std::string& path);
+    static std::unique_ptr<RuleSet> Parse(std::istream& in,
+                                          const std::string& name);
+
+    // count is false while a caller sifts through the addresses of a host,
+    // so only the decision it acts on is counted in the hits
+    bool Allowed(const ba::ip::address& source,
+                 const ba::ip::address& destination, bool count = true) const;
+
+    bool SourceAllowed(const ba::ip::address& source, bool count = true) const;
+
+    bool DestinationAllowed(const ba::ip::address& destination,
+                            bool count = true) const;
+
+    const std::vector<std::unique_ptr<Rule>>& Rules() const { return rules_; }
+
+    Action DefaultAction() const { return default_action_; }
+
+    uint64_t DefaultHits() const { return default_hits_; }
+
+   private:
+    bool Allowed(const PrefixTable& table, const ba::ip::address& address,
+                 bool count) const;
+
+   private:
+    std::vector<std::unique_ptr<Rule>> rules_;
+    PrefixTable source_;
+    PrefixTable destination_;
+    Action default_action_ = Action::allow;
+    mutable std::atomic<uint64_t> default_hits_{0};
+};
+
+}  // namespace acl
+
+#endif /* ACL_H */
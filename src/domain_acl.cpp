@@ -0,0 +1,420 @@
+#include "domain_acl.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
+
+#include <boost/interprocess/file_mapping.hpp>
+
+namespace acl {
+
+// Integers are stored in host byte order, a file from a host of the other
+// byte order is rejected.
+struct DomainRules::Header {
+    char magic[4];
+    uint32_t byte_order;
+    uint32_t version;
+    uint32_t node_count;
+    uint32_t label_bytes;
+    uint8_t default_match;
+    uint8_t reserved[3];
+};
+
+struct DomainRules::Node {
+    uint32_t first_child;
+    uint32_t child_count;
+    uint32_t label_offset;
+    uint8_t label_length;
+    uint8_t match;
+    uint16_t reserved;
+};
+
+namespace {
+
+const char magic[4] = {'S', '5', 'D', 'T'};
+const uint32_t byte_order = 0x01020304;
+const uint32_t version = 1;
+const std::size_t max_host_size = 255;
+
+// sorts below every label character, so the rules under a domain stay
+// contiguous after sorting the reversed names
+const char separator = '\x01';
+
+// "www.Example.com." -> "com\x01example\x01www", empty if malformed
+std::string ReverseLabels(const std::string& domain) {
+    std::string host = domain;
+    if (!host.empty() && host.back() == '.') {
+        host.pop_back();
+    }
+
+    std::string reversed;
+    if (host.empty() || host.size() > max_host_size) {
+        return reversed;
+    }
+
+    std::size_t end = host.size();
+    while (true) {
+        const std::size_t dot = host.rfind('.', end - 1);
+        const std::size_t start = dot == std::string::npos ? 0 : dot + 1;
+        if (start == end || end - start > 0xFF) {
+            return std::string();  // empty or oversized label
+        }
+
+        if (!reversed.empty()) {
+            reversed.push_back(separator);
+        }
+
+        for (std::size_t i = start; i < end; ++i) {
+            const auto c = static_cast<unsigned char>(host[i]);
+            if (c <= static_cast<unsigned char>(separator)) {
+                return std::string();
+            }
+            reversed.push_back(static_cast<char>(std::tolower(c)));
+        }
+
+        if (dot == std::string::npos) {
+            break;
+        }
+        end = dot;
+    }
+
+    return reversed;
+}
+
+int CompareLabel(const char* a, std::size_t a_size, const char* b,
+                 std::size_t b_size) {
+    const int c = std::memcmp(a, b, std::min(a_size, b_size));
+    if (c != 0) {
+        return c;
+    }
+
+    return a_size < b_size ? -1 : (a_size > b_size ? 1 : 0);
+}
+
+}  // namespace
+
+std::unique_ptr<DomainRules> DomainRules::Load(const std::string& path) {
+    namespace bip = boost::interprocess;
+
+    char file_magic[sizeof(magic)] = {};
+    {
+        std::ifstream in{path, std::ios::binary};
+        if (!in) {
+            throw std::runtime_error("can't open domain rules " + path);
+        }
+        in.read(file_magic, sizeof(file_magic));
+    }
+
+    if (!std::equal(magic, magic + sizeof(magic), file_magic)) {
+        std::ifstream in{path};
+        return Parse(in, path);
+    }
+
+    std::unique_ptr<DomainRules> rules{new DomainRules};
+    try {
+        bip::file_mapping file{path.c_str(), bip::read_only};
+        bip::mapped_region{file, bip::read_only}.swap(rules->region_);
+    } catch (const bip::interprocess_exception& e) {
+        throw std::runtime_error("can't map domain rules " + path + ": " +
+                                 e.what());
+    }
+
+    rules->Attach(static_cast<const char*>(rules->region_.get_address()),
+                  rules->region_.get_size(), path);
+    return rules;
+}
+
+std::unique_ptr<DomainRules> DomainRules::Parse(std::istream& in,
+                                                const std::string& name) {
+    Match default_match = Match::none;
+    std::vector<std::pair<std::string, Match>> entries;
+
+    std::string line;
+    for (std::size_t number = 1; std::getline(in, line); ++number) {
+        std::istringstream fields{line.substr(0, line.find('#'))};
+
+        auto fail = [&name, number, &line](const std::string& what) {
+            return std::runtime_error(name + ':' + std::to_string(number) +
+                                      ": " + what + ": " + line);
+        };
+
+        std::string action;
+        std::string domain;
+        if (!(fields >> action)) {
+            continue;  // blank
+        }
+
+        if (!(fields >> domain)) {
+            throw fail("expected allow|deny <domain>");
+        }
+
+        const bool allow = domain == "allow";
+        if (action == "default") {
+            if (!allow && domain != "deny") {
+                throw fail("expected allow or deny");
+            }
+            default_match = allow ? Match::allow : Match::deny;
+            continue;
+        }
+
+        if (action != "allow" && action != "deny") {
+            throw fail("unknown action");
+        }
+
+        std::string reversed = ReverseLabels(domain);
+        if (reversed.empty()) {
+            throw fail("bad domain");
+        }
+
+        entries.emplace_back(std::move(reversed), action == "allow"
+                                                      ? Match::allow
+                                                      : Match::deny);
+    }
+
+    // stable: the first of duplicate rules wins
+    std::stable_sort(entries.begin(), entries.end(),
+                     [](const std::pair<std::string, Match>& a,
+                        const std::pair<std::string, Match>& b) {
+                         return a.first < b.first;
+                     });
+
+    // breadth first, so the children of every node end up contiguous
+    std::vector<Node> nodes(1, Node{0, 0, 0, 0, 0, 0});
+    std::string labels;
+    std::unordered_map<std::string, uint32_t> label_offsets;
+
+    struct Pending {
+        uint32_t node;
+        std::size_t begin;
+        std::size_t end;
+        std::size_t pos;  // where the next label starts in the range
+    };
+    std::deque<Pending> queue{{0, 0, entries.size(), 0}};
+
+    while (!queue.empty()) {
+        const Pending item = queue.front();
+        queue.pop_front();
+
+        std::size_t i = item.begin;
+        for (; i < item.end && entries[i].first.size() < item.pos; ++i) {
+            Node& node = nodes[item.node];
+            if (!node.match) {
+                node.match = static_cast<uint8_t>(entries[i].second);
+            }
+        }
+
+        nodes[item.node].first_child = static_cast<uint32_t>(nodes.size());
+        while (i < item.end) {
+            const std::string& first = entries[i].first;
+            std::size_t label_end = first.find(separator, item.pos);
+            if (label_end == std::string::npos) {
+                label_end = first.size();
+            }
+
+            const std::string label =
+                first.substr(item.pos, label_end - item.pos);
+
+            std::size_t j = i + 1;
+            for (; j < item.end; ++j) {
+                const std::string& other = entries[j].first;
+                if (other.compare(item.pos, label.size(), label) != 0 ||
+                    (other.size() > label_end &&
+                     other[label_end] != separator) ||
+                    other.size() < label_end) {
+                    break;
+                }
+            }
+
+            auto offset = label_offsets.find(label);
+            if (offset == label_offsets.end()) {
+                offset = label_offsets
+                             .emplace(label,
+                                      static_cast<uint32_t>(labels.size()))
+                             .first;
+                labels += label;
+            }
+
+            const auto child = static_cast<uint32_t>(nodes.size());
+            nodes.push_back(Node{0, 0, offset->second,
+                                 static_cast<uint8_t>(label.size()), 0, 0});
+            ++nodes[item.node].child_count;
+            queue.push_back(Pending{child, i, j, label_end + 1});
+
+            i = j;
+        }
+    }
+
+    Header header{};
+    std::copy(magic, magic + sizeof(magic), header.magic);
+    header.byte_order = byte_order;
+    header.version = version;
+    header.node_count = static_cast<uint32_t>(nodes.size());
+    header.label_bytes = static_cast<uint32_t>(labels.size());
+    header.default_match = static_cast<uint8_t>(default_match);
+
+    std::unique_ptr<DomainRules> rules{new DomainRules};
+    auto& buffer = rules->buffer_;
+    buffer.resize(sizeof(header) + nodes.size() * sizeof(Node) +
+                  labels.size());
+    std::memcpy(buffer.data(), &header, sizeof(header));
+    std::memcpy(buffer.data() + sizeof(header), nodes.data(),
+                nodes.size() * sizeof(Node));
+    std::memcpy(buffer.data() + sizeof(header) + nodes.size() * sizeof(Node),
+                labels.data(), labels.size());
+
+    rules->Attach(buffer.data(), buffer.size(), name);
+    return rules;
+}
+
+void DomainRules::Attach(const char* data, std::size_t size,
+                         const std::string& name) {
+    auto fail = [&name](const std::string& what) {
+        return std::runtime_error("bad domain rules " + name + ": " + what);
+    };
+
+    if (size < sizeof(Header)) {
+        throw fail("truncated");
+    }
+
+    const auto* header = reinterpret_cast<const Header*>(data);
+    if (header->byte_order != byte_order || header->version != version) {
+        throw fail("unsupported version or byte order");
+    }
+
+    const std::size_t nodes_size =
+        std::size_t{header->node_count} * sizeof(Node);
+    if (header->node_count == 0 ||
+        size < sizeof(Header) + nodes_size + header->label_bytes) {
+        throw fail("truncated");
+    }
+
+    // the file is trusted as little as the network: check every offset once
+    const auto* nodes = reinterpret_cast<const Node*>(data + sizeof(Header));
+    for (uint32_t i = 0; i < header->node_count; ++i) {
+        const Node& node = nodes[i];
+        if (uint64_t{node.first_child} + node.child_count >
+                header->node_count ||
+            uint64_t{node.label_offset} + node.label_length >
+                header->label_bytes ||
+            node.match > static_cast<uint8_t>(Match::deny)) {
+            throw fail("node " + std::to_string(i) + " out of range");
+        }
+    }
+
+    data_ = data;
+    size_ = size;
+    header_ = header;
+    nodes_ = nodes;
+    labels_ = data + sizeof(Header) + nodes_size;
+}
+
+void DomainRules::Save(const std::string& path) const {
+    std::ofstream out{path, std::ios::binary | std::ios::trunc};
+    out.write(data_, static_cast<std::streamsize>(size_));
+    if (!out) {
+        throw std::runtime_error("can't write domain rules " + path);
+    }
+}
+
+std::size_t DomainRules::NodeCount() const { return header_->node_count; }
+
+DomainRules::Match DomainRules::Check(const std::string& host) const {
+    Match match = Lookup(host.data(), host.size());
+    if (match == Match::none) {
+        match = static_cast<Match>(header_->default_match);
+    }
+
+    switch (match) {
+        case Match::allow: {
+            stats_.allowed.fetch_add(1, std::memory_order_relaxed);
+            break;
+        }
+        case Match::deny: {
+            stats_.denied.fetch_add(1, std::memory_order_relaxed);
+            break;
+        }
+        case Match::none: {
+            stats_.unmatched.fetch_add(1, std::memory_order_relaxed);
+            break;
+        }
+    }
+
+    return match;
+}
+
+DomainRules::Match DomainRules::Lookup(const char* host,
+                                       std::size_t length) const {
+    if (length && host[length - 1] == '.') {
+        --length;
+    }
+
+    if (!length || length > max_host_size) {
+        return Match::none;
+    }
+
+    char lower[max_host_size];
+    for (std::size_t i = 0; i < length; ++i) {
+        lower[i] = static_cast<char>(
+            std::tolower(static_cast<unsigned char>(host[i])));
+    }
+
+    Match best = Match::none;
+    const Node* node = nodes_;
+    std::size_t end = length;
+    while (true) {
+        std::size_t start = end;
+        while (start > 0 && lower[start - 1] != '.') {
+            --start;
+        }
+
+        const char* label = lower + start;
+        const std::size_t label_size = end - start;
+
+        // binary search the sorted children
+        const Node* first = nodes_ + node->first_child;
+        std::size_t count = node->child_count;
+        const Node* found = nullptr;
+        while (count) {
+            const std::size_t half = count / 2;
+            const Node* middle = first + half;
+            const int c =
+                CompareLabel(label, label_size, labels_ + middle->label_offset,
+                             middle->label_length);
+            if (c == 0) {
+                found = middle;
+                break;
+            }
+
+            if (c > 0) {
+                first = middle + 1;
+                count -= half + 1;
+            } else {
+                count = half;
+            }
+        }
+
+        if (!found) {
+            break;
+        }
+
+        node = found;
+        if (node->match) {
+            best = static_cast<Match>(node->match);
+        }
+
+        if (start == 0) {
+            break;
+        }
+        end = start - 1;
+    }
+
+    return best;
+}
+
+}  // namespace acl
@@ -0,0 +1,85 @@
+#ifndef DOMAIN_ACL_H
+#define DOMAIN_ACL_H
+
+#include <atomic>
+#include <cstdint>
+#include <istream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <boost/interprocess/mapped_region.hpp>
+
+namespace acl {
+
+// Destination hostname rules by domain suffix, one rule per line:
+//
+//   allow|deny <domain>
+//   default allow|deny
+//
+// A rule for example.com covers example.com and every name below it, the
+// longest matching suffix decides.
+//
+// Rules are compiled into a trie over reversed labels (com -> example ->
+// www) that lives in a single buffer: a header, the nodes (children of a
+// node are contiguous & sorted, found by binary search) and a pool of
+// deduplicated labels. The buffer holds offsets only, so a compiled file is
+// used in place through a read-only memory mapping.
+class DomainRules {
+   public:
+    enum class Match : unsigned char { none, allow, deny };
+
+    struct Stats {
+        std::atomic<uint64_t> allowed{0};
+        std::atomic<uint64_t> denied{0};
+        std::atomic<uint64_t> unmatched{0};
+    };
+
+    // compiled file (mapped) or rule text (compiled in memory), throws
+    // std::runtime_error
+    static std::unique_ptr<DomainRules> Load(const std::string& path);
+
+    static std::unique_ptr<DomainRules> Parse(std::istream& in,
+                                              const std::string& name);
+
+    // write the compiled form, Load() maps it
+    void Save(const std::string& path) const;
+
+    // matching rule for host, none if no rule & no default applies
+    Match Check(const std::string& host) const;
+
+    bool Allowed(const std::string& host) const {
+        return Check(host) != Match::deny;
+    }
+
+    std::size_t NodeCount() const;
+
+    std::size_t Size() const { return size_; }
+
+    const Stats& GetStats() const { return stats_; }
+
+   private:
+    struct Header;
+    struct Node;
+
+    DomainRules() = default;
+
+    void Attach(const char* data, std::size_t size, const std::string& name);
+    Match Lookup(const char* host, std::size_t length) const;
+
+   private:
+    std::vector<char> buffer_;                   // compiled in memory
+    boost::interprocess::mapped_region region_;  // or mapped from a file
+
+    const char* data_ = nullptr;
+    std::size_t size_ = 0;
+    const Header* header_ = nullptr;
+    const Node* nodes_ = nullptr;
+    const char* labels_ = nullptr;
+
+    mutable Stats stats_;
+};
+
+}  // namespace acl
+
+#endif /* DOMAIN_ACL_H */
@@ -7,6 +7,8 @@
 
 #include <socks/socks4.h>
 
+#include "acl.h"
+
 namespace ba = boost::asio;
 namespace bs = boost::system;
 using tcp = ba::ip::tcp;
@@ -18,11 +20,13 @@ class Session : public std::enable_shared_from_this<Session> {
     };
 
    public:
-    Session(_ctor_tag /*unused*/, ba::io_service& io)
-        : downstream_socket_{io}, upstream_socket_{io} {}
+    Session(_ctor_tag /*unused*/, ba::io_service& io,
+            const acl::RuleSet* rules)
+        : rules_{rules}, downstream_socket_{io}, upstream_socket_{io} {}
 
-    static std::unique_ptr<Session> Create(ba::io_service& io) {
-        return std::make_unique<Session>(_ctor_tag{}, io);
+    static std::unique_ptr<Session> Create(ba::io_service& io,
+                                           const acl::RuleSet* rules) {
+        return std::make_unique<Session>(_ctor_tag{}, io, rules);
     }
 
     void Start() { ReadHeaders(); }
@@ -69,8 +73,17 @@ class Session : public std::enable_shared_from_this<Session> {
     }
 
     socks4::Response::Status CheckAccess(const std::string& /*unused*/,
-                                         tcp::endpoint /*unused*/) {
-        // todo:
+                                         tcp::endpoint ep) {
+        if (!rules_) {
+            return socks4::Response::Status::granted;
+        }
+
+        bs::error_code ec;
+        const tcp::endpoint source = downstream_socket_.remote_endpoint(ec);
+        if (ec || !rules_->Allowed(source.address(), ep.address())) {
+            return socks4::Response::Status::rejected;
+        }
+
         return socks4::Response::Status::granted;
     }
 
@@ -229,6 +242,7 @@ class Session : public std::enable_shared_from_this<Session> {
     }
 
    private:
+    const acl::RuleSet* rules_;
     socks4::Request request_;
     ba::streambuf buf_;
     tcp::socket downstream_socket_;
@@ -239,14 +253,15 @@ class Session : public std::enable_shared_from_this<Session> {
 
 class Server {
    public:
-    Server(ba::io_service& io, tcp::endpoint ep) : acceptor_{io, ep} {
+    Server(ba::io_service& io, tcp::endpoint ep, const acl::RuleSet* rules)
+        : acceptor_{io, ep}, rules_{rules} {
         Accept();
     }
 
    private:
     void Accept() {
         std::shared_ptr<Session> session{
-            Session::Create(acceptor_.get_io_service())};
+            Session::Create(acceptor_.get_io_service(), rules_)};
 
         auto accept_handler = [this, session](const bs::error_code& ec) {
             if (!ec) {
@@ -261,18 +276,24 @@ class Server {
 
    private:
     ba::ip::tcp::acceptor acceptor_;
+    const acl::RuleSet* rules_;
 };
 
 int main(int argc, char* argv[]) {
     if (argc < 2) {
-        std::cout << "Usage: " << argv[0] << " <port>\n";
+        std::cout << "Usage: " << argv[0] << " <port> [acl file]\n";
         return 1;
     }
 
     try {
+        std::unique_ptr<acl::RuleSet> rules;
+        if (argc > 2) {
+            rules = acl::RuleSet::Load(argv[2]);
+        }
+
         ba::io_service io;
         tcp::endpoint ep(tcp::v4(), static_cast<uint16_t>(std::atoi(argv[1])));
-        Server s{io, ep};
+        Server s{io, ep, rules.get()};
         io.run();
     } catch (std::exception& e) {
         std::cerr << "Exception: " << e.what() << '\n';
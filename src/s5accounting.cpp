@@ -0,0 +1,200 @@
+#include "s5accounting.h"
+
+#include <cstdio>
+#include <ctime>
+#include <iterator>
+
+#include <boost/log/trivial.hpp>
+
+namespace socks5 {
+
+namespace {
+
+bool IsZero(const Accounting::Counters& counters) {
+    return !counters.sessions && !counters.bytes_up && !counters.bytes_down;
+}
+
+// quoted if it has to be, hostnames come from clients
+std::string CsvField(const std::string& field) {
+    if (field.find_first_of(",\"\r\n") == std::string::npos) {
+        return field;
+    }
+
+    std::string quoted = "\"";
+    for (const char c : field) {
+        if (c == '"') {
+            quoted += '"';
+        }
+        quoted += c;
+    }
+    quoted += '"';
+    return quoted;
+}
+
+}  // namespace
+
+Accounting::Table::Account* Accounting::Table::Open(
+    const std::string& user, const std::string& destination) {
+    std::string key = user;
+    key += '\0';
+    key += destination;
+
+    Account& account = accounts_[key];
+    ++account.open;
+    ++account.counters.sessions;
+    return &account;
+}
+
+void Accounting::Table::Close(Account* account) { --account->open; }
+
+void Accounting::Table::Flush() {
+    Records records;
+    for (auto it = accounts_.begin(); it != accounts_.end();) {
+        Account& account = it->second;
+        if (!IsZero(account.counters)) {
+            records.emplace_back(it->first, account.counters);
+            account.counters = Counters{};
+        }
+
+        it = account.open ? std::next(it) : accounts_.erase(it);
+    }
+
+    accounting_.Collect(std::move(records));
+}
+
+Accounting::Accounting(const Config& config,
+                       const std::vector<ba::io_service*>& loops)
+    : config_(config) {
+    for (ba::io_service* io : loops) {
+        tables_.push_back(std::make_shared<Table>(*this, *io));
+    }
+
+    thread_ = std::thread{[this]() { Run(); }};
+}
+
+Accounting::~Accounting() {
+    {
+        std::lock_guard<std::mutex> lock{mutex_};
+        stop_ = true;
+    }
+    cv_.notify_all();
+    thread_.join();
+
+    // nothing runs on the loops anymore
+    for (auto& table : tables_) {
+        table->Flush();
+    }
+    Write(pending_);
+}
+
+void Accounting::Run() {
+    std::unique_lock<std::mutex> lock{mutex_};
+    while (!stop_) {
+        if (cv_.wait_for(lock, config_.interval, [this]() { return stop_; })) {
+            break;
+        }
+
+        collected_ = 0;
+        lock.unlock();
+        for (const auto& table : tables_) {
+            std::weak_ptr<Table> weak = table;
+            table->io_.post([weak]() {
+                if (auto table = weak.lock()) {
+                    table->Flush();
+                }
+            });
+        }
+        lock.lock();
+
+        // a busy loop that misses this interval is written with the next
+        cv_.wait_for(lock, std::chrono::seconds{1}, [this]() {
+            return stop_ || collected_ == tables_.size();
+        });
+
+        Records records;
+        records.swap(pending_);
+        lock.unlock();
+        Write(records);
+        lock.lock();
+    }
+}
+
+void Accounting::Collect(Records records) {
+    {
+        std::lock_guard<std::mutex> lock{mutex_};
+        pending_.insert(pending_.end(),
+                        std::make_move_iterator(records.begin()),
+                        std::make_move_iterator(records.end()));
+        ++collected_;
+    }
+    cv_.notify_all();
+}
+
+void Accounting::Write(const Records& records) {
+    if (records.empty()) {
+        return;
+    }
+
+    // the same user & destination from several loops
+    std::unordered_map<std::string, Counters> merged;
+    for (const auto& record : records) {
+        Counters& counters = merged[record.first];
+        counters.sessions += record.second.sessions;
+        counters.bytes_up += record.second.bytes_up;
+        counters.bytes_down += record.second.bytes_down;
+    }
+
+    if (!out_.is_open()) {
+        out_.open(config_.path, std::ios::app);
+        if (!out_) {
+            BOOST_LOG_TRIVIAL(error)
+                << "accounting: can't open " << config_.path;
+            return;
+        }
+
+        if (out_.tellp() == 0) {
+            out_ << "time,user,destination,sessions,bytes_up,bytes_down\n";
+        }
+    }
+
+    const auto now = static_cast<long long>(std::time(nullptr));
+    for (const auto& record : merged) {
+        const auto separator = record.first.find('\0');
+        out_ << now << ',' << CsvField(record.first.substr(0, separator))
+             << ',' << CsvField(record.first.substr(separator + 1)) << ','
+             << record.second.sessions << ',' << record.second.bytes_up << ','
+             << record.second.bytes_down << '\n';
+    }
+    out_.flush();
+
+    if (!out_) {
+        BOOST_LOG_TRIVIAL(error) << "accounting: can't write " << config_.path;
+        out_.close();
+        return;
+    }
+
+    if (config_.max_size &&
+        static_cast<std::size_t>(out_.tellp()) >= config_.max_size) {
+        Rotate();
+    }
+}
+
+// <path>.<keep> is dropped, <path>.<n> becomes <path>.<n + 1>
+void Accounting::Rotate() {
+    out_.close();
+
+    if (!config_.keep) {
+        std::remove(config_.path.c_str());
+        return;
+    }
+
+    for (unsigned n = config_.keep; n > 1; --n) {
+        const std::string from = config_.path + '.' + std::to_string(n - 1);
+        const std::string to = config_.path + '.' + std::to_string(n);
+        std::rename(from.c_str(), to.c_str());
+    }
+
+    std::rename(config_.path.c_str(), (config_.path + ".1").c_str());
+}
+
+}  // namespace socks5
@@ -0,0 +1,112 @@
+#ifndef S5ACCOUNTING_H
+#define S5ACCOUNTING_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <boost/asio.hpp>
+
+namespace ba = boost::asio;
+
+namespace socks5 {
+
+// Traffic per user & destination for billing, appended to a CSV file:
+//
+//   time,user,destination,sessions,bytes_up,bytes_down
+//
+// one line per (user, destination) active during an interval; up is client
+// to destination. The file is rotated to <path>.1 ... <path>.<keep> when it
+// grows past max_size.
+//
+// Sessions count into a table of their event loop with plain increments.
+// Every interval a background thread asks each loop to hand over & zero its
+// table (on the loop's thread, so the counters are never shared), merges
+// what it gets & writes it out. The relay path takes no lock.
+class Accounting {
+   public:
+    struct Config {
+        std::string path;
+        std::chrono::seconds interval{60};
+        std::size_t max_size = 64 << 20;
+        unsigned keep = 5;
+    };
+
+    struct Counters {
+        uint64_t sessions = 0;
+        uint64_t bytes_up = 0;
+        uint64_t bytes_down = 0;
+    };
+
+    // per event loop, used from that loop's thread only
+    class Table {
+       public:
+        Table(Accounting& accounting, ba::io_service& io)
+            : accounting_(accounting), io_(io) {}
+
+        struct Account {
+            Counters counters;
+            std::size_t open = 0;  // sessions
+        };
+
+        // counts a session, its bytes go to the returned account's counters
+        // until Close()
+        Account* Open(const std::string& user, const std::string& destination);
+
+        void Close(Account* account);
+
+       private:
+        friend class Accounting;
+
+        // hands non-zero counters over & zeroes them, forgets accounts
+        // without sessions
+        void Flush();
+
+       private:
+        Accounting& accounting_;
+        ba::io_service& io_;
+        std::unordered_map<std::string, Account> accounts_;  // user \0 dest
+    };
+
+    Accounting(const Config& config, const std::vector<ba::io_service*>& loops);
+
+    // flushes & writes whatever is left, the loops must be stopped by now
+    ~Accounting();
+
+    Table& GetTable(std::size_t index) { return *tables_[index]; }
+
+   private:
+    using Records = std::vector<std::pair<std::string, Counters>>;
+
+    void Run();
+
+    void Collect(Records records);
+
+    void Write(const Records& records);
+
+    void Rotate();
+
+   private:
+    const Config config_;
+    std::vector<std::shared_ptr<Table>> tables_;
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    bool stop_ = false;
+    std::size_t collected_ = 0;  // tables handed over this interval
+    Records pending_;
+
+    std::ofstream out_;  // writer thread only
+    std::thread thread_;
+};
+
+}  // namespace socks5
+
+#endif /* S5ACCOUNTING_H */
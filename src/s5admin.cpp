@@ -0,0 +1,136 @@
+#include "s5admin.h"
+
+#include <chrono>
+#include <istream>
+#include <sstream>
+
+#include <boost/log/trivial.hpp>
+
+namespace socks5 {
+
+namespace {
+
+const std::size_t max_request_size = 8192;
+const std::chrono::seconds request_timeout{5};
+const std::chrono::milliseconds accept_backoff{100};
+
+}  // namespace
+
+class AdminListener::Connection
+    : public std::enable_shared_from_this<Connection> {
+   public:
+    Connection(ba::io_service& io, const std::map<std::string, Page>& pages)
+        : socket_{io}, timer_{io}, request_{max_request_size}, pages_(pages) {}
+
+    tcp::socket& Socket() { return socket_; }
+
+    void Start() {
+        auto self(shared_from_this());
+        timer_.expires_from_now(request_timeout);
+        timer_.async_wait([this, self](const bs::error_code& ec) {
+            if (!ec) {
+                bs::error_code ignored;
+                socket_.close(ignored);
+            }
+        });
+
+        ba::async_read_until(
+            socket_, request_, "\r\n\r\n",
+            [this, self](const bs::error_code& ec, std::size_t) {
+                if (ec) {
+                    timer_.cancel();
+                    return;
+                }
+
+                Respond();
+            });
+    }
+
+   private:
+    void Respond() {
+        std::istream in{&request_};
+        std::string method;
+        std::string target;
+        in >> method >> target;
+        const std::string path = target.substr(0, target.find('?'));
+
+        std::string status = "200 OK";
+        std::string content_type;
+        std::string body;
+        const auto it = pages_.find(path);
+        if (method != "GET") {
+            status = "405 Method Not Allowed";
+        } else if (it == pages_.end()) {
+            status = "404 Not Found";
+        } else {
+            content_type = it->second.content_type;
+            body = it->second.render();
+        }
+
+        std::ostringstream head;
+        head << "HTTP/1.0 " << status << "\r\n";
+        if (!content_type.empty()) {
+            head << "Content-Type: " << content_type << "\r\n";
+        }
+        head << "Content-Length: " << body.size() << "\r\n"
+             << "Connection: close\r\n\r\n";
+        response_ = head.str() + body;
+
+        auto self(shared_from_this());
+        ba::async_write(socket_, ba::buffer(response_),
+                        [this, self](const bs::error_code&, std::size_t) {
+                            timer_.cancel();
+                            bs::error_code ignored;
+                            socket_.shutdown(tcp::socket::shutdown_both,
+                                             ignored);
+                            socket_.close(ignored);
+                        });
+    }
+
+   private:
+    tcp::socket socket_;
+    ba::steady_timer timer_;
+    ba::streambuf request_;
+    std::string response_;
+    const std::map<std::string, Page>& pages_;
+};
+
+AdminListener::AdminListener(ba::io_service& io, const tcp::endpoint& endpoint)
+    : acceptor_{io, endpoint}, accept_timer_{io} {
+    BOOST_LOG_TRIVIAL(info) << "admin on " << acceptor_.local_endpoint();
+    Accept();
+}
+
+void AdminListener::Add(const std::string& path, Page page) {
+    pages_[path] = std::move(page);
+}
+
+void AdminListener::Accept() {
+    auto connection =
+        std::make_shared<Connection>(acceptor_.get_io_service(), pages_);
+
+    acceptor_.async_accept(
+        connection->Socket(), [this, connection](const bs::error_code& ec) {
+            if (ec == ba::error::operation_aborted) {
+                return;
+            }
+
+            if (!ec) {
+                connection->Start();
+                Accept();
+                return;
+            }
+
+            // out of descriptors most likely, accepting again at once would
+            // spin until some are released
+            BOOST_LOG_TRIVIAL(warning) << "admin accept: " << ec.message();
+            accept_timer_.expires_from_now(accept_backoff);
+            accept_timer_.async_wait([this](const bs::error_code& ec) {
+                if (!ec) {
+                    Accept();
+                }
+            });
+        });
+}
+
+}  // namespace socks5
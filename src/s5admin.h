@@ -0,0 +1,45 @@
+#ifndef S5ADMIN_H
+#define S5ADMIN_H
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+
+#include <boost/asio.hpp>
+
+namespace ba = boost::asio;
+namespace bs = boost::system;
+using tcp = ba::ip::tcp;
+
+namespace socks5 {
+
+// Minimal HTTP endpoint for operators, served on the server's io service:
+// GET <path> answers with what the path's page renders, one request per
+// connection. Not meant to face the internet, listen on loopback or a
+// management network.
+class AdminListener {
+   public:
+    struct Page {
+        std::string content_type;
+        std::function<std::string()> render;
+    };
+
+    AdminListener(ba::io_service& io, const tcp::endpoint& endpoint);
+
+    void Add(const std::string& path, Page page);
+
+   private:
+    class Connection;
+
+    void Accept();
+
+   private:
+    tcp::acceptor acceptor_;
+    ba::steady_timer accept_timer_;  // backs off after accept errors
+    std::map<std::string, Page> pages_;
+};
+
+}  // namespace socks5
+
+#endif /* S5ADMIN_H */
@@ -0,0 +1,62 @@
+#include "s5admission.h"
+
+#include <algorithm>
+
+namespace socks5 {
+
+AdmissionControl::State AdmissionControl::GetState() const {
+    const std::size_t used = Used();
+    if (config_.hard_limit && used >= config_.hard_limit) {
+        return State::hard;
+    }
+
+    if (config_.soft_limit && used >= config_.soft_limit) {
+        return State::soft;
+    }
+
+    return State::normal;
+}
+
+std::chrono::milliseconds AdmissionControl::AcceptDelay() {
+    const std::size_t used = Used();
+    if (!config_.soft_limit || used < config_.soft_limit) {
+        return std::chrono::milliseconds::zero();
+    }
+
+    stats_.delayed_accepts.fetch_add(1, std::memory_order_relaxed);
+
+    if (!config_.hard_limit || config_.hard_limit <= config_.soft_limit ||
+        used >= config_.hard_limit) {
+        return config_.max_accept_delay;
+    }
+
+    const double over = static_cast<double>(used - config_.soft_limit) /
+                        (config_.hard_limit - config_.soft_limit);
+    const auto delay = std::chrono::milliseconds{static_cast<int64_t>(
+        over * static_cast<double>(config_.max_accept_delay.count()))};
+    return std::max(delay, std::chrono::milliseconds{1});
+}
+
+bool AdmissionControl::AdmitHandshake() {
+    if (config_.hard_limit && Used() >= config_.hard_limit) {
+        stats_.refused_handshakes.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    return true;
+}
+
+const char* AdmissionControl::StateName(State state) {
+    switch (state) {
+        case State::normal:
+            return "normal";
+        case State::soft:
+            return "soft";
+        case State::hard:
+            return "hard";
+    }
+
+    return "unknown";
+}
+
+}  // namespace socks5
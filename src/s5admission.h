@@ -0,0 +1,66 @@
+#ifndef S5ADMISSION_H
+#define S5ADMISSION_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+namespace socks5 {
+
+// Accounts the memory held by sessions (the session objects & their relay
+// buffers) & by tunnel streams (their receive buffers, which grow up to the
+// stream window behind a slow reader) & decides on new connections from it.
+// Below the soft limit everything is admitted. Between the limits accepting
+// slows down, the delay before re-arming accept grows linearly up to
+// max_accept_delay at the hard limit. Above the hard limit new handshakes
+// are refused, sessions already relaying are left alone.
+class AdmissionControl {
+   public:
+    enum class State { normal, soft, hard };
+
+    struct Config {
+        std::size_t soft_limit = 0;  // bytes, 0 = none
+        std::size_t hard_limit = 0;  // bytes, 0 = none
+        std::chrono::milliseconds max_accept_delay{100};
+    };
+
+    struct Stats {
+        std::atomic<uint64_t> delayed_accepts{0};
+        std::atomic<uint64_t> refused_handshakes{0};
+    };
+
+    explicit AdmissionControl(const Config& config) : config_(config) {}
+
+    void Charge(std::size_t bytes) {
+        used_.fetch_add(bytes, std::memory_order_relaxed);
+    }
+
+    void Release(std::size_t bytes) {
+        used_.fetch_sub(bytes, std::memory_order_relaxed);
+    }
+
+    std::size_t Used() const { return used_.load(std::memory_order_relaxed); }
+
+    State GetState() const;
+
+    // pause before accepting the next connection, counts delays
+    std::chrono::milliseconds AcceptDelay();
+
+    // false above the hard limit, counts refusals
+    bool AdmitHandshake();
+
+    const Config& GetConfig() const { return config_; }
+
+    const Stats& GetStats() const { return stats_; }
+
+    static const char* StateName(State state);
+
+   private:
+    const Config config_;
+    std::atomic<std::size_t> used_{0};
+    Stats stats_;
+};
+
+}  // namespace socks5
+
+#endif /* S5ADMISSION_H */
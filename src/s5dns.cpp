@@ -0,0 +1,444 @@
+#include "s5dns.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <boost/log/trivial.hpp>
+
+namespace socks5 {
+
+namespace {
+
+const std::chrono::seconds sweep_interval{1};
+
+// Snapshot file, all integers big endian:
+//   header: magic "S5DC", version u32, entry count u32
+//   entry:  remaining ttl in seconds u32, host length u8, address count u8,
+//           host, addresses (family u8 4|6, 4 or 16 bytes)
+const char snapshot_magic[4] = {'S', '5', 'D', 'C'};
+const uint32_t snapshot_version = 1;
+const std::size_t snapshot_header_size = 12;
+
+void PutU32(std::string& out, uint32_t value) {
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        out.push_back(static_cast<char>((value >> shift) & 0xFF));
+    }
+}
+
+// bounds checked reader over the mapped snapshot
+class SnapshotReader {
+   public:
+    SnapshotReader(const unsigned char* data, std::size_t size)
+        : data_{data}, size_{size} {}
+
+    bool Read(const unsigned char*& out, std::size_t length) {
+        if (size_ - offset_ < length) {
+            return false;
+        }
+
+        out = data_ + offset_;
+        offset_ += length;
+        return true;
+    }
+
+    bool U8(uint8_t& out) {
+        const unsigned char* p = nullptr;
+        if (!Read(p, 1)) {
+            return false;
+        }
+
+        out = p[0];
+        return true;
+    }
+
+    bool U32(uint32_t& out) {
+        const unsigned char* p = nullptr;
+        if (!Read(p, 4)) {
+            return false;
+        }
+
+        out = (uint32_t{p[0]} << 24) | (uint32_t{p[1]} << 16) |
+              (uint32_t{p[2]} << 8) | uint32_t{p[3]};
+        return true;
+    }
+
+   private:
+    const unsigned char* data_;
+    std::size_t size_;
+    std::size_t offset_ = 0;
+};
+
+std::vector<ba::ip::address> Addresses(tcp::resolver::iterator ep_iterator) {
+    std::vector<ba::ip::address> addresses;
+    for (; ep_iterator != tcp::resolver::iterator(); ++ep_iterator) {
+        const auto address = ep_iterator->endpoint().address();
+        if (std::find(addresses.begin(), addresses.end(), address) ==
+            addresses.end()) {
+            addresses.push_back(address);
+        }
+    }
+
+    return addresses;
+}
+
+}  // namespace
+
+DnsCache::DnsCache(ba::io_service& io, const Config& config)
+    : io_{io},
+      config_{config},
+      sweep_timer_{io},
+      alive_{std::make_shared<char>()} {
+    BOOST_LOG_TRIVIAL(info) << "dns cache: ttl=" << config_.ttl.count()
+                            << "s size=" << config_.max_entries
+                            << " refresh_hits=" << config_.refresh_hits;
+
+    if (!config_.snapshot_path.empty()) {
+        const std::size_t loaded = Load(config_.snapshot_path);
+        BOOST_LOG_TRIVIAL(info) << "dns cache: " << loaded << " entries from "
+                                << config_.snapshot_path;
+
+        // writing may block on the disk, keep it off the event loop
+        if (config_.snapshot_interval.count() > 0) {
+            snapshot_thread_ = std::thread{[this]() { RunSnapshots(); }};
+        }
+    }
+
+    Sweep();
+}
+
+DnsCache::~DnsCache() {
+    alive_.reset();
+    sweep_timer_.cancel();
+    for (auto& resolver : refreshes_) {
+        resolver->cancel();
+    }
+
+    if (snapshot_thread_.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock{snapshot_mutex_};
+            stop_ = true;
+        }
+        snapshot_cv_.notify_all();
+        snapshot_thread_.join();
+    }
+
+    if (!config_.snapshot_path.empty()) {
+        Save(config_.snapshot_path);
+    }
+}
+
+bool DnsCache::Lookup(const std::string& host,
+                      std::vector<ba::ip::address>& out) {
+    std::lock_guard<std::mutex> lock{mutex_};
+
+    auto it = entries_.find(host);
+    if (it == entries_.end() || it->second.expires <= Clock::now()) {
+        stats_.misses.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    stats_.hits.fetch_add(1, std::memory_order_relaxed);
+    ++it->second.hits;
+    out = it->second.addresses;
+    return true;
+}
+
+void DnsCache::Insert(const std::string& host,
+                      tcp::resolver::iterator ep_iterator) {
+    Store(host, Addresses(ep_iterator), config_.ttl);
+}
+
+std::size_t DnsCache::Size() const {
+    std::lock_guard<std::mutex> lock{mutex_};
+    return entries_.size();
+}
+
+tcp::resolver::iterator DnsCache::Endpoints(
+    const std::vector<ba::ip::address>& addresses, const std::string& host,
+    uint16_t port) {
+    std::vector<tcp::endpoint> endpoints;
+    endpoints.reserve(addresses.size());
+    for (const auto& address : addresses) {
+        endpoints.emplace_back(address, port);
+    }
+
+    return tcp::resolver::iterator::create(endpoints.begin(), endpoints.end(),
+                                           host, std::to_string(port));
+}
+
+bool DnsCache::Save(const std::string& path) const {
+    std::string out{snapshot_magic, sizeof(snapshot_magic)};
+    PutU32(out, snapshot_version);
+    PutU32(out, 0);  // entry count, patched below
+
+    uint32_t count = 0;
+    {
+        std::lock_guard<std::mutex> lock{mutex_};
+        const auto now = Clock::now();
+        for (const auto& kv : entries_) {
+            const Entry& entry = kv.second;
+            const auto ttl = std::chrono::duration_cast<std::chrono::seconds>(
+                entry.expires - now);
+            if (ttl.count() <= 0 || kv.first.size() > 0xFF) {
+                continue;
+            }
+
+            const std::size_t n = std::min<std::size_t>(
+                entry.addresses.size(), 0xFF);
+            PutU32(out, static_cast<uint32_t>(ttl.count()));
+            out.push_back(static_cast<char>(kv.first.size()));
+            out.push_back(static_cast<char>(n));
+            out += kv.first;
+            for (std::size_t i = 0; i < n; ++i) {
+                const auto& address = entry.addresses[i];
+                if (address.is_v4()) {
+                    out.push_back(4);
+                    const auto bytes = address.to_v4().to_bytes();
+                    out.append(bytes.begin(), bytes.end());
+                } else {
+                    out.push_back(6);
+                    const auto bytes = address.to_v6().to_bytes();
+                    out.append(bytes.begin(), bytes.end());
+                }
+            }
+            ++count;
+        }
+    }
+
+    std::string header_count;
+    PutU32(header_count, count);
+    out.replace(8, 4, header_count);
+
+    const std::string tmp_path = path + ".tmp";
+    {
+        std::ofstream file{tmp_path, std::ios::binary | std::ios::trunc};
+        file.write(out.data(), static_cast<std::streamsize>(out.size()));
+        if (!file) {
+            BOOST_LOG_TRIVIAL(warning)
+                << "dns cache: can't write snapshot " << tmp_path;
+            return false;
+        }
+    }
+
+    if (std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+        BOOST_LOG_TRIVIAL(warning)
+            << "dns cache: can't replace snapshot " << path;
+        return false;
+    }
+
+    return true;
+}
+
+std::size_t DnsCache::Load(const std::string& path) {
+    namespace bip = boost::interprocess;
+
+    bip::file_mapping file;
+    bip::mapped_region region;
+    try {
+        bip::file_mapping{path.c_str(), bip::read_only}.swap(file);
+        bip::mapped_region{file, bip::read_only}.swap(region);
+    } catch (const bip::interprocess_exception& e) {
+        BOOST_LOG_TRIVIAL(info)
+            << "dns cache: no snapshot " << path << ": " << e.what();
+        return 0;
+    }
+
+    SnapshotReader reader{
+        static_cast<const unsigned char*>(region.get_address()),
+        region.get_size()};
+
+    const unsigned char* magic = nullptr;
+    uint32_t version = 0;
+    uint32_t count = 0;
+    if (!reader.Read(magic, sizeof(snapshot_magic)) ||
+        !std::equal(magic, magic + sizeof(snapshot_magic), snapshot_magic) ||
+        !reader.U32(version) || version != snapshot_version ||
+        !reader.U32(count)) {
+        BOOST_LOG_TRIVIAL(warning) << "dns cache: bad snapshot " << path;
+        return 0;
+    }
+
+    std::size_t loaded = 0;
+    for (uint32_t i = 0; i < count; ++i) {
+        uint32_t ttl = 0;
+        uint8_t host_size = 0;
+        uint8_t address_count = 0;
+        const unsigned char* host = nullptr;
+        if (!reader.U32(ttl) || !reader.U8(host_size) ||
+            !reader.U8(address_count) || !reader.Read(host, host_size)) {
+            break;
+        }
+
+        std::vector<ba::ip::address> addresses;
+        for (uint8_t j = 0; j < address_count; ++j) {
+            uint8_t family = 0;
+            const unsigned char* bytes = nullptr;
+            if (!reader.U8(family)) {
+                return loaded;
+            }
+
+            if (family == 4 && reader.Read(bytes, 4)) {
+                ba::ip::address_v4::bytes_type v4;
+                std::copy(bytes, bytes + 4, v4.begin());
+                addresses.emplace_back(ba::ip::address_v4(v4));
+            } else if (family == 6 && reader.Read(bytes, 16)) {
+                ba::ip::address_v6::bytes_type v6;
+                std::copy(bytes, bytes + 16, v6.begin());
+                addresses.emplace_back(ba::ip::address_v6(v6));
+            } else {
+                return loaded;
+            }
+        }
+
+        if (Store(std::string(reinterpret_cast<const char*>(host), host_size),
+                  std::move(addresses),
+                  std::min<Clock::duration>(std::chrono::seconds{ttl},
+                                            config_.ttl))) {
+            ++loaded;
+        }
+    }
+
+    return loaded;
+}
+
+void DnsCache::RunSnapshots() {
+    std::unique_lock<std::mutex> lock{snapshot_mutex_};
+    while (!snapshot_cv_.wait_for(lock, config_.snapshot_interval,
+                                  [this]() { return stop_; })) {
+        lock.unlock();
+        Save(config_.snapshot_path);
+        lock.lock();
+    }
+}
+
+bool DnsCache::Store(const std::string& host,
+                     std::vector<ba::ip::address> addresses,
+                     Clock::duration ttl) {
+    if (addresses.empty()) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock{mutex_};
+
+    auto it = entries_.find(host);
+    if (it == entries_.end()) {
+        if (entries_.size() >= config_.max_entries) {
+            return false;  // full until the sweep drops expired entries
+        }
+
+        it = entries_.emplace(host, Entry{}).first;
+    }
+
+    Entry& entry = it->second;
+    entry.addresses = std::move(addresses);
+    entry.expires = Clock::now() + ttl;
+    entry.hits = 0;
+    return true;
+}
+
+// Drops expired entries & starts refreshes for hot ones about to expire,
+// hottest first.
+void DnsCache::Sweep() {
+    std::weak_ptr<char> alive = alive_;
+    sweep_timer_.expires_from_now(sweep_interval);
+    sweep_timer_.async_wait([this, alive](const bs::error_code& ec) {
+        // expired just before the cache went away
+        if (ec || alive.expired()) {
+            return;
+        }
+
+        const auto now = Clock::now();
+        const auto refresh_ahead =
+            std::max<Clock::duration>(config_.ttl / 10, 2 * sweep_interval);
+
+        std::vector<std::pair<unsigned, std::string>> hot;
+        {
+            std::lock_guard<std::mutex> lock{mutex_};
+            for (auto it = entries_.begin(); it != entries_.end();) {
+                const Entry& entry = it->second;
+                if (entry.expires <= now && !entry.refreshing) {
+                    it = entries_.erase(it);
+                    continue;
+                }
+
+                if (!entry.refreshing &&
+                    entry.hits >= config_.refresh_hits &&
+                    entry.expires - now <= refresh_ahead) {
+                    hot.emplace_back(entry.hits, it->first);
+                }
+                ++it;
+            }
+
+            const std::size_t slots = config_.max_refreshes - refreshing_;
+            if (hot.size() > slots) {
+                std::partial_sort(
+                    hot.begin(), hot.begin() + slots, hot.end(),
+                    [](const std::pair<unsigned, std::string>& a,
+                       const std::pair<unsigned, std::string>& b) {
+                        return a.first > b.first;
+                    });
+                hot.resize(slots);
+            }
+
+            for (const auto& candidate : hot) {
+                entries_[candidate.second].refreshing = true;
+            }
+            refreshing_ += hot.size();
+        }
+
+        for (const auto& candidate : hot) {
+            Refresh(candidate.second);
+        }
+
+        Sweep();
+    });
+}
+
+void DnsCache::Refresh(const std::string& host) {
+    const auto resolver = refreshes_.insert(
+        refreshes_.end(), std::make_shared<tcp::resolver>(io_));
+    std::weak_ptr<char> alive = alive_;
+    auto handler = [this, alive, resolver, host](
+                       const bs::error_code& ec,
+                       tcp::resolver::iterator ep_iterator) {
+        if (alive.expired()) {
+            return;  // completed or cancelled as the cache went away
+        }
+        refreshes_.erase(resolver);
+
+        std::vector<ba::ip::address> addresses;
+        if (!ec) {
+            addresses = Addresses(ep_iterator);
+        }
+
+        std::lock_guard<std::mutex> lock{mutex_};
+        --refreshing_;
+
+        auto it = entries_.find(host);
+        if (it == entries_.end()) {
+            return;
+        }
+
+        Entry& entry = it->second;
+        entry.refreshing = false;
+        if (ec || addresses.empty()) {
+            // keep serving the old addresses until they expire
+            stats_.refresh_errors.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+
+        stats_.refreshes.fetch_add(1, std::memory_order_relaxed);
+        entry.addresses = std::move(addresses);
+        entry.expires = Clock::now() + config_.ttl;
+        entry.hits = 0;
+    };
+
+    tcp::resolver::query q{host, "0", tcp::resolver::query::numeric_service};
+    (*resolver)->async_resolve(q, handler);
+}
+
+}  // namespace socks5
@@ -0,0 +1,118 @@
+#ifndef S5DNS_H
+#define S5DNS_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <boost/asio.hpp>
+
+namespace ba = boost::asio;
+namespace bs = boost::system;
+using tcp = ba::ip::tcp;
+
+namespace socks5 {
+
+// Hostname -> addresses cache in front of tcp::resolver.
+//
+// getaddrinfo() doesn't report record TTLs, so entries live for a fixed
+// ttl. Hosts hit at least refresh_hits times during their lifetime are
+// re-resolved in the background shortly before they expire, so popular
+// entries never go cold. At most max_refreshes names are refreshed at once.
+//
+// With a snapshot path the cache is written there periodically by a thread
+// of its own (and on destruction) with the remaining lifetimes, and read
+// back on construction, so a restarted server starts warm. A zero interval
+// only writes it on destruction.
+class DnsCache {
+   public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Config {
+        std::chrono::seconds ttl{60};
+        std::size_t max_entries = 10000;
+        unsigned refresh_hits = 3;
+        std::size_t max_refreshes = 16;
+
+        std::string snapshot_path;
+        std::chrono::seconds snapshot_interval{60};
+    };
+
+    struct Stats {
+        std::atomic<uint64_t> hits{0};
+        std::atomic<uint64_t> misses{0};
+        std::atomic<uint64_t> refreshes{0};
+        std::atomic<uint64_t> refresh_errors{0};
+    };
+
+    DnsCache(ba::io_service& io, const Config& config);
+
+    ~DnsCache();
+
+    // true & fills addresses on a hit
+    bool Lookup(const std::string& host, std::vector<ba::ip::address>& out);
+
+    void Insert(const std::string& host, tcp::resolver::iterator ep_iterator);
+
+    std::size_t Size() const;
+
+    // write all live entries to path, atomically replacing it
+    bool Save(const std::string& path) const;
+
+    // add the unexpired entries of a snapshot, returns their number
+    std::size_t Load(const std::string& path);
+
+    const Stats& GetStats() const { return stats_; }
+
+    static tcp::resolver::iterator Endpoints(
+        const std::vector<ba::ip::address>& addresses, const std::string& host,
+        uint16_t port);
+
+   private:
+    struct Entry {
+        std::vector<ba::ip::address> addresses;
+        Clock::time_point expires;
+        unsigned hits = 0;  // since the last resolve
+        bool refreshing = false;
+    };
+
+    // false if the cache is full
+    bool Store(const std::string& host, std::vector<ba::ip::address> addresses,
+               Clock::duration ttl);
+    void Sweep();
+    void Refresh(const std::string& host);
+    void RunSnapshots();
+
+   private:
+    ba::io_service& io_;
+    Config config_;
+    Stats stats_;
+
+    mutable std::mutex mutex_;
+    std::unordered_map<std::string, Entry> entries_;
+    std::size_t refreshing_ = 0;
+
+    ba::steady_timer sweep_timer_;
+
+    // refreshes in flight, cancelled on destruction; handlers left on the
+    // loop then see alive_ gone & leave the cache alone (loop thread only)
+    std::list<std::shared_ptr<tcp::resolver>> refreshes_;
+    std::shared_ptr<char> alive_;
+
+    std::mutex snapshot_mutex_;
+    std::condition_variable snapshot_cv_;
+    bool stop_ = false;
+    std::thread snapshot_thread_;
+};
+
+}  // namespace socks5
+
+#endif /* S5DNS_H */
@@ -0,0 +1,25 @@
+// Compiles a domain rule file for s5server --domain-acl, the compiled file
+// is memory mapped on start instead of parsed.
+
+#include <iostream>
+
+#include "domain_acl.h"
+
+int main(int argc, char* argv[]) {
+    if (argc != 3) {
+        std::cout << "Usage: " << argv[0] << " <rule file> <compiled file>\n";
+        return 1;
+    }
+
+    try {
+        const auto rules = acl::DomainRules::Load(argv[1]);
+        rules->Save(argv[2]);
+        std::cout << rules->NodeCount() << " nodes, " << rules->Size()
+                  << " bytes\n";
+    } catch (std::exception& e) {
+        std::cerr << "Exception: " << e.what() << '\n';
+        return 1;
+    }
+
+    return 0;
+}
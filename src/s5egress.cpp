@@ -0,0 +1,145 @@
+#include "s5egress.h"
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include <boost/log/trivial.hpp>
+
+#ifndef _WIN32
+#include <netinet/in.h>
+#include <sys/socket.h>
+#endif
+
+namespace socks5 {
+
+namespace {
+
+// fnv-1a over the address bytes, ipv4 as its v4-mapped form
+std::size_t HashAddress(const ba::ip::address& address) {
+    const auto bytes =
+        address.is_v4() ? ba::ip::address_v6::v4_mapped(address.to_v4())
+                              .to_bytes()
+                        : address.to_v6().to_bytes();
+
+    uint64_t hash = 14695981039346656037ull;
+    for (const unsigned char byte : bytes) {
+        hash = (hash ^ byte) * 1099511628211ull;
+    }
+
+    return static_cast<std::size_t>(hash ^ (hash >> 32));
+}
+
+}  // namespace
+
+EgressPool::EgressPool(const std::vector<ba::ip::address>& addresses,
+                       Strategy strategy)
+    : strategy_{strategy} {
+    for (const auto& address : addresses) {
+        auto usage = std::make_unique<Usage>();
+        usage->address = address;
+        (address.is_v4() ? v4_ : v6_).push_back(usage_.size());
+        usage_.push_back(std::move(usage));
+
+        BOOST_LOG_TRIVIAL(info) << "egress address " << address;
+    }
+}
+
+EgressPool::Strategy EgressPool::ParseStrategy(const std::string& name) {
+    if (name == "round-robin") {
+        return Strategy::round_robin;
+    }
+
+    if (name == "hash") {
+        return Strategy::hash;
+    }
+
+    throw std::invalid_argument("unknown egress strategy: " + name);
+}
+
+std::size_t EgressPool::Select(bool v4, const ba::ip::address& client) {
+    const auto& candidates = v4 ? v4_ : v6_;
+    if (candidates.empty()) {
+        return npos;
+    }
+
+    std::size_t n = 0;
+    switch (strategy_) {
+        case Strategy::round_robin: {
+            n = next_.fetch_add(1, std::memory_order_relaxed);
+            break;
+        }
+        case Strategy::hash: {
+            n = HashAddress(client);
+            break;
+        }
+    }
+
+    return candidates[n % candidates.size()];
+}
+
+std::size_t EgressPool::Bind(tcp::socket& socket,
+                             const tcp::endpoint& destination,
+                             const ba::ip::address& client,
+                             bs::error_code& ec) {
+    if (socket.is_open()) {
+        socket.close(ec);
+    }
+
+    socket.open(destination.protocol(), ec);
+    if (ec) {
+        return npos;
+    }
+
+    const std::size_t index = Select(destination.address().is_v4(), client);
+    if (index == npos) {
+        return npos;
+    }
+
+    Usage& usage = *usage_[index];
+
+    const int no_port_error = BindNoPort(socket, usage.address, ec);
+    // counted, a warning for the first only
+    if (no_port_error &&
+        usage.no_port_errors.fetch_add(1, std::memory_order_relaxed) == 0) {
+        BOOST_LOG_TRIVIAL(warning)
+            << "egress " << usage.address
+            << ": IP_BIND_ADDRESS_NO_PORT: " << std::strerror(no_port_error);
+    }
+
+    if (ec) {
+        usage.bind_errors.fetch_add(1, std::memory_order_relaxed);
+        return npos;
+    }
+
+    usage.connects.fetch_add(1, std::memory_order_relaxed);
+    usage.active.fetch_add(1, std::memory_order_relaxed);
+    return index;
+}
+
+int EgressPool::BindNoPort(tcp::socket& socket,
+                           const ba::ip::address& source,
+                           bs::error_code& ec) {
+    int no_port_error = 0;
+
+#ifdef IP_BIND_ADDRESS_NO_PORT
+    // defer the port choice to connect(): the kernel then only needs the
+    // 4-tuple to be unique instead of reserving a port per source address
+    const int one = 1;
+    if (::setsockopt(socket.native_handle(), IPPROTO_IP,
+                     IP_BIND_ADDRESS_NO_PORT, &one, sizeof(one)) != 0) {
+        no_port_error = errno;
+    }
+#endif
+
+    socket.bind(tcp::endpoint{source, 0}, ec);
+    return no_port_error;
+}
+
+void EgressPool::Release(std::size_t index) {
+    if (index != npos) {
+        usage_[index]->active.fetch_sub(1, std::memory_order_relaxed);
+    }
+}
+
+}  // namespace socks5
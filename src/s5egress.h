@@ -0,0 +1,75 @@
+#ifndef S5EGRESS_H
+#define S5EGRESS_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <boost/asio.hpp>
+
+namespace ba = boost::asio;
+namespace bs = boost::system;
+using tcp = ba::ip::tcp;
+
+namespace socks5 {
+
+// Pool of local source addresses for upstream sockets. Every address has its
+// own ~28k ephemeral ports toward a destination, so spreading connections
+// over N addresses gives N times the connections to a hot (ip, port).
+class EgressPool {
+   public:
+    enum class Strategy {
+        round_robin,
+        hash,  // by client address: a client keeps its egress address
+    };
+
+    struct Usage {
+        ba::ip::address address;
+        std::atomic<uint64_t> connects{0};
+        std::atomic<uint64_t> bind_errors{0};
+        // IP_BIND_ADDRESS_NO_PORT refused, the bind then reserves a port
+        std::atomic<uint64_t> no_port_errors{0};
+        std::atomic<int64_t> active{0};
+    };
+
+    static const std::size_t npos = static_cast<std::size_t>(-1);
+
+    EgressPool(const std::vector<ba::ip::address>& addresses,
+               Strategy strategy);
+
+    // opens socket for destination's family & binds it to a pool address,
+    // returns the address index for Release() or npos if the socket was left
+    // unbound (no address of that family)
+    std::size_t Bind(tcp::socket& socket, const tcp::endpoint& destination,
+                     const ba::ip::address& client, bs::error_code& ec);
+
+    void Release(std::size_t index);
+
+    // binds an open socket to source with the port choice deferred to
+    // connect(), as Bind() does; returns the errno of IP_BIND_ADDRESS_NO_PORT
+    // if that was refused (the bind then reserves a port), 0 otherwise
+    static int BindNoPort(tcp::socket& socket, const ba::ip::address& source,
+                          bs::error_code& ec);
+
+    const std::vector<std::unique_ptr<Usage>>& Addresses() const {
+        return usage_;
+    }
+
+    static Strategy ParseStrategy(const std::string& name);
+
+   private:
+    std::size_t Select(bool v4, const ba::ip::address& client);
+
+   private:
+    Strategy strategy_;
+    std::vector<std::unique_ptr<Usage>> usage_;
+    std::vector<std::size_t> v4_;
+    std::vector<std::size_t> v6_;
+    std::atomic<std::size_t> next_{0};
+};
+
+}  // namespace socks5
+
+#endif /* S5EGRESS_H */
@@ -0,0 +1,50 @@
+#include "s5histogram.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace socks5 {
+
+void Histogram::Merge(const Histogram& other) {
+    for (std::size_t i = 0; i < buckets; ++i) {
+        Bump(counts_[i], other.counts_[i].load(std::memory_order_relaxed));
+    }
+
+    Bump(count_, other.Count());
+    Bump(sum_, other.Sum());
+}
+
+uint64_t Histogram::Quantile(double quantile) const {
+    // the count is bumped after the bucket, so buckets may hold a few more
+    // values than count_ on a live copy, never fewer
+    const uint64_t count = Count();
+    if (!count) {
+        return 0;
+    }
+
+    const auto rank = std::max<uint64_t>(
+        1, static_cast<uint64_t>(std::ceil(quantile * count)));
+    uint64_t seen = 0;
+    for (std::size_t i = 0; i < buckets; ++i) {
+        seen += counts_[i].load(std::memory_order_relaxed);
+        if (seen >= rank) {
+            return HighestValue(i);
+        }
+    }
+
+    return HighestValue(buckets - 1);
+}
+
+uint64_t Histogram::HighestValue(std::size_t index) {
+    const std::size_t sub_buckets = std::size_t{1} << sub_bits;
+    if (index < sub_buckets) {
+        return index;
+    }
+
+    const unsigned shift = static_cast<unsigned>(index >> sub_bits) - 1;
+    const uint64_t lowest = (sub_buckets + (index & (sub_buckets - 1)))
+                            << shift;
+    return lowest + (uint64_t{1} << shift) - 1;
+}
+
+}  // namespace socks5
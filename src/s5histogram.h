@@ -0,0 +1,85 @@
+#ifndef S5HISTOGRAM_H
+#define S5HISTOGRAM_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace socks5 {
+
+// Log-linear histogram in the style of HdrHistogram: values below
+// 2^sub_bits get a bucket each, above that every power of two is split into
+// 2^sub_bits equal buckets, so a bucket is never wider than 1/32 (3%) of the
+// values in it. Values from 2^max_bits on land in the last bucket.
+//
+// Record() is a bucket index (count leading zeros, a shift) and relaxed
+// load+store pairs, no allocation: every recording thread owns its copy,
+// readers Merge() the copies.
+class Histogram {
+   public:
+    static const unsigned sub_bits = 5;
+    static const unsigned max_bits = 40;  // ~18 minutes in nanoseconds
+    static const std::size_t buckets = (max_bits - sub_bits + 1)
+                                       << sub_bits;
+
+    // from the owning thread only
+    void Record(uint64_t value) {
+        Bump(counts_[Index(value)], 1);
+        Bump(count_, 1);
+        Bump(sum_, value);
+    }
+
+    // adds other's counts, this must not be recorded into meanwhile
+    void Merge(const Histogram& other);
+
+    uint64_t Count() const { return count_.load(std::memory_order_relaxed); }
+
+    uint64_t Sum() const { return sum_.load(std::memory_order_relaxed); }
+
+    // highest value of the bucket holding the quantile (0..1), 0 if empty
+    uint64_t Quantile(double quantile) const;
+
+    static std::size_t Index(uint64_t value) {
+        if (value < (uint64_t{1} << sub_bits)) {
+            return static_cast<std::size_t>(value);
+        }
+
+        if (value >= (uint64_t{1} << max_bits)) {
+            return buckets - 1;
+        }
+
+        const unsigned shift = HighestBit(value) - sub_bits;
+        const auto sub_bucket = static_cast<std::size_t>(
+            (value >> shift) & ((uint64_t{1} << sub_bits) - 1));
+        return ((shift + 1) << sub_bits) + sub_bucket;
+    }
+
+    static uint64_t HighestValue(std::size_t index);
+
+   private:
+    static unsigned HighestBit(uint64_t value) {
+#if defined(__GNUC__)
+        return 63 - static_cast<unsigned>(__builtin_clzll(value));
+#else
+        unsigned bit = 0;
+        while (value >>= 1) {
+            ++bit;
+        }
+        return bit;
+#endif
+    }
+
+    static void Bump(std::atomic<uint64_t>& value, uint64_t n) {
+        value.store(value.load(std::memory_order_relaxed) + n,
+                    std::memory_order_relaxed);
+    }
+
+   private:
+    std::atomic<uint64_t> counts_[buckets]{};
+    std::atomic<uint64_t> count_{0};
+    std::atomic<uint64_t> sum_{0};
+};
+
+}  // namespace socks5
+
+#endif /* S5HISTOGRAM_H */
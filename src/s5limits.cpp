@@ -0,0 +1,88 @@
+#include "s5limits.h"
+
+#include <algorithm>
+
+namespace socks5 {
+
+std::size_t ConnectionLimits::AddressKeyHash::operator()(
+    const AddressKey& key) const {
+    // fnv-1a & a final mix, the shards use the high bits
+    uint64_t hash = 14695981039346656037ull;
+    for (const unsigned char byte : key) {
+        hash = (hash ^ byte) * 1099511628211ull;
+    }
+
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdull;
+    hash ^= hash >> 33;
+    return static_cast<std::size_t>(hash);
+}
+
+ConnectionLimits::AddressKey ConnectionLimits::MakeKey(
+    const ba::ip::address& address, bool network) {
+    AddressKey key;
+    bool v4 = address.is_v4();
+    if (v4) {
+        key = ba::ip::address_v6::v4_mapped(address.to_v4()).to_bytes();
+    } else {
+        key = address.to_v6().to_bytes();
+        v4 = address.to_v6().is_v4_mapped();
+    }
+
+    if (network) {
+        // /24 of ipv4, /64 of ipv6
+        std::fill(key.begin() + (v4 ? 15 : 8), key.end(), 0);
+    }
+
+    return key;
+}
+
+bool ConnectionLimits::AcquireAddress(const ba::ip::address& address) {
+    if (config_.per_address &&
+        !addresses_.TryAcquire(MakeKey(address, false), config_.per_address)) {
+        stats_.address.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    if (config_.per_network &&
+        !networks_.TryAcquire(MakeKey(address, true), config_.per_network)) {
+        if (config_.per_address) {
+            addresses_.Release(MakeKey(address, false));
+        }
+        stats_.network.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    return true;
+}
+
+void ConnectionLimits::ReleaseAddress(const ba::ip::address& address) {
+    if (config_.per_address) {
+        addresses_.Release(MakeKey(address, false));
+    }
+
+    if (config_.per_network) {
+        networks_.Release(MakeKey(address, true));
+    }
+}
+
+bool ConnectionLimits::AcquireUser(const std::string& user) {
+    if (config_.per_user && !users_.TryAcquire(user, config_.per_user)) {
+        stats_.user.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    return true;
+}
+
+void ConnectionLimits::ReleaseUser(const std::string& user) {
+    if (config_.per_user) {
+        users_.Release(user);
+    }
+}
+
+std::size_t ConnectionLimits::Tracked() {
+    return addresses_.Size() + networks_.Size() + users_.Size();
+}
+
+}  // namespace socks5
@@ -0,0 +1,131 @@
+#ifndef S5LIMITS_H
+#define S5LIMITS_H
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include <boost/asio.hpp>
+
+namespace ba = boost::asio;
+
+namespace socks5 {
+
+// Concurrent key -> count map split into shards with a lock each, so event
+// loops counting different keys rarely meet on a lock or a cache line.
+template <typename Key, typename Hash = std::hash<Key>>
+class ShardedCounter {
+   public:
+    // counts key unless it's already at limit, false (& nothing counted)
+    // if it is
+    bool TryAcquire(const Key& key, uint32_t limit) {
+        Shard& shard = GetShard(key);
+        std::lock_guard<std::mutex> lock{shard.mutex};
+
+        uint32_t& count = shard.counts[key];
+        if (count >= limit) {
+            if (count == 0) {
+                shard.counts.erase(key);
+            }
+            return false;
+        }
+
+        ++count;
+        return true;
+    }
+
+    void Release(const Key& key) {
+        Shard& shard = GetShard(key);
+        std::lock_guard<std::mutex> lock{shard.mutex};
+
+        const auto it = shard.counts.find(key);
+        if (it != shard.counts.end() && --it->second == 0) {
+            shard.counts.erase(it);
+        }
+    }
+
+    // keys with a non-zero count
+    std::size_t Size() {
+        std::size_t size = 0;
+        for (Shard& shard : shards_) {
+            std::lock_guard<std::mutex> lock{shard.mutex};
+            size += shard.counts.size();
+        }
+        return size;
+    }
+
+   private:
+    struct Shard {
+        std::mutex mutex;
+        std::unordered_map<Key, uint32_t, Hash> counts;
+        char padding[64];
+    };
+
+    static const std::size_t shard_count = 64;
+
+    Shard& GetShard(const Key& key) {
+        // the map uses the low bits of the same hash, take the high ones
+        const std::size_t hash = Hash{}(key);
+        return shards_[(hash >> (sizeof(std::size_t) * 8 - 6)) % shard_count];
+    }
+
+   private:
+    std::array<Shard, shard_count> shards_;
+};
+
+// Concurrent sessions per client address, per client network (/24 for ipv4,
+// /64 for ipv6) & per user. Addresses are counted right after accept, users
+// after auth; a session over a limit is refused & isn't counted.
+class ConnectionLimits {
+   public:
+    struct Config {
+        uint32_t per_address = 0;  // 0 = unlimited
+        uint32_t per_network = 0;
+        uint32_t per_user = 0;
+    };
+
+    // refusals by limit
+    struct Stats {
+        std::atomic<uint64_t> address{0};
+        std::atomic<uint64_t> network{0};
+        std::atomic<uint64_t> user{0};
+    };
+
+    explicit ConnectionLimits(const Config& config) : config_(config) {}
+
+    bool AcquireAddress(const ba::ip::address& address);
+    void ReleaseAddress(const ba::ip::address& address);
+
+    bool AcquireUser(const std::string& user);
+    void ReleaseUser(const std::string& user);
+
+    const Stats& GetStats() const { return stats_; }
+
+    // addresses, networks & users with sessions
+    std::size_t Tracked();
+
+   private:
+    // ipv4 as v4-mapped ipv6, masked to the prefix length
+    using AddressKey = std::array<unsigned char, 16>;
+
+    struct AddressKeyHash {
+        std::size_t operator()(const AddressKey& key) const;
+    };
+
+    static AddressKey MakeKey(const ba::ip::address& address, bool network);
+
+   private:
+    const Config config_;
+    ShardedCounter<AddressKey, AddressKeyHash> addresses_;
+    ShardedCounter<AddressKey, AddressKeyHash> networks_;
+    ShardedCounter<std::string> users_;
+    Stats stats_;
+};
+
+}  // namespace socks5
+
+#endif /* S5LIMITS_H */
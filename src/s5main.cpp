@@ -1,29 +1,216 @@
+#include <chrono>
 #include <iostream>
+#include <thread>
 
 #include <boost/asio.hpp>
 #include <boost/asio/signal_set.hpp>
 #include <boost/log/core.hpp>
 #include <boost/log/expressions.hpp>
 #include <boost/log/trivial.hpp>
+#include <boost/program_options.hpp>
 
+#include "s5options.h"
 #include "s5server.h"
 
-void run(boost::asio::io_service& io, uint16_t port) {
-    boost::asio::ip::tcp::endpoint ep(boost::asio::ip::tcp::v4(), port);
-    socks5::Server s{io, ep};
+namespace po = boost::program_options;
+
+void run(boost::asio::io_service& io, const socks5::Options& options) {
+    socks5::Server s{io, options};
     io.run();
 }
 
+bool parse_options(int argc, char* argv[], socks5::Options& options,
+                   boost::log::trivial::severity_level& log_level) {
+    po::options_description desc("Options");
+    // clang-format off
+    desc.add_options()
+        ("help,h", "print this message")
+        ("port", po::value(&options.port)->required(),
+         "port to accept socks5 clients on")
+        ("threads",
+         po::value(&options.threads)->default_value(options.threads),
+         "event loops to spread sessions over, each on its own thread")
+        ("tunnel-peer", po::value(&options.tunnel_peer),
+         "carry client streams to this s5server (host:port)")
+        ("tunnel-connections",
+         po::value(&options.tunnel_connections)
+             ->default_value(options.tunnel_connections),
+         "persistent connections to the tunnel peer")
+        ("tunnel-port", po::value(&options.tunnel_port),
+         "accept tunnel connections from peers on this port, which relay "
+         "without auth or limits; peers are checked against the --acl "
+         "source rules")
+        ("tunnel-address",
+         po::value(&options.tunnel_address)
+             ->default_value(options.tunnel_address),
+         "address the tunnel port listens on")
+        ("egress-address",
+         po::value(&options.egress_addresses)->composing(),
+         "local source address for upstream connections (repeatable)")
+        ("egress-strategy",
+         po::value(&options.egress_strategy)
+             ->default_value(options.egress_strategy),
+         "egress address selection: round-robin or hash (by client)")
+        ("connect-timeout",
+         po::value(&options.connect_timeout)
+             ->default_value(options.connect_timeout),
+         "milliseconds to resolve & connect a destination before replying "
+         "with a failure")
+        ("dns-ttl",
+         po::value(&options.dns_ttl)->default_value(options.dns_ttl),
+         "seconds to cache resolved hostnames, 0 (default) to disable the "
+         "cache")
+        ("dns-cache-size",
+         po::value(&options.dns_cache_size)
+             ->default_value(options.dns_cache_size),
+         "max cached hostnames")
+        ("dns-refresh-hits",
+         po::value(&options.dns_refresh_hits)
+             ->default_value(options.dns_refresh_hits),
+         "hits within a ttl that get a hostname refreshed before it expires")
+        ("dns-refresh-max",
+         po::value(&options.dns_refresh_max)
+             ->default_value(options.dns_refresh_max),
+         "max hostnames refreshed at once")
+        ("dns-snapshot", po::value(&options.dns_snapshot),
+         "file to persist the dns cache to, loaded on start")
+        ("dns-snapshot-interval",
+         po::value(&options.dns_snapshot_interval)
+             ->default_value(options.dns_snapshot_interval),
+         "seconds between dns cache snapshots, 0 to write one on exit "
+         "only")
+        ("acl", po::value(&options.acl),
+         "file with allow/deny rules for source & destination addresses")
+        ("domain-acl", po::value(&options.domain_acl),
+         "file with allow/deny rules for destination domains, as text or "
+         "compiled by s5domains")
+        ("users", po::value(&options.users),
+         "file with \"<user> <password>\" lines, requires username/password "
+         "auth")
+        ("routes", po::value(&options.routes),
+         "file routing destinations direct, via a parent proxy, from an "
+         "egress address or to rejection")
+        ("user-rate", po::value(&options.user_rate),
+         "bytes per second relayed for each user, all sessions together")
+        ("ip-rate", po::value(&options.ip_rate),
+         "bytes per second relayed for each client address, all sessions "
+         "together")
+        ("rate-burst", po::value(&options.rate_burst),
+         "bytes a user or address may burst above its rate, default one "
+         "second's worth")
+        ("max-conns-per-ip", po::value(&options.max_conns_per_ip),
+         "concurrent sessions per client address")
+        ("max-conns-per-net", po::value(&options.max_conns_per_net),
+         "concurrent sessions per client /24 (ipv4) or /64 (ipv6)")
+        ("max-conns-per-user", po::value(&options.max_conns_per_user),
+         "concurrent sessions per user")
+        ("memory-soft-limit", po::value(&options.memory_soft_limit),
+         "MiB of session memory above which accepting slows down")
+        ("memory-hard-limit", po::value(&options.memory_hard_limit),
+         "MiB of session memory above which new handshakes are refused")
+        ("drr-quantum",
+         po::value(&options.drr_quantum)->default_value(options.drr_quantum),
+         "bytes a session may relay per direction & scheduling round, 0 "
+         "(default) to relay unscheduled")
+        ("drr-bulk-after",
+         po::value(&options.drr_bulk_after)
+             ->default_value(options.drr_bulk_after),
+         "bytes after which a flow yields to interactive ones, 0 for a "
+         "single class")
+        ("accounting-file", po::value(&options.accounting_file),
+         "append traffic per user & destination to this csv file")
+        ("accounting-interval",
+         po::value(&options.accounting_interval)
+             ->default_value(options.accounting_interval),
+         "seconds between accounting records")
+        ("accounting-max-size",
+         po::value(&options.accounting_max_size)
+             ->default_value(options.accounting_max_size),
+         "MiB after which the accounting file is rotated")
+        ("accounting-keep",
+         po::value(&options.accounting_keep)
+             ->default_value(options.accounting_keep),
+         "rotated accounting files to keep")
+        ("flight-events",
+         po::value(&options.flight_events)
+             ->default_value(options.flight_events),
+         "session events recorded per thread (e.g. 16384), 0 (default) to "
+         "disable")
+        ("flight-sessions",
+         po::value(&options.flight_sessions)
+             ->default_value(options.flight_sessions),
+         "sessions in a flight recorder dump (SIGUSR1, admin /flight)")
+        ("admin-port", po::value(&options.admin_port),
+         "serve prometheus metrics over http on this port at /metrics")
+        ("admin-address",
+         po::value(&options.admin_address)
+             ->default_value(options.admin_address),
+         "address the admin port listens on")
+        ("stats-interval",
+         po::value(&options.stats_interval)
+             ->default_value(options.stats_interval),
+         "log statistics every N seconds, 0 to disable")
+        ("log-level", po::value(&log_level)->default_value(log_level),
+         "least severe messages logged: trace, debug, info, warning, error "
+         "or fatal (sessions are logged at info)");
+    // clang-format on
+
+    po::positional_options_description positional;
+    positional.add("port", 1);
+
+    try {
+        po::variables_map vm;
+        po::store(po::command_line_parser(argc, argv)
+                      .options(desc)
+                      .positional(positional)
+                      .run(),
+                  vm);
+
+        if (vm.count("help")) {
+            std::cout << "Usage: " << argv[0] << " <port> [options]\n"
+                      << desc;
+            return false;
+        }
+
+        po::notify(vm);
+
+        if (options.threads == 0) {
+            throw po::error("--threads must be at least 1");
+        }
+
+        if (!options.tunnel_peer.empty() &&
+            options.tunnel_peer.rfind(':') == std::string::npos) {
+            throw po::error("--tunnel-peer must be host:port");
+        }
+
+        if (!options.dns_snapshot.empty() && options.dns_ttl == 0) {
+            throw po::error("--dns-snapshot needs the cache, set --dns-ttl");
+        }
+
+        // tunnel streams are driven by the loop of the tunnel connections
+        if (!options.tunnel_peer.empty() && options.threads > 1) {
+            throw po::error("--tunnel-peer needs --threads 1");
+        }
+    } catch (po::error& e) {
+        std::cout << e.what() << "\n\n"
+                  << "Usage: " << argv[0] << " <port> [options]\n"
+                  << desc;
+        return false;
+    }
+
+    return true;
+}
+
 int main(int argc, char* argv[]) {
-    if (argc < 2) {
-        std::cout << "Usage: " << argv[0] << " <port>\n";
+    socks5::Options options;
+    boost::log::trivial::severity_level log_level = boost::log::trivial::info;
+    if (!parse_options(argc, argv, options, log_level)) {
         return 1;
     }
 
     boost::log::core::get()->set_filter(boost::log::trivial::severity >=
-                                        boost::log::trivial::info);
+                                        log_level);
 
-    const uint16_t port = std::atoi(argv[1]);
     boost::asio::io_service io;
 
     // stop io service on SIGINT/SIGTERM
@@ -34,10 +221,13 @@ int main(int argc, char* argv[]) {
     // restart server until io service isn't stopped & log exceptions
     do {
         try {
-            run(io, port);
+            run(io, options);
         } catch (std::exception& e) {
             BOOST_LOG_TRIVIAL(error) << "exception: " << e.what();
             BOOST_LOG_TRIVIAL(info) << "restart server...";
+
+            // a server that fails to start fails again right away
+            std::this_thread::sleep_for(std::chrono::seconds{1});
         }
     } while (!io.stopped());
 
@@ -0,0 +1,208 @@
+#include "s5metrics.h"
+
+#include <sstream>
+
+namespace socks5 {
+
+Metrics::Metrics(std::size_t shards) {
+    for (std::size_t i = 0; i < shards; ++i) {
+        shards_.push_back(std::make_unique<Shard>());
+    }
+}
+
+void Metrics::AddSource(Source source) {
+    sources_.push_back(std::move(source));
+}
+
+uint64_t Metrics::Get(Counter counter) const {
+    uint64_t sum = 0;
+    for (const auto& shard : shards_) {
+        sum += shard->counters_[static_cast<unsigned>(counter)].load(
+            std::memory_order_relaxed);
+    }
+
+    return sum;
+}
+
+int64_t Metrics::Get(Gauge gauge) const {
+    int64_t sum = 0;
+    for (const auto& shard : shards_) {
+        sum += shard->gauges_[static_cast<unsigned>(gauge)].load(
+            std::memory_order_relaxed);
+    }
+
+    return sum;
+}
+
+uint64_t Metrics::GetReplies(socks5::Reply reply) const {
+    const auto code = static_cast<unsigned>(reply);
+    uint64_t sum = 0;
+    for (const auto& shard : shards_) {
+        sum += code < replies
+                   ? shard->replies_[code].load(std::memory_order_relaxed)
+                   : 0;
+    }
+
+    return sum;
+}
+
+void Metrics::Merge(Phase phase, Histogram& into) const {
+    for (const auto& shard : shards_) {
+        into.Merge(shard->histograms_[static_cast<unsigned>(phase)]);
+    }
+}
+
+std::string Metrics::Render() const {
+    std::ostringstream out;
+
+    Family(out, "s5_accepts_total", "counter", "Connections accepted.");
+    out << "s5_accepts_total " << Get(Counter::accepts) << '\n';
+
+    Family(out, "s5_handshakes_total", "counter",
+           "Socks5 handshakes by outcome.");
+    const struct {
+        const char* outcome;
+        Counter counter;
+    } outcomes[] = {
+        {"ok", Counter::handshake_ok},
+        {"refused", Counter::handshake_refused},
+        {"auth_failed", Counter::handshake_auth_failed},
+        {"error", Counter::handshake_error},
+        {"aborted", Counter::handshake_aborted},
+    };
+    for (const auto& outcome : outcomes) {
+        out << "s5_handshakes_total{outcome=\"" << outcome.outcome << "\"} "
+            << Get(outcome.counter) << '\n';
+    }
+
+    Family(out, "s5_active_sessions", "gauge", "Sessions open.");
+    out << "s5_active_sessions " << Get(Gauge::active_sessions) << '\n';
+
+    Family(out, "s5_relayed_bytes_total", "counter",
+           "Bytes relayed, up is client to destination.");
+    out << "s5_relayed_bytes_total{direction=\"up\"} "
+        << Get(Counter::bytes_up) << '\n'
+        << "s5_relayed_bytes_total{direction=\"down\"} "
+        << Get(Counter::bytes_down) << '\n';
+
+    Family(out, "s5_dns_lookups_total", "counter",
+           "Destination hostname lookups by result.");
+    out << "s5_dns_lookups_total{result=\"cache_hit\"} "
+        << Get(Counter::dns_cache_hit) << '\n'
+        << "s5_dns_lookups_total{result=\"resolved\"} "
+        << Get(Counter::dns_resolved) << '\n'
+        << "s5_dns_lookups_total{result=\"failed\"} "
+        << Get(Counter::dns_failed) << '\n';
+
+    Family(out, "s5_connects_total", "counter",
+           "Upstream connection attempts by result.");
+    out << "s5_connects_total{result=\"ok\"} " << Get(Counter::connect_ok)
+        << '\n'
+        << "s5_connects_total{result=\"failed\"} "
+        << Get(Counter::connect_failed) << '\n'
+        << "s5_connects_total{result=\"timeout\"} "
+        << Get(Counter::connect_timeout) << '\n';
+
+    Family(out, "s5_errors_total", "counter",
+           "Error replies sent to clients by socks5 reply code.");
+    for (unsigned code = 1; code < replies; ++code) {
+        const auto reply = static_cast<socks5::Reply>(code);
+        out << "s5_errors_total{reply=\"" << ReplyName(reply) << "\"} "
+            << GetReplies(reply) << '\n';
+    }
+
+    Family(out, "s5_phase_seconds", "summary",
+           "Session phase latency, quantiles within 3%.");
+    const double quantiles[] = {0.5, 0.99, 0.999};
+    for (unsigned i = 0; i < phases; ++i) {
+        const auto phase = static_cast<Phase>(i);
+        auto merged = std::make_unique<Histogram>();
+        Merge(phase, *merged);
+
+        const std::string labels =
+            std::string("phase=\"") + PhaseName(phase) + '"';
+        for (const double quantile : quantiles) {
+            out << "s5_phase_seconds{" << labels << ",quantile=\""
+                << quantile << "\"} " << merged->Quantile(quantile) / 1e9
+                << '\n';
+        }
+        out << "s5_phase_seconds_sum{" << labels << "} "
+            << merged->Sum() / 1e9 << '\n'
+            << "s5_phase_seconds_count{" << labels << "} " << merged->Count()
+            << '\n';
+    }
+
+    for (const auto& source : sources_) {
+        source(out);
+    }
+
+    return out.str();
+}
+
+void Metrics::Family(std::ostream& out, const char* name, const char* type,
+                     const char* help) {
+    out << "# HELP " << name << ' ' << help << '\n'
+        << "# TYPE " << name << ' ' << type << '\n';
+}
+
+std::string Metrics::LabelValue(const std::string& text) {
+    std::string escaped;
+    for (const char c : text) {
+        if (c == '\\' || c == '"') {
+            escaped += '\\';
+            escaped += c;
+        } else if (c == '\n') {
+            escaped += "\\n";
+        } else {
+            escaped += c;
+        }
+    }
+
+    return escaped;
+}
+
+const char* Metrics::ReplyName(socks5::Reply reply) {
+    switch (reply) {
+        case socks5::Reply::succeeded:
+            return "succeeded";
+        case socks5::Reply::general_socks_server_failure:
+            return "general_socks_server_failure";
+        case socks5::Reply::connection_not_allowed_by_ruleset:
+            return "connection_not_allowed_by_ruleset";
+        case socks5::Reply::network_unreachable:
+            return "network_unreachable";
+        case socks5::Reply::host_unreachable:
+            return "host_unreachable";
+        case socks5::Reply::connection_refused:
+            return "connection_refused";
+        case socks5::Reply::ttl_expired:
+            return "ttl_expired";
+        case socks5::Reply::command_not_supported:
+            return "command_not_supported";
+        case socks5::Reply::address_type_not_supported:
+            return "address_type_not_supported";
+    }
+
+    return "unknown";
+}
+
+const char* Metrics::PhaseName(Phase phase) {
+    switch (phase) {
+        case Phase::greeting:
+            return "greeting";
+        case Phase::request:
+            return "request";
+        case Phase::resolve:
+            return "resolve";
+        case Phase::connect:
+            return "connect";
+        case Phase::first_byte:
+            return "first_byte";
+        case Phase::count:
+            break;
+    }
+
+    return "unknown";
+}
+
+}  // namespace socks5
@@ -0,0 +1,144 @@
+#ifndef S5METRICS_H
+#define S5METRICS_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <socks/socks5.h>
+
+#include "s5histogram.h"
+
+namespace socks5 {
+
+// Server metrics in the Prometheus text format. Every event loop counts into
+// a shard of its own, a cache line apart from the others, with plain
+// relaxed loads & stores (no locked instructions); a scrape sums the shards.
+// Session phase latencies go to a histogram per phase & shard, merged the
+// same way.
+class Metrics {
+   public:
+    enum class Counter : unsigned {
+        accepts,
+        handshake_ok,
+        handshake_refused,      // connection or memory limits
+        handshake_auth_failed,  // no acceptable method or bad credentials
+        handshake_error,        // an error reply to the request
+        handshake_aborted,      // closed before a reply
+        bytes_up,               // client -> upstream
+        bytes_down,             // upstream -> client
+        dns_cache_hit,
+        dns_resolved,
+        dns_failed,
+        connect_ok,
+        connect_failed,
+        connect_timeout,
+        count
+    };
+
+    enum class Gauge : unsigned { active_sessions, count };
+
+    enum class Phase : unsigned {
+        greeting,    // accepted -> greeting read
+        request,     // auth done -> request read
+        resolve,     // destination hostname lookup
+        connect,     // a connect attempt
+        first_byte,  // accepted -> first byte from upstream
+        count
+    };
+
+    static const unsigned counters = static_cast<unsigned>(Counter::count);
+    static const unsigned gauges = static_cast<unsigned>(Gauge::count);
+    static const unsigned phases = static_cast<unsigned>(Phase::count);
+
+    // socks5::Reply codes counted, higher ones aren't sent
+    static const unsigned replies = 9;
+
+    // per event loop, written from that loop's thread only
+    class Shard {
+       public:
+        void Add(Counter counter, uint64_t n = 1) {
+            Bump(counters_[static_cast<unsigned>(counter)], n);
+        }
+
+        void Add(Gauge gauge, int64_t n) {
+            auto& value = gauges_[static_cast<unsigned>(gauge)];
+            value.store(value.load(std::memory_order_relaxed) + n,
+                        std::memory_order_relaxed);
+        }
+
+        void Record(Phase phase, std::chrono::nanoseconds duration) {
+            histograms_[static_cast<unsigned>(phase)].Record(
+                static_cast<uint64_t>(std::max<std::chrono::nanoseconds::rep>(
+                    duration.count(), 0)));
+        }
+
+        void AddReply(socks5::Reply reply) {
+            const auto code = static_cast<unsigned>(reply);
+            if (code < replies) {
+                Bump(replies_[code], 1);
+            }
+        }
+
+       private:
+        friend class Metrics;
+
+        static void Bump(std::atomic<uint64_t>& value, uint64_t n) {
+            value.store(value.load(std::memory_order_relaxed) + n,
+                        std::memory_order_relaxed);
+        }
+
+       private:
+        char padding_before_[64];
+        std::atomic<uint64_t> counters_[counters]{};
+        std::atomic<int64_t> gauges_[gauges]{};
+        std::atomic<uint64_t> replies_[replies]{};
+        Histogram histograms_[phases];
+        char padding_after_[64];
+    };
+
+    // writes families kept by other components, on the scraping thread
+    using Source = std::function<void(std::ostream&)>;
+
+    explicit Metrics(std::size_t shards);
+
+    // appended to every Render(), in the order added
+    void AddSource(Source source);
+
+    Shard& GetShard(std::size_t index) { return *shards_[index]; }
+
+    uint64_t Get(Counter counter) const;
+    int64_t Get(Gauge gauge) const;
+    uint64_t GetReplies(socks5::Reply reply) const;
+
+    // adds the phase's histograms of all shards to into
+    void Merge(Phase phase, Histogram& into) const;
+
+    // text exposition format 0.0.4
+    std::string Render() const;
+
+    // the HELP & TYPE lines of a family
+    static void Family(std::ostream& out, const char* name, const char* type,
+                       const char* help);
+
+    // text escaped for use between the quotes of a label
+    static std::string LabelValue(const std::string& text);
+
+    static const char* ReplyName(socks5::Reply reply);
+
+    static const char* PhaseName(Phase phase);
+
+   private:
+    std::vector<std::unique_ptr<Shard>> shards_;
+    std::vector<Source> sources_;
+};
+
+}  // namespace socks5
+
+#endif /* S5METRICS_H */
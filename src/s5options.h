@@ -0,0 +1,105 @@
+#ifndef S5OPTIONS_H
+#define S5OPTIONS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace socks5 {
+
+// Server configuration, filled from the command line in s5main.cpp. The
+// acl, domain_acl, users & routes files are read again on SIGHUP.
+struct Options {
+    uint16_t port = 1080;
+
+    // event loops, each on its own thread
+    unsigned threads = 1;
+
+    // server-to-server tunnel: carry client streams to a peer s5server
+    // ("host:port") instead of connecting upstream directly
+    std::string tunnel_peer;
+    std::size_t tunnel_connections = 4;
+
+    // accept tunnel connections from peers on this port (0 = disabled) &
+    // address; peers relay without auth or limits, so only trusted ones
+    // should reach it
+    uint16_t tunnel_port = 0;
+    std::string tunnel_address = "127.0.0.1";
+
+    // local source addresses for upstream sockets, "round-robin" or "hash"
+    std::vector<std::string> egress_addresses;
+    std::string egress_strategy = "round-robin";
+
+    // deadline for resolving & connecting to a destination, milliseconds
+    unsigned connect_timeout = 10000;
+
+    // dns cache: entry lifetime in seconds (0 = no cache), max entries,
+    // hits per lifetime that make an entry hot enough to be refreshed ahead
+    // of expiry & how many refreshes may run at once
+    unsigned dns_ttl = 0;
+    std::size_t dns_cache_size = 10000;
+    unsigned dns_refresh_hits = 3;
+    std::size_t dns_refresh_max = 16;
+
+    // persist the dns cache to this file every N seconds & load it on start
+    std::string dns_snapshot;
+    unsigned dns_snapshot_interval = 60;
+
+    // source & destination address rules, see acl::RuleSet
+    std::string acl;
+
+    // destination hostname rules, see acl::DomainRules
+    std::string domain_acl;
+
+    // require username/password auth against this user file
+    std::string users;
+
+    // per destination route, see Routes
+    std::string routes;
+
+    // relay bandwidth per user & per client address in bytes per second
+    // (0 = unlimited), bucket size in bytes (0 = one second's worth)
+    uint64_t user_rate = 0;
+    uint64_t ip_rate = 0;
+    uint64_t rate_burst = 0;
+
+    // concurrent sessions per client address, per client /24 (ipv4) or /64
+    // (ipv6) & per user, 0 = unlimited
+    uint32_t max_conns_per_ip = 0;
+    uint32_t max_conns_per_net = 0;
+    uint32_t max_conns_per_user = 0;
+
+    // session memory in MiB above which accepting slows down / new
+    // handshakes are refused, 0 = no limit
+    std::size_t memory_soft_limit = 0;
+    std::size_t memory_hard_limit = 0;
+
+    // fair relaying per event loop: bytes a session direction may relay per
+    // round (0 = off) & bytes after which it's served as bulk (0 = never)
+    std::size_t drr_quantum = 0;
+    uint64_t drr_bulk_after = 1024 * 1024;
+
+    // per user & destination traffic, appended to this csv file every N
+    // seconds, rotated at max size (MiB) keeping this many old files
+    std::string accounting_file;
+    unsigned accounting_interval = 60;
+    std::size_t accounting_max_size = 64;
+    unsigned accounting_keep = 5;
+
+    // session state transitions kept per event loop (0 = none) & sessions
+    // traced by a dump, on SIGUSR1 & at the admin endpoint's /flight
+    std::size_t flight_events = 0;
+    std::size_t flight_sessions = 100;
+
+    // http endpoint for operators (0 = disabled): /metrics, /flight
+    uint16_t admin_port = 0;
+    std::string admin_address = "127.0.0.1";
+
+    // log server statistics every N seconds (0 = never)
+    unsigned stats_interval = 60;
+};
+
+}  // namespace socks5
+
+#endif /* S5OPTIONS_H */
@@ -0,0 +1,147 @@
+#include "s5policy.h"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+namespace socks5 {
+
+std::unique_ptr<Credentials> Credentials::Load(const std::string& path) {
+    std::ifstream in{path};
+    if (!in) {
+        throw std::runtime_error("can't open user file " + path);
+    }
+
+    return Parse(in, path);
+}
+
+std::unique_ptr<Credentials> Credentials::Parse(std::istream& in,
+                                                const std::string& name) {
+    auto credentials = std::make_unique<Credentials>();
+
+    std::string line;
+    for (std::size_t number = 1; std::getline(in, line); ++number) {
+        std::istringstream fields{line.substr(0, line.find('#'))};
+
+        std::string user;
+        if (!(fields >> user)) {
+            continue;  // blank
+        }
+
+        // both are sent with a one byte length
+        std::string password;
+        if (!(fields >> password) || user.size() > 255 ||
+            password.size() > 255) {
+            throw std::runtime_error(name + ':' + std::to_string(number) +
+                                     ": expected <user> <password>");
+        }
+
+        credentials->users_[user] = password;
+    }
+
+    return credentials;
+}
+
+bool Credentials::Check(const std::string& user,
+                        const std::string& password) const {
+    const auto it = users_.find(user);
+    return it != users_.end() && it->second == password;
+}
+
+std::unique_ptr<Policy> Policy::Load(const Options& options) {
+    auto policy = std::make_unique<Policy>();
+
+    if (!options.acl.empty()) {
+        policy->acl = acl::RuleSet::Load(options.acl);
+    }
+
+    if (!options.domain_acl.empty()) {
+        policy->domains = acl::DomainRules::Load(options.domain_acl);
+    }
+
+    if (!options.users.empty()) {
+        policy->users = Credentials::Load(options.users);
+    }
+
+    if (!options.routes.empty()) {
+        policy->routes = Routes::Load(options.routes);
+    }
+
+    return policy;
+}
+
+const Policy* PolicyStore::Reader::Acquire() {
+    if (held_.empty()) {
+        // announce before loading the pointer, see the class comment
+        pinned_.store(store_.epoch_.load());
+    }
+
+    const Policy* policy = store_.current_.load();
+    ++held_[policy->version];
+    Announce();
+    return policy;
+}
+
+void PolicyStore::Reader::Release(const Policy* policy) {
+    const auto it = held_.find(policy->version);
+    if (--it->second == 0) {
+        held_.erase(it);
+    }
+
+    Announce();
+}
+
+void PolicyStore::Reader::Announce() {
+    pinned_.store(held_.empty() ? idle : held_.begin()->first);
+}
+
+PolicyStore::PolicyStore(std::unique_ptr<Policy> policy, std::size_t readers)
+    : current_{nullptr}, epoch_{0} {
+    policy->version = next_version_++;
+    epoch_ = policy->version;
+    current_ = policy.release();
+
+    for (std::size_t i = 0; i < readers; ++i) {
+        readers_.push_back(std::make_unique<Reader>(*this));
+    }
+}
+
+PolicyStore::~PolicyStore() {
+    delete current_.load();
+    for (const Policy* policy : retired_) {
+        delete policy;
+    }
+}
+
+void PolicyStore::Publish(std::unique_ptr<Policy> policy) {
+    std::lock_guard<std::mutex> lock{mutex_};
+
+    policy->version = next_version_++;
+    const uint64_t version = policy->version;
+    retired_.push_back(current_.exchange(policy.release()));
+    epoch_.store(version);
+}
+
+std::size_t PolicyStore::Reclaim() {
+    std::lock_guard<std::mutex> lock{mutex_};
+
+    uint64_t oldest = Reader::idle;
+    for (const auto& reader : readers_) {
+        oldest = std::min(oldest, reader->pinned_.load());
+    }
+
+    std::vector<const Policy*> reachable;
+    for (const Policy* policy : retired_) {
+        if (policy->version < oldest) {
+            delete policy;
+        } else {
+            reachable.push_back(policy);
+        }
+    }
+
+    retired_.swap(reachable);
+    return retired_.size();
+}
+
+}  // namespace socks5
@@ -0,0 +1,121 @@
+#ifndef S5POLICY_H
+#define S5POLICY_H
+
+#include <atomic>
+#include <cstdint>
+#include <istream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "acl.h"
+#include "domain_acl.h"
+#include "s5options.h"
+#include "s5routes.h"
+
+namespace socks5 {
+
+// User file for username/password auth (RFC 1929), one "<user> <password>"
+// per line, '#' starts a comment.
+class Credentials {
+   public:
+    // throw std::runtime_error naming the offending line
+    static std::unique_ptr<Credentials> Load(const std::string& path);
+    static std::unique_ptr<Credentials> Parse(std::istream& in,
+                                              const std::string& name);
+
+    bool Check(const std::string& user, const std::string& password) const;
+
+    std::size_t Size() const { return users_.size(); }
+
+   private:
+    std::unordered_map<std::string, std::string> users_;
+};
+
+// Everything a session decides with, loaded from the files named in Options.
+// Immutable once published, absent parts are nullptr.
+struct Policy {
+    uint64_t version = 0;  // assigned by PolicyStore::Publish()
+
+    std::unique_ptr<acl::RuleSet> acl;
+    std::unique_ptr<acl::DomainRules> domains;
+    std::unique_ptr<Credentials> users;
+    std::unique_ptr<Routes> routes;
+
+    // throws std::runtime_error
+    static std::unique_ptr<Policy> Load(const Options& options);
+};
+
+// Publishes policy versions to the event loops without locks on the session
+// path, RCU style: a new version replaces the current one with an atomic
+// pointer swap, sessions keep the version they started with, and replaced
+// versions are freed once no session can hold them.
+//
+// Reclamation is epoch based with the version as the epoch. Every event loop
+// has a Reader announcing the oldest version its sessions hold (or idle);
+// a retired version older than every announcement is unreachable. A reader
+// announces the version it's about to pin before loading the pointer, so a
+// concurrent swap is either seen or covered by the announcement.
+class PolicyStore {
+   public:
+    // one per event loop, used from that loop's thread only
+    class Reader {
+       public:
+        explicit Reader(PolicyStore& store) : store_(store) {}
+
+        // pins the current version until Release()
+        const Policy* Acquire();
+
+        void Release(const Policy* policy);
+
+       private:
+        friend class PolicyStore;
+
+        static const uint64_t idle = UINT64_MAX;
+
+        void Announce();
+
+       private:
+        // oldest version held, read by Reclaim(); padded to a cache line of
+        // its own so loops don't share one
+        char padding_before_[64];
+        std::atomic<uint64_t> pinned_{idle};
+        char padding_after_[64 - sizeof(std::atomic<uint64_t>)];
+
+        PolicyStore& store_;
+        std::map<uint64_t, std::size_t> held_;  // version -> sessions
+    };
+
+    PolicyStore(std::unique_ptr<Policy> policy, std::size_t readers);
+
+    ~PolicyStore();
+
+    Reader& GetReader(std::size_t index) { return *readers_[index]; }
+
+    // thread safe, retires the replaced version
+    void Publish(std::unique_ptr<Policy> policy);
+
+    // Current() & Reclaim() belong to the owning thread: only Reclaim()
+    // frees, so what Current() returned stays valid on that thread until
+    // the next Reclaim()
+    const Policy* Current() const { return current_.load(); }
+
+    // frees unreachable retired versions, returns how many are left
+    std::size_t Reclaim();
+
+   private:
+    std::atomic<const Policy*> current_;
+    std::atomic<uint64_t> epoch_;  // version of current_
+    std::vector<std::unique_ptr<Reader>> readers_;
+
+    std::mutex mutex_;  // publishers & Reclaim() only
+    uint64_t next_version_ = 1;
+    std::vector<const Policy*> retired_;
+};
+
+}  // namespace socks5
+
+#endif /* S5POLICY_H */
@@ -0,0 +1,54 @@
+#ifndef S5PROBES_H
+#define S5PROBES_H
+
+// USDT probes of provider socks5 at session state transitions, built in
+// where <sys/sdt.h> is (cmake -DUSE_USDT, on by default). A probe is a nop
+// in the code & a note in the binary, for bpftrace or perf to attach to a
+// running s5server:
+//
+//   bpftrace -e 'usdt:s5server:socks5:relay_read { @[arg1] = sum(arg2); }'
+//
+// Compiled out the macros expand to nothing, arguments aren't evaluated.
+// The first argument is always the session, as in the logs:
+//
+//   start          session
+//   auth           session, method, 1 accepted / 0 refused
+//   request        session, command, address type
+//   resolve_start  session, resolve_done  session, error code
+//   connect_start  session, connect_done  session, error code (the reply
+//                  code through a tunnel)
+//   relay_read     session, direction (0 client to upstream, 1 back), bytes
+//   relay_write    session, direction, bytes
+//   close          session, error code
+
+#if defined(S5_USDT)
+
+#include <sys/sdt.h>
+
+#define S5_PROBE1(name, a1) DTRACE_PROBE1(socks5, name, a1)
+#define S5_PROBE2(name, a1, a2) DTRACE_PROBE2(socks5, name, a1, a2)
+#define S5_PROBE3(name, a1, a2, a3) DTRACE_PROBE3(socks5, name, a1, a2, a3)
+
+#else
+
+#define S5_PROBE1(name, a1) \
+    do {                    \
+    } while (0)
+#define S5_PROBE2(name, a1, a2) \
+    do {                        \
+    } while (0)
+#define S5_PROBE3(name, a1, a2, a3) \
+    do {                            \
+    } while (0)
+
+#endif
+
+namespace socks5 {
+
+// relay probes' direction
+const int probe_up = 0;    // client to upstream
+const int probe_down = 1;  // upstream to client
+
+}  // namespace socks5
+
+#endif /* S5PROBES_H */
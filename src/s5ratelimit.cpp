@@ -0,0 +1,152 @@
+#include "s5ratelimit.h"
+
+#include <algorithm>
+#include <functional>
+
+namespace socks5 {
+
+namespace {
+
+const uint64_t max_chunk = 64 * 1024;
+
+}  // namespace
+
+RateLimiter::Bucket::Bucket(uint64_t rate, uint64_t capacity)
+    : rate_(static_cast<double>(rate)),
+      capacity_(static_cast<double>(capacity)),
+      chunk_(std::max<uint64_t>(1, std::min(rate / 16, max_chunk))),
+      tokens_(capacity_),
+      refilled_(Clock::now()) {}
+
+RateLimiter::Clock::duration RateLimiter::Bucket::Take(uint64_t n,
+                                                       Clock::time_point now) {
+    std::lock_guard<std::mutex> lock{mutex_};
+
+    if (now > refilled_) {
+        const std::chrono::duration<double> elapsed = now - refilled_;
+        tokens_ = std::min(capacity_, tokens_ + elapsed.count() * rate_);
+        refilled_ = now;
+    }
+
+    tokens_ -= static_cast<double>(n);
+    if (tokens_ >= 0) {
+        return Clock::duration::zero();
+    }
+
+    return std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(-tokens_ / rate_));
+}
+
+RateLimiter::RateLimiter(const Config& config, std::size_t shards)
+    : config_(config) {
+    for (std::size_t i = 0; i < shards; ++i) {
+        shards_.push_back(std::make_unique<Shard>(*this));
+    }
+}
+
+std::shared_ptr<RateLimiter::Bucket> RateLimiter::FindBucket(
+    const std::string& key, uint64_t rate) {
+    BucketMap& map = maps_[std::hash<std::string>{}(key) % bucket_maps];
+    std::lock_guard<std::mutex> lock{map.mutex};
+
+    auto& slot = map.buckets[key];
+    auto bucket = slot.lock();
+    if (bucket) {
+        return bucket;
+    }
+
+    const uint64_t capacity = config_.burst ? config_.burst : rate;
+    bucket = std::make_shared<Bucket>(rate, capacity);
+    slot = bucket;
+
+    // drop identities nobody is attached to anymore, amortized
+    if (map.buckets.size() >= map.sweep_at) {
+        for (auto it = map.buckets.begin(); it != map.buckets.end();) {
+            it = it->second.expired() ? map.buckets.erase(it) : std::next(it);
+        }
+        map.sweep_at = std::max<std::size_t>(64, map.buckets.size() * 2);
+    }
+
+    return bucket;
+}
+
+RateLimiter::Ticket RateLimiter::Shard::Attach(
+    const std::string& user, const ba::ip::address& address) {
+    Ticket ticket;
+    if (limiter_.config_.user_rate && !user.empty()) {
+        ticket.user = Attach("user " + user, limiter_.config_.user_rate);
+    }
+
+    if (limiter_.config_.address_rate) {
+        ticket.address = Attach("address " + address.to_string(),
+                                limiter_.config_.address_rate);
+    }
+
+    return ticket;
+}
+
+RateLimiter::Lease* RateLimiter::Shard::Attach(const std::string& key,
+                                               uint64_t rate) {
+    auto it = leases_.find(key);
+    if (it == leases_.end()) {
+        it = leases_.emplace(key, Lease{}).first;
+        it->second.bucket = limiter_.FindBucket(key, rate);
+        it->second.key = &it->first;
+    }
+
+    Lease& lease = it->second;
+
+    ++lease.sessions;
+    return &lease;
+}
+
+void RateLimiter::Shard::Detach(Ticket& ticket) {
+    Detach(ticket.user);
+    Detach(ticket.address);
+    ticket = Ticket{};
+}
+
+void RateLimiter::Shard::Detach(Lease* lease) {
+    if (!lease || --lease->sessions) {
+        return;
+    }
+
+    // leftover tokens are lost, at most a chunk
+    const std::string key = *lease->key;
+    leases_.erase(key);
+}
+
+RateLimiter::Clock::duration RateLimiter::Shard::Charge(const Ticket& ticket,
+                                                        std::size_t n) {
+    auto wait = Clock::duration::zero();
+    if (!ticket.user && !ticket.address) {
+        return wait;
+    }
+
+    const auto now = Clock::now();
+    if (ticket.user) {
+        wait = std::max(wait, Charge(*ticket.user, n, now));
+    }
+
+    if (ticket.address) {
+        wait = std::max(wait, Charge(*ticket.address, n, now));
+    }
+
+    return wait;
+}
+
+RateLimiter::Clock::duration RateLimiter::Shard::Charge(
+    Lease& lease, std::size_t n, Clock::time_point now) {
+    lease.balance -= static_cast<int64_t>(n);
+    if (lease.balance < 0) {
+        const uint64_t take =
+            static_cast<uint64_t>(-lease.balance) + lease.bucket->Chunk();
+        lease.ready =
+            std::max(lease.ready, now + lease.bucket->Take(take, now));
+        lease.balance += static_cast<int64_t>(take);
+    }
+
+    return lease.ready > now ? lease.ready - now : Clock::duration::zero();
+}
+
+}  // namespace socks5
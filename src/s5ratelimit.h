@@ -0,0 +1,121 @@
+#ifndef S5RATELIMIT_H
+#define S5RATELIMIT_H
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <boost/asio.hpp>
+
+namespace ba = boost::asio;
+
+namespace socks5 {
+
+// Token bucket bandwidth limits per authenticated user & per client address,
+// shared by all sessions of the identity. Relayed bytes are charged after
+// they are written & the session delays its next read by the returned wait,
+// so nothing is dropped.
+//
+// Every identity has one bucket, but event loops don't charge it per read:
+// each loop leases tokens from it in chunks into a local balance that only
+// that loop touches, & goes back to the (locked) bucket when the balance
+// runs out. Borrowing ahead of the refill is allowed, the loop then waits
+// until the bucket has caught up.
+class RateLimiter {
+   public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Config {
+        uint64_t user_rate = 0;     // bytes per second, 0 = unlimited
+        uint64_t address_rate = 0;  // bytes per second, 0 = unlimited
+        uint64_t burst = 0;         // bucket size in bytes, 0 = 1s of rate
+    };
+
+    class Bucket {
+       public:
+        Bucket(uint64_t rate, uint64_t capacity);
+
+        // takes n tokens, returns how long until the bucket is back in
+        // credit
+        Clock::duration Take(uint64_t n, Clock::time_point now);
+
+        uint64_t Chunk() const { return chunk_; }
+
+       private:
+        std::mutex mutex_;
+        const double rate_;  // tokens per second
+        const double capacity_;
+        const uint64_t chunk_;  // leased to a loop at once
+        double tokens_;
+        Clock::time_point refilled_;
+    };
+
+    // an identity's tokens on one loop
+    struct Lease {
+        std::shared_ptr<Bucket> bucket;
+        int64_t balance = 0;
+        Clock::time_point ready;  // leased tokens are usable from then on
+        std::size_t sessions = 0;
+        const std::string* key = nullptr;  // of the loop's lease map
+    };
+
+    // what a session's traffic is charged to, null when unlimited
+    struct Ticket {
+        Lease* user = nullptr;
+        Lease* address = nullptr;
+    };
+
+    // per event loop, used from that loop's thread only
+    class Shard {
+       public:
+        explicit Shard(RateLimiter& limiter) : limiter_(limiter) {}
+
+        Ticket Attach(const std::string& user, const ba::ip::address& address);
+
+        void Detach(Ticket& ticket);
+
+        // charges n relayed bytes, returns how long to wait before reading
+        // again
+        Clock::duration Charge(const Ticket& ticket, std::size_t n);
+
+       private:
+        Lease* Attach(const std::string& key, uint64_t rate);
+        void Detach(Lease* lease);
+        Clock::duration Charge(Lease& lease, std::size_t n,
+                               Clock::time_point now);
+
+       private:
+        RateLimiter& limiter_;
+        std::unordered_map<std::string, Lease> leases_;
+    };
+
+    RateLimiter(const Config& config, std::size_t shards);
+
+    Shard& GetShard(std::size_t index) { return *shards_[index]; }
+
+   private:
+    // the bucket map is split by key hash so loops attaching different
+    // identities don't contend
+    struct BucketMap {
+        std::mutex mutex;
+        std::unordered_map<std::string, std::weak_ptr<Bucket>> buckets;
+        std::size_t sweep_at = 64;
+    };
+
+    static const std::size_t bucket_maps = 16;
+
+    std::shared_ptr<Bucket> FindBucket(const std::string& key, uint64_t rate);
+
+   private:
+    const Config config_;
+    BucketMap maps_[bucket_maps];
+    std::vector<std::unique_ptr<Shard>> shards_;
+};
+
+}  // namespace socks5
+
+#endif /* S5RATELIMIT_H */
@@ -0,0 +1,210 @@
+#include "s5recorder.h"
+
+#include <algorithm>
+#include <ctime>
+#include <iomanip>
+#include <sstream>
+#include <unordered_map>
+
+namespace socks5 {
+
+namespace {
+
+void PrintTime(std::ostream& out, std::chrono::system_clock::time_point time) {
+    const auto since_epoch = time.time_since_epoch();
+    const std::time_t seconds = static_cast<std::time_t>(
+        std::chrono::duration_cast<std::chrono::seconds>(since_epoch).count());
+    const auto micros =
+        std::chrono::duration_cast<std::chrono::microseconds>(since_epoch)
+            .count() %
+        1000000;
+
+    std::tm tm{};
+    gmtime_r(&seconds, &tm);
+    char text[32];
+    std::strftime(text, sizeof(text), "%Y-%m-%dT%H:%M:%S", &tm);
+    out << text << '.' << std::setfill('0') << std::setw(6) << micros
+        << std::setfill(' ') << 'Z';
+}
+
+}  // namespace
+
+FlightRecorder::Ring::Ring(std::size_t size) {
+    std::size_t slots = 1;
+    while (slots < size) {
+        slots <<= 1;
+    }
+
+    slots_ = std::make_unique<Slot[]>(slots);
+    mask_ = slots - 1;
+}
+
+std::vector<FlightRecorder::Entry> FlightRecorder::Ring::Copy() const {
+    const uint64_t size = mask_ + 1;
+    const uint64_t head = head_.load(std::memory_order_acquire);
+    const uint64_t first = head > size ? head - size : 0;
+
+    std::vector<Entry> entries;
+    entries.reserve(static_cast<std::size_t>(head - first));
+    for (uint64_t index = first; index < head; ++index) {
+        const Slot& slot = slots_[index & mask_];
+        const uint64_t event = slot.event.load(std::memory_order_relaxed);
+        entries.push_back(
+            {slot.ticks.load(std::memory_order_relaxed),
+             slot.session.load(std::memory_order_relaxed),
+             static_cast<Event>(event >> 32),
+             static_cast<int32_t>(static_cast<uint32_t>(event)),
+             slot.category.load(std::memory_order_relaxed)});
+    }
+
+    // the loop went on recording meanwhile: drop the slots it may have
+    // rewritten under the copy, up to the one it's writing now
+    std::atomic_thread_fence(std::memory_order_acquire);
+    const uint64_t after = head_.load(std::memory_order_relaxed);
+    const uint64_t valid = after >= size ? after - size + 1 : 0;
+    if (valid > first) {
+        entries.erase(entries.begin(),
+                      entries.begin() +
+                          static_cast<std::ptrdiff_t>(std::min<uint64_t>(
+                              valid - first, entries.size())));
+    }
+
+    return entries;
+}
+
+FlightRecorder::FlightRecorder(std::size_t rings, std::size_t ring_size)
+    : start_ticks_{Ticks()},
+      start_steady_{std::chrono::steady_clock::now()},
+      start_system_{std::chrono::system_clock::now()} {
+    for (std::size_t i = 0; i < rings; ++i) {
+        rings_.push_back(
+            std::make_unique<Ring>(std::max<std::size_t>(ring_size, 1)));
+    }
+}
+
+std::string FlightRecorder::Dump(std::size_t sessions) const {
+    struct Trace {
+        std::size_t ring;
+        std::vector<Entry> entries;
+    };
+
+    std::vector<std::pair<std::size_t, Entry>> all;
+    for (std::size_t i = 0; i < rings_.size(); ++i) {
+        for (const auto& entry : rings_[i]->Copy()) {
+            all.emplace_back(i, entry);
+        }
+    }
+
+    std::stable_sort(all.begin(), all.end(), [](const auto& a, const auto& b) {
+        return a.second.ticks < b.second.ticks;
+    });
+
+    // A trace starts at the session's accept, or is the tail of one older
+    // than the rings. Freed sessions' addresses are reused, so an accept
+    // also ends the trace of the session that had the address before.
+    std::vector<Trace> traces;
+    std::unordered_map<uintptr_t, std::size_t> open;
+    for (const auto& ring_entry : all) {
+        const Entry& entry = ring_entry.second;
+        auto it = open.find(entry.session);
+        if (it == open.end() || entry.event == Event::accept) {
+            open[entry.session] = traces.size();
+            traces.push_back({ring_entry.first, {}});
+            it = open.find(entry.session);
+        }
+
+        traces[it->second].entries.push_back(entry);
+    }
+
+    std::vector<std::size_t> last;
+    for (std::size_t i = 0; i < traces.size(); ++i) {
+        last.push_back(i);
+    }
+
+    const auto latest = [&traces](std::size_t a, std::size_t b) {
+        return traces[a].entries.back().ticks > traces[b].entries.back().ticks;
+    };
+    if (last.size() > sessions) {
+        std::partial_sort(last.begin(),
+                          last.begin() + static_cast<std::ptrdiff_t>(sessions),
+                          last.end(), latest);
+        last.resize(sessions);
+    }
+    std::sort(last.begin(), last.end());
+
+    const uint64_t now_ticks = Ticks();
+    const std::chrono::duration<double, std::nano> elapsed =
+        std::chrono::steady_clock::now() - start_steady_;
+    const double ns_per_tick =
+        now_ticks > start_ticks_
+            ? elapsed.count() / static_cast<double>(now_ticks - start_ticks_)
+            : 1.0;
+    const auto nanos = [ns_per_tick](uint64_t ticks) {
+        return static_cast<double>(static_cast<int64_t>(ticks)) * ns_per_tick;
+    };
+    const auto wall = [this, &nanos](uint64_t ticks) {
+        const std::chrono::duration<double, std::nano> since_start{
+            nanos(ticks - start_ticks_)};
+        return start_system_ +
+               std::chrono::duration_cast<std::chrono::system_clock::duration>(
+                   since_start);
+    };
+
+    std::ostringstream out;
+    out << "flight recorder: " << last.size() << " of " << traces.size()
+        << " sessions\n";
+    for (const std::size_t index : last) {
+        const Trace& trace = traces[index];
+        const Entry& first = trace.entries.front();
+
+        out << "session=0x" << std::hex << first.session << std::dec
+            << " loop=" << trace.ring << ' ';
+        PrintTime(out, wall(first.ticks));
+        if (first.event != Event::accept) {
+            out << " (older events overwritten)";
+        }
+        out << '\n';
+
+        for (const Entry& entry : trace.entries) {
+            out << "  +" << std::fixed << std::setprecision(3)
+                << nanos(entry.ticks - first.ticks) / 1e6 << "ms "
+                << EventName(entry.event);
+            if (entry.category) {
+                out << ": "
+                    << bs::error_code(entry.value, *entry.category).message();
+            } else if (entry.value) {
+                out << " reply=" << entry.value;
+            }
+            out << '\n';
+        }
+    }
+
+    return out.str();
+}
+
+const char* FlightRecorder::EventName(Event event) {
+    switch (event) {
+        case Event::accept:
+            return "accept";
+        case Event::greeting:
+            return "greeting";
+        case Event::request:
+            return "request";
+        case Event::resolve_start:
+            return "resolve_start";
+        case Event::resolve_end:
+            return "resolve_end";
+        case Event::connect_start:
+            return "connect_start";
+        case Event::connect_end:
+            return "connect_end";
+        case Event::first_byte:
+            return "first_byte";
+        case Event::close:
+            return "close";
+    }
+
+    return "unknown";
+}
+
+}  // namespace socks5
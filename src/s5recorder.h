@@ -0,0 +1,128 @@
+#ifndef S5RECORDER_H
+#define S5RECORDER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <boost/system/error_code.hpp>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#endif
+
+namespace bs = boost::system;
+
+namespace socks5 {
+
+// Flight recorder of session state transitions. Every event loop appends
+// {timestamp counter, session, event, result} entries to a fixed ring of its
+// own, overwriting the oldest, with relaxed stores only: nothing is
+// formatted, allocated or shared until somebody asks for a Dump(), which
+// copies the rings from any thread & groups the entries by session.
+class FlightRecorder {
+   public:
+    enum class Event : uint32_t {
+        accept,
+        greeting,  // greeting read
+        request,   // request read
+        resolve_start,
+        resolve_end,
+        connect_start,  // an attempt, to the destination, parent or tunnel
+        connect_end,
+        first_byte,  // from upstream
+        close
+    };
+
+    struct Entry {
+        uint64_t ticks;
+        uintptr_t session;
+        Event event;
+        int32_t value;                        // error code or socks5 reply
+        const bs::error_category* category;  // null for replies
+    };
+
+    // per event loop, recorded into from that loop's thread only
+    class Ring {
+       public:
+        explicit Ring(std::size_t size);
+
+        void Record(const void* session, Event event, int32_t value = 0,
+                    const bs::error_category* category = nullptr) {
+            const uint64_t index = head_.load(std::memory_order_relaxed);
+            // a reader must not see this slot change before the head moved
+            // past the entry it held
+            std::atomic_thread_fence(std::memory_order_release);
+
+            Slot& slot = slots_[index & mask_];
+            slot.ticks.store(Ticks(), std::memory_order_relaxed);
+            slot.session.store(reinterpret_cast<uintptr_t>(session),
+                               std::memory_order_relaxed);
+            slot.event.store((static_cast<uint64_t>(event) << 32) |
+                                 static_cast<uint32_t>(value),
+                             std::memory_order_relaxed);
+            slot.category.store(category, std::memory_order_relaxed);
+            head_.store(index + 1, std::memory_order_release);
+        }
+
+        void Record(const void* session, Event event,
+                    const bs::error_code& ec) {
+            Record(session, event, ec.value(), ec ? &ec.category() : nullptr);
+        }
+
+        // the entries still held, oldest first, from any thread
+        std::vector<Entry> Copy() const;
+
+       private:
+        struct Slot {
+            std::atomic<uint64_t> ticks{0};
+            std::atomic<uintptr_t> session{0};
+            std::atomic<uint64_t> event{0};  // event << 32 | value
+            std::atomic<const bs::error_category*> category{nullptr};
+        };
+
+        char padding_before_[64];
+        std::unique_ptr<Slot[]> slots_;
+        uint64_t mask_;
+        std::atomic<uint64_t> head_{0};
+        char padding_after_[64];
+    };
+
+    // ring_size entries per loop, rounded up to a power of two
+    FlightRecorder(std::size_t rings, std::size_t ring_size);
+
+    Ring& GetRing(std::size_t index) { return *rings_[index]; }
+
+    // the trace of the last sessions that had an event, oldest first
+    std::string Dump(std::size_t sessions) const;
+
+    static const char* EventName(Event event);
+
+    // the timestamp counter, steady clock nanoseconds where there's none
+    static uint64_t Ticks() {
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+        return __rdtsc();
+#else
+        return static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch())
+                .count());
+#endif
+    }
+
+   private:
+    std::vector<std::unique_ptr<Ring>> rings_;
+
+    // ticks are converted by the rate measured since construction
+    uint64_t start_ticks_;
+    std::chrono::steady_clock::time_point start_steady_;
+    std::chrono::system_clock::time_point start_system_;
+};
+
+}  // namespace socks5
+
+#endif /* S5RECORDER_H */
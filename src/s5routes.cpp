@@ -0,0 +1,269 @@
+#include "s5routes.h"
+
+#include <cctype>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+namespace socks5 {
+
+namespace {
+
+const std::size_t max_host_size = 255;
+
+// fnv-1a, fed the name back to front
+const uint64_t hash_basis = 14695981039346656037ULL;
+const uint64_t hash_prime = 1099511628211ULL;
+
+uint64_t HashByte(uint64_t hash, char c) {
+    return (hash ^ static_cast<unsigned char>(c)) * hash_prime;
+}
+
+// "Example.COM." -> "example.com", empty if malformed
+std::string NormalizeDomain(const std::string& domain) {
+    std::string host = domain;
+    if (!host.empty() && host.back() == '.') {
+        host.pop_back();
+    }
+
+    if (host.empty() || host.size() > max_host_size || host.front() == '.' ||
+        host.find("..") != std::string::npos) {
+        return std::string();
+    }
+
+    for (char& c : host) {
+        c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+    }
+
+    return host;
+}
+
+// "<address>:<port>", ipv6 addresses in brackets
+bool ParseEndpoint(const std::string& text, tcp::endpoint& endpoint) {
+    const auto colon = text.rfind(':');
+    if (colon == std::string::npos) {
+        return false;
+    }
+
+    std::string host = text.substr(0, colon);
+    if (host.size() > 2 && host.front() == '[' && host.back() == ']') {
+        host = host.substr(1, host.size() - 2);
+    }
+
+    boost::system::error_code ec;
+    const auto address = ba::ip::address::from_string(host, ec);
+    if (ec) {
+        return false;
+    }
+
+    // digits only, so "1080x" or "+1080" aren't taken for 1080
+    const std::string digits = text.substr(colon + 1);
+    if (digits.empty() || digits.size() > 5 ||
+        digits.find_first_not_of("0123456789") != std::string::npos) {
+        return false;
+    }
+
+    const unsigned long port = std::stoul(digits);
+    if (!port || port > 0xFFFF) {
+        return false;
+    }
+
+    endpoint = tcp::endpoint{address, static_cast<uint16_t>(port)};
+    return true;
+}
+
+}  // namespace
+
+std::unique_ptr<Routes> Routes::Load(const std::string& path) {
+    std::ifstream in{path};
+    if (!in) {
+        throw std::runtime_error("can't open route file " + path);
+    }
+
+    return Parse(in, path);
+}
+
+std::unique_ptr<Routes> Routes::Parse(std::istream& in,
+                                      const std::string& name) {
+    auto routes = std::make_unique<Routes>();
+    std::vector<Domain> domains;
+
+    std::string line;
+    for (std::size_t number = 1; std::getline(in, line); ++number) {
+        std::istringstream fields{line.substr(0, line.find('#'))};
+
+        auto fail = [&name, number, &line](const std::string& what) {
+            return std::runtime_error(name + ':' + std::to_string(number) +
+                                      ": " + what + ": " + line);
+        };
+
+        std::string destination;
+        if (!(fields >> destination)) {
+            continue;  // blank
+        }
+
+        auto route = std::make_unique<Route>();
+        std::string action;
+        fields >> action;
+        route->text = destination + ' ' + action;
+        if (action == "direct") {
+            route->action = Action::direct;
+        } else if (action == "reject") {
+            route->action = Action::reject;
+        } else if (action == "egress" || action == "parent") {
+            std::string argument;
+            fields >> argument;
+            route->text += ' ' + argument;
+
+            boost::system::error_code ec;
+            if (action == "egress") {
+                route->action = Action::egress;
+                route->target.address(
+                    ba::ip::address::from_string(argument, ec));
+                if (ec) {
+                    throw fail("expected egress <local address>");
+                }
+            } else {
+                route->action = Action::parent;
+                if (!ParseEndpoint(argument, route->target)) {
+                    throw fail("expected parent <address>:<port>");
+                }
+            }
+        } else {
+            throw fail("expected direct, reject, egress or parent");
+        }
+
+        std::string extra;
+        if (fields >> extra) {
+            throw fail("unexpected field");
+        }
+
+        if (destination == "default") {
+            routes->default_ = std::move(route);
+            continue;
+        }
+
+        const auto id = static_cast<uint32_t>(routes->routes_.size() + 1);
+
+        ba::ip::address address;
+        unsigned length = 0;
+        if (acl::ParsePrefix(destination, address, length)) {
+            routes->addresses_.Add(address, length, id);
+        } else if (destination.find('/') != std::string::npos) {
+            throw fail("bad address or prefix length");
+        } else {
+            const std::string domain = NormalizeDomain(destination);
+            if (domain.empty()) {
+                throw fail("bad address or domain");
+            }
+
+            domains.emplace_back(domain, id);
+        }
+
+        routes->routes_.push_back(std::move(route));
+    }
+
+    routes->addresses_.Compile();
+    routes->BuildDomains(domains);
+    return routes;
+}
+
+void Routes::BuildDomains(const std::vector<Domain>& domains) {
+    std::size_t size = 16;
+    while (size < domains.size() * 2) {
+        size *= 2;
+    }
+
+    domains_.assign(size, Slot{});
+    const std::size_t mask = size - 1;
+    for (const auto& domain : domains) {
+        const std::string& host = domain.first;
+
+        uint64_t hash = hash_basis;
+        for (auto it = host.rbegin(); it != host.rend(); ++it) {
+            hash = HashByte(hash, *it);
+        }
+
+        std::size_t index = hash & mask;
+        bool duplicate = false;
+        while (domains_[index].route) {
+            const Slot& slot = domains_[index];
+            if (slot.hash == hash && slot.length == host.size() &&
+                names_.compare(slot.name, slot.length, host) == 0) {
+                duplicate = true;
+                break;
+            }
+            index = (index + 1) & mask;
+        }
+
+        if (duplicate) {
+            continue;  // the first route wins
+        }
+
+        Slot& slot = domains_[index];
+        slot.hash = hash;
+        slot.name = static_cast<uint32_t>(names_.size());
+        slot.length = static_cast<uint32_t>(host.size());
+        slot.route = domain.second;
+        names_ += host;
+    }
+}
+
+const Routes::Route* Routes::Find(const ba::ip::address& address) const {
+    return Hit(addresses_.Lookup(address));
+}
+
+const Routes::Route* Routes::Find(const std::string& host) const {
+    std::size_t length = host.size();
+    if (length && host[length - 1] == '.') {
+        --length;
+    }
+
+    if (!length || length > max_host_size) {
+        return Hit(0);
+    }
+
+    char lower[max_host_size];
+    for (std::size_t i = 0; i < length; ++i) {
+        lower[i] = static_cast<char>(
+            std::tolower(static_cast<unsigned char>(host[i])));
+    }
+
+    // every suffix starting at a label is probed, the last (longest) match
+    // found wins
+    uint32_t best = 0;
+    uint64_t hash = hash_basis;
+    const std::size_t mask = domains_.size() - 1;
+    for (std::size_t start = length; start-- > 0;) {
+        hash = HashByte(hash, lower[start]);
+        if (start > 0 && lower[start - 1] != '.') {
+            continue;
+        }
+
+        const std::size_t suffix_length = length - start;
+        for (std::size_t index = hash & mask; domains_[index].route;
+             index = (index + 1) & mask) {
+            const Slot& slot = domains_[index];
+            if (slot.hash == hash && slot.length == suffix_length &&
+                std::memcmp(names_.data() + slot.name, lower + start,
+                            suffix_length) == 0) {
+                best = slot.route;
+                break;
+            }
+        }
+    }
+
+    return Hit(best);
+}
+
+const Routes::Route* Routes::Hit(uint32_t route) const {
+    Route* found = route ? routes_[route - 1].get() : default_.get();
+    if (found) {
+        found->hits.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    return found;
+}
+
+}  // namespace socks5
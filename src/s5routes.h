@@ -0,0 +1,90 @@
+#ifndef S5ROUTES_H
+#define S5ROUTES_H
+
+#include <atomic>
+#include <cstdint>
+#include <istream>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <boost/asio.hpp>
+
+#include "acl.h"
+
+namespace ba = boost::asio;
+using tcp = ba::ip::tcp;
+
+namespace socks5 {
+
+// Where connections to a destination go, one route per line, '#' starts a
+// comment:
+//
+//   <address>[/<length>]|<domain> direct|reject
+//   <address>[/<length>]|<domain> egress <local address>
+//   <address>[/<length>]|<domain> parent <address>:<port>
+//   default <action> [<argument>]
+//
+// direct connects from here (through the egress pool if there is one),
+// egress from the given local address, parent through a socks5 proxy
+// without auth, reject refuses the request. Routed requests bypass the
+// tunnel.
+//
+// A request is routed once, by what the client sent: an address by the
+// longest matching prefix, a domain by the longest matching suffix (a route
+// for example.com covers www.example.com) without resolving it first. Routes
+// for the same destination: the first one wins.
+class Routes {
+   public:
+    enum class Action : unsigned char { direct, reject, egress, parent };
+
+    struct Route {
+        Action action;
+        tcp::endpoint target;  // egress: local address, parent: the proxy
+        std::string text;      // as written in the route file
+        std::atomic<uint64_t> hits{0};
+    };
+
+    // throw std::runtime_error naming the offending line
+    static std::unique_ptr<Routes> Load(const std::string& path);
+    static std::unique_ptr<Routes> Parse(std::istream& in,
+                                         const std::string& name);
+
+    // the matching route or the default one, nullptr if there's none
+    const Route* Find(const ba::ip::address& address) const;
+    const Route* Find(const std::string& host) const;
+
+    const std::vector<std::unique_ptr<Route>>& GetRoutes() const {
+        return routes_;
+    }
+
+    const Route* Default() const { return default_.get(); }
+
+   private:
+    // open addressing by the hash of the reversed name, so a host's
+    // suffixes are hashed in a single pass from its end
+    struct Slot {
+        uint64_t hash = 0;
+        uint32_t name = 0;    // offset in names_
+        uint32_t length = 0;  // of the name
+        uint32_t route = 0;   // index in routes_ + 1, 0 = empty slot
+    };
+
+    using Domain = std::pair<std::string, uint32_t>;  // name, route
+
+    void BuildDomains(const std::vector<Domain>& domains);
+
+    const Route* Hit(uint32_t route) const;
+
+   private:
+    std::vector<std::unique_ptr<Route>> routes_;
+    std::unique_ptr<Route> default_;
+    acl::PrefixTable addresses_;
+    std::vector<Slot> domains_;  // power of two size, at most half full
+    std::string names_;          // lowercased, without the trailing dot
+};
+
+}  // namespace socks5
+
+#endif /* S5ROUTES_H */
@@ -0,0 +1,97 @@
+#include "s5scheduler.h"
+
+#include <utility>
+
+namespace socks5 {
+
+Scheduler::Scheduler(ba::io_service& io, const Config& config)
+    : io_(io), config_(config) {}
+
+bool Scheduler::Admit(Flow& flow, std::size_t bytes) {
+    const auto quantum = static_cast<int64_t>(config_.quantum);
+    const uint64_t round = rounds_.load(std::memory_order_relaxed);
+    if (flow.relayed_ == 0) {
+        flow.deficit_ = quantum;  // a new flow starts with a full quantum
+    } else if (round > flow.round_ + 1) {
+        flow.deficit_ = 0;  // back from idle
+    }
+    flow.round_ = round;
+
+    flow.relayed_ += bytes;
+    flow.deficit_ -= static_cast<int64_t>(bytes);
+    if (config_.bulk_after && flow.relayed_ >= config_.bulk_after) {
+        flow.class_ = Class::bulk;
+    }
+
+    return flow.deficit_ >= 0;
+}
+
+void Scheduler::Defer(Flow& flow, std::function<void()> resume) {
+    flow.resume_ = std::move(resume);
+    flow.waiting_ = true;
+
+    auto& queue = Queue(flow.class_);
+    flow.position_ = queue.insert(queue.end(), &flow);
+    deferred_.store(deferred_.load(std::memory_order_relaxed) + 1,
+                    std::memory_order_relaxed);
+
+    if (!round_posted_) {
+        round_posted_ = true;
+        io_.post([this]() { Round(); });
+    }
+}
+
+void Scheduler::Cancel(Flow& flow) {
+    if (!flow.waiting_) {
+        return;
+    }
+
+    Queue(flow.class_).erase(flow.position_);
+    flow.waiting_ = false;
+    flow.resume_ = nullptr;
+}
+
+void Scheduler::Round() {
+    round_posted_ = false;
+    rounds_.store(rounds_.load(std::memory_order_relaxed) + 1,
+                  std::memory_order_relaxed);
+
+    const uint64_t round = rounds_.load(std::memory_order_relaxed);
+
+    // top up everyone waiting in the class served, resume whoever is back
+    // in credit; resumed flows only start reads, so no flow runs inside
+    // this loop
+    auto& queue = interactive_.empty() ? bulk_ : interactive_;
+    std::list<Flow*> resumed;
+    for (auto it = queue.begin(); it != queue.end();) {
+        Flow& flow = **it;
+        flow.round_ = round;  // waiting counts as active
+        flow.deficit_ += static_cast<int64_t>(config_.quantum);
+        if (flow.deficit_ < 0) {
+            ++it;
+            continue;
+        }
+
+        auto next = std::next(it);
+        resumed.splice(resumed.end(), queue, it);
+        it = next;
+    }
+
+    // a resume handler may close its session & cancel the other flow
+    for (Flow* flow : resumed) {
+        flow->waiting_ = false;
+    }
+
+    for (Flow* flow : resumed) {
+        auto resume = std::move(flow->resume_);
+        flow->resume_ = nullptr;
+        resume();
+    }
+
+    if (!round_posted_ && (!interactive_.empty() || !bulk_.empty())) {
+        round_posted_ = true;
+        io_.post([this]() { Round(); });
+    }
+}
+
+}  // namespace socks5
@@ -0,0 +1,95 @@
+#ifndef S5SCHEDULER_H
+#define S5SCHEDULER_H
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <list>
+
+#include <boost/asio.hpp>
+
+namespace ba = boost::asio;
+
+namespace socks5 {
+
+// Deficit round robin over the relay flows of one event loop, used from that
+// loop's thread only.
+//
+// A flow (one direction of a session) may relay up to its deficit, topped
+// up by a quantum per round, before it has to wait for the next round.
+// Rounds are posted to the loop, so everything else that is ready (handshakes,
+// interactive flows within their share) runs between two rounds of a flow
+// that keeps its buffers full. A flow that sat out a whole round left the
+// active set: its deficit starts over from zero, so neither credit nor debt
+// is carried across idle periods.
+//
+// Flows start in the interactive class & move to the bulk class once they
+// have relayed bulk_after bytes. Interactive flows have strict priority: a
+// round serves the bulk class only while no interactive flow is waiting.
+class Scheduler {
+   public:
+    enum class Class { interactive, bulk };
+
+    struct Config {
+        std::size_t quantum = 16 * 1024;   // bytes per flow & round
+        uint64_t bulk_after = 1024 * 1024;  // 0 = every flow interactive
+    };
+
+    class Flow {
+       public:
+        Flow() = default;
+        Flow(const Flow&) = delete;
+        Flow& operator=(const Flow&) = delete;
+
+        Class GetClass() const { return class_; }
+
+       private:
+        friend class Scheduler;
+
+        int64_t deficit_ = 0;
+        uint64_t relayed_ = 0;
+        uint64_t round_ = 0;  // last round the flow was active in
+        Class class_ = Class::interactive;
+        bool waiting_ = false;
+        std::list<Flow*>::iterator position_;
+        std::function<void()> resume_;
+    };
+
+    Scheduler(ba::io_service& io, const Config& config);
+
+    // charges bytes relayed by flow, true if it may go on right away
+    bool Admit(Flow& flow, std::size_t bytes);
+
+    // after Admit() returned false: resume runs in a later round
+    void Defer(Flow& flow, std::function<void()> resume);
+
+    // drops a waiting flow & its resume handler, for closing sessions
+    void Cancel(Flow& flow);
+
+    // read from other threads for stats
+    uint64_t Rounds() const { return rounds_.load(std::memory_order_relaxed); }
+
+    uint64_t Deferred() const {
+        return deferred_.load(std::memory_order_relaxed);
+    }
+
+   private:
+    void Round();
+
+    std::list<Flow*>& Queue(Class c) {
+        return c == Class::interactive ? interactive_ : bulk_;
+    }
+
+   private:
+    ba::io_service& io_;
+    const Config config_;
+    std::list<Flow*> interactive_;
+    std::list<Flow*> bulk_;
+    bool round_posted_ = false;
+    std::atomic<uint64_t> rounds_{0};  // written by the loop only
+    std::atomic<uint64_t> deferred_{0};
+};
+
+}  // namespace socks5
+
+#endif /* S5SCHEDULER_H */
@@ -1,27 +1,678 @@
 #include "s5server.h"
 
+#include <algorithm>
+
 #include <boost/log/trivial.hpp>
 
 namespace socks5 {
 
-Server::Server(ba::io_service& io, tcp::endpoint ep) : acceptor_{io, ep} {
-    BOOST_LOG_TRIVIAL(info) << "accept on " << ep;
-    Accept();
+namespace {
+
+void LogPolicy(const Policy& policy) {
+    BOOST_LOG_TRIVIAL(info) << "policy version " << policy.version;
+
+    if (policy.acl) {
+        BOOST_LOG_TRIVIAL(info)
+            << "acl: " << policy.acl->Rules().size() << " rules";
+    }
+
+    if (policy.domains) {
+        BOOST_LOG_TRIVIAL(info)
+            << "domain acl: " << policy.domains->NodeCount() << " nodes, "
+            << policy.domains->Size() << " bytes";
+    }
+
+    if (policy.users) {
+        BOOST_LOG_TRIVIAL(info) << "users: " << policy.users->Size();
+    }
+
+    if (policy.routes) {
+        BOOST_LOG_TRIVIAL(info)
+            << "routes: " << policy.routes->GetRoutes().size();
+    }
+}
+
+}  // namespace
+
+Server::Server(ba::io_service& io, const Options& options)
+    : options_{options},
+      acceptor_{io, tcp::endpoint{tcp::v4(), options.port}},
+      accept_{SelectAccept(options)},
+      reload_signals_{io, SIGHUP},
+      reclaim_timer_{io},
+      accept_timer_{io},
+      dump_signals_{io, SIGUSR1},
+      stats_interval_{options.stats_interval},
+      stats_timer_{io} {
+    BOOST_LOG_TRIVIAL(info) << "accept on " << acceptor_.local_endpoint();
+
+    if (options.memory_soft_limit || options.memory_hard_limit) {
+        AdmissionControl::Config admission_config;
+        admission_config.soft_limit = options.memory_soft_limit << 20;
+        admission_config.hard_limit = options.memory_hard_limit << 20;
+        admission_ = std::make_unique<AdmissionControl>(admission_config);
+    }
+
+    if (!options.tunnel_peer.empty()) {
+        tunnel_pool_ = std::make_unique<tunnel::Pool>(
+            io, options.tunnel_peer, options.tunnel_connections,
+            admission_.get());
+    }
+
+    if (!options.egress_addresses.empty()) {
+        std::vector<ba::ip::address> addresses;
+        for (const auto& address : options.egress_addresses) {
+            addresses.push_back(ba::ip::address::from_string(address));
+        }
+
+        egress_pool_ = std::make_unique<EgressPool>(
+            addresses, EgressPool::ParseStrategy(options.egress_strategy));
+    }
+
+    if (options.dns_ttl) {
+        DnsCache::Config config;
+        config.ttl = std::chrono::seconds{options.dns_ttl};
+        config.max_entries = options.dns_cache_size;
+        config.refresh_hits = options.dns_refresh_hits;
+        config.max_refreshes = options.dns_refresh_max;
+        config.snapshot_path = options.dns_snapshot;
+        config.snapshot_interval =
+            std::chrono::seconds{options.dns_snapshot_interval};
+        dns_cache_ = std::make_unique<DnsCache>(io, config);
+    }
+
+    const std::size_t threads = std::max(options.threads, 1u);
+    policy_store_ =
+        std::make_unique<PolicyStore>(Policy::Load(options), threads);
+    LogPolicy(*policy_store_->Current());
+
+    RateLimiter::Config rate_config;
+    rate_config.user_rate = options.user_rate;
+    rate_config.address_rate = options.ip_rate;
+    rate_config.burst = options.rate_burst;
+    if (rate_config.user_rate || rate_config.address_rate) {
+        rate_limiter_ = std::make_unique<RateLimiter>(rate_config, threads);
+    }
+
+    ConnectionLimits::Config limits_config;
+    limits_config.per_address = options.max_conns_per_ip;
+    limits_config.per_network = options.max_conns_per_net;
+    limits_config.per_user = options.max_conns_per_user;
+    if (limits_config.per_address || limits_config.per_network ||
+        limits_config.per_user) {
+        connection_limits_ = std::make_unique<ConnectionLimits>(limits_config);
+    }
+
+    // the tunnel listener counts on the server's io, a loop of its own
+    // unless there's a single loop
+    const bool listener_shard = options.tunnel_port && threads > 1;
+    if (options.admin_port) {
+        metrics_ = std::make_unique<Metrics>(threads + listener_shard);
+    }
+
+    if (options.tunnel_port) {
+        tunnel::Listener::Services tunnel_services;
+        tunnel_services.policy = policy_store_.get();
+        tunnel_services.egress = egress_pool_.get();
+        tunnel_services.dns = dns_cache_.get();
+        tunnel_services.metrics =
+            metrics_ ? &metrics_->GetShard(listener_shard ? threads : 0)
+                     : nullptr;
+        tunnel_services.admission = admission_.get();
+        tunnel_services.connect_timeout =
+            std::chrono::milliseconds{options.connect_timeout};
+        const tcp::endpoint tunnel_endpoint{
+            ba::ip::address::from_string(options.tunnel_address),
+            options.tunnel_port};
+        tunnel_listener_ = std::make_unique<tunnel::Listener>(
+            io, tunnel_endpoint, tunnel_services);
+    }
+
+    if (options.flight_events) {
+        recorder_ =
+            std::make_unique<FlightRecorder>(threads, options.flight_events);
+    }
+
+    for (std::size_t i = 0; i < threads; ++i) {
+        auto loop = std::make_unique<Loop>();
+        if (threads == 1) {
+            loop->io = &io;
+        } else {
+            loop->own_io = std::make_unique<ba::io_service>(1);
+            loop->io = loop->own_io.get();
+            loop->work = std::make_unique<ba::io_service::work>(*loop->io);
+        }
+
+        if (options.drr_quantum) {
+            Scheduler::Config scheduler_config;
+            scheduler_config.quantum = options.drr_quantum;
+            scheduler_config.bulk_after = options.drr_bulk_after;
+            loop->scheduler =
+                std::make_unique<Scheduler>(*loop->io, scheduler_config);
+        }
+
+        loop->services.tunnel = tunnel_pool_.get();
+        loop->services.egress = egress_pool_.get();
+        loop->services.dns = dns_cache_.get();
+        loop->services.policy = &policy_store_->GetReader(i);
+        loop->services.limiter =
+            rate_limiter_ ? &rate_limiter_->GetShard(i) : nullptr;
+        loop->services.limits = connection_limits_.get();
+        loop->services.admission = admission_.get();
+        loop->services.scheduler = loop->scheduler.get();
+        loop->services.metrics = metrics_ ? &metrics_->GetShard(i) : nullptr;
+        loop->services.recorder = recorder_ ? &recorder_->GetRing(i) : nullptr;
+        loop->services.sessions = &loop->sessions;
+        loop->services.connect_timeout =
+            std::chrono::milliseconds{options.connect_timeout};
+        loops_.push_back(std::move(loop));
+    }
+
+    if (!options.accounting_file.empty()) {
+        Accounting::Config accounting_config;
+        accounting_config.path = options.accounting_file;
+        accounting_config.interval =
+            std::chrono::seconds{std::max(options.accounting_interval, 1u)};
+        accounting_config.max_size = options.accounting_max_size << 20;
+        accounting_config.keep = options.accounting_keep;
+
+        std::vector<ba::io_service*> loop_ios;
+        for (const auto& loop : loops_) {
+            loop_ios.push_back(loop->io);
+        }
+
+        accounting_ = std::make_unique<Accounting>(accounting_config, loop_ios);
+        for (std::size_t i = 0; i < loops_.size(); ++i) {
+            loops_[i]->services.accounting = &accounting_->GetTable(i);
+        }
+    }
+
+    if (options.admin_port) {
+        const tcp::endpoint admin_endpoint{
+            ba::ip::address::from_string(options.admin_address),
+            options.admin_port};
+        admin_ = std::make_unique<AdminListener>(io, admin_endpoint);
+        AddMetricSources();
+        Metrics* metrics = metrics_.get();
+        admin_->Add("/metrics",
+                    {"text/plain; version=0.0.4",
+                     [metrics]() { return metrics->Render(); }});
+
+        if (recorder_) {
+            FlightRecorder* recorder = recorder_.get();
+            const std::size_t sessions = options.flight_sessions;
+            admin_->Add("/flight",
+                        {"text/plain", [recorder, sessions]() {
+                             return recorder->Dump(sessions);
+                         }});
+        }
+    }
+
+    for (auto& loop : loops_) {
+        if (loop->own_io) {
+            ba::io_service* loop_io = loop->io;
+            loop->thread = std::thread{[loop_io]() { loop_io->run(); }};
+        }
+    }
+
+    BOOST_LOG_TRIVIAL(info) << "event loops: " << loops_.size();
+
+    (this->*accept_)();
+    WaitReload();
+    WaitDump();
+    ReclaimPolicies();
+    ReportStats();
+}
+
+// The caller's io service outlives the server & may be run again: nothing
+// queued on it or on the loops may be left holding a session, whose
+// destructor uses the services below, or the server itself.
+Server::~Server() {
+    bs::error_code ignored;
+    acceptor_.close(ignored);
+    accept_timer_.cancel();
+    reclaim_timer_.cancel();
+    stats_timer_.cancel();
+    reload_signals_.cancel(ignored);
+    dump_signals_.cancel(ignored);
+
+    // its upstreams use policy_store_ & the other services
+    tunnel_listener_.reset();
+
+    if (reload_thread_.joinable()) {
+        reload_thread_.join();
+    }
+
+    // the aborted accept still holds a session, on the loop's io only when
+    // that is the server's
+    if (loops_.front()->own_io) {
+        Poll(acceptor_.get_io_service());
+    }
+
+    for (auto& loop : loops_) {
+        if (loop->thread.joinable()) {
+            loop->work.reset();
+            loop->io->stop();
+            loop->thread.join();
+        }
+
+        Drain(*loop);
+    }
+
+    // posts flushes to the loops until it's gone
+    accounting_.reset();
+    loops_.clear();
+}
+
+Server::AcceptFn Server::SelectAccept(const Options& options) {
+    return options.users.empty() ? SelectAccess<NoAuth>(options)
+                                 : SelectAccess<PasswordAuth>(options);
+}
+
+template <typename AuthPolicy>
+Server::AcceptFn Server::SelectAccess(const Options& options) {
+    return options.acl.empty() && options.domain_acl.empty()
+               ? SelectAccounting<AuthPolicy, NoAccess>(options)
+               : SelectAccounting<AuthPolicy, RuleAccess>(options);
+}
+
+template <typename AuthPolicy, typename AccessPolicy>
+Server::AcceptFn Server::SelectAccounting(const Options& options) {
+    using Plain = Session<AuthPolicy, AccessPolicy, NoAccounting>;
+    using Accounted = Session<AuthPolicy, AccessPolicy, TableAccounting>;
+    return options.accounting_file.empty() ? &Server::Accept<Plain>
+                                           : &Server::Accept<Accounted>;
 }
 
+template <typename SessionType>
 void Server::Accept() {
-    std::shared_ptr<Session> session{
-        Session::Create(acceptor_.get_io_service())};
+    Loop& loop = *loops_[next_loop_++ % loops_.size()];
+    std::shared_ptr<SessionType> session{
+        SessionType::Create(*loop.io, loop.services)};
+
+    auto accept_handler = [this, session,
+                           &loop](const bs::error_code& ec) mutable {
+        if (ec == ba::error::operation_aborted) {
+            return;
+        }
 
-    auto accept_handler = [this, session](const bs::error_code& ec) {
         if (!ec) {
-            session->Start();
+            // right away on a single loop, else queued to the session's loop;
+            // handed over, so the session is released on its loop
+            loop.io->dispatch(
+                [session = std::move(session)]() { session->Start(); });
+        }
+
+        // back off while sessions are over the soft memory limit
+        const auto delay = admission_ ? admission_->AcceptDelay()
+                                      : std::chrono::milliseconds::zero();
+        if (delay == std::chrono::milliseconds::zero()) {
+            Accept<SessionType>();
+            return;
         }
 
-        Accept();
+        accept_timer_.expires_from_now(delay);
+        accept_timer_.async_wait([this](const bs::error_code& ec) {
+            if (!ec) {
+                Accept<SessionType>();
+            }
+        });
     };
 
     acceptor_.async_accept(session->AcceptorSocket(), accept_handler);
 }
 
+void Server::Poll(ba::io_service& io) {
+    // a stopped io service stays stopped for its owner
+    const bool stopped = io.stopped();
+    io.reset();
+    io.poll();
+    if (stopped) {
+        io.stop();
+    }
+}
+
+void Server::Drain(Loop& loop) {
+    ba::io_service& io = *loop.io;
+    const bool stopped = io.stopped();
+    io.reset();
+
+    // sessions handed over to the loop but not started yet, then the rest
+    io.poll();
+    loop.sessions.CloseAll();
+    io.poll();
+
+    // those still resolving finish once getaddrinfo() returns
+    while (!loop.sessions.Empty() && io.run_one()) {
+    }
+
+    if (stopped) {
+        io.stop();
+    }
+}
+
+void Server::WaitReload() {
+    reload_signals_.async_wait([this](const bs::error_code& ec, int) {
+        if (ec) {
+            return;
+        }
+
+        Reload();
+        WaitReload();
+    });
+}
+
+// Loading may take a while (large rule files), so it runs on a thread of its
+// own & the event loops only ever see the atomic swap in Publish().
+void Server::Reload() {
+    if (reloading_.exchange(true)) {
+        BOOST_LOG_TRIVIAL(info) << "reload already in progress";
+        return;
+    }
+
+    if (reload_thread_.joinable()) {
+        reload_thread_.join();
+    }
+
+    reload_thread_ = std::thread{[this]() {
+        try {
+            auto policy = Policy::Load(options_);
+            const Policy& loaded = *policy;
+            policy_store_->Publish(std::move(policy));
+            LogPolicy(loaded);
+        } catch (std::exception& e) {
+            BOOST_LOG_TRIVIAL(error)
+                << "reload failed, keeping the current policy: " << e.what();
+        }
+
+        reloading_ = false;
+    }};
+}
+
+void Server::ReclaimPolicies() {
+    retired_policies_ = policy_store_->Reclaim();
+
+    reclaim_timer_.expires_from_now(std::chrono::seconds{1});
+    reclaim_timer_.async_wait([this](const bs::error_code& ec) {
+        if (!ec) {
+            ReclaimPolicies();
+        }
+    });
+}
+
+void Server::WaitDump() {
+    if (!recorder_) {
+        return;
+    }
+
+    dump_signals_.async_wait([this](const bs::error_code& ec, int) {
+        if (ec) {
+            return;
+        }
+
+        BOOST_LOG_TRIVIAL(info) << recorder_->Dump(options_.flight_sessions);
+        WaitDump();
+    });
+}
+
+void Server::AddMetricSources() {
+    if (egress_pool_) {
+        EgressPool* egress = egress_pool_.get();
+        metrics_->AddSource([egress](std::ostream& out) {
+            const struct {
+                const char* name;
+                const char* help;
+                const std::atomic<uint64_t> EgressPool::Usage::*counter;
+            } families[] = {
+                {"s5_egress_connects_total",
+                 "Upstream sockets bound to an egress address.",
+                 &EgressPool::Usage::connects},
+                {"s5_egress_bind_errors_total",
+                 "Failed binds to an egress address.",
+                 &EgressPool::Usage::bind_errors},
+                {"s5_egress_no_port_errors_total",
+                 "Binds that couldn't defer the port choice to connect.",
+                 &EgressPool::Usage::no_port_errors},
+            };
+            for (const auto& family : families) {
+                Metrics::Family(out, family.name, "counter", family.help);
+                for (const auto& usage : egress->Addresses()) {
+                    out << family.name << "{address=\"" << usage->address
+                        << "\"} " << ((*usage).*family.counter) << '\n';
+                }
+            }
+
+            Metrics::Family(out, "s5_egress_active", "gauge",
+                            "Upstream sockets open per egress address.");
+            for (const auto& usage : egress->Addresses()) {
+                out << "s5_egress_active{address=\"" << usage->address
+                    << "\"} " << usage->active << '\n';
+            }
+        });
+    }
+
+    if (admission_) {
+        AdmissionControl* admission = admission_.get();
+        metrics_->AddSource([admission](std::ostream& out) {
+            Metrics::Family(out, "s5_admission_used_bytes", "gauge",
+                            "Session & tunnel buffer memory charged.");
+            out << "s5_admission_used_bytes " << admission->Used() << '\n';
+
+            Metrics::Family(out, "s5_admission_state", "gauge",
+                            "1 for the current memory admission state.");
+            const AdmissionControl::State states[] = {
+                AdmissionControl::State::normal, AdmissionControl::State::soft,
+                AdmissionControl::State::hard};
+            const auto current = admission->GetState();
+            for (const auto state : states) {
+                out << "s5_admission_state{state=\""
+                    << AdmissionControl::StateName(state) << "\"} "
+                    << (state == current ? 1 : 0) << '\n';
+            }
+
+            const auto& stats = admission->GetStats();
+            Metrics::Family(out, "s5_admission_delayed_accepts_total",
+                            "counter", "Accepts delayed over the soft limit.");
+            out << "s5_admission_delayed_accepts_total "
+                << stats.delayed_accepts << '\n';
+            Metrics::Family(out, "s5_admission_refused_handshakes_total",
+                            "counter",
+                            "Handshakes refused over the hard limit.");
+            out << "s5_admission_refused_handshakes_total "
+                << stats.refused_handshakes << '\n';
+        });
+    }
+
+    if (connection_limits_) {
+        ConnectionLimits* limits = connection_limits_.get();
+        metrics_->AddSource([limits](std::ostream& out) {
+            const auto& stats = limits->GetStats();
+            Metrics::Family(out, "s5_limit_refusals_total", "counter",
+                            "Connections refused by limit.");
+            out << "s5_limit_refusals_total{limit=\"address\"} "
+                << stats.address << '\n'
+                << "s5_limit_refusals_total{limit=\"network\"} "
+                << stats.network << '\n'
+                << "s5_limit_refusals_total{limit=\"user\"} " << stats.user
+                << '\n';
+
+            Metrics::Family(out, "s5_limit_tracked", "gauge",
+                            "Addresses, networks & users with connections.");
+            out << "s5_limit_tracked " << limits->Tracked() << '\n';
+        });
+    }
+
+    // the policy's counters start over with every version it loads; served
+    // on the main thread, which owns policy_store_->Current()
+    PolicyStore* store = policy_store_.get();
+    metrics_->AddSource([store](std::ostream& out) {
+        const Policy& policy = *store->Current();
+        Metrics::Family(out, "s5_policy_version", "gauge",
+                        "Policy version in use, 1 up on every reload.");
+        out << "s5_policy_version " << policy.version << '\n';
+
+        if (policy.acl) {
+            uint64_t allowed = 0;
+            uint64_t denied = 0;
+            for (const auto& rule : policy.acl->Rules()) {
+                (rule->action == acl::Action::allow ? allowed : denied) +=
+                    rule->hits;
+            }
+
+            Metrics::Family(out, "s5_acl_decisions_total", "counter",
+                            "Address rule decisions, default when no rule "
+                            "matched.");
+            out << "s5_acl_decisions_total{rule=\"allow\"} " << allowed
+                << '\n'
+                << "s5_acl_decisions_total{rule=\"deny\"} " << denied << '\n'
+                << "s5_acl_decisions_total{rule=\"default\"} "
+                << policy.acl->DefaultHits() << '\n';
+        }
+
+        if (policy.domains) {
+            const auto& stats = policy.domains->GetStats();
+            Metrics::Family(out, "s5_domain_acl_decisions_total", "counter",
+                            "Destination hostname rule decisions.");
+            out << "s5_domain_acl_decisions_total{result=\"allowed\"} "
+                << stats.allowed << '\n'
+                << "s5_domain_acl_decisions_total{result=\"denied\"} "
+                << stats.denied << '\n'
+                << "s5_domain_acl_decisions_total{result=\"unmatched\"} "
+                << stats.unmatched << '\n';
+        }
+
+        if (policy.routes) {
+            Metrics::Family(out, "s5_route_hits_total", "counter",
+                            "Connections per route, as written in the file.");
+            for (const auto& route : policy.routes->GetRoutes()) {
+                out << "s5_route_hits_total{route=\""
+                    << Metrics::LabelValue(route->text) << "\"} "
+                    << route->hits << '\n';
+            }
+
+            if (const Routes::Route* route = policy.routes->Default()) {
+                out << "s5_route_hits_total{route=\""
+                    << Metrics::LabelValue(route->text) << "\"} "
+                    << route->hits << '\n';
+            }
+        }
+    });
+}
+
+void Server::ReportStats() {
+    if (stats_interval_.count() == 0) {
+        return;
+    }
+
+    stats_timer_.expires_from_now(stats_interval_);
+    stats_timer_.async_wait([this](const bs::error_code& ec) {
+        if (ec) {
+            return;
+        }
+
+        if (egress_pool_) {
+            for (const auto& usage : egress_pool_->Addresses()) {
+                BOOST_LOG_TRIVIAL(info)
+                    << "stats egress=" << usage->address
+                    << " active=" << usage->active
+                    << " connects=" << usage->connects
+                    << " bind_errors=" << usage->bind_errors
+                    << " no_port_errors=" << usage->no_port_errors;
+            }
+        }
+
+        if (dns_cache_) {
+            const auto& stats = dns_cache_->GetStats();
+            BOOST_LOG_TRIVIAL(info)
+                << "stats dns entries=" << dns_cache_->Size()
+                << " hits=" << stats.hits << " misses=" << stats.misses
+                << " refreshes=" << stats.refreshes
+                << " refresh_errors=" << stats.refresh_errors;
+        }
+
+        for (std::size_t i = 0; i < loops_.size(); ++i) {
+            if (loops_[i]->scheduler) {
+                BOOST_LOG_TRIVIAL(info)
+                    << "stats loop=" << i
+                    << " rounds=" << loops_[i]->scheduler->Rounds()
+                    << " deferred=" << loops_[i]->scheduler->Deferred();
+            }
+        }
+
+        if (admission_) {
+            const auto& stats = admission_->GetStats();
+            BOOST_LOG_TRIVIAL(info)
+                << "stats memory used=" << admission_->Used()
+                << " soft_limit=" << admission_->GetConfig().soft_limit
+                << " hard_limit=" << admission_->GetConfig().hard_limit
+                << " state="
+                << AdmissionControl::StateName(admission_->GetState())
+                << " delayed_accepts=" << stats.delayed_accepts
+                << " refused_handshakes=" << stats.refused_handshakes;
+        }
+
+        if (connection_limits_) {
+            const auto& stats = connection_limits_->GetStats();
+            BOOST_LOG_TRIVIAL(info)
+                << "stats limits tracked=" << connection_limits_->Tracked()
+                << " refused_ip=" << stats.address
+                << " refused_net=" << stats.network
+                << " refused_user=" << stats.user;
+        }
+
+        if (metrics_) {
+            for (unsigned i = 0; i < Metrics::phases; ++i) {
+                const auto phase = static_cast<Metrics::Phase>(i);
+                auto merged = std::make_unique<Histogram>();
+                metrics_->Merge(phase, *merged);
+                BOOST_LOG_TRIVIAL(info)
+                    << "stats latency phase=" << Metrics::PhaseName(phase)
+                    << " count=" << merged->Count()
+                    << " p50_us=" << merged->Quantile(0.5) / 1000
+                    << " p99_us=" << merged->Quantile(0.99) / 1000
+                    << " p999_us=" << merged->Quantile(0.999) / 1000;
+            }
+        }
+
+        const Policy& policy = *policy_store_->Current();
+        BOOST_LOG_TRIVIAL(info) << "stats policy version=" << policy.version
+                                << " retired=" << retired_policies_;
+
+        if (policy.acl) {
+            uint64_t allowed = 0;
+            uint64_t denied = 0;
+            for (const auto& rule : policy.acl->Rules()) {
+                (rule->action == acl::Action::allow ? allowed : denied) +=
+                    rule->hits;
+            }
+
+            BOOST_LOG_TRIVIAL(info)
+                << "stats acl allowed=" << allowed << " denied=" << denied
+                << " default=" << policy.acl->DefaultHits();
+        }
+
+        if (policy.domains) {
+            const auto& stats = policy.domains->GetStats();
+            BOOST_LOG_TRIVIAL(info)
+                << "stats domain_acl allowed=" << stats.allowed
+                << " denied=" << stats.denied
+                << " unmatched=" << stats.unmatched;
+        }
+
+        if (policy.routes) {
+            for (const auto& route : policy.routes->GetRoutes()) {
+                BOOST_LOG_TRIVIAL(info) << "stats route " << route->text
+                                        << " hits=" << route->hits;
+            }
+
+            if (const Routes::Route* route = policy.routes->Default()) {
+                BOOST_LOG_TRIVIAL(info) << "stats route " << route->text
+                                        << " hits=" << route->hits;
+            }
+        }
+
+        ReportStats();
+    });
+}
+
 }  // namespace socks5
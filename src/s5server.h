@@ -1,11 +1,29 @@
 #ifndef S5SERVER_H
 #define S5SERVER_H
 
+#include <atomic>
+#include <chrono>
 #include <memory>
+#include <thread>
+#include <vector>
 
 #include <boost/asio.hpp>
+#include <boost/asio/signal_set.hpp>
 
+#include "s5accounting.h"
+#include "s5admin.h"
+#include "s5admission.h"
+#include "s5dns.h"
+#include "s5egress.h"
+#include "s5limits.h"
+#include "s5metrics.h"
+#include "s5options.h"
+#include "s5policy.h"
+#include "s5scheduler.h"
+#include "s5ratelimit.h"
+#include "s5recorder.h"
 #include "s5session.h"
+#include "s5tunnel.h"
 
 namespace ba = boost::asio;
 namespace bs = boost::system;
@@ -15,13 +33,100 @@ namespace socks5 {
 
 class Server {
    public:
-    Server(ba::io_service& io, tcp::endpoint ep);
+    Server(ba::io_service& io, const Options& options);
+
+    ~Server();
 
    private:
+    // Sessions are spread over the loops round-robin. A single loop is the
+    // server's own io service, otherwise every loop runs on its own thread
+    // and the server's io service only accepts.
+    struct Loop {
+        std::unique_ptr<ba::io_service> own_io;
+        ba::io_service* io = nullptr;
+        std::unique_ptr<ba::io_service::work> work;
+        std::thread thread;
+        std::unique_ptr<Scheduler> scheduler;
+        SessionList sessions;
+        Services services;
+    };
+
+    using AcceptFn = void (Server::*)();
+
+    // sessions are instantiated for the features the options enable, the
+    // choice is made once here rather than per session
+    template <typename SessionType>
     void Accept();
 
+    static AcceptFn SelectAccept(const Options& options);
+
+    template <typename AuthPolicy>
+    static AcceptFn SelectAccess(const Options& options);
+
+    template <typename AuthPolicy, typename AccessPolicy>
+    static AcceptFn SelectAccounting(const Options& options);
+
+    // runs the handlers that are ready, io must not be running
+    static void Poll(ba::io_service& io);
+
+    // closes the loop's sessions & runs their handlers until all are gone,
+    // the loop must not be running
+    static void Drain(Loop& loop);
+
+    void WaitReload();
+
+    void Reload();
+
+    void ReclaimPolicies();
+
+    void WaitDump();
+
+    void ReportStats();
+
+    // /metrics families of the server's components
+    void AddMetricSources();
+
    private:
+    Options options_;
     ba::ip::tcp::acceptor acceptor_;
+    AcceptFn accept_;
+
+    // charged by sessions & tunnel streams, so it must outlive them
+    std::unique_ptr<AdmissionControl> admission_;
+
+    std::unique_ptr<tunnel::Pool> tunnel_pool_;
+    std::unique_ptr<tunnel::Listener> tunnel_listener_;
+    std::unique_ptr<EgressPool> egress_pool_;
+    std::unique_ptr<DnsCache> dns_cache_;
+
+    // reloaded on SIGHUP off the event loops
+    std::unique_ptr<PolicyStore> policy_store_;
+    ba::signal_set reload_signals_;
+    std::thread reload_thread_;
+    std::atomic<bool> reloading_{false};
+    ba::steady_timer reclaim_timer_;
+    std::size_t retired_policies_ = 0;  // left by the last reclaim
+
+    std::unique_ptr<RateLimiter> rate_limiter_;
+    std::unique_ptr<ConnectionLimits> connection_limits_;
+
+    // flushes the loops' tables, so it must outlive them
+    std::unique_ptr<Accounting> accounting_;
+    ba::steady_timer accept_timer_;
+
+    std::unique_ptr<Metrics> metrics_;
+
+    // dumped to the log on SIGUSR1
+    std::unique_ptr<FlightRecorder> recorder_;
+    ba::signal_set dump_signals_;
+
+    std::unique_ptr<AdminListener> admin_;
+
+    std::chrono::seconds stats_interval_;
+    ba::steady_timer stats_timer_;
+
+    std::vector<std::unique_ptr<Loop>> loops_;
+    std::size_t next_loop_ = 0;
 };
 
 }  // namespace socks5
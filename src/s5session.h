@@ -1,6 +1,7 @@
 #ifndef S5SESSION_H
 #define S5SESSION_H
 
+#include <chrono>
 #include <iostream>
 #include <memory>
 #include <string>
@@ -9,28 +10,234 @@
 
 #include <socks/socks5.h>
 
+#include "s5accounting.h"
+#include "s5admission.h"
+#include "s5dns.h"
+#include "s5egress.h"
+#include "s5limits.h"
+#include "s5metrics.h"
+#include "s5policy.h"
+#include "s5ratelimit.h"
+#include "s5recorder.h"
+#include "s5scheduler.h"
+#include "s5tunnel.h"
+
 namespace ba = boost::asio;
 namespace bs = boost::system;
 using tcp = ba::ip::tcp;
 
 namespace socks5 {
 
-class Session : public std::enable_shared_from_this<Session> {
+// Sessions started on an event loop, so the server can close them while the
+// services they use are still there. Intrusive, nothing is allocated per
+// session. Loop thread only.
+class SessionList {
+   public:
+    struct Hook {
+        void* session = nullptr;
+        void (*close)(void* session) = nullptr;
+        Hook* prev = nullptr;
+        Hook* next = nullptr;
+    };
+
+    SessionList() { head_.prev = head_.next = &head_; }
+
+    SessionList(const SessionList&) = delete;
+    SessionList& operator=(const SessionList&) = delete;
+
+    void Add(Hook& hook) {
+        hook.prev = head_.prev;
+        hook.next = &head_;
+        head_.prev->next = &hook;
+        head_.prev = &hook;
+    }
+
+    // a hook that was never added is left alone
+    void Remove(Hook& hook) {
+        if (hook.next) {
+            hook.prev->next = hook.next;
+            hook.next->prev = hook.prev;
+            hook.prev = hook.next = nullptr;
+        }
+    }
+
+    bool Empty() const { return head_.next == &head_; }
+
+    // the sessions' pending operations complete with operation_aborted, each
+    // session is removed once the last of them has run
+    void CloseAll() {
+        for (Hook* hook = head_.next; hook != &head_;) {
+            Hook* next = hook->next;
+            hook->close(hook->session);
+            hook = next;
+        }
+    }
+
+   private:
+    Hook head_;
+};
+
+// Server-wide services used by sessions, absent ones are nullptr.
+struct Services {
+    tunnel::Pool* tunnel = nullptr;
+    EgressPool* egress = nullptr;
+    DnsCache* dns = nullptr;
+    PolicyStore::Reader* policy = nullptr;  // of the session's event loop
+    RateLimiter::Shard* limiter = nullptr;  // of the session's event loop
+    ConnectionLimits* limits = nullptr;
+    AdmissionControl* admission = nullptr;
+    Scheduler* scheduler = nullptr;            // of the session's event loop
+    Accounting::Table* accounting = nullptr;   // of the session's event loop
+    Metrics::Shard* metrics = nullptr;         // of the session's event loop
+    FlightRecorder::Ring* recorder = nullptr;  // of the session's event loop
+    SessionList* sessions = nullptr;           // of the session's event loop
+
+    // deadline for resolving & connecting to the destination
+    std::chrono::milliseconds connect_timeout{10000};
+};
+
+// Session policies, chosen at compile time: disabled features are empty
+// inline functions instead of indirect calls on every handshake & chunk.
+//
+// AuthPolicy: the auth method clients must use & the username/password
+// check for it.
+struct NoAuth {
+    static socks5::AuthMethod Method(const Policy* /*unused*/) {
+        return socks5::AuthMethod::no_auth;
+    }
+
+    static bool Authenticate(const Policy* /*unused*/,
+                             const std::string& /*unused*/,
+                             const std::string& /*unused*/) {
+        return false;
+    }
+};
+
+struct PasswordAuth {
+    static socks5::AuthMethod Method(const Policy* policy) {
+        return policy && policy->users ? socks5::AuthMethod::username_password
+                                       : socks5::AuthMethod::no_auth;
+    }
+
+    static bool Authenticate(const Policy* policy, const std::string& user,
+                             const std::string& password) {
+        return policy->users->Check(user, password);
+    }
+};
+
+// AccessPolicy: address & domain rules, enabled = false skips the checks
+// altogether.
+struct NoAccess {
+    static constexpr bool enabled = false;
+
+    static bool Allowed(const Policy* /*unused*/,
+                        const ba::ip::address& /*unused*/,
+                        const ba::ip::address& /*unused*/,
+                        bool /*unused*/ = true) {
+        return true;
+    }
+
+    static bool SourceAllowed(const Policy* /*unused*/,
+                              const ba::ip::address& /*unused*/) {
+        return true;
+    }
+
+    static bool DomainAllowed(const Policy* /*unused*/,
+                              const std::string& /*unused*/) {
+        return true;
+    }
+};
+
+struct RuleAccess {
+    static constexpr bool enabled = true;
+
+    static bool Allowed(const Policy* policy, const ba::ip::address& source,
+                        const ba::ip::address& destination,
+                        bool count = true) {
+        return !policy || !policy->acl ||
+               policy->acl->Allowed(source, destination, count);
+    }
+
+    static bool SourceAllowed(const Policy* policy,
+                              const ba::ip::address& source) {
+        return !policy || !policy->acl || policy->acl->SourceAllowed(source);
+    }
+
+    static bool DomainAllowed(const Policy* policy, const std::string& host) {
+        return !policy || !policy->domains || policy->domains->Allowed(host);
+    }
+};
+
+// AccountingPolicy: a base of the session (so an empty one takes no space)
+// counting its relayed bytes.
+class NoAccounting {
+   protected:
+    void AccountOpen(Accounting::Table* /*unused*/,
+                     const std::string& /*unused*/,
+                     const std::string& /*unused*/) {}
+    void AccountUp(std::size_t /*unused*/) {}
+    void AccountDown(std::size_t /*unused*/) {}
+    void AccountClose(Accounting::Table* /*unused*/) {}
+};
+
+class TableAccounting {
+   protected:
+    void AccountOpen(Accounting::Table* table, const std::string& user,
+                     const std::string& destination) {
+        account_ = table->Open(user, destination);
+    }
+
+    void AccountUp(std::size_t length) {
+        if (account_) {
+            account_->counters.bytes_up += length;
+        }
+    }
+
+    void AccountDown(std::size_t length) {
+        if (account_) {
+            account_->counters.bytes_down += length;
+        }
+    }
+
+    void AccountClose(Accounting::Table* table) {
+        if (account_) {
+            table->Close(account_);
+        }
+    }
+
+   private:
+    Accounting::Table::Account* account_ = nullptr;
+};
+
+// Definitions are in s5session_impl.h, instantiated in s5session.cpp for the
+// policy combinations the server picks from.
+template <typename AuthPolicy, typename AccessPolicy,
+          typename AccountingPolicy>
+class Session
+    : public std::enable_shared_from_this<
+          Session<AuthPolicy, AccessPolicy, AccountingPolicy>>,
+      private AccountingPolicy {
    private:
     struct _ctor_tag {
         explicit _ctor_tag() = default;
     };
 
    public:
-    Session(_ctor_tag /*unused*/, ba::io_service& io);
+    Session(_ctor_tag /*unused*/, ba::io_service& io,
+            const Services& services);
 
-    static std::unique_ptr<Session> Create(ba::io_service& io);
+    ~Session();
+
+    static std::unique_ptr<Session> Create(ba::io_service& io,
+                                           const Services& services = {});
 
     void Start();
 
     tcp::socket& AcceptorSocket();
 
    private:
+    void Refuse(const char* reason);
+
     std::size_t AuthRequestSize();
 
     void ReadAuthRequest();
@@ -39,6 +246,14 @@ class Session : public std::enable_shared_from_this<Session> {
 
     void AuthResponse();
 
+    socks5::AuthMethod SelectAuthMethod() const;
+
+    std::size_t UserPassRequestSize() const;
+
+    void ReadUserPass();
+
+    void UserPassResponse();
+
     socks5::AddressType RequestAddressType() const;
 
     std::size_t RequestDomainNameSize() const;
@@ -47,6 +262,8 @@ class Session : public std::enable_shared_from_this<Session> {
 
     std::string RequestDomainName() const;
 
+    std::string RequestDestination() const;
+
     uint16_t RequestPort() const;
 
     void ReadRequest();
@@ -65,11 +282,29 @@ class Session : public std::enable_shared_from_this<Session> {
 
     void Connect(tcp::resolver::iterator ep_iterator);
 
-    void ConnectResponse(socks5::Reply reply);
+    void ConnectNext(tcp::resolver::iterator ep_iterator);
+
+    void ConnectTunnel();
+
+    void ConnectParent();
+
+    void ParentGreeting();
+
+    void ParentRequest();
+
+    void ParentReplyHead();
+
+    void ParentReply(std::size_t bytes_left);
+
+    void StartConnectTimer();
+
+    void ConnectFailed(const bs::error_code& ec);
 
     void Bind();
     void UdpAssociate();
-    bool CheckAccess();
+    bool CheckAccess(const tcp::endpoint& destination);
+    bool CheckDomainAccess();
+    bool CheckForwardedAccess();
 
     void Close(const bs::error_code& ec);
 
@@ -83,14 +318,66 @@ class Session : public std::enable_shared_from_this<Session> {
 
     void UpstreamWrite(std::size_t length);
 
+    void Throttle(ba::steady_timer& timer, Scheduler::Flow& flow,
+                  std::size_t length, void (Session::*read)());
+
+    void Schedule(Scheduler::Flow& flow, std::size_t length,
+                  void (Session::*read)());
+
+    void Count(Metrics::Counter counter, uint64_t n = 1);
+
+    // counts the handshake's outcome, the first one only
+    void Handshake(Metrics::Counter outcome);
+
+    void CountConnect(const bs::error_code& ec);
+
+    void StartPhase();
+
+    // records the time since StartPhase()
+    void EndPhase(Metrics::Phase phase);
+
+    void Trace(FlightRecorder::Event event, const bs::error_code& ec = {});
+
    private:
     std::size_t downstream_bytes_read_ = 0;
+    Services services_;
+    const Policy* policy_ = nullptr;  // version pinned for the session
+    std::string user_;                // authenticated user, if any
+    ba::ip::address client_address_;
+    bool address_counted_ = false;  // by services_.limits
+    bool user_counted_ = false;
+    bool started_ = false;
+    bool handshake_pending_ = false;  // no outcome counted yet
+    bool first_byte_pending_ = false;  // with metrics or the recorder
+    std::chrono::steady_clock::time_point accepted_at_;    // with metrics
+    std::chrono::steady_clock::time_point phase_started_;  // with metrics
+    std::size_t egress_index_ = EgressPool::npos;
     tcp::socket downstream_socket_;
     tcp::socket upstream_socket_;
+    std::shared_ptr<tunnel::Stream> upstream_stream_;
+    tcp::resolver resolver_;
+    ba::steady_timer connect_timer_;
+    bool connect_timed_out_ = false;
+    const Routes::Route* route_ = nullptr;  // of policy_, if one matched
+    RateLimiter::Ticket rate_ticket_;
+    ba::steady_timer upstream_read_timer_;
+    ba::steady_timer downstream_read_timer_;
+    Scheduler::Flow upstream_flow_;    // upstream -> downstream
+    Scheduler::Flow downstream_flow_;  // downstream -> upstream
+    SessionList::Hook hook_;           // in services_.sessions once started
     std::array<char, 4096> upstream_buf_;
     std::array<char, 4096> downstream_buf_;
 };
 
+extern template class Session<NoAuth, NoAccess, NoAccounting>;
+extern template class Session<NoAuth, NoAccess, TableAccounting>;
+extern template class Session<NoAuth, RuleAccess, NoAccounting>;
+extern template class Session<NoAuth, RuleAccess, TableAccounting>;
+extern template class Session<PasswordAuth, NoAccess, NoAccounting>;
+extern template class Session<PasswordAuth, NoAccess, TableAccounting>;
+extern template class Session<PasswordAuth, RuleAccess, NoAccounting>;
+extern template class Session<PasswordAuth, RuleAccess, TableAccounting>;
+
 }  // namespace socks5
 
 #endif /* S5SESSION_H */
@@ -0,0 +1,1384 @@
+#ifndef S5SESSION_IMPL_H
+#define S5SESSION_IMPL_H
+
+#include "s5session.h"
+#include "s5probes.h"
+
+#include <boost/log/trivial.hpp>
+
+namespace socks5 {
+
+const std::size_t parent_reply_head_size = 5;
+
+// RFC 1929 subnegotiation version
+const unsigned char userpass_version = 0x01;
+
+template <typename AuthPolicy, typename AccessPolicy,
+          typename AccountingPolicy>
+Session<AuthPolicy, AccessPolicy, AccountingPolicy>::Session(
+    _ctor_tag /*unused*/, ba::io_service& io, const Services& services)
+    : services_{services},
+      downstream_socket_{io},
+      upstream_socket_{io},
+      resolver_{io},
+      connect_timer_{io},
+      upstream_read_timer_{io},
+      downstream_read_timer_{io} {
+    if (services_.admission) {
+        services_.admission->Charge(sizeof(Session));
+    }
+
+    hook_.session = this;
+    hook_.close = [](void* session) {
+        auto self = static_cast<Session*>(session)->shared_from_this();
+        self->Close(ba::error::operation_aborted);
+    };
+}
+
+template <typename AuthPolicy, typename AccessPolicy,
+          typename AccountingPolicy>
+Session<AuthPolicy, AccessPolicy, AccountingPolicy>::~Session() {
+    if (services_.sessions) {
+        services_.sessions->Remove(hook_);
+    }
+
+    if (services_.accounting) {
+        this->AccountClose(services_.accounting);
+    }
+
+    if (services_.admission) {
+        services_.admission->Release(sizeof(Session));
+    }
+
+    if (started_ && services_.metrics) {
+        Handshake(Metrics::Counter::handshake_aborted);
+        services_.metrics->Add(Metrics::Gauge::active_sessions, -1);
+    }
+
+    if (user_counted_) {
+        services_.limits->ReleaseUser(user_);
+    }
+
+    if (address_counted_) {
+        services_.limits->ReleaseAddress(client_address_);
+    }
+
+    if (services_.limiter) {
+        services_.limiter->Detach(rate_ticket_);
+    }
+
+    if (policy_) {
+        services_.policy->Release(policy_);
+    }
+}
+
+template <typename AuthPolicy, typename AccessPolicy,
+          typename AccountingPolicy>
+std::unique_ptr<Session<AuthPolicy, AccessPolicy, AccountingPolicy>>
+Session<AuthPolicy, AccessPolicy, AccountingPolicy>::Create(
+    ba::io_service& io, const Services& services) {
+    return std::make_unique<Session>(_ctor_tag{}, io, services);
+}
+
+template <typename AuthPolicy, typename AccessPolicy,
+          typename AccountingPolicy>
+void Session<AuthPolicy, AccessPolicy, AccountingPolicy>::Start() {
+    if (services_.policy) {
+        policy_ = services_.policy->Acquire();
+    }
+
+    started_ = true;
+    handshake_pending_ = true;
+    if (services_.sessions) {
+        services_.sessions->Add(hook_);
+    }
+
+    S5_PROBE1(start, this);
+    if (services_.metrics) {
+        services_.metrics->Add(Metrics::Counter::accepts);
+        services_.metrics->Add(Metrics::Gauge::active_sessions, 1);
+        accepted_at_ = std::chrono::steady_clock::now();
+        phase_started_ = accepted_at_;
+        first_byte_pending_ = true;
+    }
+
+    if (services_.recorder) {
+        Trace(FlightRecorder::Event::accept);
+        first_byte_pending_ = true;
+    }
+
+    downstream_bytes_read_ = 0;
+    bs::error_code ec;
+    const tcp::endpoint client = downstream_socket_.remote_endpoint(ec);
+    client_address_ = client.address();
+    BOOST_LOG_TRIVIAL(info) << "session=" << this << ' '
+                            << downstream_socket_.local_endpoint(ec) << " <- "
+                            << client;
+
+    if (services_.admission && !services_.admission->AdmitHandshake()) {
+        Refuse("over memory limit");
+        return;
+    }
+
+    if (services_.limits) {
+        if (!services_.limits->AcquireAddress(client_address_)) {
+            Refuse("over connection limit");
+            return;
+        }
+        address_counted_ = true;
+    }
+
+    ReadAuthRequest();
+}
+
+// Refused before the greeting: answer it in advance with "no acceptable
+// methods", the client gives up on that.
+template <typename AuthPolicy, typename AccessPolicy,
+          typename AccountingPolicy>
+void Session<AuthPolicy, AccessPolicy, AccountingPolicy>::Refuse(
+    const char* reason) {
+    BOOST_LOG_TRIVIAL(info) << "session=" << this << " refused: " << reason;
+    Handshake(Metrics::Counter::handshake_refused);
+
+    auto self(this->shared_from_this());
+    auto handler = [this, self](const bs::error_code& ec, std::size_t) {
+        Close(ec ? ec : ba::error::no_permission);
+    };
+
+    const std::size_t response_size = 2;
+    downstream_buf_[0] = socks5::version;
+    downstream_buf_[1] =
+        static_cast<unsigned char>(socks5::AuthMethod::no_acceptable_methods);
+
+    ba::async_write(downstream_socket_,
+                    ba::buffer(downstream_buf_.data(), response_size), handler);
+}
+
+template <typename AuthPolicy, typename AccessPolicy,
+          typename AccountingPolicy>
+tcp::socket&
+Session<AuthPolicy, AccessPolicy, AccountingPolicy>::AcceptorSocket() {
+    return downstream_socket_;
+}
+
+template <typename AuthPolicy, typename AccessPolicy,
+          typename AccountingPolicy>
+std::size_t
+Session<AuthPolicy, AccessPolicy, AccountingPolicy>::AuthRequestSize() {
+    return socks5::GreetingSize(downstream_buf_.data());
+}
+
+template <typename AuthPolicy, typename AccessPolicy,
+          typename AccountingPolicy>
+void Session<AuthPolicy, AccessPolicy, AccountingPolicy>::ReadAuthRequest() {
+    auto self(this->shared_from_this());
+    auto handler = [this, self](const bs::error_code& ec, std::size_t length) {
+        if (ec) {
+            Close(ec);
+            return;
+        }
+
+        downstream_bytes_read_ += length;
+        const std::size_t auth_msg_min_size = 3;
+        if (downstream_bytes_read_ < auth_msg_min_size) {
+            ReadAuthRequest();
+        } else {
+            if (downstream_bytes_read_ < AuthRequestSize()) {
+                ReadAuthMethods();
+            } else {
+                AuthResponse();
+            }
+        }
+    };
+
+    downstream_socket_.async_read_some(
+        ba::buffer(downstream_buf_.data() + downstream_bytes_read_,
+                   downstream_buf_.size() - downstream_bytes_read_),
+        handler);
+}
+
+template <typename AuthPolicy, typename AccessPolicy,
+          typename AccountingPolicy>
+void Session<AuthPolicy, AccessPolicy, AccountingPolicy>::ReadAuthMethods() {
+    auto self(this->shared_from_this());
+    auto handler = [this, self](const bs::error_code& ec, std::size_t length) {
+        if (ec) {
+            Close(ec);
+            return;
+        }
+
+        downstream_bytes_read_ += length;
+        if (downstream_bytes_read_ < AuthRequestSize()) {
+            ReadAuthMethods();
+        } else {
+            AuthResponse();
+        }
+    };
+
+    downstream_socket_.async_read_some(
+        ba::buffer(downstream_buf_.data() + downstream_bytes_read_,
+                   downstream_buf_.size() - downstream_bytes_read_),
+        handler);
+}
+
+template <typename AuthPolicy, typename AccessPolicy,
+          typename AccountingPolicy>
+void Session<AuthPolicy, AccessPolicy, AccountingPolicy>::AuthResponse() {
+    EndPhase(Metrics::Phase::greeting);
+    Trace(FlightRecorder::Event::greeting);
+
+    const socks5::AuthMethod method = SelectAuthMethod();
+    if (method == socks5::AuthMethod::no_acceptable_methods) {
+        Handshake(Metrics::Counter::handshake_auth_failed);
+    }
+    // username/password is decided on the credentials
+    if (method != socks5::AuthMethod::username_password) {
+        S5_PROBE3(auth, this, static_cast<int>(method),
+                  method == socks5::AuthMethod::no_auth);
+    }
+
+    auto self(this->shared_from_this());
+    auto handler = [this, self, method](const bs::error_code& ec,
+                                        std::size_t) {
+        if (ec) {
+            Close(ec);
+            return;
+        }
+
+        downstream_bytes_read_ = 0;
+        switch (method) {
+            case socks5::AuthMethod::no_auth: {
+                StartPhase();
+                ReadRequest();
+                break;
+            }
+            case socks5::AuthMethod::username_password: {
+                ReadUserPass();
+                break;
+            }
+            default:
+                Close(ba::error::no_permission);
+                break;
+        }
+    };
+
+    const std::size_t response_size = 2;
+    downstream_buf_[0] = socks5::version;
+    downstream_buf_[1] = static_cast<unsigned char>(method);
+
+    ba::async_write(downstream_socket_,
+                    ba::buffer(downstream_buf_.data(), response_size), handler);
+}
+
+template <typename AuthPolicy, typename AccessPolicy,
+          typename AccountingPolicy>
+socks5::AuthMethod
+Session<AuthPolicy, AccessPolicy, AccountingPolicy>::SelectAuthMethod() const {
+    return socks5::SelectAuthMethod(downstream_buf_.data(),
+                                    AuthPolicy::Method(policy_));
+}
+
+// RFC 1929: VER ULEN UNAME PLEN PASSWD, 0 while the lengths aren't read yet
+template <typename AuthPolicy, typename AccessPolicy,
+          typename AccountingPolicy>
+std::size_t
+Session<AuthPolicy, AccessPolicy, AccountingPolicy>::UserPassRequestSize()
+    const {
+    if (downstream_bytes_read_ < 2) {
+        return 0;
+    }
+
+    const std::size_t ulen = static_cast<unsigned char>(downstream_buf_[1]);
+    if (downstream_bytes_read_ < 3 + ulen) {
+        return 0;
+    }
+
+    const std::size_t plen =
+        static_cast<unsigned char>(downstream_buf_[2 + ulen]);
+    return 3 + ulen + plen;
+}
+
+template <typename AuthPolicy, typename AccessPolicy,
+          typename AccountingPolicy>
+void Session<AuthPolicy, AccessPolicy, AccountingPolicy>::ReadUserPass() {
+    auto self(this->shared_from_this());
+    auto handler = [this, self](const bs::error_code& ec, std::size_t length) {
+        if (ec) {
+            Close(ec);
+            return;
+        }
+
+        downstream_bytes_read_ += length;
+        const std::size_t size = UserPassRequestSize();
+        if (size == 0 || downstream_bytes_read_ < size) {
+            ReadUserPass();
+        } else {
+            UserPassResponse();
+        }
+    };
+
+    downstream_socket_.async_read_some(
+        ba::buffer(downstream_buf_.data() + downstream_bytes_read_,
+                   downstream_buf_.size() - downstream_bytes_read_),
+        handler);
+}
+
+template <typename AuthPolicy, typename AccessPolicy,
+          typename AccountingPolicy>
+void Session<AuthPolicy, AccessPolicy, AccountingPolicy>::UserPassResponse() {
+    const std::size_t ulen = static_cast<unsigned char>(downstream_buf_[1]);
+    const std::size_t plen =
+        static_cast<unsigned char>(downstream_buf_[2 + ulen]);
+    const std::string user(downstream_buf_.data() + 2, ulen);
+    const std::string password(downstream_buf_.data() + 3 + ulen, plen);
+
+    const auto version = static_cast<unsigned char>(downstream_buf_[0]);
+    bool ok = version == userpass_version &&
+              AuthPolicy::Authenticate(policy_, user, password);
+    if (version != userpass_version) {
+        BOOST_LOG_TRIVIAL(info)
+            << "session=" << this << " bad subnegotiation version "
+            << static_cast<unsigned>(version);
+        Handshake(Metrics::Counter::handshake_auth_failed);
+    } else if (!ok) {
+        BOOST_LOG_TRIVIAL(info)
+            << "session=" << this << " auth failed for user " << user;
+        Handshake(Metrics::Counter::handshake_auth_failed);
+    } else if (services_.limits && !services_.limits->AcquireUser(user)) {
+        BOOST_LOG_TRIVIAL(info) << "session=" << this << " refused user "
+                                << user << ": over connection limit";
+        Handshake(Metrics::Counter::handshake_refused);
+        ok = false;
+    } else {
+        user_ = user;
+        user_counted_ = services_.limits != nullptr;
+    }
+    S5_PROBE3(auth, this,
+              static_cast<int>(socks5::AuthMethod::username_password), ok);
+
+    auto self(this->shared_from_this());
+    auto handler = [this, self, ok](const bs::error_code& ec, std::size_t) {
+        if (ec || !ok) {
+            Close(ec ? ec : ba::error::no_permission);
+            return;
+        }
+
+        downstream_bytes_read_ = 0;
+        StartPhase();
+        ReadRequest();
+    };
+
+    // any status but 0 fails, the client must close
+    const std::size_t response_size = 2;
+    downstream_buf_[0] = userpass_version;
+    downstream_buf_[1] = ok ? 0x00 : 0x01;
+
+    ba::async_write(downstream_socket_,
+                    ba::buffer(downstream_buf_.data(), response_size), handler);
+}
+
+template <typename AuthPolicy, typename AccessPolicy,
+          typename AccountingPolicy>
+socks5::AddressType
+Session<AuthPolicy, AccessPolicy, AccountingPolicy>::RequestAddressType()
+    const {
+    return socks5::RequestAddressType(downstream_buf_.data());
+}
+
+template <typename AuthPolicy, typename AccessPolicy,
+          typename AccountingPolicy>
+std::size_t
+Session<AuthPolicy, AccessPolicy, AccountingPolicy>::RequestDomainNameSize()
+    const {
+    return socks5::RequestDomainNameSize(downstream_buf_.data());
+}
+
+template <typename AuthPolicy, typename AccessPolicy,
+          typename AccountingPolicy>
+std::size_t
+Session<AuthPolicy, AccessPolicy, AccountingPolicy>::RequestSize() const {
+    return socks5::RequestSize(downstream_buf_.data());
+}
+
+template <typename AuthPolicy, typename AccessPolicy,
+          typename AccountingPolicy>
+std::string
+Session<AuthPolicy, AccessPolicy, AccountingPolicy>::RequestDomainName() const {
+    return socks5::RequestDomainName(downstream_buf_.data());
+}
+
+template <typename AuthPolicy, typename AccessPolicy,
+          typename AccountingPolicy>
+uint16_t
+Session<AuthPolicy, AccessPolicy, AccountingPolicy>::RequestPort() const {
+    return socks5::RequestPort(downstream_buf_.data());
+}
+
+// host:port as requested, for accounting
+template <typename AuthPolicy, typename AccessPolicy,
+          typename AccountingPolicy>
+std::string
+Session<AuthPolicy, AccessPolicy, AccountingPolicy>::RequestDestination()
+    const {
+    const std::string host =
+        RequestAddressType() == socks5::AddressType::domain_name
+            ? RequestDomainName()
+            : RequestAddress().to_string();
+    return host + ':' + std::to_string(RequestPort());
+}
+
+template <typename AuthPolicy, typename AccessPolicy,
+          typename AccountingPolicy>
+void Session<AuthPolicy, AccessPolicy, AccountingPolicy>::ReadRequest() {
+    auto self(this->shared_from_this());
+    auto handler = [this, self](const bs::error_code& ec, std::size_t length) {
+        if (ec) {
+            Close(ec);
+            return;
+        }
+
+        downstream_bytes_read_ += length;
+        const std::size_t request_min_size = 10;
+        if (downstream_bytes_read_ < request_min_size) {
+            ReadRequest();
+        } else {
+            const std::size_t request_size = RequestSize();
+            if (request_size == 0) {
+                Response(socks5::Reply::address_type_not_supported);
+                return;
+            }
+
+            ReadRequest(request_size - downstream_bytes_read_);
+        }
+    };
+
+    downstream_socket_.async_read_some(
+        ba::buffer(downstream_buf_.data() + downstream_bytes_read_,
+                   downstream_buf_.size() - downstream_bytes_read_),
+        handler);
+}
+
+template <typename AuthPolicy, typename AccessPolicy,
+          typename AccountingPolicy>
+void Session<AuthPolicy, AccessPolicy, AccountingPolicy>::ReadRequest(
+    std::size_t bytes_left) {
+    if (!bytes_left) {
+        ProcessRequest();
+        return;
+    }
+
+    auto self(this->shared_from_this());
+    auto handler = [this, self](const bs::error_code& ec, std::size_t length) {
+        if (ec) {
+            Close(ec);
+            return;
+        }
+
+        downstream_bytes_read_ += length;
+        ProcessRequest();
+    };
+
+    ba::async_read(
+        downstream_socket_,
+        ba::buffer(downstream_buf_.data() + downstream_bytes_read_, bytes_left),
+        handler);
+}
+
+template <typename AuthPolicy, typename AccessPolicy,
+          typename AccountingPolicy>
+void Session<AuthPolicy, AccessPolicy, AccountingPolicy>::Response(
+    socks5::Reply reply) {
+    auto self(this->shared_from_this());
+    auto handler = [this, self, reply](const bs::error_code& ec, std::size_t) {
+        if (ec) {
+            Close(ec);
+            return;
+        }
+
+        if (reply != socks5::Reply::succeeded) {
+            Close(bs::errc::make_error_code(bs::errc::success));
+            return;
+        }
+
+        if (services_.limiter) {
+            rate_ticket_ = services_.limiter->Attach(user_, client_address_);
+        }
+
+        UpstreamRead();
+        DownstreamRead();
+    };
+
+    if (reply == socks5::Reply::succeeded) {
+        Handshake(Metrics::Counter::handshake_ok);
+    } else {
+        Handshake(Metrics::Counter::handshake_error);
+        if (services_.metrics) {
+            services_.metrics->AddReply(reply);
+        }
+    }
+
+    // before the reply overwrites the request
+    if (reply == socks5::Reply::succeeded && services_.accounting) {
+        this->AccountOpen(services_.accounting, user_, RequestDestination());
+    }
+
+    // BND.ADDR & BND.PORT: our end of the upstream connection if there is
+    // one, 0.0.0.0:0 otherwise
+    bs::error_code ec;
+    tcp::endpoint bound;
+    if (reply == socks5::Reply::succeeded && upstream_socket_.is_open()) {
+        bound = upstream_socket_.local_endpoint(ec);
+    }
+
+    const std::size_t response_size =
+        socks5::WriteReply(downstream_buf_.data(), reply, bound);
+
+    ba::async_write(downstream_socket_,
+                    ba::buffer(downstream_buf_.data(), response_size), handler);
+}
+
+template <typename AuthPolicy, typename AccessPolicy,
+          typename AccountingPolicy>
+socks5::Command
+Session<AuthPolicy, AccessPolicy, AccountingPolicy>::RequestCommand() const {
+    return socks5::RequestCommand(downstream_buf_.data());
+}
+
+template <typename AuthPolicy, typename AccessPolicy,
+          typename AccountingPolicy>
+ba::ip::address
+Session<AuthPolicy, AccessPolicy, AccountingPolicy>::RequestAddress() const {
+    return socks5::RequestAddress(downstream_buf_.data());
+}
+
+template <typename AuthPolicy, typename AccessPolicy,
+          typename AccountingPolicy>
+void Session<AuthPolicy, AccessPolicy, AccountingPolicy>::ProcessRequest() {
+    EndPhase(Metrics::Phase::request);
+    Trace(FlightRecorder::Event::request);
+    S5_PROBE3(request, this, static_cast<int>(RequestCommand()),
+              static_cast<int>(RequestAddressType()));
+
+    switch (RequestCommand()) {
+        case socks5::Command::connect: {
+            if (policy_ && policy_->routes) {
+                route_ = RequestAddressType() ==
+                                 socks5::AddressType::domain_name
+                             ? policy_->routes->Find(RequestDomainName())
+                             : policy_->routes->Find(RequestAddress());
+            }
+
+            if (route_ && route_->action == Routes::Action::reject) {
+                BOOST_LOG_TRIVIAL(info) << "session=" << this << " route "
+                                        << route_->text;
+                Response(socks5::Reply::connection_not_allowed_by_ruleset);
+                break;
+            }
+
+            Connect();
+            break;
+        }
+        case socks5::Command::bind: {
+            Bind();
+            break;
+        }
+        case socks5::Command::udp_associate: {
+            UdpAssociate();
+            break;
+        }
+        default:
+            Response(socks5::Reply::command_not_supported);
+            break;
+    }
+}
+
+template <typename AuthPolicy, typename AccessPolicy,
+          typename AccountingPolicy>
+void Session<AuthPolicy, AccessPolicy, AccountingPolicy>::Connect() {
+    if (!CheckDomainAccess()) {
+        Response(socks5::Reply::connection_not_allowed_by_ruleset);
+        return;
+    }
+
+    StartConnectTimer();
+
+    if (route_ && route_->action == Routes::Action::parent) {
+        ConnectParent();
+        return;
+    }
+
+    // routed requests go from here
+    if (services_.tunnel && !route_) {
+        ConnectTunnel();
+        return;
+    }
+
+    if (RequestAddressType() == socks5::AddressType::domain_name) {
+        const std::string host = RequestDomainName();
+        std::vector<ba::ip::address> addresses;
+        if (services_.dns && services_.dns->Lookup(host, addresses)) {
+            Count(Metrics::Counter::dns_cache_hit);
+            Connect(DnsCache::Endpoints(addresses, host, RequestPort()));
+            return;
+        }
+
+        auto self(this->shared_from_this());
+        auto handler = [this, self, host](const bs::error_code& ec,
+                                          tcp::resolver::iterator ep_iterator) {
+            if (ec != ba::error::operation_aborted) {
+                EndPhase(Metrics::Phase::resolve);
+            }
+            Trace(FlightRecorder::Event::resolve_end, ec);
+            S5_PROBE2(resolve_done, this, ec.value());
+
+            if (ec) {
+                if (ec != ba::error::operation_aborted) {
+                    Count(Metrics::Counter::dns_failed);
+                }
+                ConnectFailed(ec);
+                return;
+            }
+
+            Count(Metrics::Counter::dns_resolved);
+            if (services_.dns) {
+                services_.dns->Insert(host, ep_iterator);
+            }
+
+            Connect(ep_iterator);
+        };
+
+        tcp::resolver::query q{host, std::to_string(RequestPort())};
+
+        BOOST_LOG_TRIVIAL(info) << "session=" << this << " resolve "
+                                << q.host_name() << ':' << q.service_name();
+
+        StartPhase();
+        Trace(FlightRecorder::Event::resolve_start);
+        S5_PROBE1(resolve_start, this);
+        resolver_.async_resolve(q, handler);
+    } else {
+        // fixme:
+        tcp::endpoint ep{RequestAddress(), RequestPort()};
+        auto ep_iterator = tcp::resolver::iterator::create(
+            ep, RequestDomainName(), std::to_string(RequestPort()));
+        Connect(ep_iterator);
+    }
+}
+
+template <typename AuthPolicy, typename AccessPolicy,
+          typename AccountingPolicy>
+void Session<AuthPolicy, AccessPolicy, AccountingPolicy>::Connect(
+    tcp::resolver::iterator ep_iterator) {
+    // the rules count one decision per request: the first endpoint they
+    // allow, or the first endpoint when they allow none
+    if (AccessPolicy::enabled && ep_iterator != tcp::resolver::iterator()) {
+        auto allowed = ep_iterator;
+        while (allowed != tcp::resolver::iterator() &&
+               !AccessPolicy::Allowed(policy_, client_address_,
+                                      allowed->endpoint().address(), false)) {
+            ++allowed;
+        }
+
+        CheckAccess(allowed != tcp::resolver::iterator()
+                        ? allowed->endpoint()
+                        : ep_iterator->endpoint());
+    }
+
+    ConnectNext(ep_iterator);
+}
+
+// Tries the endpoints in order like ba::async_connect, but opens the socket
+// itself, so it can be bound to an egress address before every attempt.
+// Endpoints the rules deny are skipped, uncounted.
+template <typename AuthPolicy, typename AccessPolicy,
+          typename AccountingPolicy>
+void Session<AuthPolicy, AccessPolicy, AccountingPolicy>::ConnectNext(
+    tcp::resolver::iterator ep_iterator) {
+    // resolved or refused just as the timer fired
+    if (connect_timed_out_) {
+        ConnectFailed(ba::error::timed_out);
+        return;
+    }
+
+    while (ep_iterator != tcp::resolver::iterator() &&
+           !AccessPolicy::Allowed(policy_, client_address_,
+                                  ep_iterator->endpoint().address(), false)) {
+        ++ep_iterator;
+    }
+
+    if (ep_iterator == tcp::resolver::iterator()) {
+        connect_timer_.cancel();
+        Response(socks5::Reply::connection_not_allowed_by_ruleset);
+        return;
+    }
+
+    const tcp::endpoint ep = ep_iterator->endpoint();
+
+    bs::error_code ec;
+    if (route_ && route_->action == Routes::Action::egress) {
+        if (upstream_socket_.is_open()) {
+            upstream_socket_.close(ec);
+        }
+        upstream_socket_.open(ep.protocol(), ec);
+        if (!ec) {
+            EgressPool::BindNoPort(upstream_socket_, route_->target.address(),
+                                   ec);
+        }
+    } else if (services_.egress) {
+        services_.egress->Release(egress_index_);
+        egress_index_ =
+            services_.egress->Bind(upstream_socket_, ep, client_address_, ec);
+    } else {
+        if (upstream_socket_.is_open()) {
+            upstream_socket_.close(ec);
+        }
+        upstream_socket_.open(ep.protocol(), ec);
+    }
+
+    if (ec) {
+        CountConnect(ec);
+        BOOST_LOG_TRIVIAL(info) << "session=" << this << " socket for " << ep
+                                << ": " << ec.message();
+
+        // e.g. a source address of the other family, the next may do
+        if (++ep_iterator != tcp::resolver::iterator()) {
+            ConnectNext(ep_iterator);
+            return;
+        }
+
+        ConnectFailed(ec);
+        return;
+    }
+
+    auto self(this->shared_from_this());
+    auto handler = [this, self, ep_iterator](const bs::error_code& ec) mutable {
+        // connected just as the timer fired, the socket is closed by now
+        if (connect_timed_out_) {
+            ConnectFailed(ba::error::timed_out);
+            return;
+        }
+
+        CountConnect(ec);
+        if (ec != ba::error::operation_aborted) {
+            EndPhase(Metrics::Phase::connect);
+        }
+        Trace(FlightRecorder::Event::connect_end, ec);
+        S5_PROBE2(connect_done, this, ec.value());
+
+        if (ec) {
+            if (ec != ba::error::operation_aborted &&
+                ++ep_iterator != tcp::resolver::iterator()) {
+                ConnectNext(ep_iterator);
+                return;
+            }
+
+            ConnectFailed(ec);
+            return;
+        }
+
+        connect_timer_.cancel();
+        Response(socks5::Reply::succeeded);
+    };
+
+    BOOST_LOG_TRIVIAL(info) << "session=" << this << " connect to " << ep;
+
+    StartPhase();
+    Trace(FlightRecorder::Event::connect_start);
+    S5_PROBE1(connect_start, this);
+    upstream_socket_.async_connect(ep, handler);
+}
+
+template <typename AuthPolicy, typename AccessPolicy,
+          typename AccountingPolicy>
+void Session<AuthPolicy, AccessPolicy, AccountingPolicy>::ConnectTunnel() {
+    if (!CheckForwardedAccess()) {
+        connect_timer_.cancel();
+        Response(socks5::Reply::connection_not_allowed_by_ruleset);
+        return;
+    }
+
+    auto self(this->shared_from_this());
+    auto handler = [this, self](socks5::Reply reply) {
+        if (connect_timed_out_) {
+            ConnectFailed(ba::error::timed_out);
+            return;
+        }
+
+        Count(reply == socks5::Reply::succeeded
+                  ? Metrics::Counter::connect_ok
+                  : Metrics::Counter::connect_failed);
+        if (services_.recorder) {
+            services_.recorder->Record(this,
+                                       FlightRecorder::Event::connect_end,
+                                       static_cast<int32_t>(reply));
+        }
+        S5_PROBE2(connect_done, this, static_cast<int>(reply));
+
+        connect_timer_.cancel();
+        Response(reply);
+    };
+
+    // the peer resolves & connects: pass ATYP, address & port through as is
+    const std::string address(downstream_buf_.data() + 3, RequestSize() - 3);
+
+    BOOST_LOG_TRIVIAL(info) << "session=" << this << " tunnel to "
+                            << (RequestAddressType() ==
+                                        socks5::AddressType::domain_name
+                                    ? RequestDomainName()
+                                    : RequestAddress().to_string())
+                            << ':' << RequestPort();
+
+    Trace(FlightRecorder::Event::connect_start);
+    S5_PROBE1(connect_start, this);
+    upstream_stream_ = services_.tunnel->OpenStream(address, handler);
+}
+
+// Hands the request to the route's parent socks5 proxy: a greeting offering
+// no auth, then the client's request as is. The parent's reply code is
+// passed on, its bound address isn't.
+template <typename AuthPolicy, typename AccessPolicy,
+          typename AccountingPolicy>
+void Session<AuthPolicy, AccessPolicy, AccountingPolicy>::ConnectParent() {
+    if (!CheckForwardedAccess()) {
+        connect_timer_.cancel();
+        Response(socks5::Reply::connection_not_allowed_by_ruleset);
+        return;
+    }
+
+    const tcp::endpoint parent = route_->target;
+
+    bs::error_code ec;
+    if (upstream_socket_.is_open()) {
+        upstream_socket_.close(ec);
+    }
+    upstream_socket_.open(parent.protocol(), ec);
+    if (ec) {
+        ConnectFailed(ec);
+        return;
+    }
+
+    auto self(this->shared_from_this());
+    auto handler = [this, self](const bs::error_code& ec) {
+        if (connect_timed_out_) {
+            ConnectFailed(ba::error::timed_out);
+            return;
+        }
+
+        CountConnect(ec);
+        if (ec != ba::error::operation_aborted) {
+            EndPhase(Metrics::Phase::connect);
+        }
+        Trace(FlightRecorder::Event::connect_end, ec);
+        S5_PROBE2(connect_done, this, ec.value());
+
+        if (ec) {
+            ConnectFailed(ec);
+            return;
+        }
+
+        ParentGreeting();
+    };
+
+    BOOST_LOG_TRIVIAL(info) << "session=" << this << " connect to parent "
+                            << parent;
+
+    StartPhase();
+    Trace(FlightRecorder::Event::connect_start);
+    S5_PROBE1(connect_start, this);
+    upstream_socket_.async_connect(parent, handler);
+}
+
+template <typename AuthPolicy, typename AccessPolicy,
+          typename AccountingPolicy>
+void Session<AuthPolicy, AccessPolicy, AccountingPolicy>::ParentGreeting() {
+    auto self(this->shared_from_this());
+    auto read_handler = [this, self](const bs::error_code& ec, std::size_t) {
+        if (ec) {
+            ConnectFailed(ec);
+            return;
+        }
+
+        if (upstream_buf_[0] != socks5::version ||
+            static_cast<socks5::AuthMethod>(upstream_buf_[1]) !=
+                socks5::AuthMethod::no_auth) {
+            BOOST_LOG_TRIVIAL(info) << "session=" << this
+                                    << " parent refused the greeting";
+            connect_timer_.cancel();
+            Response(socks5::Reply::general_socks_server_failure);
+            return;
+        }
+
+        ParentRequest();
+    };
+
+    auto write_handler = [this, self, read_handler](const bs::error_code& ec,
+                                                    std::size_t) {
+        if (ec) {
+            ConnectFailed(ec);
+            return;
+        }
+
+        const std::size_t response_size = 2;
+        ba::async_read(upstream_socket_,
+                       ba::buffer(upstream_buf_.data(), response_size),
+                       read_handler);
+    };
+
+    const std::size_t greeting_size = 3;
+    upstream_buf_[0] = socks5::version;
+    upstream_buf_[1] = 1;  // nmethods
+    upstream_buf_[2] = static_cast<char>(socks5::AuthMethod::no_auth);
+
+    ba::async_write(upstream_socket_,
+                    ba::buffer(upstream_buf_.data(), greeting_size),
+                    write_handler);
+}
+
+template <typename AuthPolicy, typename AccessPolicy,
+          typename AccountingPolicy>
+void Session<AuthPolicy, AccessPolicy, AccountingPolicy>::ParentRequest() {
+    auto self(this->shared_from_this());
+    auto handler = [this, self](const bs::error_code& ec, std::size_t) {
+        if (ec) {
+            ConnectFailed(ec);
+            return;
+        }
+
+        ParentReplyHead();
+    };
+
+    ba::async_write(upstream_socket_,
+                    ba::buffer(downstream_buf_.data(), RequestSize()), handler);
+}
+
+// VER REP RSV ATYP & the first byte of BND.ADDR, the length of a domain
+// name, tell how much of the reply is left.
+template <typename AuthPolicy, typename AccessPolicy,
+          typename AccountingPolicy>
+void Session<AuthPolicy, AccessPolicy, AccountingPolicy>::ParentReplyHead() {
+    auto self(this->shared_from_this());
+    auto handler = [this, self](const bs::error_code& ec, std::size_t) {
+        if (ec) {
+            ConnectFailed(ec);
+            return;
+        }
+
+        std::size_t address_left = 0;
+        switch (static_cast<socks5::AddressType>(upstream_buf_[3])) {
+            case socks5::AddressType::ipv4:
+                address_left = 4 - 1;
+                break;
+            case socks5::AddressType::ipv6:
+                address_left = 16 - 1;
+                break;
+            default:
+                address_left = static_cast<unsigned char>(upstream_buf_[4]);
+                break;
+        }
+
+        const std::size_t port_size = 2;
+        ParentReply(address_left + port_size);
+    };
+
+    ba::async_read(upstream_socket_,
+                   ba::buffer(upstream_buf_.data(), parent_reply_head_size),
+                   handler);
+}
+
+template <typename AuthPolicy, typename AccessPolicy,
+          typename AccountingPolicy>
+void Session<AuthPolicy, AccessPolicy, AccountingPolicy>::ParentReply(
+    std::size_t bytes_left) {
+    auto self(this->shared_from_this());
+    auto handler = [this, self](const bs::error_code& ec, std::size_t) {
+        if (ec || connect_timed_out_) {
+            ConnectFailed(ec);
+            return;
+        }
+
+        connect_timer_.cancel();
+        Response(static_cast<socks5::Reply>(upstream_buf_[1]));
+    };
+
+    // after the head, which holds the reply code
+    ba::async_read(upstream_socket_,
+                   ba::buffer(upstream_buf_.data() + parent_reply_head_size,
+                              bytes_left),
+                   handler);
+}
+
+template <typename AuthPolicy, typename AccessPolicy,
+          typename AccountingPolicy>
+void Session<AuthPolicy, AccessPolicy, AccountingPolicy>::StartConnectTimer() {
+    auto self(this->shared_from_this());
+    auto handler = [this, self](const bs::error_code& ec) {
+        if (ec) {
+            return;  // connected, failed or closed in time
+        }
+
+        // abort whatever is in progress, its handler replies
+        connect_timed_out_ = true;
+        Count(Metrics::Counter::connect_timeout);
+        resolver_.cancel();
+
+        bs::error_code ignored;
+        upstream_socket_.close(ignored);
+        if (upstream_stream_) {
+            upstream_stream_->Close();
+        }
+    };
+
+    connect_timer_.expires_from_now(services_.connect_timeout);
+    connect_timer_.async_wait(handler);
+}
+
+// Tells the client why right away instead of just closing, so it can retry
+// elsewhere.
+template <typename AuthPolicy, typename AccessPolicy,
+          typename AccountingPolicy>
+void Session<AuthPolicy, AccessPolicy, AccountingPolicy>::ConnectFailed(
+    const bs::error_code& ec) {
+    connect_timer_.cancel();
+
+    if (ec == ba::error::operation_aborted && !connect_timed_out_) {
+        Close(ec);  // the session is closing anyway
+        return;
+    }
+
+    const bs::error_code reason =
+        connect_timed_out_ ? bs::error_code{ba::error::timed_out} : ec;
+    BOOST_LOG_TRIVIAL(info) << "session=" << this
+                            << " connect failed: " << reason.message();
+
+    Response(socks5::ErrorReply(reason));
+}
+
+template <typename AuthPolicy, typename AccessPolicy,
+          typename AccountingPolicy>
+void Session<AuthPolicy, AccessPolicy, AccountingPolicy>::Bind() {}  // todo:
+
+template <typename AuthPolicy, typename AccessPolicy,
+          typename AccountingPolicy>
+void
+Session<AuthPolicy, AccessPolicy, AccountingPolicy>::UdpAssociate() {}  // todo:
+
+template <typename AuthPolicy, typename AccessPolicy,
+          typename AccountingPolicy>
+bool Session<AuthPolicy, AccessPolicy, AccountingPolicy>::CheckAccess(
+    const tcp::endpoint& destination) {
+    if (!AccessPolicy::enabled) {
+        return true;
+    }
+
+    const bool allowed = AccessPolicy::Allowed(policy_, client_address_,
+                                               destination.address());
+    if (!allowed) {
+        BOOST_LOG_TRIVIAL(info) << "session=" << this << " denied "
+                                << client_address_ << " -> " << destination;
+    }
+
+    return allowed;
+}
+
+// For requests passed on as is, to a tunnel peer or a parent proxy: domains
+// are resolved there, only the source is known here.
+template <typename AuthPolicy, typename AccessPolicy,
+          typename AccountingPolicy>
+bool
+Session<AuthPolicy, AccessPolicy, AccountingPolicy>::CheckForwardedAccess() {
+    if (RequestAddressType() == socks5::AddressType::domain_name) {
+        return AccessPolicy::SourceAllowed(policy_, client_address_);
+    }
+
+    return CheckAccess(tcp::endpoint{RequestAddress(), RequestPort()});
+}
+
+// Domain requests are checked by name before anything is resolved, in
+// tunnel mode too.
+template <typename AuthPolicy, typename AccessPolicy,
+          typename AccountingPolicy>
+bool Session<AuthPolicy, AccessPolicy, AccountingPolicy>::CheckDomainAccess() {
+    if (!AccessPolicy::enabled ||
+        RequestAddressType() != socks5::AddressType::domain_name) {
+        return true;
+    }
+
+    const std::string host = RequestDomainName();
+    if (AccessPolicy::DomainAllowed(policy_, host)) {
+        return true;
+    }
+
+    BOOST_LOG_TRIVIAL(info) << "session=" << this << " denied domain " << host;
+    return false;
+}
+
+template <typename AuthPolicy, typename AccessPolicy,
+          typename AccountingPolicy>
+void Session<AuthPolicy, AccessPolicy, AccountingPolicy>::Close(
+    const bs::error_code& ec) {
+    BOOST_LOG_TRIVIAL(info) << "session=" << this << " close: " << ec.message();
+    Trace(FlightRecorder::Event::close, ec);
+    S5_PROBE2(close, this, ec.value());
+
+    resolver_.cancel();
+    connect_timer_.cancel();
+    upstream_read_timer_.cancel();
+    downstream_read_timer_.cancel();
+
+    if (services_.scheduler) {
+        services_.scheduler->Cancel(upstream_flow_);
+        services_.scheduler->Cancel(downstream_flow_);
+    }
+
+    if (downstream_socket_.is_open()) {
+        downstream_socket_.close();
+    }
+
+    if (upstream_socket_.is_open()) {
+        upstream_socket_.close();
+    }
+
+    if (upstream_stream_) {
+        upstream_stream_->Close();
+    }
+
+    if (services_.egress) {
+        services_.egress->Release(egress_index_);
+        egress_index_ = EgressPool::npos;
+    }
+}
+
+template <typename AuthPolicy, typename AccessPolicy,
+          typename AccountingPolicy>
+void Session<AuthPolicy, AccessPolicy, AccountingPolicy>::Relay(
+    tcp::endpoint ep) {
+    auto self(this->shared_from_this());
+    auto handler = [this, self](const bs::error_code& ec) {
+        if (!ec) {
+            UpstreamRead();
+            DownstreamRead();
+        } else {
+            Close(ec);
+        }
+    };
+
+    upstream_socket_.async_connect(ep, handler);
+}
+
+template <typename AuthPolicy, typename AccessPolicy,
+          typename AccountingPolicy>
+void Session<AuthPolicy, AccessPolicy, AccountingPolicy>::UpstreamRead() {
+    auto self(this->shared_from_this());
+    auto handler = [this, self](const bs::error_code& ec, std::size_t length) {
+        if (!ec) {
+            BOOST_LOG_TRIVIAL(debug) << "session=" << this << " upstream <- "
+                                     << length << 'b';
+            S5_PROBE3(relay_read, this, probe_down, length);
+
+            if (first_byte_pending_) {
+                first_byte_pending_ = false;
+                if (services_.metrics) {
+                    services_.metrics->Record(
+                        Metrics::Phase::first_byte,
+                        std::chrono::steady_clock::now() - accepted_at_);
+                }
+                Trace(FlightRecorder::Event::first_byte);
+            }
+
+            DownstreamWrite(length);
+        } else {
+            Close(ec);
+        }
+    };
+
+    if (upstream_stream_) {
+        upstream_stream_->AsyncReadSome(
+            ba::buffer(upstream_buf_.data(), upstream_buf_.size()), handler);
+        return;
+    }
+
+    upstream_socket_.async_read_some(
+        ba::buffer(upstream_buf_.data(), upstream_buf_.size()), handler);
+}
+
+template <typename AuthPolicy, typename AccessPolicy,
+          typename AccountingPolicy>
+void Session<AuthPolicy, AccessPolicy, AccountingPolicy>::DownstreamRead() {
+    auto self(this->shared_from_this());
+    auto handler = [this, self](const bs::error_code& ec, std::size_t length) {
+        if (!ec) {
+            BOOST_LOG_TRIVIAL(debug)
+                << "session=" << this << ' '
+                << downstream_socket_.local_endpoint() << " <- "
+                << downstream_socket_.remote_endpoint() << ' ' << length << 'b';
+            S5_PROBE3(relay_read, this, probe_up, length);
+
+            UpstreamWrite(length);
+        } else {
+            Close(ec);
+        }
+    };
+
+    downstream_socket_.async_read_some(
+        ba::buffer(downstream_buf_.data(), downstream_buf_.size()), handler);
+}
+
+template <typename AuthPolicy, typename AccessPolicy,
+          typename AccountingPolicy>
+void Session<AuthPolicy, AccessPolicy, AccountingPolicy>::DownstreamWrite(
+    std::size_t length) {
+    auto self(this->shared_from_this());
+    auto handler = [this, self](const bs::error_code& ec, std::size_t length) {
+        if (!ec) {
+            BOOST_LOG_TRIVIAL(debug)
+                << "session=" << this << ' '
+                << downstream_socket_.local_endpoint() << " -> "
+                << downstream_socket_.remote_endpoint() << ' ' << length << 'b';
+            S5_PROBE3(relay_write, this, probe_down, length);
+
+            this->AccountDown(length);
+            Count(Metrics::Counter::bytes_down, length);
+
+            Throttle(upstream_read_timer_, upstream_flow_, length,
+                     &Session::UpstreamRead);
+        } else {
+            Close(ec);
+        }
+    };
+
+    ba::async_write(downstream_socket_,
+                    ba::buffer(upstream_buf_.data(), length), handler);
+}
+
+template <typename AuthPolicy, typename AccessPolicy,
+          typename AccountingPolicy>
+void Session<AuthPolicy, AccessPolicy, AccountingPolicy>::UpstreamWrite(
+    std::size_t length) {
+    auto self(this->shared_from_this());
+    auto handler = [this, self](const bs::error_code& ec, std::size_t length) {
+        if (!ec) {
+            BOOST_LOG_TRIVIAL(debug) << "session=" << this << " upstream -> "
+                                     << length << 'b';
+            S5_PROBE3(relay_write, this, probe_up, length);
+
+            this->AccountUp(length);
+            Count(Metrics::Counter::bytes_up, length);
+
+            Throttle(downstream_read_timer_, downstream_flow_, length,
+                     &Session::DownstreamRead);
+        } else {
+            Close(ec);
+        }
+    };
+
+    if (upstream_stream_) {
+        upstream_stream_->AsyncWrite(ba::buffer(downstream_buf_.data(), length),
+                                     handler);
+        return;
+    }
+
+    ba::async_write(upstream_socket_,
+                    ba::buffer(downstream_buf_.data(), length), handler);
+}
+
+// Re-arms a relay read once the rate limits allow length more bytes, the
+// data already read has been written either way.
+template <typename AuthPolicy, typename AccessPolicy,
+          typename AccountingPolicy>
+void Session<AuthPolicy, AccessPolicy, AccountingPolicy>::Throttle(
+    ba::steady_timer& timer, Scheduler::Flow& flow, std::size_t length,
+    void (Session::*read)()) {
+    const auto wait = services_.limiter
+                          ? services_.limiter->Charge(rate_ticket_, length)
+                          : RateLimiter::Clock::duration::zero();
+    if (wait == RateLimiter::Clock::duration::zero()) {
+        Schedule(flow, length, read);
+        return;
+    }
+
+    auto self(this->shared_from_this());
+    timer.expires_from_now(wait);
+    timer.async_wait(
+        [this, self, &flow, length, read](const bs::error_code& ec) {
+            if (!ec) {
+                Schedule(flow, length, read);
+            }
+        });
+}
+
+// Re-arms a relay read now or, past the flow's share of the round, in a
+// later round of the loop's scheduler.
+template <typename AuthPolicy, typename AccessPolicy,
+          typename AccountingPolicy>
+void Session<AuthPolicy, AccessPolicy, AccountingPolicy>::Schedule(
+    Scheduler::Flow& flow, std::size_t length, void (Session::*read)()) {
+    if (!services_.scheduler || services_.scheduler->Admit(flow, length)) {
+        (this->*read)();
+        return;
+    }
+
+    auto self(this->shared_from_this());
+    services_.scheduler->Defer(flow, [this, self, read]() { (this->*read)(); });
+}
+
+template <typename AuthPolicy, typename AccessPolicy,
+          typename AccountingPolicy>
+void Session<AuthPolicy, AccessPolicy, AccountingPolicy>::Count(
+    Metrics::Counter counter, uint64_t n) {
+    if (services_.metrics) {
+        services_.metrics->Add(counter, n);
+    }
+}
+
+template <typename AuthPolicy, typename AccessPolicy,
+          typename AccountingPolicy>
+void Session<AuthPolicy, AccessPolicy, AccountingPolicy>::Handshake(
+    Metrics::Counter outcome) {
+    if (handshake_pending_) {
+        handshake_pending_ = false;
+        Count(outcome);
+    }
+}
+
+// A connect aborted by the timer or by closing isn't a result of its own.
+template <typename AuthPolicy, typename AccessPolicy,
+          typename AccountingPolicy>
+void Session<AuthPolicy, AccessPolicy, AccountingPolicy>::CountConnect(
+    const bs::error_code& ec) {
+    if (!ec) {
+        Count(Metrics::Counter::connect_ok);
+    } else if (ec != ba::error::operation_aborted) {
+        Count(Metrics::Counter::connect_failed);
+    }
+}
+
+template <typename AuthPolicy, typename AccessPolicy,
+          typename AccountingPolicy>
+void Session<AuthPolicy, AccessPolicy, AccountingPolicy>::StartPhase() {
+    if (services_.metrics) {
+        phase_started_ = std::chrono::steady_clock::now();
+    }
+}
+
+template <typename AuthPolicy, typename AccessPolicy,
+          typename AccountingPolicy>
+void Session<AuthPolicy, AccessPolicy, AccountingPolicy>::EndPhase(
+    Metrics::Phase phase) {
+    if (services_.metrics) {
+        services_.metrics->Record(
+            phase, std::chrono::steady_clock::now() - phase_started_);
+    }
+}
+
+template <typename AuthPolicy, typename AccessPolicy,
+          typename AccountingPolicy>
+void Session<AuthPolicy, AccessPolicy, AccountingPolicy>::Trace(
+    FlightRecorder::Event event, const bs::error_code& ec) {
+    if (services_.recorder) {
+        services_.recorder->Record(this, event, ec);
+    }
+}
+
+}  // namespace socks5
+
+#endif /* S5SESSION_IMPL_H */
@@ -0,0 +1,1393 @@
+#include "s5tunnel.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+
+#include <boost/log/trivial.hpp>
+
+namespace socks5 {
+namespace tunnel {
+
+namespace {
+
+// pending connection output above which streams stop queueing data
+const std::size_t max_pending_output = 1024 * 1024;
+
+const std::chrono::seconds reconnect_delay{1};
+const std::chrono::milliseconds accept_backoff{100};
+
+tcp::resolver::query PeerQuery(const std::string& peer) {
+    const auto colon = peer.rfind(':');
+    if (colon == std::string::npos) {
+        throw std::invalid_argument("tunnel peer must be host:port: " + peer);
+    }
+
+    return tcp::resolver::query{peer.substr(0, colon), peer.substr(colon + 1)};
+}
+
+uint16_t ReadPort(const std::string& address, std::size_t offset) {
+    const auto hi = static_cast<unsigned char>(address[offset]);
+    const auto lo = static_cast<unsigned char>(address[offset + 1]);
+    return static_cast<uint16_t>((hi << 8) | lo);
+}
+
+// Core side of a stream: connects to the requested destination like a
+// session does, by the routes, through the dns cache & the egress pool
+// within the connect timeout, and relays between the stream and the
+// upstream socket.
+class Upstream : public std::enable_shared_from_this<Upstream> {
+   public:
+    Upstream(ba::io_service& io, std::shared_ptr<Stream> stream,
+             std::weak_ptr<const Listener::Services> services,
+             const ba::ip::address& peer)
+        : resolver_{io},
+          socket_{io},
+          connect_timer_{io},
+          stream_{std::move(stream)},
+          services_{std::move(services)},
+          peer_{peer} {}
+
+    ~Upstream() {
+        const auto services = services_.lock();
+        if (services && services->egress) {
+            services->egress->Release(egress_index_);
+        }
+    }
+
+    void Start(const std::string& address) {
+        if (address.empty()) {
+            Reply(socks5::Reply::address_type_not_supported);
+            return;
+        }
+
+        switch (static_cast<socks5::AddressType>(address[0])) {
+            case socks5::AddressType::ipv4: {
+                if (address.size() != 7) {  // atyp + 4 + port
+                    break;
+                }
+
+                ba::ip::address_v4::bytes_type bytes;
+                std::copy(address.begin() + 1, address.begin() + 5,
+                          bytes.begin());
+                Route(address, ba::ip::address_v4(bytes), std::string(),
+                      ReadPort(address, 5));
+                return;
+            }
+            case socks5::AddressType::ipv6: {
+                if (address.size() != 19) {  // atyp + 16 + port
+                    break;
+                }
+
+                ba::ip::address_v6::bytes_type bytes;
+                std::copy(address.begin() + 1, address.begin() + 17,
+                          bytes.begin());
+                Route(address, ba::ip::address_v6(bytes), std::string(),
+                      ReadPort(address, 17));
+                return;
+            }
+            case socks5::AddressType::domain_name: {
+                if (address.size() < 2) {
+                    break;
+                }
+
+                const std::size_t length =
+                    static_cast<unsigned char>(address[1]);
+                if (address.size() != 4 + length) {  // atyp + len + port
+                    break;
+                }
+
+                Route(address, ba::ip::address(), address.substr(2, length),
+                      ReadPort(address, 2 + length));
+                return;
+            }
+        }
+
+        Reply(socks5::Reply::address_type_not_supported);
+    }
+
+   private:
+    // the current policy's decisions are made here, its routes are copied:
+    // a reload may free the policy before the connect completes
+    void Route(const std::string& address, const ba::ip::address& ip,
+               const std::string& host, uint16_t port) {
+        const auto services = services_.lock();
+        if (!services) {  // the listener is gone
+            Reply(socks5::Reply::general_socks_server_failure);
+            return;
+        }
+
+        if (services->admission && !services->admission->AdmitHandshake()) {
+            BOOST_LOG_TRIVIAL(info) << "tunnel stream=" << stream_->Id()
+                                    << " refused: memory hard limit";
+            Reply(socks5::Reply::general_socks_server_failure);
+            return;
+        }
+
+        const Policy* policy =
+            services->policy ? services->policy->Current() : nullptr;
+        if (policy && policy->domains && !host.empty() &&
+            !policy->domains->Allowed(host)) {
+            BOOST_LOG_TRIVIAL(info) << "tunnel stream=" << stream_->Id()
+                                    << " denied domain " << host;
+            Reply(socks5::Reply::connection_not_allowed_by_ruleset);
+            return;
+        }
+
+        const Routes::Route* route = nullptr;
+        if (policy && policy->routes) {
+            route = host.empty() ? policy->routes->Find(ip)
+                                 : policy->routes->Find(host);
+        }
+
+        if (route) {
+            BOOST_LOG_TRIVIAL(info) << "tunnel stream=" << stream_->Id()
+                                    << " route " << route->text;
+            routed_ = true;
+            route_action_ = route->action;
+            route_target_ = route->target;
+        }
+
+        if (routed_ && route_action_ == Routes::Action::reject) {
+            Reply(socks5::Reply::connection_not_allowed_by_ruleset);
+            return;
+        }
+
+        StartConnectTimer(services->connect_timeout);
+
+        if (routed_ && route_action_ == Routes::Action::parent) {
+            // the parent resolves names, addresses are checked here
+            if (host.empty() && !Allowed(ip, true)) {
+                Reply(socks5::Reply::connection_not_allowed_by_ruleset);
+                return;
+            }
+
+            ConnectParent(address);
+            return;
+        }
+
+        if (host.empty()) {
+            Connect(tcp::resolver::iterator::create(tcp::endpoint{ip, port},
+                                                    "", ""));
+            return;
+        }
+
+        std::vector<ba::ip::address> addresses;
+        if (services->dns && services->dns->Lookup(host, addresses)) {
+            Count(Metrics::Counter::dns_cache_hit);
+            Connect(DnsCache::Endpoints(addresses, host, port));
+            return;
+        }
+
+        Resolve(host, port);
+    }
+
+    void Resolve(const std::string& host, uint16_t port) {
+        auto self(shared_from_this());
+        auto handler = [this, self, host](const bs::error_code& ec,
+                                          tcp::resolver::iterator ep_iterator) {
+            if (ec != ba::error::operation_aborted) {
+                EndPhase(Metrics::Phase::resolve);
+            }
+
+            if (ec) {
+                if (ec != ba::error::operation_aborted) {
+                    Count(Metrics::Counter::dns_failed);
+                }
+                Fail(ec);
+                return;
+            }
+
+            Count(Metrics::Counter::dns_resolved);
+            const auto services = services_.lock();
+            if (services && services->dns) {
+                services->dns->Insert(host, ep_iterator);
+            }
+
+            Connect(ep_iterator);
+        };
+
+        tcp::resolver::query q{host, std::to_string(port)};
+        StartPhase();
+        resolver_.async_resolve(q, handler);
+    }
+
+    // by the current policy's destination rules, the listener's loop owns
+    // the current version for the call
+    bool Allowed(const ba::ip::address& destination, bool count) const {
+        const auto services = services_.lock();
+        if (!services || !services->policy) {
+            return static_cast<bool>(services);
+        }
+
+        const Policy* policy = services->policy->Current();
+        return !policy->acl ||
+               policy->acl->DestinationAllowed(destination, count);
+    }
+
+    // resolved names are checked here, the edge only knew the name; one
+    // decision per stream is counted
+    void Connect(tcp::resolver::iterator ep_iterator) {
+        if (ep_iterator != tcp::resolver::iterator()) {
+            auto allowed = ep_iterator;
+            while (allowed != tcp::resolver::iterator() &&
+                   !Allowed(allowed->endpoint().address(), false)) {
+                ++allowed;
+            }
+
+            const tcp::endpoint decided = allowed != tcp::resolver::iterator()
+                                              ? allowed->endpoint()
+                                              : ep_iterator->endpoint();
+            if (!Allowed(decided.address(), true)) {
+                BOOST_LOG_TRIVIAL(info) << "tunnel stream=" << stream_->Id()
+                                        << " denied " << decided;
+                Reply(socks5::Reply::connection_not_allowed_by_ruleset);
+                return;
+            }
+        }
+
+        ConnectNext(ep_iterator);
+    }
+
+    // tries the endpoints in order, binding the socket for every attempt
+    // like Session::ConnectNext(); denied endpoints are skipped, uncounted
+    void ConnectNext(tcp::resolver::iterator ep_iterator) {
+        if (timed_out_) {
+            Fail(ba::error::timed_out);
+            return;
+        }
+
+        while (ep_iterator != tcp::resolver::iterator() &&
+               !Allowed(ep_iterator->endpoint().address(), false)) {
+            ++ep_iterator;
+        }
+
+        const auto services = services_.lock();
+        if (!services || ep_iterator == tcp::resolver::iterator()) {
+            Reply(services ? socks5::Reply::connection_not_allowed_by_ruleset
+                           : socks5::Reply::general_socks_server_failure);
+            return;
+        }
+
+        const tcp::endpoint ep = ep_iterator->endpoint();
+
+        // the egress pool hashes by the peer, the edge's clients aren't
+        // known here
+        bs::error_code ec;
+        if (routed_ && route_action_ == Routes::Action::egress) {
+            Open(ep, ec);
+            if (!ec) {
+                EgressPool::BindNoPort(socket_, route_target_.address(), ec);
+            }
+        } else if (services->egress) {
+            services->egress->Release(egress_index_);
+            egress_index_ = services->egress->Bind(socket_, ep, peer_, ec);
+        } else {
+            Open(ep, ec);
+        }
+
+        if (ec) {
+            CountConnect(ec);
+            BOOST_LOG_TRIVIAL(info) << "tunnel stream=" << stream_->Id()
+                                    << " socket for " << ep << ": "
+                                    << ec.message();
+
+            // e.g. a source address of the other family, the next may do
+            if (++ep_iterator != tcp::resolver::iterator()) {
+                ConnectNext(ep_iterator);
+                return;
+            }
+
+            Fail(ec);
+            return;
+        }
+
+        auto self(shared_from_this());
+        auto handler = [this, self,
+                        ep_iterator](const bs::error_code& ec) mutable {
+            if (timed_out_) {
+                Fail(ba::error::timed_out);
+                return;
+            }
+
+            CountConnect(ec);
+            if (ec != ba::error::operation_aborted) {
+                EndPhase(Metrics::Phase::connect);
+            }
+
+            if (ec) {
+                if (ec != ba::error::operation_aborted &&
+                    ++ep_iterator != tcp::resolver::iterator()) {
+                    ConnectNext(ep_iterator);
+                    return;
+                }
+
+                Fail(ec);
+                return;
+            }
+
+            Relay();
+        };
+
+        StartPhase();
+        socket_.async_connect(ep, handler);
+    }
+
+    // a socks5 proxy without auth, the stream's request is passed on as is
+    void ConnectParent(const std::string& address) {
+        bs::error_code ec;
+        Open(route_target_, ec);
+        if (ec) {
+            Fail(ec);
+            return;
+        }
+
+        auto self(shared_from_this());
+        auto handler = [this, self, address](const bs::error_code& ec) {
+            if (timed_out_) {
+                Fail(ba::error::timed_out);
+                return;
+            }
+
+            CountConnect(ec);
+            if (ec != ba::error::operation_aborted) {
+                EndPhase(Metrics::Phase::connect);
+            }
+
+            if (ec) {
+                Fail(ec);
+                return;
+            }
+
+            ParentGreeting(address);
+        };
+
+        StartPhase();
+        socket_.async_connect(route_target_, handler);
+    }
+
+    // a greeting offering no auth, then the stream's request as is; the
+    // parent's reply code is passed on, its bound address isn't
+    void ParentGreeting(const std::string& address) {
+        auto self(shared_from_this());
+        auto read_handler = [this, self, address](const bs::error_code& ec,
+                                                  std::size_t) {
+            if (ec) {
+                Fail(ec);
+                return;
+            }
+
+            if (socket_buf_[0] != socks5::version ||
+                static_cast<socks5::AuthMethod>(socket_buf_[1]) !=
+                    socks5::AuthMethod::no_auth) {
+                BOOST_LOG_TRIVIAL(info) << "tunnel stream=" << stream_->Id()
+                                        << " parent refused the greeting";
+                Reply(socks5::Reply::general_socks_server_failure);
+                return;
+            }
+
+            ParentRequest(address);
+        };
+
+        auto write_handler = [this, self, read_handler](
+                                 const bs::error_code& ec, std::size_t) {
+            if (ec) {
+                Fail(ec);
+                return;
+            }
+
+            ba::async_read(socket_, ba::buffer(socket_buf_.data(), 2),
+                           read_handler);
+        };
+
+        socket_buf_[0] = socks5::version;
+        socket_buf_[1] = 1;  // nmethods
+        socket_buf_[2] = static_cast<char>(socks5::AuthMethod::no_auth);
+        ba::async_write(socket_, ba::buffer(socket_buf_.data(), 3),
+                        write_handler);
+    }
+
+    void ParentRequest(const std::string& address) {
+        auto self(shared_from_this());
+        auto read_handler = [this, self](const bs::error_code& ec,
+                                         std::size_t) {
+            if (ec) {
+                Fail(ec);
+                return;
+            }
+
+            ParentReply();
+        };
+
+        auto write_handler = [this, self, read_handler](
+                                 const bs::error_code& ec, std::size_t) {
+            if (ec) {
+                Fail(ec);
+                return;
+            }
+
+            // VER REP RSV ATYP & the first byte of BND.ADDR
+            ba::async_read(socket_, ba::buffer(socket_buf_.data(), 5),
+                           read_handler);
+        };
+
+        socket_buf_[0] = socks5::version;
+        socket_buf_[1] = static_cast<char>(socks5::Command::connect);
+        socket_buf_[2] = 0;  // reserved
+        std::copy(address.begin(), address.end(), socket_buf_.begin() + 3);
+        ba::async_write(socket_,
+                        ba::buffer(socket_buf_.data(), 3 + address.size()),
+                        write_handler);
+    }
+
+    void ParentReply() {
+        const auto reply = static_cast<socks5::Reply>(socket_buf_[1]);
+        std::size_t address_left = 0;
+        switch (static_cast<socks5::AddressType>(socket_buf_[3])) {
+            case socks5::AddressType::ipv4:
+                address_left = 4 - 1;
+                break;
+            case socks5::AddressType::ipv6:
+                address_left = 16 - 1;
+                break;
+            default:
+                address_left = static_cast<unsigned char>(socket_buf_[4]);
+                break;
+        }
+
+        const std::size_t port_size = 2;
+        auto self(shared_from_this());
+        auto handler = [this, self, reply](const bs::error_code& ec,
+                                           std::size_t) {
+            if (ec || timed_out_) {
+                Fail(ec);
+                return;
+            }
+
+            if (reply != socks5::Reply::succeeded) {
+                Reply(reply);
+                return;
+            }
+
+            Relay();
+        };
+
+        ba::async_read(socket_,
+                       ba::buffer(socket_buf_.data(), address_left + port_size),
+                       handler);
+    }
+
+    void Open(const tcp::endpoint& ep, bs::error_code& ec) {
+        if (socket_.is_open()) {
+            socket_.close(ec);
+        }
+        socket_.open(ep.protocol(), ec);
+    }
+
+    void StartConnectTimer(std::chrono::milliseconds timeout) {
+        auto self(shared_from_this());
+        auto handler = [this, self](const bs::error_code& ec) {
+            if (ec) {
+                return;  // connected, failed or closed in time
+            }
+
+            // abort whatever is in progress, its handler replies
+            timed_out_ = true;
+            Count(Metrics::Counter::connect_timeout);
+            resolver_.cancel();
+
+            bs::error_code ignored;
+            socket_.close(ignored);
+        };
+
+        connect_timer_.expires_from_now(timeout);
+        connect_timer_.async_wait(handler);
+    }
+
+    void Relay() {
+        Reply(socks5::Reply::succeeded);
+        StreamRead();
+        SocketRead();
+    }
+
+    void Fail(const bs::error_code& ec) {
+        const bs::error_code reason =
+            timed_out_ ? bs::error_code{ba::error::timed_out} : ec;
+        BOOST_LOG_TRIVIAL(info) << "tunnel stream=" << stream_->Id()
+                                << " connect failed: " << reason.message();
+        Reply(socks5::ErrorReply(reason));
+    }
+
+    // the stream's one answer
+    void Reply(socks5::Reply reply) {
+        if (replied_) {
+            return;
+        }
+
+        replied_ = true;
+        connect_timer_.cancel();
+        stream_->Accept(reply);
+    }
+
+    void Count(Metrics::Counter counter) {
+        const auto services = services_.lock();
+        if (services && services->metrics) {
+            services->metrics->Add(counter);
+        }
+    }
+
+    // a connect aborted by the timer or by closing isn't a result of its own
+    void CountConnect(const bs::error_code& ec) {
+        if (!ec) {
+            Count(Metrics::Counter::connect_ok);
+        } else if (ec != ba::error::operation_aborted) {
+            Count(Metrics::Counter::connect_failed);
+        }
+    }
+
+    void StartPhase() { phase_started_ = std::chrono::steady_clock::now(); }
+
+    void EndPhase(Metrics::Phase phase) {
+        const auto services = services_.lock();
+        if (services && services->metrics) {
+            services->metrics->Record(
+                phase, std::chrono::steady_clock::now() - phase_started_);
+        }
+    }
+
+    void Close() {
+        if (socket_.is_open()) {
+            bs::error_code ignored;
+            socket_.close(ignored);
+        }
+
+        stream_->Close();
+    }
+
+    void StreamRead() {
+        auto self(shared_from_this());
+        auto handler = [this, self](const bs::error_code& ec,
+                                    std::size_t length) {
+            if (ec) {
+                Close();
+                return;
+            }
+
+            SocketWrite(length);
+        };
+
+        stream_->AsyncReadSome(ba::buffer(stream_buf_), handler);
+    }
+
+    void SocketWrite(std::size_t length) {
+        auto self(shared_from_this());
+        auto handler = [this, self](const bs::error_code& ec, std::size_t) {
+            if (ec) {
+                Close();
+                return;
+            }
+
+            StreamRead();
+        };
+
+        ba::async_write(socket_, ba::buffer(stream_buf_.data(), length),
+                        handler);
+    }
+
+    void SocketRead() {
+        auto self(shared_from_this());
+        auto handler = [this, self](const bs::error_code& ec,
+                                    std::size_t length) {
+            if (ec) {
+                Close();
+                return;
+            }
+
+            StreamWrite(length);
+        };
+
+        socket_.async_read_some(ba::buffer(socket_buf_), handler);
+    }
+
+    void StreamWrite(std::size_t length) {
+        auto self(shared_from_this());
+        auto handler = [this, self](const bs::error_code& ec, std::size_t) {
+            if (ec) {
+                Close();
+                return;
+            }
+
+            SocketRead();
+        };
+
+        stream_->AsyncWrite(ba::buffer(socket_buf_.data(), length), handler);
+    }
+
+   private:
+    tcp::resolver resolver_;
+    tcp::socket socket_;
+    ba::steady_timer connect_timer_;
+    bool timed_out_ = false;
+    bool replied_ = false;
+    std::shared_ptr<Stream> stream_;
+    // gone with the listener
+    std::weak_ptr<const Listener::Services> services_;
+    ba::ip::address peer_;
+    std::size_t egress_index_ = EgressPool::npos;
+    bool routed_ = false;
+    Routes::Action route_action_ = Routes::Action::direct;
+    tcp::endpoint route_target_;
+    std::chrono::steady_clock::time_point phase_started_;
+    std::array<char, max_frame_payload> stream_buf_;
+    std::array<char, max_frame_payload> socket_buf_;
+};
+
+}  // namespace
+
+void FrameHeader::Encode(unsigned char* out) const {
+    out[0] = version;
+    out[1] = static_cast<unsigned char>(type);
+    out[2] = (flags >> 8) & 0xFF;
+    out[3] = flags & 0xFF;
+    for (std::size_t i = 0; i < 4; ++i) {
+        out[4 + i] = (stream_id >> (24 - 8 * i)) & 0xFF;
+        out[8 + i] = (length >> (24 - 8 * i)) & 0xFF;
+    }
+}
+
+bool FrameHeader::Decode(const unsigned char* in) {
+    if (in[0] != version) {
+        return false;
+    }
+
+    type = static_cast<FrameType>(in[1]);
+    flags = static_cast<uint16_t>((in[2] << 8) | in[3]);
+    stream_id = 0;
+    length = 0;
+    for (std::size_t i = 0; i < 4; ++i) {
+        stream_id = (stream_id << 8) | in[4 + i];
+        length = (length << 8) | in[8 + i];
+    }
+
+    return true;
+}
+
+Stream::Stream(_ctor_tag /*unused*/, std::shared_ptr<Connection> connection,
+               uint32_t id)
+    : io_{connection->GetIoService()},
+      connection_{connection},
+      id_{id},
+      admission_{connection->admission_} {}
+
+Stream::~Stream() { ReleaseReceiveBuffer(); }
+
+void Stream::AsyncReadSome(ba::mutable_buffer buffer, Handler handler) {
+    if (local_closed_) {
+        io_.post([handler]() { handler(ba::error::operation_aborted, 0); });
+        return;
+    }
+
+    read_buffer_ = buffer;
+    read_handler_ = std::move(handler);
+    CompleteRead();
+}
+
+void Stream::AsyncWrite(ba::const_buffer buffer, Handler handler) {
+    if (local_closed_ || connection_.expired()) {
+        io_.post([handler]() { handler(ba::error::broken_pipe, 0); });
+        return;
+    }
+
+    write_buffer_ = buffer;
+    write_offset_ = 0;
+    write_handler_ = std::move(handler);
+    Flush();
+}
+
+void Stream::Accept(socks5::Reply reply) {
+    auto connection = connection_.lock();
+    if (!connection) {
+        return;
+    }
+
+    const char payload = static_cast<char>(reply);
+    if (reply == socks5::Reply::succeeded) {
+        connection->Send(FrameType::data, Flags::ack, id_, 1, &payload, 1);
+        return;
+    }
+
+    connection->Send(FrameType::data, Flags::ack | Flags::rst, id_, 1,
+                     &payload, 1);
+    local_closed_ = remote_closed_ = true;
+    connection->Forget(id_);
+}
+
+void Stream::Close() {
+    if (local_closed_) {
+        return;
+    }
+
+    local_closed_ = true;
+    Abort(ba::error::operation_aborted);
+    ReleaseReceiveBuffer();  // nobody reads anymore
+
+    auto connection = connection_.lock();
+    if (!connection) {
+        return;
+    }
+
+    connection->Send(FrameType::data, Flags::fin, id_, 0, nullptr, 0);
+    if (remote_closed_) {
+        connection->Forget(id_);
+    }
+}
+
+void Stream::OnOpened(socks5::Reply reply, bool reset) {
+    if (reset) {
+        local_closed_ = remote_closed_ = true;
+    }
+
+    auto handler = std::move(open_handler_);
+    open_handler_ = nullptr;
+    if (handler) {
+        io_.post([handler, reply]() { handler(reply); });
+    }
+}
+
+void Stream::OnData(const char* data, std::size_t length) {
+    if (local_closed_) {
+        return;  // nobody reads anymore
+    }
+
+    if (length > recv_window_) {
+        BOOST_LOG_TRIVIAL(warning)
+            << "tunnel stream=" << id_ << " window exceeded: " << length
+            << " > " << recv_window_;
+
+        auto connection = connection_.lock();
+        if (connection) {
+            connection->Send(FrameType::window_update, Flags::rst, id_, 0,
+                             nullptr, 0);
+            connection->Forget(id_);
+        }
+        OnReset();
+        return;
+    }
+
+    // drop what was read once it outweighs what's left, so the buffer stays
+    // within the window & data is moved about once
+    if (recv_offset_ > 0 && recv_offset_ >= recv_buf_.size() - recv_offset_) {
+        recv_buf_.erase(recv_buf_.begin(), recv_buf_.begin() + recv_offset_);
+        recv_offset_ = 0;
+    }
+
+    recv_window_ -= static_cast<uint32_t>(length);
+    recv_buf_.insert(recv_buf_.end(), data, data + length);
+    ChargeReceiveBuffer();
+    CompleteRead();
+}
+
+void Stream::OnWindowUpdate(uint32_t delta) {
+    send_window_ += delta;
+    Flush();
+}
+
+void Stream::OnFin() {
+    remote_closed_ = true;
+    CompleteRead();
+
+    auto connection = connection_.lock();
+    if (local_closed_ && connection) {
+        connection->Forget(id_);
+    }
+}
+
+void Stream::OnReset() {
+    local_closed_ = remote_closed_ = true;
+    Abort(ba::error::connection_reset);
+    ReleaseReceiveBuffer();
+}
+
+void Stream::CompleteRead() {
+    if (!read_handler_) {
+        return;
+    }
+
+    const std::size_t available = recv_buf_.size() - recv_offset_;
+    if (available == 0) {
+        if (remote_closed_) {
+            auto handler = std::move(read_handler_);
+            read_handler_ = nullptr;
+            io_.post([handler]() { handler(ba::error::eof, 0); });
+        }
+        return;
+    }
+
+    const std::size_t length =
+        std::min(available, ba::buffer_size(read_buffer_));
+    std::memcpy(ba::buffer_cast<void*>(read_buffer_),
+                recv_buf_.data() + recv_offset_, length);
+    recv_offset_ += length;
+    if (recv_offset_ == recv_buf_.size()) {
+        // a buffer grown by a slow reader is given back once drained
+        if (recv_buf_.capacity() > max_frame_payload) {
+            ReleaseReceiveBuffer();
+        } else {
+            recv_buf_.clear();
+            recv_offset_ = 0;
+        }
+    }
+
+    // return the consumed window in batches, not for every read
+    recv_consumed_ += static_cast<uint32_t>(length);
+    auto connection = connection_.lock();
+    if (recv_consumed_ >= initial_window / 2 && !remote_closed_ &&
+        connection) {
+        connection->Send(FrameType::window_update, 0, id_, recv_consumed_,
+                         nullptr, 0);
+        recv_window_ += recv_consumed_;
+        recv_consumed_ = 0;
+    }
+
+    auto handler = std::move(read_handler_);
+    read_handler_ = nullptr;
+    io_.post([handler, length]() { handler(bs::error_code{}, length); });
+}
+
+void Stream::Flush() {
+    if (!write_handler_) {
+        return;
+    }
+
+    auto connection = connection_.lock();
+    if (!connection) {
+        OnReset();
+        return;
+    }
+
+    const char* data = ba::buffer_cast<const char*>(write_buffer_);
+    const std::size_t size = ba::buffer_size(write_buffer_);
+    while (write_offset_ < size && send_window_ > 0) {
+        if (!connection->CanSend()) {
+            connection->WaitForSend(shared_from_this());
+            return;
+        }
+
+        const std::size_t chunk = std::min<std::size_t>(
+            {size - write_offset_, send_window_, max_frame_payload});
+        if (!connection->Send(FrameType::data, 0, id_,
+                              static_cast<uint32_t>(chunk),
+                              data + write_offset_, chunk)) {
+            // the connection is down, its data would never arrive
+            OnReset();
+            return;
+        }
+
+        write_offset_ += chunk;
+        send_window_ -= static_cast<uint32_t>(chunk);
+    }
+
+    if (write_offset_ < size) {
+        return;  // wait for a window update
+    }
+
+    auto handler = std::move(write_handler_);
+    write_handler_ = nullptr;
+    io_.post([handler, size]() { handler(bs::error_code{}, size); });
+}
+
+void Stream::ChargeReceiveBuffer() {
+    if (admission_ && recv_buf_.capacity() > recv_charged_) {
+        admission_->Charge(recv_buf_.capacity() - recv_charged_);
+        recv_charged_ = recv_buf_.capacity();
+    }
+}
+
+void Stream::ReleaseReceiveBuffer() {
+    std::vector<char>().swap(recv_buf_);
+    recv_offset_ = 0;
+    if (recv_charged_) {
+        admission_->Release(recv_charged_);
+        recv_charged_ = 0;
+    }
+}
+
+void Stream::Abort(const bs::error_code& ec) {
+    if (read_handler_) {
+        auto handler = std::move(read_handler_);
+        read_handler_ = nullptr;
+        io_.post([handler, ec]() { handler(ec, 0); });
+    }
+
+    if (write_handler_) {
+        auto handler = std::move(write_handler_);
+        write_handler_ = nullptr;
+        io_.post([handler, ec]() { handler(ec, 0); });
+    }
+
+    if (open_handler_) {
+        OnOpened(socks5::Reply::general_socks_server_failure, true);
+    }
+}
+
+Connection::Connection(_ctor_tag /*unused*/, ba::io_service& io, Role role,
+                       AdmissionControl* admission)
+    : socket_{io},
+      role_{role},
+      admission_{admission},
+      next_stream_id_{role == Role::client ? 1u : 2u} {}
+
+std::shared_ptr<Connection> Connection::Create(ba::io_service& io,
+                                               Role role,
+                                               AdmissionControl* admission) {
+    return std::make_shared<Connection>(_ctor_tag{}, io, role, admission);
+}
+
+void Connection::Start(AcceptHandler accept_handler,
+                       CloseHandler close_handler) {
+    accept_handler_ = std::move(accept_handler);
+    close_handler_ = std::move(close_handler);
+    open_ = true;
+
+    // frames are batched in WriteNext(), don't let nagle delay them
+    bs::error_code ignored;
+    socket_.set_option(tcp::no_delay(true), ignored);
+
+    BOOST_LOG_TRIVIAL(info) << "tunnel=" << this << ' '
+                            << socket_.local_endpoint(ignored) << " <-> "
+                            << socket_.remote_endpoint(ignored);
+
+    ReadHeader();
+}
+
+std::shared_ptr<Stream> Connection::OpenStream(const std::string& address,
+                                               Stream::OpenHandler handler) {
+    const uint32_t id = next_stream_id_;
+    next_stream_id_ += 2;
+
+    auto stream =
+        std::make_shared<Stream>(Stream::_ctor_tag{}, shared_from_this(), id);
+    stream->open_handler_ = std::move(handler);
+    streams_.emplace(id, stream);
+
+    Send(FrameType::data, Flags::syn, id,
+         static_cast<uint32_t>(address.size()), address.data(),
+         address.size());
+
+    return stream;
+}
+
+void Connection::Close(const bs::error_code& ec) {
+    if (!open_) {
+        return;
+    }
+
+    open_ = false;
+    BOOST_LOG_TRIVIAL(info) << "tunnel=" << this << " close: " << ec.message();
+
+    bs::error_code ignored;
+    socket_.close(ignored);
+
+    auto streams = std::move(streams_);
+    streams_.clear();
+    for (auto& stream : streams) {
+        stream.second->OnReset();
+    }
+
+    if (close_handler_) {
+        close_handler_(ec);
+    }
+}
+
+void Connection::ReadHeader() {
+    auto self(shared_from_this());
+    auto handler = [this, self](const bs::error_code& ec, std::size_t) {
+        if (ec) {
+            Close(ec);
+            return;
+        }
+
+        if (!header_.Decode(header_buf_.data())) {
+            Close(bs::errc::make_error_code(bs::errc::protocol_error));
+            return;
+        }
+
+        if (header_.type == FrameType::data && header_.length > 0) {
+            if (header_.length > initial_window) {
+                Close(bs::errc::make_error_code(bs::errc::message_size));
+                return;
+            }
+
+            ReadPayload();
+            return;
+        }
+
+        Dispatch(nullptr);
+        if (open_) {
+            ReadHeader();
+        }
+    };
+
+    ba::async_read(socket_, ba::buffer(header_buf_), handler);
+}
+
+void Connection::ReadPayload() {
+    auto self(shared_from_this());
+    auto handler = [this, self](const bs::error_code& ec, std::size_t) {
+        if (ec) {
+            Close(ec);
+            return;
+        }
+
+        Dispatch(payload_buf_.data());
+        if (open_) {
+            ReadHeader();
+        }
+    };
+
+    payload_buf_.resize(header_.length);
+    ba::async_read(socket_, ba::buffer(payload_buf_), handler);
+}
+
+void Connection::Dispatch(const char* payload) {
+    switch (header_.type) {
+        case FrameType::data:
+        case FrameType::window_update: {
+            DispatchStream(payload);
+            break;
+        }
+        case FrameType::ping: {
+            if (header_.flags & Flags::syn) {
+                Send(FrameType::ping, Flags::ack, 0, header_.length, nullptr,
+                     0);
+            }
+            break;
+        }
+        case FrameType::go_away: {
+            Close(ba::error::connection_aborted);
+            break;
+        }
+        default:
+            Close(bs::errc::make_error_code(bs::errc::protocol_error));
+            break;
+    }
+}
+
+void Connection::DispatchStream(const char* payload) {
+    const uint32_t id = header_.stream_id;
+    const uint16_t flags = header_.flags;
+    const std::size_t length =
+        header_.type == FrameType::data ? header_.length : 0;
+
+    auto it = streams_.find(id);
+    if (flags & Flags::syn) {
+        if (role_ != Role::server || it != streams_.end() || !length) {
+            Send(FrameType::window_update, Flags::rst, id, 0, nullptr, 0);
+            return;
+        }
+
+        auto stream = std::make_shared<Stream>(Stream::_ctor_tag{},
+                                               shared_from_this(), id);
+        streams_.emplace(id, stream);
+        if (accept_handler_) {
+            accept_handler_(stream, std::string(payload, length));
+        }
+        return;
+    }
+
+    if (it == streams_.end()) {
+        return;  // late frame for a forgotten stream
+    }
+
+    auto stream = it->second;
+    if ((flags & Flags::ack) && stream->open_handler_) {
+        const auto reply =
+            length ? static_cast<socks5::Reply>(payload[0])
+                   : socks5::Reply::general_socks_server_failure;
+        if (flags & Flags::rst) {
+            Forget(id);
+        }
+
+        stream->OnOpened(reply, (flags & Flags::rst) != 0);
+        return;
+    }
+
+    if (flags & Flags::rst) {
+        Forget(id);
+        stream->OnReset();
+        return;
+    }
+
+    if (header_.type == FrameType::window_update) {
+        stream->OnWindowUpdate(header_.length);
+    } else if (length) {
+        stream->OnData(payload, length);
+    }
+
+    if (flags & Flags::fin) {
+        stream->OnFin();
+    }
+}
+
+bool Connection::Send(FrameType type, uint16_t flags, uint32_t stream_id,
+                      uint32_t length, const char* payload, std::size_t size) {
+    if (!open_) {
+        return false;
+    }
+
+    FrameHeader header;
+    header.type = type;
+    header.flags = flags;
+    header.stream_id = stream_id;
+    header.length = length;
+
+    const std::size_t offset = pending_buf_.size();
+    pending_buf_.resize(offset + header_size + size);
+    header.Encode(
+        reinterpret_cast<unsigned char*>(pending_buf_.data() + offset));
+    if (size) {
+        std::memcpy(pending_buf_.data() + offset + header_size, payload, size);
+    }
+
+    WriteNext();
+    return true;
+}
+
+void Connection::WriteNext() {
+    if (writing_ || pending_buf_.empty() || !open_) {
+        return;
+    }
+
+    // everything queued while the previous write was in flight goes out in a
+    // single write
+    write_buf_.swap(pending_buf_);
+    pending_buf_.clear();
+    writing_ = true;
+
+    auto self(shared_from_this());
+    auto handler = [this, self](const bs::error_code& ec, std::size_t) {
+        writing_ = false;
+        if (ec) {
+            Close(ec);
+            return;
+        }
+
+        write_buf_.clear();
+        WriteNext();
+
+        while (!blocked_.empty() && CanSend()) {
+            auto stream = blocked_.front().lock();
+            blocked_.pop_front();
+            if (stream) {
+                stream->Flush();
+            }
+        }
+    };
+
+    ba::async_write(socket_, ba::buffer(write_buf_), handler);
+}
+
+bool Connection::CanSend() const {
+    return pending_buf_.size() < max_pending_output;
+}
+
+void Connection::WaitForSend(std::shared_ptr<Stream> stream) {
+    blocked_.push_back(stream);
+}
+
+void Connection::Forget(uint32_t stream_id) { streams_.erase(stream_id); }
+
+Pool::Pool(ba::io_service& io, const std::string& peer,
+           std::size_t connections, AdmissionControl* admission)
+    : io_{io},
+      admission_{admission},
+      peer_{peer},
+      query_{PeerQuery(peer)},
+      resolver_{io} {
+    BOOST_LOG_TRIVIAL(info) << "tunnel to " << peer << " over " << connections
+                            << " connections";
+
+    for (std::size_t i = 0; i < connections; ++i) {
+        connections_.emplace_back();
+        timers_.emplace_back(std::make_unique<ba::steady_timer>(io_));
+        Connect(i);
+    }
+}
+
+Pool::~Pool() {
+    bs::error_code ignored;
+    resolver_.cancel();
+    for (auto& connection : connections_) {
+        if (connection) {
+            connection->Socket().close(ignored);  // a connect in progress
+            connection->Close(ba::error::operation_aborted);
+        }
+    }
+}
+
+std::shared_ptr<Stream> Pool::OpenStream(const std::string& address,
+                                         Stream::OpenHandler handler) {
+    Connection* best = nullptr;
+    for (auto& connection : connections_) {
+        if (connection && connection->IsOpen() &&
+            (!best || connection->StreamCount() < best->StreamCount())) {
+            best = connection.get();
+        }
+    }
+
+    if (!best) {
+        io_.post([handler]() {
+            handler(socks5::Reply::general_socks_server_failure);
+        });
+        return nullptr;
+    }
+
+    return best->OpenStream(address, std::move(handler));
+}
+
+void Pool::Connect(std::size_t index) {
+    // a peer that doesn't resolve yet is retried like one that is down
+    auto handler = [this, index](const bs::error_code& ec,
+                                 tcp::resolver::iterator ep_iterator) {
+        if (ec == ba::error::operation_aborted) {
+            return;
+        }
+
+        if (ec) {
+            BOOST_LOG_TRIVIAL(warning)
+                << "tunnel resolve " << peer_ << ": " << ec.message();
+            Reconnect(index);
+            return;
+        }
+
+        Connect(index, ep_iterator->endpoint());
+    };
+
+    resolver_.async_resolve(query_, handler);
+}
+
+void Pool::Connect(std::size_t index, tcp::endpoint ep) {
+    auto connection =
+        Connection::Create(io_, Connection::Role::client, admission_);
+    connections_[index] = connection;
+
+    auto handler = [this, index, ep, connection](const bs::error_code& ec) {
+        if (ec == ba::error::operation_aborted) {
+            return;
+        }
+
+        if (ec) {
+            BOOST_LOG_TRIVIAL(warning)
+                << "tunnel connect to " << ep << ": " << ec.message();
+            Reconnect(index);
+            return;
+        }
+
+        connection->Start(nullptr, [this, index](const bs::error_code& ec) {
+            if (ec != ba::error::operation_aborted) {
+                Reconnect(index);
+            }
+        });
+    };
+
+    connection->Socket().async_connect(ep, handler);
+}
+
+void Pool::Reconnect(std::size_t index) {
+    auto& timer = timers_[index];
+    timer->expires_from_now(reconnect_delay);
+    timer->async_wait([this, index](const bs::error_code& ec) {
+        if (!ec) {
+            Connect(index);
+        }
+    });
+}
+
+Listener::Listener(ba::io_service& io, tcp::endpoint ep,
+                   const Services& services)
+    : acceptor_{io, ep},
+      accept_timer_{io},
+      services_{std::make_shared<const Services>(services)} {
+    BOOST_LOG_TRIVIAL(info) << "accept tunnels on " << ep;
+    Accept();
+}
+
+Listener::~Listener() {
+    bs::error_code ignored;
+    acceptor_.close(ignored);
+    accept_timer_.cancel();
+    for (const auto& weak : connections_) {
+        if (auto connection = weak.lock()) {
+            connection->Close(ba::error::operation_aborted);
+        }
+    }
+}
+
+void Listener::Accept() {
+    ba::io_service& io = acceptor_.get_io_service();
+    auto connection = Connection::Create(io, Connection::Role::server,
+                                         services_->admission);
+
+    auto accept_handler = [this, &io, connection](const bs::error_code& ec) {
+        if (ec == ba::error::operation_aborted) {
+            return;
+        }
+
+        if (ec) {
+            // out of descriptors most likely, accepting again at once would
+            // spin until some are released
+            BOOST_LOG_TRIVIAL(warning) << "tunnel accept: " << ec.message();
+            accept_timer_.expires_from_now(accept_backoff);
+            accept_timer_.async_wait([this](const bs::error_code& ec) {
+                if (!ec) {
+                    Accept();
+                }
+            });
+            return;
+        }
+
+        bs::error_code ignored;
+        const ba::ip::address peer =
+            connection->Socket().remote_endpoint(ignored).address();
+        if (!PeerAllowed(peer)) {
+            BOOST_LOG_TRIVIAL(info) << "tunnel peer " << peer << " denied";
+            connection->Socket().close(ignored);
+            Accept();
+            return;
+        }
+
+        std::weak_ptr<const Services> services = services_;
+        connection->Start(
+            [&io, services, peer](std::shared_ptr<Stream> stream,
+                                  std::string address) {
+                std::make_shared<Upstream>(io, std::move(stream), services,
+                                           peer)
+                    ->Start(address);
+            },
+            nullptr);
+
+        // closed ones are dropped as new ones come in
+        connections_.erase(
+            std::remove_if(connections_.begin(), connections_.end(),
+                           [](const std::weak_ptr<Connection>& weak) {
+                               auto open = weak.lock();
+                               return !open || !open->IsOpen();
+                           }),
+            connections_.end());
+        connections_.push_back(connection);
+
+        Accept();
+    };
+
+    acceptor_.async_accept(connection->Socket(), accept_handler);
+}
+
+bool Listener::PeerAllowed(const ba::ip::address& peer) const {
+    const Policy* policy =
+        services_->policy ? services_->policy->Current() : nullptr;
+    return !policy || !policy->acl || policy->acl->SourceAllowed(peer);
+}
+
+}  // namespace tunnel
+}  // namespace socks5
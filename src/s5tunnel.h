@@ -0,0 +1,300 @@
+#ifndef S5TUNNEL_H
+#define S5TUNNEL_H
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <boost/asio.hpp>
+
+#include <socks/socks5.h>
+
+#include "s5admission.h"
+#include "s5dns.h"
+#include "s5egress.h"
+#include "s5metrics.h"
+#include "s5policy.h"
+
+namespace ba = boost::asio;
+namespace bs = boost::system;
+using tcp = ba::ip::tcp;
+
+// Server-to-server tunnel: many client streams multiplexed over a few
+// persistent tcp connections between two s5server instances.
+//
+// Framing follows yamux: a 12 byte header (version, type, flags, stream id,
+// length; big endian) optionally followed by a payload. Every stream has its
+// own receive window, so a slow client never stalls the other streams of the
+// connection.
+//
+// Stream open: the edge sends a data frame with SYN whose payload is the
+// socks5 destination (ATYP, address, port). The core answers with a data
+// frame with ACK and a single socks5::Reply byte, plus RST if the connect
+// failed. Open handshake payloads are not counted against the window.
+namespace socks5 {
+namespace tunnel {
+
+const unsigned char version = 0x00;
+
+enum class FrameType : unsigned char {
+    data = 0x00,
+    window_update = 0x01,
+    ping = 0x02,
+    go_away = 0x03,
+};
+
+enum Flags : uint16_t {
+    syn = 0x01,
+    ack = 0x02,
+    fin = 0x04,
+    rst = 0x08,
+};
+
+const std::size_t header_size = 12;
+const uint32_t initial_window = 256 * 1024;
+const uint32_t max_frame_payload = 16 * 1024;
+
+struct FrameHeader {
+    FrameType type = FrameType::data;
+    uint16_t flags = 0;
+    uint32_t stream_id = 0;
+    uint32_t length = 0;
+
+    void Encode(unsigned char* out) const;
+    // false on unknown version
+    bool Decode(const unsigned char* in);
+};
+
+class Connection;
+
+class Stream : public std::enable_shared_from_this<Stream> {
+   private:
+    struct _ctor_tag {
+        explicit _ctor_tag() = default;
+    };
+
+   public:
+    using Handler = std::function<void(const bs::error_code&, std::size_t)>;
+    using OpenHandler = std::function<void(socks5::Reply)>;
+
+    Stream(_ctor_tag /*unused*/, std::shared_ptr<Connection> connection,
+           uint32_t id);
+
+    ~Stream();
+
+    uint32_t Id() const { return id_; }
+
+    // completes with eof once the peer closed its side and the received data
+    // is drained
+    void AsyncReadSome(ba::mutable_buffer buffer, Handler handler);
+
+    // completes when all of buffer is handed to the connection
+    void AsyncWrite(ba::const_buffer buffer, Handler handler);
+
+    // core side: answer the open request
+    void Accept(socks5::Reply reply);
+
+    // half-close our side, pending operations are aborted
+    void Close();
+
+   private:
+    friend class Connection;
+
+    void OnOpened(socks5::Reply reply, bool reset);
+    void OnData(const char* data, std::size_t length);
+    void OnWindowUpdate(uint32_t delta);
+    void OnFin();
+    void OnReset();
+
+    void CompleteRead();
+    void Flush();
+    void Abort(const bs::error_code& ec);
+
+    // charges growth of recv_buf_ to admission_, the window bounds it
+    void ChargeReceiveBuffer();
+    void ReleaseReceiveBuffer();
+
+   private:
+    ba::io_service& io_;
+    std::weak_ptr<Connection> connection_;
+    uint32_t id_;
+
+    bool local_closed_ = false;
+    bool remote_closed_ = false;
+
+    OpenHandler open_handler_;
+
+    AdmissionControl* admission_;  // of the connection
+    std::vector<char> recv_buf_;
+    std::size_t recv_charged_ = 0;  // capacity of recv_buf_ charged
+    std::size_t recv_offset_ = 0;
+    uint32_t recv_window_ = initial_window;
+    uint32_t recv_consumed_ = 0;
+    ba::mutable_buffer read_buffer_;
+    Handler read_handler_;
+
+    uint32_t send_window_ = initial_window;
+    ba::const_buffer write_buffer_;
+    std::size_t write_offset_ = 0;
+    Handler write_handler_;
+};
+
+class Connection : public std::enable_shared_from_this<Connection> {
+   private:
+    struct _ctor_tag {
+        explicit _ctor_tag() = default;
+    };
+
+   public:
+    enum class Role { client, server };
+
+    using AcceptHandler =
+        std::function<void(std::shared_ptr<Stream>, std::string)>;
+    using CloseHandler = std::function<void(const bs::error_code&)>;
+
+    // streams charge their receive buffers to admission, if any
+    Connection(_ctor_tag /*unused*/, ba::io_service& io, Role role,
+               AdmissionControl* admission);
+
+    static std::shared_ptr<Connection> Create(
+        ba::io_service& io, Role role, AdmissionControl* admission = nullptr);
+
+    tcp::socket& Socket() { return socket_; }
+
+    ba::io_service& GetIoService() { return socket_.get_io_service(); }
+
+    void Start(AcceptHandler accept_handler, CloseHandler close_handler);
+
+    bool IsOpen() const { return open_; }
+
+    std::size_t StreamCount() const { return streams_.size(); }
+
+    // client side: address is the socks5 ATYP, address, port triple
+    std::shared_ptr<Stream> OpenStream(const std::string& address,
+                                       Stream::OpenHandler handler);
+
+    void Close(const bs::error_code& ec);
+
+   private:
+    friend class Stream;
+
+    void ReadHeader();
+    void ReadPayload();
+    void Dispatch(const char* payload);
+    void DispatchStream(const char* payload);
+
+    // false when the connection is closed & the frame is dropped
+    bool Send(FrameType type, uint16_t flags, uint32_t stream_id,
+              uint32_t length, const char* payload, std::size_t size);
+    void WriteNext();
+
+    // a stream may queue data while the pending output is small enough
+    bool CanSend() const;
+    void WaitForSend(std::shared_ptr<Stream> stream);
+    void Forget(uint32_t stream_id);
+
+   private:
+    tcp::socket socket_;
+    Role role_;
+    AdmissionControl* admission_;
+    bool open_ = false;
+    uint32_t next_stream_id_;
+
+    AcceptHandler accept_handler_;
+    CloseHandler close_handler_;
+
+    std::unordered_map<uint32_t, std::shared_ptr<Stream>> streams_;
+    std::deque<std::weak_ptr<Stream>> blocked_;
+
+    std::array<unsigned char, header_size> header_buf_;
+    FrameHeader header_;
+    std::vector<char> payload_buf_;
+
+    std::vector<char> write_buf_;
+    std::vector<char> pending_buf_;
+    bool writing_ = false;
+};
+
+// Edge side: a fixed number of persistent connections to the peer,
+// reconnected in the background. New streams go to the least loaded one.
+class Pool {
+   public:
+    // peer is host:port, resolved again for every connect
+    Pool(ba::io_service& io, const std::string& peer, std::size_t connections,
+         AdmissionControl* admission = nullptr);
+
+    // closes the connections, handlers left on the loop then see
+    // operation_aborted & leave the pool alone
+    ~Pool();
+
+    // nullptr (and a failure reply) when no connection to the peer is up
+    std::shared_ptr<Stream> OpenStream(const std::string& address,
+                                       Stream::OpenHandler handler);
+
+   private:
+    void Connect(std::size_t index);
+    void Connect(std::size_t index, tcp::endpoint ep);
+    void Reconnect(std::size_t index);
+
+   private:
+    ba::io_service& io_;
+    AdmissionControl* admission_;
+    std::string peer_;
+    tcp::resolver::query query_;
+    tcp::resolver resolver_;
+    std::vector<std::shared_ptr<Connection>> connections_;
+    std::vector<std::unique_ptr<ba::steady_timer>> timers_;
+};
+
+// Core side: accepts tunnel connections and connects their streams upstream
+// like sessions connect, by the routes, through the dns cache & the egress
+// pool, within the connect timeout. Limits on clients (auth, rates,
+// concurrent sessions) are the edge's: peers are trusted with them, so the
+// listener should only be reachable by them, by its address & the source
+// rules, which every peer is checked against.
+class Listener {
+   public:
+    // absent ones are nullptr, all used on the listener's loop
+    struct Services {
+        // the current version's rules for peers, destinations & domains
+        // and its routes
+        PolicyStore* policy = nullptr;
+        EgressPool* egress = nullptr;
+        DnsCache* dns = nullptr;
+        Metrics::Shard* metrics = nullptr;  // of the listener's loop
+        // charged by streams, refuses new ones above the hard limit
+        AdmissionControl* admission = nullptr;
+
+        // deadline for resolving & connecting to the destination
+        std::chrono::milliseconds connect_timeout{10000};
+    };
+
+    Listener(ba::io_service& io, tcp::endpoint ep, const Services& services);
+
+    // closes the tunnel connections & their streams, upstreams still
+    // connecting fail instead of using the services
+    ~Listener();
+
+   private:
+    void Accept();
+
+    // by the current policy's source rules
+    bool PeerAllowed(const ba::ip::address& peer) const;
+
+   private:
+    ba::ip::tcp::acceptor acceptor_;
+    ba::steady_timer accept_timer_;
+    std::shared_ptr<const Services> services_;  // upstreams hold weak ones
+    std::vector<std::weak_ptr<Connection>> connections_;
+};
+
+}  // namespace tunnel
+}  // namespace socks5
+
+#endif /* S5TUNNEL_H */
@@ -0,0 +1,150 @@
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+#include <catch.hpp>
+
+#include "acl.h"
+
+namespace ba = boost::asio;
+
+namespace {
+
+ba::ip::address Address(const char* text) {
+    return ba::ip::address::from_string(text);
+}
+
+std::unique_ptr<acl::RuleSet> Parse(const std::string& text) {
+    std::istringstream in{text};
+    return acl::RuleSet::Parse(in, "rules");
+}
+
+}  // namespace
+
+TEST_CASE("prefix table finds the longest matching prefix", "[acl]") {
+    acl::PrefixTable table;
+    table.Add(Address("10.0.0.0"), 8, 1);
+    table.Add(Address("10.1.0.0"), 16, 2);
+    table.Add(Address("10.1.2.0"), 24, 3);
+    table.Add(Address("10.1.2.3"), 32, 4);
+    table.Add(Address("2001:db8::"), 32, 5);
+    table.Add(Address("2001:db8:1::"), 48, 6);
+    table.Compile();
+
+    CHECK(table.Lookup(Address("10.200.0.1")) == 1);
+    CHECK(table.Lookup(Address("10.1.200.1")) == 2);
+    CHECK(table.Lookup(Address("10.1.2.4")) == 3);
+    CHECK(table.Lookup(Address("10.1.2.3")) == 4);
+    CHECK(table.Lookup(Address("11.0.0.1")) == 0);
+
+    CHECK(table.Lookup(Address("2001:db8:2::1")) == 5);
+    CHECK(table.Lookup(Address("2001:db8:1:ffff::1")) == 6);
+    CHECK(table.Lookup(Address("2001:db9::1")) == 0);
+
+    // ipv4 & ipv6 are separate tables
+    CHECK(table.Lookup(Address("::a01:203")) == 0);
+}
+
+TEST_CASE("prefix table matches v4-mapped addresses as ipv4", "[acl]") {
+    acl::PrefixTable table;
+    table.Add(Address("192.168.0.0"), 16, 1);
+    table.Add(Address("::ffff:172.16.0.0"), 108, 2);  // 172.16.0.0/12
+    table.Compile();
+
+    CHECK(table.Lookup(Address("::ffff:192.168.1.1")) == 1);
+    CHECK(table.Lookup(Address("172.20.0.1")) == 2);
+    CHECK(table.Lookup(Address("::ffff:172.20.0.1")) == 2);
+    CHECK(table.Lookup(Address("172.32.0.1")) == 0);
+}
+
+TEST_CASE("prefix table keeps the first value added for a prefix", "[acl]") {
+    acl::PrefixTable table;
+    table.Add(Address("10.0.0.0"), 8, 1);
+    table.Add(Address("10.0.0.0"), 8, 2);
+    table.Add(Address("0.0.0.0"), 0, 3);
+    table.Compile();
+
+    CHECK(table.Lookup(Address("10.0.0.1")) == 1);
+    CHECK(table.Lookup(Address("192.0.2.1")) == 3);
+}
+
+TEST_CASE("prefixes parse strictly", "[acl]") {
+    ba::ip::address address;
+    unsigned length = 0;
+
+    REQUIRE(acl::ParsePrefix("10.0.0.0/8", address, length));
+    CHECK(address == Address("10.0.0.0"));
+    CHECK(length == 8);
+
+    REQUIRE(acl::ParsePrefix("10.0.0.1", address, length));
+    CHECK(length == 32);
+
+    REQUIRE(acl::ParsePrefix("2001:db8::/32", address, length));
+    CHECK(length == 32);
+
+    REQUIRE(acl::ParsePrefix("::1", address, length));
+    CHECK(length == 128);
+
+    CHECK_FALSE(acl::ParsePrefix("10.0.0.0/24abc", address, length));
+    CHECK_FALSE(acl::ParsePrefix("10.0.0.0/ 24", address, length));
+    CHECK_FALSE(acl::ParsePrefix("10.0.0.0/", address, length));
+    CHECK_FALSE(acl::ParsePrefix("10.0.0.0/33", address, length));
+    CHECK_FALSE(acl::ParsePrefix("2001:db8::/129", address, length));
+    CHECK_FALSE(acl::ParsePrefix("10.0.0/8", address, length));
+    CHECK_FALSE(acl::ParsePrefix("example.com", address, length));
+}
+
+TEST_CASE("rule file decides by the longest prefix per direction", "[acl]") {
+    const auto rules = Parse(
+        "# comment\n"
+        "\n"
+        "deny src 10.0.0.0/8\n"
+        "allow src 10.1.0.0/16  # trailing comment\n"
+        "deny dst 192.0.2.0/24\n"
+        "default allow\n");
+    REQUIRE(rules->Rules().size() == 3);
+    CHECK(rules->DefaultAction() == acl::Action::allow);
+    CHECK(rules->Rules()[1]->text == "allow src 10.1.0.0/16");
+
+    const auto destination = Address("198.51.100.1");
+    CHECK_FALSE(rules->Allowed(Address("10.2.0.1"), destination));
+    CHECK(rules->Allowed(Address("10.1.0.1"), destination));
+    CHECK(rules->Allowed(Address("172.16.0.1"), destination));
+    CHECK_FALSE(rules->Allowed(Address("172.16.0.1"), Address("192.0.2.7")));
+    CHECK_FALSE(
+        rules->Allowed(Address("::ffff:10.2.0.1"), Address("2001:db8::1")));
+}
+
+TEST_CASE("rule hits are counted only when asked to", "[acl]") {
+    const auto rules = Parse(
+        "allow dst 192.0.2.0/24\n"
+        "default deny\n");
+
+    CHECK(rules->DestinationAllowed(Address("192.0.2.1")));
+    CHECK_FALSE(rules->DestinationAllowed(Address("198.51.100.1")));
+    CHECK(rules->Rules()[0]->hits == 1);
+    CHECK(rules->DefaultHits() == 1);
+
+    // sifting through a host's addresses
+    CHECK(rules->DestinationAllowed(Address("192.0.2.2"), false));
+    CHECK_FALSE(rules->DestinationAllowed(Address("198.51.100.2"), false));
+    CHECK(rules->Rules()[0]->hits == 1);
+    CHECK(rules->DefaultHits() == 1);
+
+    // both directions of a connection, default for the source
+    CHECK_FALSE(rules->Allowed(Address("10.0.0.1"), Address("192.0.2.1")));
+    CHECK(rules->DefaultHits() == 2);
+}
+
+TEST_CASE("rule file errors name the line", "[acl]") {
+    CHECK_THROWS_WITH(Parse("allow src 10.0.0.0/8\npermit src 10.0.0.0/8\n"),
+                      Catch::Contains("rules:2: unknown action"));
+    CHECK_THROWS_WITH(Parse("allow src 10.0.0.0/24abc\n"),
+                      Catch::Contains("bad address or prefix length"));
+    CHECK_THROWS_WITH(Parse("allow src 10.0.0.0/8 extra\n"),
+                      Catch::Contains("unexpected field"));
+    CHECK_THROWS_WITH(Parse("allow both 10.0.0.0/8\n"),
+                      Catch::Contains("expected src|dst"));
+    CHECK_THROWS_WITH(Parse("default allow deny\n"),
+                      Catch::Contains("expected allow or deny"));
+}
@@ -0,0 +1,88 @@
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+#include <string>
+
+#include <catch.hpp>
+
+#include "domain_acl.h"
+
+namespace {
+
+using Match = acl::DomainRules::Match;
+
+std::unique_ptr<acl::DomainRules> Parse(const std::string& text) {
+    std::istringstream in{text};
+    return acl::DomainRules::Parse(in, "domains");
+}
+
+}  // namespace
+
+TEST_CASE("domain rules match by the longest suffix", "[domain_acl]") {
+    const auto rules = Parse(
+        "deny example.com\n"
+        "allow www.example.com  # but not its siblings\n"
+        "allow org\n");
+
+    CHECK(rules->Check("example.com") == Match::deny);
+    CHECK(rules->Check("mail.example.com") == Match::deny);
+    CHECK(rules->Check("www.example.com") == Match::allow);
+    CHECK(rules->Check("a.b.www.example.com") == Match::allow);
+    CHECK(rules->Check("example.org") == Match::allow);
+
+    // whole labels only, case & a trailing dot don't matter
+    CHECK(rules->Check("badexample.com") == Match::none);
+    CHECK(rules->Check("example.co") == Match::none);
+    CHECK(rules->Check("WWW.Example.COM.") == Match::allow);
+
+    CHECK(rules->Allowed("other.net"));
+    CHECK_FALSE(rules->Allowed("example.com"));
+}
+
+TEST_CASE("domain rules count decisions & apply the default",
+          "[domain_acl]") {
+    const auto rules = Parse(
+        "allow example.com\n"
+        "allow example.com\n"
+        "deny example.com\n"
+        "default deny\n");
+
+    // the first of duplicate rules wins
+    CHECK(rules->Check("example.com") == Match::allow);
+    CHECK(rules->Check("example.net") == Match::deny);
+    CHECK(rules->Check("") == Match::deny);
+
+    CHECK(rules->GetStats().allowed == 1);
+    CHECK(rules->GetStats().denied == 2);
+    CHECK(rules->GetStats().unmatched == 0);
+}
+
+TEST_CASE("compiled domain rules load back", "[domain_acl]") {
+    char path[] = "/tmp/domain_acl_test.XXXXXX";
+    const int fd = mkstemp(path);
+    REQUIRE(fd >= 0);
+    close(fd);
+
+    Parse(
+        "deny example.com\n"
+        "allow www.example.com\n")
+        ->Save(path);
+    const auto rules = acl::DomainRules::Load(path);
+    std::remove(path);
+
+    CHECK(rules->Check("mail.example.com") == Match::deny);
+    CHECK(rules->Check("www.example.com") == Match::allow);
+    CHECK(rules->Check("example.org") == Match::none);
+}
+
+TEST_CASE("domain rule errors name the line", "[domain_acl]") {
+    CHECK_THROWS_WITH(Parse("allow example.com\npermit example.org\n"),
+                      Catch::Contains("domains:2: unknown action"));
+    CHECK_THROWS_WITH(Parse("allow\n"),
+                      Catch::Contains("expected allow|deny <domain>"));
+    CHECK_THROWS_WITH(Parse("deny a..b\n"), Catch::Contains("bad domain"));
+    CHECK_THROWS_WITH(Parse("default maybe\n"),
+                      Catch::Contains("expected allow or deny"));
+}
@@ -0,0 +1,190 @@
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <catch.hpp>
+
+#include "s5accounting.h"
+
+using socks5::Accounting;
+
+namespace {
+
+const char* const header =
+    "time,user,destination,sessions,bytes_up,bytes_down";
+
+std::string TempPath() {
+    char path[] = "/tmp/s5accounting_test.XXXXXX";
+    const int fd = mkstemp(path);
+    REQUIRE(fd >= 0);
+    close(fd);
+    std::remove(path);
+    return path;
+}
+
+bool Exists(const std::string& path) {
+    return std::ifstream{path}.good();
+}
+
+// the records without their time, sorted, after checking the header
+std::vector<std::string> Records(const std::string& path) {
+    std::ifstream in{path};
+    std::string line;
+    REQUIRE(std::getline(in, line));
+    CHECK(line == header);
+
+    std::vector<std::string> records;
+    while (std::getline(in, line)) {
+        records.push_back(line.substr(line.find(',') + 1));
+    }
+    std::sort(records.begin(), records.end());
+    return records;
+}
+
+void Remove(const std::string& path, unsigned keep) {
+    std::remove(path.c_str());
+    for (unsigned n = 1; n <= keep + 1; ++n) {
+        std::remove((path + '.' + std::to_string(n)).c_str());
+    }
+}
+
+// runs the loop until done() or the timeout, false on the timeout
+bool RunUntil(ba::io_service& io, const std::function<bool()>& done,
+              std::chrono::milliseconds timeout) {
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+    while (!done()) {
+        if (std::chrono::steady_clock::now() > deadline) {
+            return false;
+        }
+
+        io.reset();
+        if (!io.poll()) {
+            std::this_thread::sleep_for(std::chrono::milliseconds{1});
+        }
+    }
+
+    return true;
+}
+
+}  // namespace
+
+TEST_CASE("accounting merges the loops' tables", "[accounting]") {
+    const std::string path = TempPath();
+    Accounting::Config config;
+    config.path = path;
+    config.interval = std::chrono::hours{1};
+
+    ba::io_service first;
+    ba::io_service second;
+    {
+        Accounting accounting{config, {&first, &second}};
+        auto* a = accounting.GetTable(0).Open("alice", "example.com:443");
+        a->counters.bytes_up += 100;
+        a->counters.bytes_down += 1000;
+        auto* b = accounting.GetTable(1).Open("alice", "example.com:443");
+        b->counters.bytes_up += 1;
+        b->counters.bytes_down += 2;
+        auto* c = accounting.GetTable(1).Open("bob", "192.0.2.1:80");
+        c->counters.bytes_up += 5;
+        accounting.GetTable(0).Close(a);
+        accounting.GetTable(1).Close(b);
+    }
+
+    CHECK(Records(path) == std::vector<std::string>{
+                               "alice,example.com:443,2,101,1002",
+                               "bob,192.0.2.1:80,1,5,0"});
+    Remove(path, 0);
+}
+
+TEST_CASE("accounting quotes fields clients choose", "[accounting]") {
+    const std::string path = TempPath();
+    Accounting::Config config;
+    config.path = path;
+    config.interval = std::chrono::hours{1};
+
+    ba::io_service io;
+    {
+        Accounting accounting{config, {&io}};
+        accounting.GetTable(0).Open("a,b", "say \"hi\":80");
+        accounting.GetTable(0).Open("", "two\rlines:80");
+    }
+
+    CHECK(Records(path) == std::vector<std::string>{
+                               "\"a,b\",\"say \"\"hi\"\":80\",1,0,0",
+                               ",\"two\rlines:80\",1,0,0"});
+    Remove(path, 0);
+}
+
+TEST_CASE("accounting writes only what changed per interval",
+          "[accounting]") {
+    const std::string path = TempPath();
+    Accounting::Config config;
+    config.path = path;
+    config.interval = std::chrono::seconds{1};
+
+    ba::io_service io;
+    {
+        Accounting accounting{config, {&io}};
+        auto& table = accounting.GetTable(0);
+        auto* account = table.Open("alice", "example.com:443");
+        account->counters.bytes_up += 10;
+        table.Open("bob", "example.com:443");
+
+        // the writer asks the loop for its table
+        REQUIRE(RunUntil(io, [&]() { return Exists(path); },
+                         std::chrono::seconds{3}));
+
+        // counters start over, accounts with sessions are kept
+        account->counters.bytes_down += 20;
+        table.Close(account);
+    }
+
+    CHECK(Records(path) == std::vector<std::string>{
+                               "alice,example.com:443,0,0,20",
+                               "alice,example.com:443,1,10,0",
+                               "bob,example.com:443,1,0,0"});
+    Remove(path, 0);
+}
+
+TEST_CASE("accounting rotates past the max size", "[accounting]") {
+    const std::string path = TempPath();
+    Accounting::Config config;
+    config.path = path;
+    config.interval = std::chrono::hours{1};
+    config.max_size = 1;
+    config.keep = 2;
+
+    ba::io_service io;
+    for (const char* user : {"first", "second", "third"}) {
+        Accounting accounting{config, {&io}};
+        accounting.GetTable(0).Open(user, "example.com:443");
+    }
+
+    // the oldest file is dropped
+    CHECK_FALSE(Exists(path));
+    CHECK(Records(path + ".1") ==
+          std::vector<std::string>{"third,example.com:443,1,0,0"});
+    CHECK(Records(path + ".2") ==
+          std::vector<std::string>{"second,example.com:443,1,0,0"});
+    CHECK_FALSE(Exists(path + ".3"));
+
+    SECTION("keeping none removes the file") {
+        config.keep = 0;
+        {
+            Accounting accounting{config, {&io}};
+            accounting.GetTable(0).Open("fourth", "example.com:443");
+        }
+        CHECK_FALSE(Exists(path));
+        CHECK(Records(path + ".1") ==
+              std::vector<std::string>{"third,example.com:443,1,0,0"});
+    }
+
+    Remove(path, 2);
+}
@@ -0,0 +1,82 @@
+#include <chrono>
+#include <string>
+
+#include <catch.hpp>
+
+#include "s5admission.h"
+
+using socks5::AdmissionControl;
+
+namespace {
+
+AdmissionControl::Config Limits(std::size_t soft, std::size_t hard) {
+    AdmissionControl::Config config;
+    config.soft_limit = soft;
+    config.hard_limit = hard;
+    config.max_accept_delay = std::chrono::milliseconds{100};
+    return config;
+}
+
+}  // namespace
+
+TEST_CASE("accept delay grows linearly between the limits", "[admission]") {
+    AdmissionControl admission{Limits(1000, 2000)};
+    CHECK(admission.GetState() == AdmissionControl::State::normal);
+
+    admission.Charge(999);
+    CHECK(admission.AcceptDelay().count() == 0);
+    CHECK(admission.GetStats().delayed_accepts == 0);
+
+    // at the soft limit the delay is never zero
+    admission.Charge(1);
+    CHECK(admission.GetState() == AdmissionControl::State::soft);
+    CHECK(admission.AcceptDelay().count() == 1);
+
+    admission.Charge(250);
+    CHECK(admission.AcceptDelay().count() == 25);
+    admission.Charge(250);
+    CHECK(admission.AcceptDelay().count() == 50);
+    admission.Charge(250);
+    CHECK(admission.AcceptDelay().count() == 75);
+
+    admission.Charge(250);
+    CHECK(admission.GetState() == AdmissionControl::State::hard);
+    CHECK(admission.AcceptDelay().count() == 100);
+    admission.Charge(1000);
+    CHECK(admission.AcceptDelay().count() == 100);
+    CHECK(admission.GetStats().delayed_accepts == 6);
+
+    admission.Release(admission.Used());
+    CHECK(admission.AcceptDelay().count() == 0);
+    CHECK(admission.GetStats().delayed_accepts == 6);
+}
+
+TEST_CASE("a soft limit alone delays by the maximum", "[admission]") {
+    AdmissionControl admission{Limits(1000, 0)};
+    admission.Charge(1000);
+    CHECK(admission.AcceptDelay().count() == 100);
+    CHECK(admission.AdmitHandshake());
+
+    AdmissionControl none{Limits(0, 0)};
+    none.Charge(1 << 30);
+    CHECK(none.GetState() == AdmissionControl::State::normal);
+    CHECK(none.AcceptDelay().count() == 0);
+    CHECK(none.AdmitHandshake());
+}
+
+TEST_CASE("handshakes are refused above the hard limit", "[admission]") {
+    AdmissionControl admission{Limits(1000, 2000)};
+    admission.Charge(1999);
+    CHECK(admission.AdmitHandshake());
+
+    admission.Charge(1);
+    CHECK_FALSE(admission.AdmitHandshake());
+    CHECK_FALSE(admission.AdmitHandshake());
+    CHECK(admission.GetStats().refused_handshakes == 2);
+
+    admission.Release(1);
+    CHECK(admission.AdmitHandshake());
+    CHECK(admission.GetStats().refused_handshakes == 2);
+    CHECK(AdmissionControl::StateName(admission.GetState()) ==
+          std::string{"soft"});
+}
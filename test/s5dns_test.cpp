@@ -0,0 +1,192 @@
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <initializer_list>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <catch.hpp>
+
+#include "s5dns.h"
+
+using socks5::DnsCache;
+
+namespace {
+
+std::vector<ba::ip::address> Addresses(
+    std::initializer_list<const char*> list) {
+    std::vector<ba::ip::address> addresses;
+    for (const char* text : list) {
+        addresses.push_back(ba::ip::address::from_string(text));
+    }
+    return addresses;
+}
+
+void Insert(DnsCache& cache, const std::string& host,
+            const std::vector<ba::ip::address>& addresses) {
+    cache.Insert(host, DnsCache::Endpoints(addresses, host, 80));
+}
+
+// runs the handlers that are ready for duration
+void RunFor(ba::io_service& io, std::chrono::milliseconds duration) {
+    const auto deadline = std::chrono::steady_clock::now() + duration;
+    while (std::chrono::steady_clock::now() < deadline) {
+        io.reset();
+        if (!io.poll()) {
+            std::this_thread::sleep_for(std::chrono::milliseconds{1});
+        }
+    }
+}
+
+std::string TempPath() {
+    char path[] = "/tmp/s5dns_test.XXXXXX";
+    const int fd = mkstemp(path);
+    REQUIRE(fd >= 0);
+    close(fd);
+    return path;
+}
+
+std::string ReadFile(const std::string& path) {
+    std::ifstream in{path, std::ios::binary};
+    return std::string{std::istreambuf_iterator<char>{in},
+                       std::istreambuf_iterator<char>{}};
+}
+
+void WriteFile(const std::string& path, const std::string& content) {
+    std::ofstream out{path, std::ios::binary | std::ios::trunc};
+    out << content;
+}
+
+}  // namespace
+
+TEST_CASE("dns cache refreshes hot entries ahead of expiry", "[dns]") {
+    ba::io_service io;
+    DnsCache::Config config;
+    config.ttl = std::chrono::seconds{2};
+    config.refresh_hits = 2;
+    DnsCache cache{io, config};
+
+    // stale addresses the refresh replaces
+    const auto stale = Addresses({"192.0.2.1"});
+    const auto cold = Addresses({"192.0.2.2"});
+    Insert(cache, "localhost", stale);
+    Insert(cache, "cold.invalid", cold);
+
+    std::vector<ba::ip::address> out;
+    REQUIRE(cache.Lookup("localhost", out));
+    REQUIRE(cache.Lookup("localhost", out));
+    CHECK(out == stale);
+    CHECK(cache.GetStats().hits == 2);
+
+    // the first sweep comes within the refresh window, entries not hit
+    // often enough are left to expire
+    RunFor(io, std::chrono::milliseconds{1500});
+    CHECK(cache.GetStats().refreshes == 1);
+    CHECK(cache.GetStats().refresh_errors == 0);
+
+    REQUIRE(cache.Lookup("localhost", out));
+    CHECK(out != stale);
+    REQUIRE(cache.Lookup("cold.invalid", out));
+    CHECK(out == cold);
+
+    RunFor(io, std::chrono::milliseconds{1000});
+    CHECK(cache.Lookup("localhost", out));
+    CHECK_FALSE(cache.Lookup("cold.invalid", out));
+    CHECK(cache.GetStats().misses == 1);
+}
+
+TEST_CASE("dns refreshes in flight don't outlive the cache", "[dns]") {
+    ba::io_service io;
+    DnsCache::Config config;
+    config.ttl = std::chrono::seconds{2};
+    config.refresh_hits = 1;
+    auto cache = std::make_unique<DnsCache>(io, config);
+
+    Insert(*cache, "localhost", Addresses({"192.0.2.1"}));
+    std::vector<ba::ip::address> out;
+    REQUIRE(cache->Lookup("localhost", out));
+
+    // the sweep is the first handler, it starts the refresh
+    CHECK(io.run_one() == 1);
+    cache.reset();
+
+    // the refresh completes, aborted or not, without touching the cache
+    std::this_thread::sleep_for(std::chrono::milliseconds{100});
+    io.reset();
+    io.poll();
+}
+
+TEST_CASE("dns snapshot round-trips entries", "[dns]") {
+    const std::string path = TempPath();
+    const auto v4 = Addresses({"192.0.2.1", "192.0.2.2"});
+    const auto v6 = Addresses({"2001:db8::1"});
+
+    ba::io_service io;
+    DnsCache saved{io, DnsCache::Config{}};
+    Insert(saved, "example.com", v4);
+    Insert(saved, "example.org", v6);
+    REQUIRE(saved.Save(path));
+
+    DnsCache loaded{io, DnsCache::Config{}};
+    CHECK(loaded.Load(path) == 2);
+    CHECK(loaded.Size() == 2);
+
+    std::vector<ba::ip::address> out;
+    REQUIRE(loaded.Lookup("example.com", out));
+    CHECK(out == v4);
+    REQUIRE(loaded.Lookup("example.org", out));
+    CHECK(out == v6);
+    CHECK_FALSE(loaded.Lookup("example.net", out));
+
+    std::remove(path.c_str());
+}
+
+TEST_CASE("dns snapshot rejects corrupt files", "[dns]") {
+    const std::string path = TempPath();
+
+    ba::io_service io;
+    DnsCache saved{io, DnsCache::Config{}};
+    Insert(saved, "example.com", Addresses({"192.0.2.1"}));
+    REQUIRE(saved.Save(path));
+    const std::string good = ReadFile(path);
+    REQUIRE(good.size() > 12);
+
+    DnsCache loaded{io, DnsCache::Config{}};
+
+    SECTION("bad magic") {
+        std::string bad = good;
+        bad[0] = static_cast<char>(bad[0] ^ 0xff);
+        WriteFile(path, bad);
+        CHECK(loaded.Load(path) == 0);
+    }
+
+    SECTION("unknown version") {
+        std::string bad = good;
+        bad[4] = static_cast<char>(bad[4] ^ 0xff);
+        WriteFile(path, bad);
+        CHECK(loaded.Load(path) == 0);
+    }
+
+    SECTION("truncated header") {
+        WriteFile(path, good.substr(0, 6));
+        CHECK(loaded.Load(path) == 0);
+    }
+
+    SECTION("truncated entry") {
+        WriteFile(path, good.substr(0, good.size() - 1));
+        CHECK(loaded.Load(path) == 0);
+    }
+
+    SECTION("missing file") {
+        std::remove(path.c_str());
+        CHECK(loaded.Load(path) == 0);
+    }
+
+    CHECK(loaded.Size() == 0);
+    std::remove(path.c_str());
+}
@@ -0,0 +1,95 @@
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <catch.hpp>
+
+#include "s5egress.h"
+
+using socks5::EgressPool;
+
+namespace {
+
+ba::ip::address Address(const std::string& text) {
+    return ba::ip::address::from_string(text);
+}
+
+// loopback addresses are bound without configuring anything
+std::vector<ba::ip::address> Loopbacks() {
+    return {Address("127.0.0.1"), Address("127.0.0.2"), Address("127.0.0.3")};
+}
+
+const tcp::endpoint destination{Address("127.0.0.1"), 80};
+
+}  // namespace
+
+TEST_CASE("egress round-robin takes the addresses in turn", "[egress]") {
+    ba::io_service io;
+    EgressPool pool{Loopbacks(), EgressPool::Strategy::round_robin};
+    const ba::ip::address client = Address("192.0.2.1");
+
+    tcp::socket socket{io};
+    std::vector<std::size_t> indexes;
+    for (int i = 0; i < 4; ++i) {
+        bs::error_code ec;
+        indexes.push_back(pool.Bind(socket, destination, client, ec));
+        REQUIRE_FALSE(ec);
+        CHECK(socket.local_endpoint().address() ==
+              pool.Addresses()[indexes.back()]->address);
+    }
+
+    CHECK(indexes == std::vector<std::size_t>{0, 1, 2, 0});
+    CHECK(pool.Addresses()[0]->connects == 2);
+    CHECK(pool.Addresses()[0]->active == 2);
+    CHECK(pool.Addresses()[1]->active == 1);
+
+    for (const std::size_t index : indexes) {
+        pool.Release(index);
+    }
+    CHECK(pool.Addresses()[0]->active == 0);
+    CHECK(pool.Addresses()[0]->connects == 2);
+}
+
+TEST_CASE("egress hash keeps a client on its address", "[egress]") {
+    ba::io_service io;
+    EgressPool pool{Loopbacks(), EgressPool::Strategy::hash};
+
+    tcp::socket socket{io};
+    bs::error_code ec;
+    const ba::ip::address client = Address("192.0.2.1");
+    const std::size_t first = pool.Bind(socket, destination, client, ec);
+    REQUIRE_FALSE(ec);
+    for (int i = 0; i < 4; ++i) {
+        CHECK(pool.Bind(socket, destination, client, ec) == first);
+    }
+
+    // ipv4 clients hash like their v4-mapped form
+    CHECK(pool.Bind(socket, destination, Address("::ffff:192.0.2.1"), ec) ==
+          first);
+
+    std::set<std::size_t> used;
+    for (int i = 1; i < 64; ++i) {
+        used.insert(pool.Bind(socket, destination,
+                              Address("192.0.2." + std::to_string(i)), ec));
+    }
+    CHECK(used.size() == 3);
+}
+
+TEST_CASE("egress leaves sockets of another family unbound", "[egress]") {
+    ba::io_service io;
+    EgressPool pool{Loopbacks(), EgressPool::Strategy::round_robin};
+
+    tcp::socket socket{io};
+    bs::error_code ec;
+    const tcp::endpoint v6{Address("::1"), 80};
+    const std::size_t index = pool.Bind(socket, v6, Address("192.0.2.1"), ec);
+    CHECK(index == std::size_t{EgressPool::npos});
+    CHECK_FALSE(ec);
+    CHECK(socket.is_open());
+    pool.Release(index);
+
+    CHECK(EgressPool::ParseStrategy("hash") == EgressPool::Strategy::hash);
+    CHECK_THROWS_AS(EgressPool::ParseStrategy("random"),
+                    std::invalid_argument);
+}
@@ -0,0 +1,67 @@
+#include <cstdint>
+#include <memory>
+
+#include <catch.hpp>
+
+#include "s5histogram.h"
+
+using socks5::Histogram;
+
+TEST_CASE("histogram buckets are exact below 32 & within 3% above",
+          "[histogram]") {
+    for (uint64_t value = 0; value < 32; ++value) {
+        CHECK(Histogram::Index(value) == value);
+        CHECK(Histogram::HighestValue(value) == value);
+    }
+
+    CHECK(Histogram::Index(32) == 32);
+    CHECK(Histogram::Index(63) == 63);
+    CHECK(Histogram::Index(64) == 64);
+    CHECK(Histogram::Index(65) == 64);
+    CHECK(Histogram::Index(66) == 65);
+    CHECK(Histogram::HighestValue(64) == 65);
+
+    // every value lands in the bucket whose range holds it
+    const uint64_t max = uint64_t{1} << Histogram::max_bits;
+    for (uint64_t value = 1; value < max; value = value * 3 / 2 + 1) {
+        const std::size_t index = Histogram::Index(value);
+        REQUIRE(index > 0);
+        const uint64_t highest = Histogram::HighestValue(index);
+        const uint64_t below = Histogram::HighestValue(index - 1);
+        CHECK(highest >= value);
+        CHECK(below < value);
+        CHECK(highest - below <= value / 32 + 1);
+    }
+
+    // the last bucket takes everything from there on
+    CHECK(Histogram::Index(max - 1) == Histogram::buckets - 1);
+    CHECK(Histogram::Index(max) == Histogram::buckets - 1);
+    CHECK(Histogram::Index(UINT64_MAX) == Histogram::buckets - 1);
+}
+
+TEST_CASE("histogram quantiles & merging", "[histogram]") {
+    auto histogram = std::make_unique<Histogram>();
+    CHECK(histogram->Quantile(0.5) == 0);
+
+    for (uint64_t value = 1; value <= 1000; ++value) {
+        histogram->Record(value);
+    }
+    CHECK(histogram->Count() == 1000);
+    CHECK(histogram->Sum() == 500500);
+
+    // the highest value of the quantile's bucket, never below the exact one
+    CHECK(histogram->Quantile(0.5) >= 500);
+    CHECK(histogram->Quantile(0.5) <= 500 * 33 / 32);
+    CHECK(histogram->Quantile(0.99) >= 990);
+    CHECK(histogram->Quantile(0.99) <= 990 * 33 / 32);
+    CHECK(histogram->Quantile(1.0) >= 1000);
+    CHECK(histogram->Quantile(0.0) == 1);
+
+    auto merged = std::make_unique<Histogram>();
+    merged->Record(5000);
+    merged->Merge(*histogram);
+    CHECK(merged->Count() == 1001);
+    CHECK(merged->Sum() == 505500);
+    CHECK(merged->Quantile(1.0) >= 5000);
+    CHECK(merged->Quantile(0.5) == histogram->Quantile(0.5));
+}
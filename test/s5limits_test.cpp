@@ -0,0 +1,95 @@
+#include <catch.hpp>
+
+#include "s5limits.h"
+
+using socks5::ConnectionLimits;
+
+namespace {
+
+ba::ip::address Address(const char* text) {
+    return ba::ip::address::from_string(text);
+}
+
+}  // namespace
+
+TEST_CASE("sharded counter stops at the limit", "[limits]") {
+    socks5::ShardedCounter<std::string> counter;
+    CHECK(counter.TryAcquire("a", 2));
+    CHECK(counter.TryAcquire("a", 2));
+    CHECK_FALSE(counter.TryAcquire("a", 2));
+    CHECK(counter.TryAcquire("b", 2));
+    CHECK(counter.Size() == 2);
+
+    // a refused key isn't left behind
+    CHECK_FALSE(counter.TryAcquire("c", 0));
+    CHECK(counter.Size() == 2);
+
+    counter.Release("a");
+    CHECK(counter.TryAcquire("a", 2));
+    counter.Release("a");
+    counter.Release("a");
+    counter.Release("b");
+    counter.Release("unknown");
+    CHECK(counter.Size() == 0);
+}
+
+TEST_CASE("connection limits per address & network", "[limits]") {
+    ConnectionLimits::Config config;
+    config.per_address = 2;
+    config.per_network = 3;
+    ConnectionLimits limits{config};
+
+    CHECK(limits.AcquireAddress(Address("192.0.2.1")));
+    CHECK(limits.AcquireAddress(Address("::ffff:192.0.2.1")));  // the same
+    CHECK_FALSE(limits.AcquireAddress(Address("192.0.2.1")));
+    CHECK(limits.GetStats().address == 1);
+
+    CHECK(limits.AcquireAddress(Address("192.0.2.200")));
+    CHECK_FALSE(limits.AcquireAddress(Address("192.0.2.201")));
+    CHECK(limits.GetStats().network == 1);
+    CHECK(limits.AcquireAddress(Address("192.0.3.1")));
+
+    // a /64 for ipv6
+    CHECK(limits.AcquireAddress(Address("2001:db8::1")));
+    CHECK(limits.AcquireAddress(Address("2001:db8::2")));
+    CHECK(limits.AcquireAddress(Address("2001:db8::3")));
+    CHECK_FALSE(limits.AcquireAddress(Address("2001:db8::4")));
+    CHECK(limits.AcquireAddress(Address("2001:db8:0:1::4")));
+
+    // a refusal by network isn't counted against the address
+    limits.ReleaseAddress(Address("192.0.2.1"));
+    CHECK(limits.AcquireAddress(Address("192.0.2.201")));
+    CHECK_FALSE(limits.AcquireAddress(Address("192.0.2.202")));
+    limits.ReleaseAddress(Address("192.0.2.201"));
+    CHECK(limits.AcquireAddress(Address("192.0.2.202")));
+
+    for (const char* address :
+         {"192.0.2.1", "192.0.2.200", "192.0.2.202", "192.0.3.1",
+          "2001:db8::1", "2001:db8::2", "2001:db8::3", "2001:db8:0:1::4"}) {
+        limits.ReleaseAddress(Address(address));
+    }
+    CHECK(limits.Tracked() == 0);
+}
+
+TEST_CASE("connection limits per user", "[limits]") {
+    ConnectionLimits::Config config;
+    config.per_user = 1;
+    ConnectionLimits limits{config};
+
+    // addresses aren't limited
+    CHECK(limits.AcquireAddress(Address("192.0.2.1")));
+    CHECK(limits.AcquireAddress(Address("192.0.2.1")));
+    CHECK(limits.Tracked() == 0);
+
+    CHECK(limits.AcquireUser("alice"));
+    CHECK_FALSE(limits.AcquireUser("alice"));
+    CHECK(limits.AcquireUser("bob"));
+    CHECK(limits.GetStats().user == 1);
+    CHECK(limits.Tracked() == 2);
+
+    limits.ReleaseUser("alice");
+    CHECK(limits.AcquireUser("alice"));
+    limits.ReleaseUser("alice");
+    limits.ReleaseUser("bob");
+    CHECK(limits.Tracked() == 0);
+}
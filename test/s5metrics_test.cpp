@@ -0,0 +1,119 @@
+#include <chrono>
+#include <memory>
+#include <ostream>
+#include <sstream>
+#include <string>
+
+#include <catch.hpp>
+
+#include "s5metrics.h"
+
+using socks5::Metrics;
+
+namespace {
+
+bool HasLine(const std::string& text, const std::string& line) {
+    return ('\n' + text).find('\n' + line + '\n') != std::string::npos;
+}
+
+}  // namespace
+
+TEST_CASE("metrics sum the shards", "[metrics]") {
+    Metrics metrics{2};
+    metrics.GetShard(0).Add(Metrics::Counter::accepts);
+    metrics.GetShard(1).Add(Metrics::Counter::accepts, 2);
+    metrics.GetShard(1).Add(Metrics::Counter::bytes_up, 1000);
+
+    // a session may end on another loop than it started on
+    metrics.GetShard(0).Add(Metrics::Gauge::active_sessions, 1);
+    metrics.GetShard(1).Add(Metrics::Gauge::active_sessions, -3);
+
+    metrics.GetShard(0).AddReply(socks5::Reply::connection_refused);
+    metrics.GetShard(1).AddReply(socks5::Reply::connection_refused);
+    metrics.GetShard(1).AddReply(static_cast<socks5::Reply>(0x42));
+
+    CHECK(metrics.Get(Metrics::Counter::accepts) == 3);
+    CHECK(metrics.Get(Metrics::Counter::bytes_up) == 1000);
+    CHECK(metrics.Get(Metrics::Counter::bytes_down) == 0);
+    CHECK(metrics.Get(Metrics::Gauge::active_sessions) == -2);
+    CHECK(metrics.GetReplies(socks5::Reply::connection_refused) == 2);
+    CHECK(metrics.GetReplies(static_cast<socks5::Reply>(0x42)) == 0);
+
+    metrics.GetShard(0).Record(Metrics::Phase::connect,
+                               std::chrono::milliseconds{1});
+    metrics.GetShard(1).Record(Metrics::Phase::connect,
+                               std::chrono::milliseconds{3});
+    metrics.GetShard(1).Record(Metrics::Phase::connect,
+                               std::chrono::milliseconds{-1});
+    auto merged = std::make_unique<socks5::Histogram>();
+    metrics.Merge(Metrics::Phase::connect, *merged);
+    CHECK(merged->Count() == 3);
+    CHECK(merged->Sum() == 4000000);
+}
+
+TEST_CASE("metrics render the text exposition format", "[metrics]") {
+    Metrics metrics{2};
+    metrics.GetShard(0).Add(Metrics::Counter::handshake_refused);
+    metrics.GetShard(1).Add(Metrics::Counter::bytes_down, 42);
+    metrics.GetShard(1).Add(Metrics::Gauge::active_sessions, 2);
+    metrics.GetShard(0).AddReply(socks5::Reply::host_unreachable);
+    metrics.GetShard(1).Record(Metrics::Phase::resolve,
+                               std::chrono::milliseconds{2});
+    metrics.GetShard(0).Record(Metrics::Phase::resolve,
+                               std::chrono::milliseconds{2});
+    metrics.AddSource([](std::ostream& out) {
+        Metrics::Family(out, "s5_test", "gauge", "Added by a source.");
+        out << "s5_test{name=\"" << Metrics::LabelValue("a\"b") << "\"} 1\n";
+    });
+
+    const std::string text = metrics.Render();
+    CHECK(text.compare(0, 2, "# ") == 0);
+    CHECK(text.back() == '\n');
+
+    CHECK(HasLine(text, "# HELP s5_accepts_total Connections accepted."));
+    CHECK(HasLine(text, "# TYPE s5_accepts_total counter"));
+    CHECK(HasLine(text, "s5_accepts_total 0"));
+    CHECK(HasLine(text, "s5_handshakes_total{outcome=\"refused\"} 1"));
+    CHECK(HasLine(text, "s5_handshakes_total{outcome=\"ok\"} 0"));
+    CHECK(HasLine(text, "# TYPE s5_active_sessions gauge"));
+    CHECK(HasLine(text, "s5_active_sessions 2"));
+    CHECK(HasLine(text, "s5_relayed_bytes_total{direction=\"down\"} 42"));
+    CHECK(HasLine(text, "s5_errors_total{reply=\"host_unreachable\"} 1"));
+    CHECK(HasLine(text, "s5_errors_total{reply=\"ttl_expired\"} 0"));
+
+    // succeeded is no error
+    CHECK(text.find("reply=\"succeeded\"") == std::string::npos);
+
+    CHECK(HasLine(text, "# TYPE s5_phase_seconds summary"));
+    CHECK(HasLine(text, "s5_phase_seconds_count{phase=\"resolve\"} 2"));
+    CHECK(HasLine(text, "s5_phase_seconds_sum{phase=\"resolve\"} 0.004"));
+    CHECK(HasLine(text, "s5_phase_seconds_count{phase=\"first_byte\"} 0"));
+    CHECK(text.find("s5_phase_seconds{phase=\"resolve\","
+                    "quantile=\"0.99\"} ") != std::string::npos);
+
+    // sources come last
+    const std::string source =
+        "# HELP s5_test Added by a source.\n"
+        "# TYPE s5_test gauge\n"
+        "s5_test{name=\"a\\\"b\"} 1\n";
+    REQUIRE(text.size() > source.size());
+    CHECK(text.compare(text.size() - source.size(), source.size(), source) ==
+          0);
+}
+
+TEST_CASE("metrics escape label values", "[metrics]") {
+    CHECK(Metrics::LabelValue("example.com") == "example.com");
+    CHECK(Metrics::LabelValue("a\\b") == "a\\\\b");
+    CHECK(Metrics::LabelValue("say \"hi\"") == "say \\\"hi\\\"");
+    CHECK(Metrics::LabelValue("two\nlines") == "two\\nlines");
+    CHECK(Metrics::LabelValue("") == "");
+
+    std::ostringstream out;
+    Metrics::Family(out, "s5_x", "counter", "Help text.");
+    CHECK(out.str() == "# HELP s5_x Help text.\n# TYPE s5_x counter\n");
+
+    CHECK(Metrics::ReplyName(socks5::Reply::ttl_expired) ==
+          std::string{"ttl_expired"});
+    CHECK(Metrics::PhaseName(Metrics::Phase::first_byte) ==
+          std::string{"first_byte"});
+}
@@ -0,0 +1,85 @@
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+#include <catch.hpp>
+
+#include "s5policy.h"
+
+namespace {
+
+std::unique_ptr<socks5::Credentials> Parse(const std::string& text) {
+    std::istringstream in{text};
+    return socks5::Credentials::Parse(in, "users");
+}
+
+}  // namespace
+
+TEST_CASE("credentials check user & password", "[policy]") {
+    const auto users = Parse(
+        "# user password\n"
+        "alice secret\n"
+        "\n"
+        "bob hunter2  # comment\n"
+        "alice changed\n");
+    CHECK(users->Size() == 2);
+
+    CHECK(users->Check("alice", "changed"));
+    CHECK_FALSE(users->Check("alice", "secret"));
+    CHECK(users->Check("bob", "hunter2"));
+    CHECK_FALSE(users->Check("bob", "Hunter2"));
+    CHECK_FALSE(users->Check("carol", ""));
+}
+
+TEST_CASE("credentials errors name the line", "[policy]") {
+    CHECK_THROWS_WITH(Parse("alice secret\nbob\n"),
+                      Catch::Contains("users:2: expected <user> <password>"));
+    CHECK_THROWS_WITH(Parse(std::string(256, 'u') + " secret\n"),
+                      Catch::Contains("users:1"));
+}
+
+TEST_CASE("policy versions are reclaimed once no reader holds them",
+          "[policy]") {
+    socks5::PolicyStore store{std::make_unique<socks5::Policy>(), 2};
+    auto& first = store.GetReader(0);
+    auto& second = store.GetReader(1);
+    CHECK(store.Current()->version == 1);
+
+    const socks5::Policy* v1 = first.Acquire();
+    CHECK(v1->version == 1);
+
+    store.Publish(std::make_unique<socks5::Policy>());
+    store.Publish(std::make_unique<socks5::Policy>());
+    CHECK(store.Current()->version == 3);
+
+    // a session started on version 1 keeps it & everything after it
+    const socks5::Policy* v3 = second.Acquire();
+    CHECK(v3->version == 3);
+    CHECK(store.Reclaim() == 2);
+    CHECK(v1->version == 1);
+
+    // new sessions of the first loop see the current version, the oldest
+    // one held still pins
+    const socks5::Policy* also_v3 = first.Acquire();
+    CHECK(also_v3 == v3);
+    CHECK(store.Reclaim() == 2);
+
+    first.Release(v1);
+    CHECK(store.Reclaim() == 0);
+
+    first.Release(also_v3);
+    second.Release(v3);
+    store.Publish(std::make_unique<socks5::Policy>());
+    CHECK(store.Reclaim() == 0);
+}
+
+TEST_CASE("an idle reader doesn't hold back reclamation", "[policy]") {
+    socks5::PolicyStore store{std::make_unique<socks5::Policy>(), 2};
+
+    const socks5::Policy* v1 = store.GetReader(0).Acquire();
+    store.GetReader(0).Release(v1);
+
+    store.Publish(std::make_unique<socks5::Policy>());
+    CHECK(store.Reclaim() == 0);
+}
@@ -0,0 +1,80 @@
+#include <chrono>
+
+#include <catch.hpp>
+
+#include "s5ratelimit.h"
+
+using socks5::RateLimiter;
+
+namespace {
+
+ba::ip::address Address(const char* text) {
+    return ba::ip::address::from_string(text);
+}
+
+}  // namespace
+
+TEST_CASE("token bucket waits out what was borrowed", "[ratelimit]") {
+    RateLimiter::Bucket bucket{1000, 500};
+    const auto now = RateLimiter::Clock::now();
+
+    CHECK(bucket.Take(500, now) == RateLimiter::Clock::duration::zero());
+    CHECK(bucket.Take(250, now) == std::chrono::milliseconds{250});
+
+    // refilled at the rate, up to the capacity
+    CHECK(bucket.Take(0, now + std::chrono::milliseconds{250}) ==
+          RateLimiter::Clock::duration::zero());
+    CHECK(bucket.Take(500, now + std::chrono::seconds{10}) ==
+          RateLimiter::Clock::duration::zero());
+    CHECK(bucket.Take(1, now + std::chrono::seconds{10}) >
+          RateLimiter::Clock::duration::zero());
+}
+
+TEST_CASE("rate limits charge the identities a session has", "[ratelimit]") {
+    RateLimiter::Config config;
+    config.address_rate = 1000000;
+    RateLimiter limiter{config, 2};
+    auto& shard = limiter.GetShard(0);
+
+    // no user limit configured
+    auto ticket = shard.Attach("alice", Address("192.0.2.1"));
+    CHECK(ticket.user == nullptr);
+    REQUIRE(ticket.address != nullptr);
+
+    // a second's worth of burst, then the bucket is in debt
+    CHECK(shard.Charge(ticket, 1000) == RateLimiter::Clock::duration::zero());
+    CHECK(shard.Charge(ticket, 1000000) > std::chrono::milliseconds{30});
+    CHECK(shard.Charge(ticket, 1000000) > std::chrono::milliseconds{900});
+
+    // other loops lease from the same bucket, other addresses don't
+    auto& other_shard = limiter.GetShard(1);
+    auto same = other_shard.Attach("", Address("192.0.2.1"));
+    CHECK(other_shard.Charge(same, 1) > std::chrono::milliseconds{900});
+    auto other = other_shard.Attach("", Address("192.0.2.2"));
+    CHECK(other_shard.Charge(other, 1000) ==
+          RateLimiter::Clock::duration::zero());
+
+    shard.Detach(ticket);
+    CHECK(ticket.address == nullptr);
+    other_shard.Detach(same);
+    other_shard.Detach(other);
+}
+
+TEST_CASE("sessions without limits aren't charged", "[ratelimit]") {
+    RateLimiter::Config config;
+    config.user_rate = 1000;
+    RateLimiter limiter{config, 1};
+    auto& shard = limiter.GetShard(0);
+
+    // no user before auth
+    auto ticket = shard.Attach("", Address("192.0.2.1"));
+    CHECK(ticket.user == nullptr);
+    CHECK(ticket.address == nullptr);
+    CHECK(shard.Charge(ticket, 1000000) ==
+          RateLimiter::Clock::duration::zero());
+
+    auto user = shard.Attach("alice", Address("192.0.2.1"));
+    REQUIRE(user.user != nullptr);
+    CHECK(shard.Charge(user, 100000) > std::chrono::seconds{50});
+    shard.Detach(user);
+}
@@ -0,0 +1,127 @@
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/asio/error.hpp>
+
+#include <catch.hpp>
+
+#include "s5recorder.h"
+
+using socks5::FlightRecorder;
+using Event = FlightRecorder::Event;
+
+namespace {
+
+std::vector<int32_t> Values(const std::vector<FlightRecorder::Entry>& entries) {
+    std::vector<int32_t> values;
+    for (const auto& entry : entries) {
+        values.push_back(entry.value);
+    }
+    return values;
+}
+
+}  // namespace
+
+TEST_CASE("flight recorder rings keep the newest entries", "[recorder]") {
+    // rounded up to 4 slots
+    FlightRecorder::Ring ring{3};
+    const int session = 0;
+    CHECK(ring.Copy().empty());
+
+    for (int32_t i = 0; i < 3; ++i) {
+        ring.Record(&session, Event::request, i);
+    }
+    CHECK(Values(ring.Copy()) == std::vector<int32_t>{0, 1, 2});
+
+    // once full, the oldest slot is the one written next & isn't copied
+    ring.Record(&session, Event::request, 3);
+    CHECK(Values(ring.Copy()) == std::vector<int32_t>{1, 2, 3});
+
+    for (int32_t i = 4; i < 10; ++i) {
+        ring.Record(&session, Event::request, i);
+    }
+    const auto entries = ring.Copy();
+    CHECK(Values(entries) == std::vector<int32_t>{7, 8, 9});
+    for (const auto& entry : entries) {
+        CHECK(entry.session == reinterpret_cast<uintptr_t>(&session));
+        CHECK(entry.event == Event::request);
+        CHECK(entry.category == nullptr);
+    }
+    CHECK(entries[0].ticks <= entries[1].ticks);
+    CHECK(entries[1].ticks <= entries[2].ticks);
+
+    const bs::error_code ec = boost::asio::error::connection_refused;
+    ring.Record(&session, Event::connect_end, ec);
+    const auto last = ring.Copy().back();
+    CHECK(last.value == ec.value());
+    CHECK(last.category == &ec.category());
+}
+
+TEST_CASE("flight recorder copies drop entries rewritten meanwhile",
+          "[recorder]") {
+    FlightRecorder::Ring ring{64};
+    const int session = 0;
+    std::atomic<bool> stop{false};
+
+    // values count up, so a rewritten slot would break the sequence
+    std::thread writer{[&]() {
+        for (int32_t i = 0; !stop.load(); ++i) {
+            ring.Record(&session, Event::request, i);
+        }
+    }};
+
+    while (ring.Copy().empty()) {
+        std::this_thread::yield();
+    }
+
+    for (int i = 0; i < 2000; ++i) {
+        const auto values = Values(ring.Copy());
+        REQUIRE(values.size() <= 63);
+        bool consecutive = true;
+        for (std::size_t j = 1; j < values.size(); ++j) {
+            consecutive = consecutive && values[j] == values[j - 1] + 1;
+        }
+        REQUIRE(consecutive);
+    }
+
+    stop = true;
+    writer.join();
+    CHECK(ring.Copy().size() == 63);
+}
+
+TEST_CASE("flight recorder dumps the latest sessions", "[recorder]") {
+    FlightRecorder recorder{2, 4};
+    const int first = 0;
+    const int second = 0;
+    const bs::error_code timed_out = boost::asio::error::timed_out;
+
+    recorder.GetRing(0).Record(&first, Event::accept);
+    recorder.GetRing(0).Record(&first, Event::request);
+    recorder.GetRing(1).Record(&second, Event::accept);
+    recorder.GetRing(1).Record(&second, Event::connect_end, timed_out);
+    recorder.GetRing(0).Record(&first, Event::close, 5);
+
+    const std::string both = recorder.Dump(10);
+    CHECK(both.compare(0, 32, "flight recorder: 2 of 2 sessions") == 0);
+    CHECK(both.find("loop=0") < both.find("loop=1"));
+    CHECK(both.find(" close reply=5\n") != std::string::npos);
+    CHECK(both.find(" connect_end: " + timed_out.message() + '\n') !=
+          std::string::npos);
+    CHECK(both.find("overwritten") == std::string::npos);
+
+    // first had the last event
+    const std::string latest = recorder.Dump(1);
+    CHECK(latest.compare(0, 32, "flight recorder: 1 of 2 sessions") == 0);
+    CHECK(latest.find("loop=0") != std::string::npos);
+    CHECK(latest.find("loop=1") == std::string::npos);
+
+    // the accept was overwritten
+    for (int i = 0; i < 3; ++i) {
+        recorder.GetRing(0).Record(&first, Event::first_byte);
+    }
+    CHECK(recorder.Dump(1).find("(older events overwritten)") !=
+          std::string::npos);
+}
@@ -0,0 +1,101 @@
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+#include <catch.hpp>
+
+#include "s5routes.h"
+
+using socks5::Routes;
+
+namespace {
+
+std::unique_ptr<Routes> Parse(const std::string& text) {
+    std::istringstream in{text};
+    return Routes::Parse(in, "routes");
+}
+
+ba::ip::address Address(const char* text) {
+    return ba::ip::address::from_string(text);
+}
+
+}  // namespace
+
+TEST_CASE("routes by the longest matching prefix", "[routes]") {
+    const auto routes = Parse(
+        "# destination action\n"
+        "10.0.0.0/8 reject\n"
+        "10.1.0.0/16 parent 192.0.2.1:1080  # via the office\n"
+        "10.1.0.0/16 direct\n"
+        "2001:db8::/32 egress 2001:db8::1\n");
+    REQUIRE(routes->GetRoutes().size() == 4);
+    CHECK(routes->Default() == nullptr);
+
+    const Routes::Route* route = routes->Find(Address("10.2.3.4"));
+    REQUIRE(route != nullptr);
+    CHECK(route->action == Routes::Action::reject);
+
+    route = routes->Find(Address("10.1.3.4"));
+    REQUIRE(route != nullptr);
+    CHECK(route->action == Routes::Action::parent);
+    CHECK(route->target == tcp::endpoint{Address("192.0.2.1"), 1080});
+    CHECK(route->text == "10.1.0.0/16 parent 192.0.2.1:1080");
+    CHECK(route->hits == 1);
+
+    route = routes->Find(Address("2001:db8::2"));
+    REQUIRE(route != nullptr);
+    CHECK(route->action == Routes::Action::egress);
+    CHECK(route->target.address() == Address("2001:db8::1"));
+
+    CHECK(routes->Find(Address("192.0.2.1")) == nullptr);
+    CHECK(routes->GetRoutes()[0]->hits == 1);
+    CHECK(routes->GetRoutes()[2]->hits == 0);
+}
+
+TEST_CASE("routes by the longest matching domain suffix", "[routes]") {
+    const auto routes = Parse(
+        "example.com parent [2001:db8::1]:1080\n"
+        "internal.example.com direct\n"
+        "Example.ORG. reject\n"
+        "default egress 192.0.2.1\n");
+    REQUIRE(routes->Default() != nullptr);
+
+    const Routes::Route* route = routes->Find(std::string{"www.example.com"});
+    REQUIRE(route != nullptr);
+    CHECK(route->action == Routes::Action::parent);
+    CHECK(route->target == tcp::endpoint{Address("2001:db8::1"), 1080});
+
+    route = routes->Find(std::string{"a.Internal.Example.com."});
+    REQUIRE(route != nullptr);
+    CHECK(route->action == Routes::Action::direct);
+
+    route = routes->Find(std::string{"example.org"});
+    REQUIRE(route != nullptr);
+    CHECK(route->action == Routes::Action::reject);
+
+    // a suffix only matches at a label
+    CHECK(routes->Find(std::string{"notexample.com"}) == routes->Default());
+    CHECK(routes->Find(std::string{"com"}) == routes->Default());
+    CHECK(routes->Find(std::string{""}) == routes->Default());
+    CHECK(routes->Find(Address("192.0.2.2")) == routes->Default());
+    CHECK(routes->Default()->hits == 4);
+}
+
+TEST_CASE("route errors name the line", "[routes]") {
+    CHECK_THROWS_WITH(Parse("10.0.0.0/8 direct\nexample.com forward\n"),
+                      Catch::Contains("routes:2: expected direct, reject, "
+                                      "egress or parent"));
+    CHECK_THROWS_WITH(Parse("10.0.0.0/8 direct extra\n"),
+                      Catch::Contains("routes:1: unexpected field"));
+    CHECK_THROWS_WITH(Parse("10.0.0.0/33 direct\n"),
+                      Catch::Contains("bad address or prefix length"));
+    CHECK_THROWS_WITH(Parse("example..com direct\n"),
+                      Catch::Contains("bad address or domain"));
+    CHECK_THROWS_WITH(Parse("example.com parent 192.0.2.1\n"),
+                      Catch::Contains("expected parent <address>:<port>"));
+    CHECK_THROWS_WITH(Parse("example.com parent 192.0.2.1:1080x\n"),
+                      Catch::Contains("expected parent <address>:<port>"));
+    CHECK_THROWS_WITH(Parse("example.com egress example.net\n"),
+                      Catch::Contains("expected egress <local address>"));
+}
@@ -0,0 +1,81 @@
+#include <catch.hpp>
+
+#include "s5scheduler.h"
+
+using socks5::Scheduler;
+
+TEST_CASE("scheduler admits flows within their deficit", "[scheduler]") {
+    ba::io_service io;
+    Scheduler scheduler{io, Scheduler::Config{1000, 0}};
+    Scheduler::Flow flow;
+
+    // a new flow starts with a full quantum
+    CHECK(scheduler.Admit(flow, 600));
+    CHECK(scheduler.Admit(flow, 400));
+    CHECK_FALSE(scheduler.Admit(flow, 300));
+    CHECK(flow.GetClass() == Scheduler::Class::interactive);
+
+    bool resumed = false;
+    scheduler.Defer(flow, [&resumed]() { resumed = true; });
+    CHECK(scheduler.Deferred() == 1);
+    CHECK_FALSE(resumed);
+
+    CHECK(io.poll() == 1);
+    CHECK(resumed);
+    CHECK(scheduler.Rounds() == 1);
+
+    // credit left from the round is kept while the flow stays active
+    CHECK(scheduler.Admit(flow, 700));
+    CHECK_FALSE(scheduler.Admit(flow, 1));
+}
+
+TEST_CASE("scheduler serves interactive flows first", "[scheduler]") {
+    ba::io_service io;
+    Scheduler scheduler{io, Scheduler::Config{1000, 3000}};
+    Scheduler::Flow bulk, interactive;
+
+    CHECK_FALSE(scheduler.Admit(bulk, 3600));
+    CHECK(bulk.GetClass() == Scheduler::Class::bulk);
+    CHECK_FALSE(scheduler.Admit(interactive, 1500));
+    CHECK(interactive.GetClass() == Scheduler::Class::interactive);
+
+    int bulk_resumed = 0, interactive_resumed = 0;
+    scheduler.Defer(bulk, [&bulk_resumed]() { ++bulk_resumed; });
+    scheduler.Defer(interactive,
+                    [&interactive_resumed]() { ++interactive_resumed; });
+
+    CHECK(io.poll_one() == 1);
+    CHECK(interactive_resumed == 1);
+    CHECK(bulk_resumed == 0);
+
+    // the bulk flow waits out its debt, a quantum per round
+    CHECK(io.poll_one() == 1);
+    CHECK(io.poll_one() == 1);
+    CHECK(bulk_resumed == 0);
+    CHECK(io.poll_one() == 1);
+    CHECK(bulk_resumed == 1);
+    CHECK(scheduler.Rounds() == 4);
+    CHECK(io.poll() == 0);
+
+    // the interactive flow sat out rounds, so it starts over from zero
+    CHECK_FALSE(scheduler.Admit(interactive, 1));
+    CHECK(scheduler.Admit(bulk, 400));
+}
+
+TEST_CASE("scheduler drops cancelled flows", "[scheduler]") {
+    ba::io_service io;
+    Scheduler scheduler{io, Scheduler::Config{1000, 0}};
+    Scheduler::Flow flow;
+
+    // cancelling a flow that isn't waiting does nothing
+    scheduler.Cancel(flow);
+
+    CHECK_FALSE(scheduler.Admit(flow, 2000));
+    bool resumed = false;
+    scheduler.Defer(flow, [&resumed]() { resumed = true; });
+    scheduler.Cancel(flow);
+
+    CHECK(io.poll() == 1);
+    CHECK_FALSE(resumed);
+    CHECK(io.poll() == 0);
+}
@@ -0,0 +1,244 @@
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <catch.hpp>
+
+#include "s5metrics.h"
+#include "s5policy.h"
+#include "s5tunnel.h"
+
+namespace tunnel = socks5::tunnel;
+
+namespace {
+
+// runs the io service until done() or the timeout, false on the timeout
+bool RunUntil(ba::io_service& io, const std::function<bool()>& done,
+              std::chrono::milliseconds timeout = std::chrono::seconds{5}) {
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+    while (!done()) {
+        if (std::chrono::steady_clock::now() > deadline) {
+            return false;
+        }
+
+        io.reset();
+        if (!io.poll()) {
+            std::this_thread::sleep_for(std::chrono::milliseconds{1});
+        }
+    }
+
+    return true;
+}
+
+// a client & a server connection over loopback
+struct Tunnel {
+    explicit Tunnel(socks5::AdmissionControl* admission)
+        : client{tunnel::Connection::Create(io,
+                                            tunnel::Connection::Role::client)},
+          server{tunnel::Connection::Create(
+              io, tunnel::Connection::Role::server, admission)} {
+        tcp::acceptor acceptor{
+            io, tcp::endpoint{ba::ip::address_v4::loopback(), 0}};
+        client->Socket().connect(acceptor.local_endpoint());
+        acceptor.accept(server->Socket());
+
+        client->Start(nullptr, [](const bs::error_code&) {});
+        server->Start(
+            [this](std::shared_ptr<tunnel::Stream> stream, std::string) {
+                stream->Accept(socks5::Reply::succeeded);
+                accepted = stream;
+            },
+            [](const bs::error_code&) {});
+    }
+
+    ~Tunnel() {
+        client->Close(ba::error::operation_aborted);
+        server->Close(ba::error::operation_aborted);
+        io.reset();
+        io.poll();
+    }
+
+    ba::io_service io;
+    std::shared_ptr<tunnel::Connection> client;
+    std::shared_ptr<tunnel::Connection> server;
+    std::shared_ptr<tunnel::Stream> accepted;
+};
+
+// the socks5 ATYP, address & port of an ipv4 endpoint
+std::string StreamAddress(const tcp::endpoint& ep) {
+    const auto bytes = ep.address().to_v4().to_bytes();
+    std::string address(1, static_cast<char>(socks5::AddressType::ipv4));
+    address.append(bytes.begin(), bytes.end());
+    address += static_cast<char>(ep.port() >> 8);
+    address += static_cast<char>(ep.port() & 0xFF);
+    return address;
+}
+
+std::unique_ptr<socks5::Policy> AclPolicy(const std::string& rules) {
+    auto policy = std::make_unique<socks5::Policy>();
+    std::istringstream in{rules};
+    policy->acl = acl::RuleSet::Parse(in, "acl");
+    return policy;
+}
+
+}  // namespace
+
+TEST_CASE("frame headers encode big endian & decode back", "[tunnel]") {
+    tunnel::FrameHeader header;
+    header.type = tunnel::FrameType::window_update;
+    header.flags = tunnel::Flags::syn | tunnel::Flags::rst;
+    header.stream_id = 0x01020304;
+    header.length = 0x00a0b0c0;
+
+    unsigned char bytes[tunnel::header_size];
+    header.Encode(bytes);
+    const unsigned char expected[tunnel::header_size] = {
+        0x00, 0x01, 0x00, 0x09, 0x01, 0x02, 0x03, 0x04, 0x00, 0xa0, 0xb0, 0xc0};
+    CHECK(std::equal(bytes, bytes + tunnel::header_size, expected));
+
+    tunnel::FrameHeader decoded;
+    REQUIRE(decoded.Decode(bytes));
+    CHECK(decoded.type == header.type);
+    CHECK(decoded.flags == header.flags);
+    CHECK(decoded.stream_id == header.stream_id);
+    CHECK(decoded.length == header.length);
+
+    bytes[0] = 0x01;
+    CHECK_FALSE(decoded.Decode(bytes));
+}
+
+TEST_CASE("a stream sends no more than the receiver's window", "[tunnel]") {
+    socks5::AdmissionControl admission{socks5::AdmissionControl::Config{}};
+    Tunnel t{&admission};
+
+    bool opened = false;
+    auto stream = t.client->OpenStream(
+        std::string{"\x01\x7f\x00\x00\x01\x00\x50", 7},
+        [&opened](socks5::Reply reply) {
+            opened = reply == socks5::Reply::succeeded;
+        });
+    REQUIRE(RunUntil(t.io, [&]() { return opened && t.accepted; }));
+
+    std::vector<char> sent(2 * tunnel::initial_window + 1000);
+    for (std::size_t i = 0; i < sent.size(); ++i) {
+        sent[i] = static_cast<char>(i * 7);
+    }
+    bool written = false;
+    stream->AsyncWrite(ba::buffer(sent),
+                       [&written](const bs::error_code& ec, std::size_t) {
+                           written = !ec;
+                       });
+
+    // nobody reads: the receiver buffers a window's worth & no more
+    REQUIRE(RunUntil(t.io, [&]() {
+        return admission.Used() >= tunnel::initial_window;
+    }));
+    RunUntil(t.io, []() { return false; }, std::chrono::milliseconds{200});
+    CHECK_FALSE(written);
+    CHECK(admission.Used() >= tunnel::initial_window);
+    CHECK(admission.Used() <= 2 * tunnel::initial_window);
+
+    // reading returns the window, the rest of the write follows
+    std::vector<char> received;
+    std::vector<char> buf(8192);
+    std::function<void(const bs::error_code&, std::size_t)> on_read =
+        [&](const bs::error_code& ec, std::size_t length) {
+            if (ec) {
+                return;
+            }
+            received.insert(received.end(), buf.begin(),
+                            buf.begin() + length);
+            t.accepted->AsyncReadSome(ba::buffer(buf), on_read);
+        };
+    t.accepted->AsyncReadSome(ba::buffer(buf), on_read);
+    REQUIRE(RunUntil(
+        t.io, [&]() { return written && received.size() == sent.size(); }));
+    CHECK(received == sent);
+
+    // a drained buffer is given back
+    CHECK(admission.Used() < tunnel::initial_window);
+    stream->Close();
+    t.accepted->Close();
+    t.accepted.reset();
+    stream.reset();
+    REQUIRE(RunUntil(t.io, [&]() { return admission.Used() == 0; }));
+}
+
+TEST_CASE("the listener connects streams by the current policy",
+          "[tunnel]") {
+    ba::io_service io;
+    tcp::acceptor upstream{io,
+                           tcp::endpoint{ba::ip::address_v4::loopback(), 0}};
+    tcp::socket upstream_socket{io};
+    bool upstream_accepted = false;
+    upstream.async_accept(upstream_socket,
+                          [&](const bs::error_code& ec) {
+                              upstream_accepted = !ec;
+                          });
+
+    socks5::PolicyStore store{AclPolicy("deny dst 192.0.2.0/24\n"), 1};
+    socks5::Metrics metrics{1};
+    tunnel::Listener::Services services;
+    services.policy = &store;
+    services.metrics = &metrics.GetShard(0);
+
+    // a port that was free a moment ago
+    tcp::endpoint listener_endpoint;
+    {
+        tcp::acceptor free{io,
+                           tcp::endpoint{ba::ip::address_v4::loopback(), 0}};
+        listener_endpoint = free.local_endpoint();
+    }
+    auto listener = std::make_unique<tunnel::Listener>(io, listener_endpoint,
+                                                       services);
+
+    auto client =
+        tunnel::Connection::Create(io, tunnel::Connection::Role::client);
+    client->Socket().connect(listener_endpoint);
+    bool closed = false;
+    client->Start(nullptr,
+                  [&closed](const bs::error_code&) { closed = true; });
+
+    std::vector<socks5::Reply> replies;
+    auto on_open = [&replies](socks5::Reply reply) {
+        replies.push_back(reply);
+    };
+    auto allowed =
+        client->OpenStream(StreamAddress(upstream.local_endpoint()), on_open);
+    REQUIRE(RunUntil(io, [&]() { return replies.size() == 1; }));
+    CHECK(replies[0] == socks5::Reply::succeeded);
+    CHECK(RunUntil(io, [&]() { return upstream_accepted; }));
+    CHECK(metrics.Get(socks5::Metrics::Counter::connect_ok) == 1);
+
+    auto denied = client->OpenStream(
+        StreamAddress(tcp::endpoint{ba::ip::address::from_string("192.0.2.1"),
+                                    80}),
+        on_open);
+    REQUIRE(RunUntil(io, [&]() { return replies.size() == 2; }));
+    CHECK(replies[1] == socks5::Reply::connection_not_allowed_by_ruleset);
+
+    // peers are checked against the source rules of the version current
+    // when they connect
+    store.Publish(AclPolicy("deny src 127.0.0.1\n"));
+    auto refused =
+        tunnel::Connection::Create(io, tunnel::Connection::Role::client);
+    refused->Socket().connect(listener_endpoint);
+    bool refused_closed = false;
+    refused->Start(nullptr, [&refused_closed](const bs::error_code&) {
+        refused_closed = true;
+    });
+    CHECK(RunUntil(io, [&]() { return refused_closed; }));
+    CHECK_FALSE(closed);
+
+    allowed->Close();
+    listener.reset();
+    CHECK(RunUntil(io, [&]() { return closed; }));
+    client->Close(ba::error::operation_aborted);
+    io.reset();
+    io.poll();
+}
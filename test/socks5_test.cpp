@@ -0,0 +1,110 @@
+#include <array>
+#include <cstring>
+
+#include <catch.hpp>
+
+#include <socks/socks5.h>
+
+namespace ba = boost::asio;
+
+TEST_CASE("greeting size counts every offered method", "[socks5]") {
+    std::array<char, 2 + 255> greeting{};
+    greeting[0] = socks5::version;
+
+    greeting[1] = 2;
+    CHECK(socks5::GreetingSize(greeting.data()) == 4);
+
+    // past 127 the count is negative as a char
+    greeting[1] = static_cast<char>(200);
+    CHECK(socks5::GreetingSize(greeting.data()) == 202);
+
+    greeting[1] = static_cast<char>(255);
+    CHECK(socks5::GreetingSize(greeting.data()) == 257);
+}
+
+TEST_CASE("auth method is found among many offered", "[socks5]") {
+    std::array<char, 2 + 255> greeting{};
+    greeting[0] = socks5::version;
+    greeting[1] = static_cast<char>(200);
+    for (std::size_t i = 0; i < 200; ++i) {
+        greeting[2 + i] = static_cast<char>(0x80);  // private methods
+    }
+
+    CHECK(socks5::SelectAuthMethod(greeting.data(),
+                                   socks5::AuthMethod::no_auth) ==
+          socks5::AuthMethod::no_acceptable_methods);
+
+    greeting[2 + 150] = static_cast<char>(socks5::AuthMethod::no_auth);
+    CHECK(socks5::SelectAuthMethod(greeting.data(),
+                                   socks5::AuthMethod::no_auth) ==
+          socks5::AuthMethod::no_auth);
+}
+
+TEST_CASE("request size & port by address type", "[socks5]") {
+    std::array<char, 64> request{};
+    request[0] = socks5::version;
+    request[1] = static_cast<char>(socks5::Command::connect);
+
+    SECTION("ipv4") {
+        request[3] = static_cast<char>(socks5::AddressType::ipv4);
+        std::memcpy(&request[4], "\x0a\x00\x00\x01\x01\xbb", 6);
+
+        CHECK(socks5::RequestSize(request.data()) == 10);
+        CHECK(socks5::RequestPort(request.data()) == 443);
+        CHECK(socks5::RequestAddress(request.data()) ==
+              ba::ip::address::from_string("10.0.0.1"));
+    }
+
+    SECTION("domain name") {
+        request[3] = static_cast<char>(socks5::AddressType::domain_name);
+        request[4] = 11;
+        std::memcpy(&request[5], "example.com\x00\x50", 13);
+
+        CHECK(socks5::RequestSize(request.data()) == 18);
+        CHECK(socks5::RequestDomainName(request.data()) == "example.com");
+        CHECK(socks5::RequestPort(request.data()) == 80);
+    }
+
+    SECTION("ipv6") {
+        request[3] = static_cast<char>(socks5::AddressType::ipv6);
+        request[4] = 0x20;
+        request[5] = 0x01;
+        request[19] = 0x01;
+        request[20] = 0x01;
+        request[21] = static_cast<char>(0xbb);
+
+        // VER CMD RSV ATYP, 16 address bytes, 2 port bytes
+        CHECK(socks5::RequestSize(request.data()) == 22);
+        CHECK(socks5::RequestPort(request.data()) == 443);
+        CHECK(socks5::RequestAddress(request.data()) ==
+              ba::ip::address::from_string("2001::1"));
+    }
+
+    SECTION("unknown address type") {
+        request[3] = 0x05;
+        CHECK(socks5::RequestSize(request.data()) == 0);
+        CHECK(socks5::RequestPort(request.data()) == 0);
+    }
+}
+
+TEST_CASE("reply carries the bound address", "[socks5]") {
+    std::array<char, 32> reply{};
+
+    const ba::ip::tcp::endpoint bound4{
+        ba::ip::address::from_string("10.0.0.1"), 40000};
+    REQUIRE(socks5::WriteReply(reply.data(), socks5::Reply::succeeded,
+                               bound4) == 10);
+    CHECK(reply[1] == static_cast<char>(socks5::Reply::succeeded));
+    CHECK(reply[3] == static_cast<char>(socks5::AddressType::ipv4));
+    CHECK(socks5::RequestAddress(reply.data()) == bound4.address());
+    CHECK(socks5::RequestPort(reply.data()) == 40000);
+
+    const ba::ip::tcp::endpoint bound6{
+        ba::ip::address::from_string("2001::1"), 40000};
+    REQUIRE(socks5::WriteReply(reply.data(),
+                               socks5::Reply::host_unreachable,
+                               bound6) == 22);
+    CHECK(reply[1] == static_cast<char>(socks5::Reply::host_unreachable));
+    CHECK(socks5::RequestAddress(reply.data()) == bound6.address());
+    CHECK(socks5::RequestPort(reply.data()) == 40000);
+}